@@ -0,0 +1,223 @@
+#include "align.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QtAlgorithms>
+
+/* Bit-packed bitmap, pixel x of a row is bit x % 64 of word x / 64
+ * Padding bits after width are zero */
+typedef struct {
+    int width;
+    int height;
+    int words; /* Per row */
+    QVector<quint64> bits;
+} bitmap;
+
+static void resizeBitmap(bitmap &b, int w, int h)
+{
+    b.width = w;
+    b.height = h;
+    b.words = (w + 63) / 64;
+    b.bits.fill(0, b.words * h);
+}
+
+/*! \brief Build gray pyramid of a shot
+ *
+ * Gray is Ward's (54 R + 183 G + 19 B) / 256, each level is
+ * a 2x2 box downsample of the previous one. Pyramid stops
+ * before levels get too small to be meaningful.
+ */
+void buildGrayPyramid(const QImage &image, grayPyramid &pyr, int levels)
+{
+    QImage rgb = image.format() == QImage::Format_RGB32 ||
+                         image.format() == QImage::Format_ARGB32
+                     ? image
+                     : image.convertToFormat(QImage::Format_RGB32);
+    int w = rgb.width();
+    int h = rgb.height();
+
+    TRACE_SCOPE("gray_pyramid", "align");
+
+    pyr.resize(1);
+    pyr[0].width = w;
+    pyr[0].height = h;
+    pyr[0].gray.resize(w * h);
+    uchar *g0 = pyr[0].gray.data();
+    parallelFor(0, h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const QRgb *line =
+                reinterpret_cast<const QRgb *>(rgb.constScanLine(y));
+            uchar *dst = g0 + y * w;
+            for (int x = 0; x < w; x++)
+                dst[x] = (qRed(line[x]) * 54 + qGreen(line[x]) * 183 +
+                          qBlue(line[x]) * 19) >>
+                         8;
+        }
+    });
+
+    for (int l = 1; l <= levels; l++) {
+        const grayLevel &up = pyr[l - 1];
+        if (qMin(up.width, up.height) < 64)
+            break;
+        grayLevel down;
+        down.width = up.width / 2;
+        down.height = up.height / 2;
+        down.gray.resize(down.width * down.height);
+        for (int y = 0; y < down.height; y++) {
+            const uchar *r0 = up.gray.constData() + 2 * y * up.width;
+            const uchar *r1 = r0 + up.width;
+            uchar *dst = down.gray.data() + y * down.width;
+            for (int x = 0; x < down.width; x++)
+                dst[x] = (r0[2 * x] + r0[2 * x + 1] + r1[2 * x] +
+                          r1[2 * x + 1] + 2) >>
+                         2;
+        }
+        pyr.append(down);
+    }
+}
+
+/*! \brief Compute median threshold and exclusion bitmaps
+ *
+ * Threshold bitmap is set above median gray, exclusion bitmap
+ * is cleared for pixels too close to median (noise)
+ */
+static void thresholdBitmaps(const grayLevel &g, bitmap &tb, bitmap &eb)
+{
+    int hist[256] = {0};
+    int n = g.width * g.height;
+    int median = 0;
+
+    for (int i = 0; i < n; i++)
+        hist[g.gray[i]]++;
+    for (int sum = 0; median < 255; median++) {
+        sum += hist[median];
+        if (sum >= n / 2)
+            break;
+    }
+
+    resizeBitmap(tb, g.width, g.height);
+    resizeBitmap(eb, g.width, g.height);
+    for (int y = 0; y < g.height; y++) {
+        const uchar *src = g.gray.constData() + y * g.width;
+        quint64 *t = tb.bits.data() + y * tb.words;
+        quint64 *e = eb.bits.data() + y * eb.words;
+        for (int x = 0; x < g.width; x++) {
+            quint64 bit = 1ULL << (x & 63);
+            if (src[x] > median)
+                t[x >> 6] |= bit;
+            if (src[x] > median + ALIGN_NOISE ||
+                src[x] < median - ALIGN_NOISE)
+                e[x >> 6] |= bit;
+        }
+    }
+}
+
+/*! \brief Get 64 bits of a row starting at any bit position
+ *
+ * Bits outside of the row are zero
+ */
+static inline quint64 fetch64(const quint64 *row, int words, int pos)
+{
+    int w = pos >= 0 ? pos / 64 : -((-pos + 63) / 64);
+    int r = pos - w * 64;
+    quint64 lo = (w >= 0 && w < words) ? row[w] : 0;
+
+    if (!r)
+        return lo;
+    quint64 hi = (w + 1 >= 0 && w + 1 < words) ? row[w + 1] : 0;
+    return (lo >> r) | (hi << (64 - r));
+}
+
+/*! \brief Count differences between reference and shifted bitmaps
+ *
+ * Image bitmaps are shifted by (dx, dy) on the fly, 64 pixels
+ * at a time : XOR, AND and population count over packed words
+ */
+static qint64 countDifferences(const bitmap &tb1, const bitmap &eb1,
+                               const bitmap &tb2, const bitmap &eb2, int dx,
+                               int dy)
+{
+    qint64 err = 0;
+    int words = tb1.words;
+
+    for (int y = 0; y < tb1.height; y++) {
+        int sy = y - dy;
+        if (sy < 0 || sy >= tb2.height)
+            continue;
+        const quint64 *t1 = tb1.bits.constData() + y * words;
+        const quint64 *e1 = eb1.bits.constData() + y * words;
+        const quint64 *t2 = tb2.bits.constData() + sy * tb2.words;
+        const quint64 *e2 = eb2.bits.constData() + sy * eb2.words;
+        for (int i = 0; i < words; i++) {
+            int pos = i * 64 - dx;
+            quint64 diff = (t1[i] ^ fetch64(t2, tb2.words, pos)) & e1[i] &
+                           fetch64(e2, eb2.words, pos);
+            err += qPopulationCount(diff);
+        }
+    }
+
+    return err;
+}
+
+/*! \brief Compute translation aligning a shot on a reference
+ *
+ * Ward median threshold bitmap : from the coarsest level,
+ * offset is doubled and refined among its 9 neighbours.
+ * Returned offset d is such that image(p - d) matches reference(p)
+ */
+QPoint computeShift(const grayPyramid &reference, const grayPyramid &image)
+{
+    int levels = qMin(reference.size(), image.size());
+    QPoint cur(0, 0);
+
+    TRACE_SCOPE("compute_shift", "align");
+
+    for (int l = levels - 1; l >= 0; l--) {
+        bitmap tb1, eb1, tb2, eb2;
+        qint64 err[9];
+
+        cur *= 2;
+        thresholdBitmaps(reference.at(l), tb1, eb1);
+        thresholdBitmaps(image.at(l), tb2, eb2);
+
+        parallelFor(0, 9, [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                err[i] = countDifferences(tb1, eb1, tb2, eb2,
+                                          cur.x() + i % 3 - 1,
+                                          cur.y() + i / 3 - 1);
+        });
+
+        int best = 4;
+        for (int i = 0; i < 9; i++)
+            if (err[i] < err[best])
+                best = i;
+        cur += QPoint(best % 3 - 1, best / 3 - 1);
+    }
+
+    return cur;
+}
+
+/*! \brief Align a bracket
+ *
+ * Middle shot is the reference, others are aligned on their
+ * neighbour towards it (closer exposures) and offsets are chained
+ */
+QList<QPoint> alignExposures(const QList<QImage> &images)
+{
+    int n = images.size();
+    int ref = n / 2;
+    QVector<grayPyramid> pyr(n);
+    QList<QPoint> offsets;
+
+    TRACE_SCOPE("align", "align");
+
+    for (int i = 0; i < n; i++) {
+        buildGrayPyramid(images.at(i), pyr[i]);
+        offsets.append(QPoint(0, 0));
+    }
+    for (int i = ref + 1; i < n; i++)
+        offsets[i] = offsets[i - 1] + computeShift(pyr[i - 1], pyr[i]);
+    for (int i = ref - 1; i >= 0; i--)
+        offsets[i] = offsets[i + 1] + computeShift(pyr[i + 1], pyr[i]);
+
+    return offsets;
+}
@@ -0,0 +1,29 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <QImage>
+#include <QList>
+#include <QPoint>
+#include <QVector>
+
+/* Pyramid depth : shifts up to 2^ALIGN_LEVELS pixels are found */
+#define ALIGN_LEVELS 6
+/* Pixels this close to median are ignored */
+#define ALIGN_NOISE 4
+
+/* 8 bit gray image */
+typedef struct {
+    int width;
+    int height;
+    QVector<uchar> gray;
+} grayLevel;
+
+/* Gray pyramid of a shot, full resolution first */
+typedef QVector<grayLevel> grayPyramid;
+
+void buildGrayPyramid(const QImage &image, grayPyramid &pyr,
+                      int levels = ALIGN_LEVELS);
+QPoint computeShift(const grayPyramid &reference, const grayPyramid &image);
+QList<QPoint> alignExposures(const QList<QImage> &images);
+
+#endif // ALIGN_H
@@ -0,0 +1,147 @@
+#include "analysis.h"
+#include "config.h"
+#include "parallel.h"
+#include "trace.h"
+
+/* Row bands of a luma histogram, counted in parallel */
+#define HISTOGRAM_BANDS 32
+
+/*! \brief Check overexposition of a pixel
+ *
+ * A pixel is overexposed if at least one of its
+ * color components is above given threshold
+ */
+static bool isOverExposed(QRgb px, unsigned char overexp_threshold)
+{
+    return ((((px & 0x00FF0000) >> 16) >= overexp_threshold) ||
+            (((px & 0x0000FF00) >> 8) >= overexp_threshold) ||
+            ((px & 0x000000FF) >= overexp_threshold));
+}
+
+/*! \brief Check underexposition of a pixel
+ *
+ * A pixel is underexposed if all of its
+ * color components are under given threshold
+ */
+static bool isUnderExposed(QRgb px, unsigned char underexp_threshold)
+{
+    return ((((px & 0x00FF0000) >> 16) <= underexp_threshold) &&
+            (((px & 0x0000FF00) >> 8) <= underexp_threshold) &&
+            ((px & 0x000000FF) <= underexp_threshold));
+}
+
+/*! \brief Rate image (under- or over-) exposition
+ *
+ * Analyses every pixel of an image and returns a percentage
+ * of under- or over-exposition
+ * Rows are split on all cores at calling thread priority,
+ * realtime for liveview and sequence search
+ */
+int rateImageExposition(Config *conf, QImage &image, ExpositionType exp)
+{
+    qint64 n = 0;
+    int w = image.width();
+    int h = image.height();
+    bool (*pf)(QRgb, unsigned char);
+    unsigned char threshold;
+
+    TRACE_SCOPE("rate_exposition", "analysis");
+
+    /* If the image is invalid
+     * make the function harmless */
+    if (!w || !h)
+        return -1;
+
+    if (exp == UNDER_EXPOSITION) {
+        pf = &isUnderExposed;
+        threshold = conf->getBlackThreshold();
+    } else {
+        pf = &isOverExposed;
+        threshold = conf->getWhiteThreshold();
+    }
+
+    /* Analyse every pixel of the image */
+    QVector<int> rowCount(h);
+    int *counts = rowCount.data();
+    parallelFor(0, h, [&](int y0, int y1) {
+        for (int j = y0; j < y1; j++) {
+            int c = 0;
+            for (int i = 0; i < w; i++)
+                if (pf(image.pixel(i, j), threshold))
+                    c++;
+            counts[j] = c;
+        }
+    });
+    for (int j = 0; j < h; j++)
+        n += rowCount.at(j);
+
+    /* Return an exposition percentage */
+    return int(n * 100 / (qint64(w) * h));
+}
+
+/*! \brief Compute luminance histogram of an image
+ *
+ * HISTOGRAM_BINS bins, Rec. 601 luma
+ * Histogram is empty if the image is invalid
+ * Row bands are counted on all cores, as rateImageExposition()
+ */
+void computeLumaHistogram(QImage &image, QVector<int> &hist)
+{
+    int w = image.width();
+    int h = image.height();
+
+    TRACE_SCOPE("luma_histogram", "analysis");
+
+    hist.clear();
+    if (!w || !h)
+        return;
+
+    int bands = qMin(h, HISTOGRAM_BANDS);
+    QVector<int> bandHist(bands * HISTOGRAM_BINS, 0);
+    int *counts = bandHist.data();
+    parallelFor(0, bands, [&](int b0, int b1) {
+        for (int b = b0; b < b1; b++) {
+            int *band = counts + b * HISTOGRAM_BINS;
+            for (int j = b * h / bands; j < (b + 1) * h / bands; j++)
+                for (int i = 0; i < w; i++) {
+                    QRgb px = image.pixel(i, j);
+                    int luma = qRed(px) * 77 + qGreen(px) * 150 +
+                               qBlue(px) * 29;
+                    band[(luma >> 8) * HISTOGRAM_BINS / 256]++;
+                }
+        }
+    });
+
+    hist.fill(0, HISTOGRAM_BINS);
+    for (int b = 0; b < bands; b++)
+        for (int k = 0; k < HISTOGRAM_BINS; k++)
+            hist[k] += bandHist.at(b * HISTOGRAM_BINS + k);
+}
+
+/*! \brief Compare two luminance histograms
+ *
+ * Returns the percentage of pixels that moved to another bin
+ * (0 : same scene, 100 : nothing in common)
+ * Returns -1 if histograms cannot be compared
+ */
+int compareHistograms(const QVector<int> &a, const QVector<int> &b)
+{
+    qint64 na = 0, nb = 0;
+    qint64 diff = 0;
+
+    if (a.size() != HISTOGRAM_BINS || b.size() != HISTOGRAM_BINS)
+        return -1;
+
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        na += a[i];
+        nb += b[i];
+    }
+    if (!na || !nb)
+        return -1;
+
+    /* Half the L1 distance of normalized histograms */
+    for (int i = 0; i < HISTOGRAM_BINS; i++)
+        diff += qAbs(a[i] * nb - b[i] * na);
+
+    return diff * 50 / (na * nb);
+}
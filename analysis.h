@@ -0,0 +1,19 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <QImage>
+#include <QVector>
+
+class Config;
+
+enum ExpositionType { UNDER_EXPOSITION, OVER_EXPOSITION };
+
+int rateImageExposition(Config *conf, QImage &image, ExpositionType exp);
+
+/* Luminance histogram, for scene change detection */
+#define HISTOGRAM_BINS 64
+
+void computeLumaHistogram(QImage &image, QVector<int> &hist);
+int compareHistograms(const QVector<int> &a, const QVector<int> &b);
+
+#endif // ANALYSIS_H
@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# AutoHDR camera helper
+#
+# Runs libgphoto2 for AutoHDR and autohdr-daemon, which start it
+#
+#-------------------------------------------------
+
+QT       += core gui xml
+QT       -= widgets
+
+TARGET = autohdr-camerahost
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+OBJECTS_DIR = .obj/camerahost
+MOC_DIR = .moc/camerahost
+
+include(core.pri)
+
+SOURCES += \
+    camerahost_main.cpp
@@ -20,6 +20,18 @@ void AutoHDR_Compose::updateStatus(QString status)
     ui->status->setText(status);
 }
 
+/*! \brief Show composition draft
+ *
+ * Null image clears previous draft
+ */
+void AutoHDR_Compose::setDraft(QImage draft)
+{
+    if (draft.isNull())
+        ui->draft->clear();
+    else
+        ui->draft->setPixmap(QPixmap::fromImage(draft));
+}
+
 void AutoHDR_Compose::handleStop()
 {
     emit abortCompose();
@@ -2,6 +2,7 @@
 #define AUTOHDR_COMPOSE_H
 
 #include <QDialog>
+#include <QImage>
 #include <QString>
 
 namespace Ui
@@ -18,6 +19,7 @@ class AutoHDR_Compose : public QDialog
     ~AutoHDR_Compose();
 
     void updateStatus(QString status);
+    void setDraft(QImage draft);
 
   signals:
     void abortCompose();
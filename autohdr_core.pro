@@ -0,0 +1,88 @@
+#-------------------------------------------------
+#
+# AutoHDR core library
+#
+# Configuration, camera, sequence search, capture and composition.
+# No QtWidgets dependency : used by the GUI, the headless daemon
+# and the benchmarks.
+#
+#-------------------------------------------------
+
+QT       += core gui xml
+QT       -= widgets
+
+TARGET = autohdr-core
+TEMPLATE = lib
+CONFIG += staticlib
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# RAW decoding, optional (reentrant LibRaw)
+packagesExist(libraw_r) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libraw_r
+    DEFINES += HAVE_LIBRAW
+}
+
+OBJECTS_DIR = .obj/core
+MOC_DIR = .moc/core
+
+SOURCES += \
+    config.cpp \
+    camera.cpp \
+    camerahost.cpp \
+    camerastats.cpp \
+    analysis.cpp \
+    trace.cpp \
+    log.cpp \
+    executor.cpp \
+    bufferpool.cpp \
+    memorybudget.cpp \
+    liveviewworker.cpp \
+    sequence.cpp \
+    captureworker.cpp \
+    rawloader.cpp \
+    align.cpp \
+    planarimage.cpp \
+    hdrmerge.cpp \
+    response.cpp \
+    imagewriter.cpp \
+    fusion.cpp \
+    tonemap.cpp \
+    radiancecache.cpp \
+    mergeworker.cpp \
+    composition.cpp \
+    compositionqueue.cpp \
+    batch.cpp \
+    autotune.cpp
+
+HEADERS += \
+    config.h \
+    camera.h \
+    cameracontrol.h \
+    camerahost.h \
+    camerastats.h \
+    analysis.h \
+    trace.h \
+    log.h \
+    executor.h \
+    bufferpool.h \
+    memorybudget.h \
+    liveviewworker.h \
+    sequence.h \
+    captureworker.h \
+    parallel.h \
+    rawloader.h \
+    align.h \
+    planarimage.h \
+    hdrmerge.h \
+    response.h \
+    imagewriter.h \
+    fusion.h \
+    tonemap.h \
+    radiancecache.h \
+    mergeworker.h \
+    composition.h \
+    compositionqueue.h \
+    batch.h \
+    autotune.h
@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# AutoHDR headless daemon
+#
+# QCoreApplication only : no X server needed
+#
+#-------------------------------------------------
+
+QT       += core gui xml
+QT       -= widgets
+
+TARGET = autohdr-daemon
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+OBJECTS_DIR = .obj/daemon
+MOC_DIR = .moc/daemon
+
+include(core.pri)
+
+SOURCES += \
+    daemon.cpp \
+    daemon_main.cpp
+
+HEADERS += \
+    daemon.h
@@ -1,5 +1,11 @@
 #include "autohdr_mainwindow.h"
+#include "bufferpool.h"
+#include "executor.h"
+#include "log.h"
+#include "memorybudget.h"
+#include "trace.h"
 #include "ui_autohdr_mainwindow.h"
+#include <QMessageBox>
 
 /*! \brief AutoHDR_MainWindow constructor
  *
@@ -25,6 +31,10 @@ AutoHDR_MainWindow::AutoHDR_MainWindow(QWidget *parent)
     conf = new Config();
     c = new RemoteCamera(conf);
     s = new Sequence(c, conf);
+    sUI = new SequenceUI(s, this);
+
+    /* Configuration errors */
+    connect(conf, &Config::error, this, &AutoHDR_MainWindow::handleConfigError);
 
     /* UI */
     connect(ui->sliderLowerCriteria, SIGNAL(valueChanged(int)), this,
@@ -55,6 +65,7 @@ AutoHDR_MainWindow::AutoHDR_MainWindow(QWidget *parent)
     /* Live View thread */
     liveViewWorker = new LiveViewWorker();
     liveViewWorker->setCamera(c);
+    liveViewWorker->setDisplay(true);
     liveViewWorker->moveToThread(&liveViewAcquisition);
     connect(&liveViewAcquisition, &QThread::finished, liveViewWorker,
             &QObject::deleteLater);
@@ -65,11 +76,25 @@ AutoHDR_MainWindow::AutoHDR_MainWindow(QWidget *parent)
     liveViewAcquisition.start();
 
     /* State machine is sequenced by liveview acquisition */
-    connect(liveViewWorker, &LiveViewWorker::imageReady, s,
+    connect(liveViewWorker, &LiveViewWorker::analysisReady, s,
             &Sequence::runStateMachine);
 
     /* Load default config */
     conf->load();
+    Trace::setEnabled(conf->getTraceEnabled());
+    Trace::setThreadName("gui");
+    bufferPool().setCacheLimit(conf->getPoolCache());
+    bufferPool().setHugePages(conf->getPoolHugePages());
+    memoryBudget().setLimit(conf->getMemoryBudget());
+    memoryBudget().setSpillFolder(conf->getSpillFolder());
+    Log::setFile(conf->getLogFile(), conf->getLogSize(), conf->getLogFiles());
+    /* Tuned in the background on first start, window shows meanwhile */
+    connect(conf, &Config::tuned, this, [this]() {
+        liveViewWorker->setDecodeScale(conf->getLiveViewScale());
+    });
+    if (!conf->loadProfile())
+        conf->startAutotune();
+    liveViewWorker->setDecodeScale(conf->getLiveViewScale());
     /* Try to connect immediately */
     statusBar()->showMessage("Connecting...");
     c->connectCamera();
@@ -87,6 +112,13 @@ AutoHDR_MainWindow::~AutoHDR_MainWindow()
     liveViewAcquisition.quit();
     liveViewAcquisition.wait();
 
+    /* Keep what was traced */
+    if (Trace::isEnabled())
+        Trace::dump(conf->getTraceFile());
+    bufferPool().report();
+    executor().report();
+    Log::flush();
+
     delete conf;
     delete c;
     delete s;
@@ -263,6 +295,13 @@ void AutoHDR_MainWindow::handleLiveView(QImage *image)
     ui->liveViewDisplay->setImage(image);
 }
 
+/*! \brief Show configuration and sequence file errors
+ */
+void AutoHDR_MainWindow::handleConfigError(QString msg)
+{
+    QMessageBox::critical(this, "Error", msg);
+}
+
 #include <QFileDialog>
 /*! \brief Load general configuration file
  *
@@ -274,6 +313,15 @@ void AutoHDR_MainWindow::on_actionConfiguration_load_triggered()
         this, tr("Open configuration file"), "/home/");
 
     conf->load(fileName);
+    Trace::setEnabled(conf->getTraceEnabled());
+    bufferPool().setCacheLimit(conf->getPoolCache());
+    bufferPool().setHugePages(conf->getPoolHugePages());
+    memoryBudget().setLimit(conf->getMemoryBudget());
+    memoryBudget().setSpillFolder(conf->getSpillFolder());
+    Log::setFile(conf->getLogFile(), conf->getLogSize(), conf->getLogFiles());
+    if (!conf->loadProfile())
+        conf->startAutotune();
+    liveViewWorker->setDecodeScale(conf->getLiveViewScale());
     /* Reload camera config */
     c->initCameraConfig();
     setCapabilities();
@@ -291,7 +339,8 @@ void AutoHDR_MainWindow::on_actionSequence_load_triggered()
 
     if (!fileName.isEmpty()) {
         /* Load criterias and shots */
-        conf->loadSequence(fileName, s);
+        if (!conf->loadSequence(fileName, s))
+            return;
         /* Set criterias to UI */
         int lower, upper, maxNb;
         s->getCriterias(&lower, &upper, &maxNb);
@@ -316,3 +365,34 @@ void AutoHDR_MainWindow::on_actionSequence_save_triggered()
         conf->saveSequence(fileName, s);
     }
 }
+
+/*! \brief Dump pipeline trace
+ *
+ * From Tools > Dump trace menu
+ * Tracing must be enabled in configuration file
+ */
+void AutoHDR_MainWindow::on_actionTrace_dump_triggered()
+{
+    if (!Trace::isEnabled()) {
+        statusBar()->showMessage("Tracing is disabled in configuration.");
+        return;
+    }
+
+    if (Trace::dump(conf->getTraceFile()))
+        statusBar()->showMessage("Trace saved to " + conf->getTraceFile());
+}
+
+/*! \brief Show camera latency statistics
+ *
+ * From Tools > Camera statistics menu
+ * Statistics are also printed to standard output
+ */
+void AutoHDR_MainWindow::on_actionCamera_stats_triggered()
+{
+    QString report = CameraStats::reportAll();
+
+    for (QString line : report.split('\n'))
+        if (!line.isEmpty())
+            LOG_INFO("%s\n", line.toStdString().c_str());
+    QMessageBox::information(this, "Camera statistics", report);
+}
@@ -4,6 +4,7 @@
 #include "config.h"
 #include "liveviewworker.h"
 #include "sequence.h"
+#include "sequenceui.h"
 #include <QMainWindow>
 #include <QThread>
 
@@ -28,6 +29,7 @@ class AutoHDR_MainWindow : public QMainWindow
   public slots:
     void cameraConnected();
     void handleLiveView(QImage *image);
+    void handleConfigError(QString msg);
 
   private slots:
     /* Parameters */
@@ -42,11 +44,14 @@ class AutoHDR_MainWindow : public QMainWindow
     void on_actionConfiguration_load_triggered();
     void on_actionSequence_load_triggered();
     void on_actionSequence_save_triggered();
+    void on_actionTrace_dump_triggered();
+    void on_actionCamera_stats_triggered();
 
   private:
     Ui::AutoHDR_MainWindow *ui;
     RemoteCamera *c;
     Sequence *s;
+    SequenceUI *sUI;
     Config *conf;
     /* Continuous live shot for display */
     QThread liveViewAcquisition;
@@ -62,6 +62,11 @@ void AutoHDR_PreviewSequence::setUpperPreview(QImage preview)
     ui->upperPreview->setPixmap(QPixmap::fromImage(preview));
 }
 
+void AutoHDR_PreviewSequence::setFusedPreview(QImage preview)
+{
+    ui->fusedPreview->setPixmap(QPixmap::fromImage(preview));
+}
+
 void AutoHDR_PreviewSequence::setLabelResults(QString str)
 {
     ui->labelResults->setText(str);
@@ -20,6 +20,7 @@ class AutoHDR_PreviewSequence : public QDialog
     /* Setters */
     void setLowerPreview(QImage preview);
     void setUpperPreview(QImage preview);
+    void setFusedPreview(QImage preview);
     void setLabelResults(QString str);
 
     void startCountdown();
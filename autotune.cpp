@@ -0,0 +1,331 @@
+#include "autotune.h"
+#include "analysis.h"
+#include "config.h"
+#include "fusion.h"
+#include "hdrmerge.h"
+#include "imagewriter.h"
+#include "log.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QBuffer>
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <math.h>
+
+/* Synthetic frames, liveview and merged shots */
+#define TUNE_LIVEVIEW_WIDTH 1024
+#define TUNE_LIVEVIEW_HEIGHT 680
+#define TUNE_SHOT_WIDTH 1500
+#define TUNE_SHOT_HEIGHT 1000
+#define TUNE_SHOTS 3
+/* Fewer threads win within this margin of the fastest, in % */
+#define TUNE_THREADS_MARGIN 5
+
+/*! \brief Render the synthetic scene of autotuning and benchmarks
+ *
+ * The scene covers about 14 stops of dynamic range: a horizontal
+ * radiance ramp, a dark vertical band and a few bright highlights.
+ * ev shifts the exposure, the result goes through a 2.2 gamma.
+ * Output is deterministic so results are comparable between runs.
+ */
+QImage renderScene(int w, int h, double ev)
+{
+    QImage img(w, h, QImage::Format_RGB32);
+    double gain = pow(2.0, ev);
+
+    for (int y = 0; y < h; y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < w; x++) {
+            /* Radiance from 2^-10 to 2^4 */
+            double rad = pow(2.0, -10.0 + 14.0 * x / w);
+            if (y > h / 3 && y < h / 2)
+                rad /= 16;
+            if (((x / 64) + (y / 64)) % 11 == 0)
+                rad *= 8;
+            double r = pow(qMin(rad * gain, 1.0), 1 / 2.2) * 255;
+            double g = pow(qMin(rad * gain * 0.9, 1.0), 1 / 2.2) * 255;
+            double b = pow(qMin(rad * gain * 0.7, 1.0), 1 / 2.2) * 255;
+            line[x] = qRgb(int(r), int(g), int(b));
+        }
+    }
+    return img;
+}
+
+/*! \brief Identify this machine : CPU architecture and cores
+ */
+static QString machineId()
+{
+    return QSysInfo::currentCpuArchitecture() + " " +
+           QString::number(QThread::idealThreadCount());
+}
+
+/*! \brief Time f, best of AUTOTUNE_RUNS runs, in ns
+ */
+template <typename F> static qint64 timeBest(F f)
+{
+    qint64 best = -1;
+
+    for (int i = 0; i < AUTOTUNE_RUNS; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        f();
+        qint64 t = timer.nsecsElapsed();
+        if (best < 0 || t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+/*! \brief Decode a JPEG, downscaled while decoded
+ */
+static QImage decodeScaled(const QByteArray &jpeg, int scale)
+{
+    QBuffer buffer;
+    buffer.setData(jpeg);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, "JPG");
+
+    if (scale > 1)
+        reader.setScaledSize(reader.size() / scale);
+
+    return reader.read();
+}
+
+/*! \brief Pick liveview decode scale
+ *
+ * Fastest decode and rating whose exposure ratings stay within
+ * AUTOTUNE_RATE_TOLERANCE of full size ones
+ */
+static int tuneDecodeScale(Config *conf)
+{
+    QImage frame = renderScene(TUNE_LIVEVIEW_WIDTH, TUNE_LIVEVIEW_HEIGHT, 0);
+    QByteArray jpeg;
+    QBuffer buffer(&jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    frame.save(&buffer, "JPG");
+
+    int under = 0, over = 0;
+    int best = 1;
+    qint64 bestTime = -1;
+    for (int scale = 1; scale <= 4; scale *= 2) {
+        QImage image;
+        qint64 t = timeBest([&]() {
+            image = decodeScaled(jpeg, scale);
+            rateImageExposition(conf, image, UNDER_EXPOSITION);
+            rateImageExposition(conf, image, OVER_EXPOSITION);
+        });
+        int u = rateImageExposition(conf, image, UNDER_EXPOSITION);
+        int o = rateImageExposition(conf, image, OVER_EXPOSITION);
+        if (scale == 1) {
+            under = u;
+            over = o;
+        } else if (abs(u - under) > AUTOTUNE_RATE_TOLERANCE ||
+                   abs(o - over) > AUTOTUNE_RATE_TOLERANCE)
+            break;
+        if (bestTime < 0 || t < bestTime) {
+            best = scale;
+            bestTime = t;
+        }
+    }
+
+    return best;
+}
+
+/*! \brief Pick threads of a merge
+ *
+ * Fewest threads within TUNE_THREADS_MARGIN of the fastest merge :
+ * slow cores (big.LITTLE) or shared memory bandwidth may not pay
+ * back. Returns 0 for all cores
+ */
+static int tuneThreads(QList<QImage> &shots, QList<double> &times)
+{
+    int cores = qMax(1, QThread::idealThreadCount());
+    int saved = parallelThreadLimit();
+    QList<int> candidates;
+    QList<qint64> costs;
+    RadianceMap hdr;
+
+    for (int t = 1; t < cores; t *= 2)
+        candidates << t;
+    candidates << cores;
+    for (int t : candidates) {
+        parallelThreadLimit() = t;
+        costs << timeBest([&]() { mergeExposures(shots, times, hdr); });
+    }
+    parallelThreadLimit() = saved;
+
+    qint64 fastest = costs.first();
+    for (qint64 c : costs)
+        fastest = qMin(fastest, c);
+    for (int i = 0; i < candidates.size(); i++)
+        if (costs.at(i) * 100 <= fastest * (100 + TUNE_THREADS_MARGIN))
+            return candidates.at(i) == cores ? 0 : candidates.at(i);
+
+    return 0;
+}
+
+/*! \brief Pick exposure fusion tile side
+ */
+static int tuneFusionTile(QStringList paths, QString output)
+{
+    int best = FUSION_TILE;
+    qint64 bestTime = -1;
+
+    for (int tile : {256, 512, 1024}) {
+        qint64 t = timeBest([&]() { fuseExposures(paths, output, tile); });
+        if (bestTime < 0 || t < bestTime) {
+            best = tile;
+            bestTime = t;
+        }
+    }
+
+    return best;
+}
+
+/*! \brief Pick OpenEXR tile side
+ */
+static int tuneExrTile(const RadianceMap &hdr, QString output)
+{
+    int best = EXR_TILE;
+    qint64 bestTime = -1;
+
+    for (int tile : {32, 64, 128}) {
+        qint64 t = timeBest([&]() { writeEXR(output, hdr, tile, true); });
+        if (bestTime < 0 || t < bestTime) {
+            best = tile;
+            bestTime = t;
+        }
+    }
+
+    return best;
+}
+
+/*! \brief Set built-in parameters, used until tuned
+ */
+void defaultProfile(tuningProfile &profile)
+{
+    profile.threads = 0;
+    profile.fusionTile = FUSION_TILE;
+    profile.exrTile = EXR_TILE;
+    profile.decodeScale = 1;
+}
+
+/*! \brief Measure kernel parameters on this machine
+ *
+ * conf gives analysis thresholds. Synthetic shots are written
+ * to a temporary folder, removed afterwards.
+ * Returns false if shots could not be written (defaults are set)
+ */
+bool runAutotune(Config *conf, tuningProfile &profile)
+{
+    QTemporaryDir tmp;
+    QList<QImage> shots;
+    QList<double> times;
+    QStringList paths;
+
+    TRACE_SCOPE("autotune", "startup");
+
+    defaultProfile(profile);
+    LOG_INFO("[Autotune] Measuring kernels, once for this machine\n");
+
+    for (int i = 0; i < TUNE_SHOTS; i++) {
+        double ev = 2.0 * (i - TUNE_SHOTS / 2);
+        shots << renderScene(TUNE_SHOT_WIDTH, TUNE_SHOT_HEIGHT, ev);
+        times << pow(2.0, ev);
+        paths << tmp.path() + QString("/shot%1.jpg").arg(i);
+        if (!tmp.isValid() || !shots.last().save(paths.last(), "JPG", 95)) {
+            LOG_ERROR("[Autotune] Could not write %s\n",
+                      paths.last().toStdString().c_str());
+            return false;
+        }
+    }
+
+    profile.decodeScale = tuneDecodeScale(conf);
+    profile.threads = tuneThreads(shots, times);
+    profile.fusionTile = tuneFusionTile(paths, tmp.path() + "/fused.tif");
+    RadianceMap hdr;
+    if (mergeExposures(shots, times, hdr))
+        profile.exrTile = tuneExrTile(hdr, tmp.path() + "/merged.exr");
+
+    LOG_INFO("[Autotune] Merge threads %d, fusion tile %d, EXR tile %d, "
+             "liveview decode 1/%d\n",
+             profile.threads, profile.fusionTile, profile.exrTile,
+             profile.decodeScale);
+
+    return true;
+}
+
+/*! \brief Load tuning profile
+ *
+ * Returns false if file does not exist, cannot be read or was
+ * measured on another machine
+ */
+bool loadProfile(QString file, tuningProfile &profile)
+{
+    QFile f(file);
+    QDomDocument doc;
+
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    QDomElement root = doc.setContent(&f) ? doc.documentElement()
+                                          : QDomElement();
+    if (root.tagName() != "autohdr_profile") {
+        LOG_ERROR("[Autotune] Could not read %s\n", file.toStdString().c_str());
+        return false;
+    }
+    if (root.attribute("machine") != machineId()) {
+        LOG_INFO("[Autotune] Profile of another machine\n");
+        return false;
+    }
+
+    defaultProfile(profile);
+    QDomElement merge = root.firstChildElement("merge");
+    profile.threads = merge.attribute("threads", "0").toInt();
+    profile.fusionTile =
+        merge.attribute("fusion_tile", QString::number(FUSION_TILE)).toInt();
+    profile.exrTile =
+        merge.attribute("exr_tile", QString::number(EXR_TILE)).toInt();
+    QDomElement liveview = root.firstChildElement("liveview");
+    profile.decodeScale = liveview.attribute("decode_scale", "1").toInt();
+
+    return true;
+}
+
+/*! \brief Save tuning profile, for this machine
+ */
+bool saveProfile(QString file, const tuningProfile &profile)
+{
+    QDomDocument doc("XML");
+    QDomElement root = doc.createElement("autohdr_profile");
+    root.setAttribute("machine", machineId());
+    doc.appendChild(root);
+
+    QDomElement merge = doc.createElement("merge");
+    merge.setAttribute("threads", profile.threads);
+    merge.setAttribute("fusion_tile", profile.fusionTile);
+    merge.setAttribute("exr_tile", profile.exrTile);
+    root.appendChild(merge);
+    QDomElement liveview = doc.createElement("liveview");
+    liveview.setAttribute("decode_scale", profile.decodeScale);
+    root.appendChild(liveview);
+
+    QSaveFile f(file);
+    if (!f.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[Autotune] Could not write %s\n",
+                  file.toStdString().c_str());
+        return false;
+    }
+    QTextStream stream(&f);
+    stream << doc.toString();
+    stream.flush();
+
+    return f.commit();
+}
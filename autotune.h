@@ -0,0 +1,42 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <QImage>
+#include <QString>
+
+class Config;
+
+/* Tuning profile file, next to config file */
+#define PROFILE_FILE "autohdr_profile.xml"
+/* Timed runs per candidate, best one counts */
+#define AUTOTUNE_RUNS 3
+/* Exposure rating drift allowed by a liveview decode scale, in % */
+#define AUTOTUNE_RATE_TOLERANCE 1
+
+/* Kernel parameters measured on this machine */
+typedef struct {
+    /* Threads of a merge, 0 for all cores */
+    int threads;
+    /* Exposure fusion tile side */
+    int fusionTile;
+    /* OpenEXR tile side */
+    int exrTile;
+    /* Liveview JPEG decode downscale : 1, 2 or 4 */
+    int decodeScale;
+} tuningProfile;
+
+/* Startup autotuning
+ *
+ * Candidate parameters of the analysis and merge kernels are
+ * timed on synthetic frames of standard sizes, fastest ones win.
+ * Takes a few seconds, done once : the profile is saved with the
+ * machine it was measured on and only loaded afterwards. A profile
+ * of another machine (copied config folder) is not loaded
+ */
+QImage renderScene(int w, int h, double ev);
+void defaultProfile(tuningProfile &profile);
+bool runAutotune(Config *conf, tuningProfile &profile);
+bool loadProfile(QString file, tuningProfile &profile);
+bool saveProfile(QString file, const tuningProfile &profile);
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,402 @@
+#include "batch.h"
+#include "log.h"
+#include <QDir>
+#include <QStringList>
+
+/* Field bounds : minute, hour, day of month, month, day of week */
+static const int cronMin[5] = {0, 0, 1, 1, 0};
+static const int cronMax[5] = {59, 23, 31, 12, 6};
+
+/*! \brief Parse a cron-like expression
+ *
+ * Returns false if expression is invalid
+ */
+bool CronSchedule::parse(QString expr)
+{
+    QStringList f = expr.simplified().split(' ');
+
+    if (f.size() != 5)
+        return false;
+    for (int i = 0; i < 5; i++)
+        if (!parseField(f[i], cronMin[i], cronMax[i], &fields[i]))
+            return false;
+
+    /* Sunday can be written 7 */
+    if (fields[4] & (1ULL << 7))
+        fields[4] |= 1ULL;
+    /* As in cron, restricted day and weekday are ORed */
+    anyDay = f[2].startsWith('*');
+    anyWeekday = f[4].startsWith('*');
+
+    return true;
+}
+
+/*! \brief Parse one cron field into a mask of allowed values
+ */
+bool CronSchedule::parseField(QString field, int min, int max, quint64 *mask)
+{
+    *mask = 0;
+    /* Weekday 7 is Sunday too */
+    if (min == 0 && max == 6)
+        max = 7;
+
+    for (QString item : field.split(',')) {
+        int step = 1;
+        int a = min, b = max;
+        bool ok = true;
+
+        int slash = item.indexOf('/');
+        if (slash >= 0) {
+            step = item.mid(slash + 1).toInt(&ok);
+            if (!ok || step <= 0)
+                return false;
+            item = item.left(slash);
+        }
+        if (item != "*") {
+            int dash = item.indexOf('-');
+            if (dash >= 0) {
+                a = item.left(dash).toInt(&ok);
+                if (ok)
+                    b = item.mid(dash + 1).toInt(&ok);
+            } else {
+                a = item.toInt(&ok);
+                /* "a/n" means from a to max */
+                b = slash >= 0 ? max : a;
+            }
+            if (!ok || a < min || b > max || a > b)
+                return false;
+        }
+        for (int v = a; v <= b; v += step)
+            *mask |= 1ULL << v;
+    }
+
+    return true;
+}
+
+/*! \brief Check if a time matches schedule (minute resolution)
+ *
+ * Day of month and weekday are ORed when both are restricted,
+ * "0 6 1 * 1" fires on the 1st and on Mondays
+ */
+bool CronSchedule::matches(const QDateTime &t)
+{
+    QDate d = t.date();
+    QTime h = t.time();
+    bool day = fields[2] & (1ULL << d.day());
+    bool weekday = fields[4] & (1ULL << (d.dayOfWeek() % 7));
+
+    if (!(fields[0] & (1ULL << h.minute())) ||
+        !(fields[1] & (1ULL << h.hour())) ||
+        !(fields[3] & (1ULL << d.month())))
+        return false;
+    if (!anyDay && !anyWeekday)
+        return day || weekday;
+
+    return day && weekday;
+}
+
+/*! \brief Get first matching minute strictly after given time
+ *
+ * Returns an invalid date if nothing matches within a year
+ * (e.g. February 31st)
+ */
+QDateTime CronSchedule::next(const QDateTime &from)
+{
+    QDateTime t = from.addSecs(60);
+    t.setTime(QTime(t.time().hour(), t.time().minute()));
+
+    for (int i = 0; i < 366 * 24 * 60; i++) {
+        if (matches(t))
+            return t;
+        t = t.addSecs(60);
+    }
+
+    return QDateTime();
+}
+
+/*! \brief BatchRunner constructor
+ *
+ * Owns its composition queue, so that sequences can be
+ * composed while next one is captured
+ */
+BatchRunner::BatchRunner(Config *config, Sequence *seq, QObject *parent)
+    : QObject(parent)
+{
+    conf = config;
+    s = seq;
+    queue = new CompositionQueue(conf, this);
+    /* Compositions are queued, shots are not merged while captured */
+    s->getComposition()->setIncremental(false);
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+
+    count = conf->getBatchCount();
+    interval = conf->getBatchInterval();
+    useCron = false;
+    if (!conf->getBatchCron().isEmpty())
+        setCron(conf->getBatchCron());
+    backlog = conf->getBatchBacklog();
+    compose = true;
+
+    run = 0;
+    running = false;
+    waitingBacklog = false;
+    failures = 0;
+
+    connect(timer, &QTimer::timeout, this, &BatchRunner::startRun);
+    connect(queue, &CompositionQueue::jobFinished, this,
+            &BatchRunner::compositionFinished);
+    connect(queue, &CompositionQueue::jobFailed, this,
+            &BatchRunner::compositionError);
+}
+
+/*! \brief Set number of sequences, 0 for no limit
+ */
+void BatchRunner::setCount(int n)
+{
+    count = n;
+}
+
+/*! \brief Set delay between two sequences starts, in seconds
+ *
+ * Disables cron schedule
+ */
+void BatchRunner::setInterval(int seconds)
+{
+    interval = seconds;
+    useCron = false;
+}
+
+/*! \brief Set cron-like schedule
+ *
+ * Returns false (schedule unchanged) if expression is invalid
+ */
+bool BatchRunner::setCron(QString expr)
+{
+    if (!cron.parse(expr)) {
+        LOG_ERROR("[Batch] Invalid schedule \"%s\"\n",
+                  expr.toStdString().c_str());
+        return false;
+    }
+    useCron = true;
+
+    return true;
+}
+
+/*! \brief Set maximum number of compositions waiting
+ *
+ * Counts compositions not started yet.
+ * Next sequence is delayed while backlog is full
+ */
+void BatchRunner::setBacklog(int n)
+{
+    backlog = n > 0 ? n : 1;
+}
+
+/*! \brief Enable or disable composition of captured sequences
+ */
+void BatchRunner::setCompose(bool enable)
+{
+    compose = enable;
+}
+
+/*! \brief Check if next sequence must wait for queued compositions
+ */
+bool BatchRunner::backlogFull(int waiting)
+{
+    return compose && waiting >= backlog;
+}
+
+/*! \brief Start batch
+ *
+ * Output folders are created under current capture
+ * and composition folders
+ * Compositions left by a previous batch are resumed
+ */
+void BatchRunner::start()
+{
+    captureBase = conf->getCaptureFolder();
+    compBase = conf->getCompFolder();
+    run = 0;
+    failures = 0;
+    if (compose)
+        queue->load();
+
+    LOG_INFO("[Batch] Starting %s sequences\n",
+             count ? QString::number(count).toStdString().c_str()
+                   : "unlimited");
+    scheduleNext();
+}
+
+/*! \brief Schedule next sequence, or end batch
+ */
+void BatchRunner::scheduleNext()
+{
+    if (count && run >= count) {
+        checkFinished();
+        return;
+    }
+
+    QDateTime now = QDateTime::currentDateTime();
+
+    if (useCron) {
+        nextStart = cron.next(now);
+        if (!nextStart.isValid()) {
+            LOG_ERROR("[Batch] Schedule never matches\n");
+            count = run;
+            checkFinished();
+            return;
+        }
+    } else if (run > 0) {
+        /* Fixed rate : late sequences start right away */
+        nextStart = lastStart.addSecs(interval);
+    } else {
+        nextStart = now;
+    }
+
+    qint64 delay = now.msecsTo(nextStart);
+    if (delay > 0)
+        LOG_INFO("[Batch] Next sequence in %lld s\n",
+                 (long long)(delay / 1000));
+    armTimer();
+}
+
+/*! \brief Arm timer towards next start
+ *
+ * QTimer takes an int : long delays are split in hours
+ */
+void BatchRunner::armTimer()
+{
+    qint64 delay = QDateTime::currentDateTime().msecsTo(nextStart);
+
+    if (delay < 0)
+        delay = 0;
+    if (delay > 3600 * 1000)
+        delay = 3600 * 1000;
+    timer->start((int)delay);
+}
+
+/*! \brief Start a sequence in its own folder
+ *
+ * Waits for a composition to end if backlog is full
+ */
+void BatchRunner::startRun()
+{
+    if (QDateTime::currentDateTime() < nextStart) {
+        armTimer();
+        return;
+    }
+
+    int waiting = queue->pendingCount();
+
+    if (backlogFull(waiting)) {
+        LOG_INFO("[Batch] %d compositions waiting, delaying capture\n",
+                 waiting);
+        waitingBacklog = true;
+        return;
+    }
+    waitingBacklog = false;
+
+    QString dir = QString("seq_%1/").arg(run + 1, 4, 10, QChar('0'));
+    QDir().mkpath(captureBase + dir);
+    QDir().mkpath(compBase + dir);
+    conf->setCaptureFolder(captureBase + dir);
+    runCompFolder = compBase + dir;
+
+    run++;
+    running = true;
+    lastStart = QDateTime::currentDateTime();
+
+    LOG_INFO("[Batch] Sequence %d in %s\n", run, dir.toStdString().c_str());
+    emit runRequested(run);
+}
+
+/*! \brief Sequence captured
+ *
+ * Queue its composition and go on with next sequence
+ */
+void BatchRunner::captureFinished(int total)
+{
+    if (!running)
+        return;
+
+    if (compose) {
+        QList<shotParameters> shots;
+        for (int i = 0; i < total; i++) {
+            shotParameters sp = s->getShotParameters(i);
+            /* Previews are not needed anymore */
+            sp.preview = QImage();
+            shots << sp;
+        }
+        queue->enqueue(shots, runCompFolder);
+    }
+
+    runDone();
+}
+
+/*! \brief Sequence could not be computed or captured
+ *
+ * Batch goes on with next one
+ */
+void BatchRunner::runFailed()
+{
+    if (!running)
+        return;
+
+    LOG_ERROR("[Batch] Sequence %d failed\n", run);
+    failures++;
+
+    runDone();
+}
+
+void BatchRunner::runDone()
+{
+    running = false;
+    conf->setCaptureFolder(captureBase);
+
+    scheduleNext();
+}
+
+void BatchRunner::compositionFinished(int id, int code)
+{
+    Q_UNUSED(id);
+    if (code)
+        failures++;
+
+    compositionDone();
+}
+
+void BatchRunner::compositionError(int id, QString msg)
+{
+    Q_UNUSED(id);
+    Q_UNUSED(msg);
+    failures++;
+
+    compositionDone();
+}
+
+/*! \brief A queued composition ended, next one already started
+ *
+ * Resumes a capture delayed by backlog
+ */
+void BatchRunner::compositionDone()
+{
+    if (waitingBacklog)
+        startRun();
+    checkFinished();
+}
+
+/*! \brief End batch once all sequences are captured and composed
+ */
+void BatchRunner::checkFinished()
+{
+    if (running || timer->isActive() || waitingBacklog)
+        return;
+    if (!count || run < count)
+        return;
+    if (!queue->isIdle())
+        return;
+
+    LOG_INFO("[Batch] %d sequences done, %d failures\n", run, failures);
+    emit finished(failures ? 1 : 0);
+}
@@ -0,0 +1,103 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "compositionqueue.h"
+#include "config.h"
+#include "sequence.h"
+#include <QDateTime>
+#include <QObject>
+#include <QTimer>
+
+/* Cron-like schedule
+ *
+ * "minute hour day month weekday", each field being "*", "a" or "a-b",
+ * optionally followed by "/step", or a comma separated list of those
+ * As in cron, a time matches day or weekday when both are restricted
+ */
+class CronSchedule
+{
+  public:
+    bool parse(QString expr);
+    bool matches(const QDateTime &t);
+    QDateTime next(const QDateTime &from);
+
+  private:
+    /* One bit per allowed value */
+    quint64 fields[5];
+    /* Day and weekday fields starting with "*" */
+    bool anyDay;
+    bool anyWeekday;
+
+    static bool parseField(QString field, int min, int max, quint64 *mask);
+};
+
+/* Batch / timelapse runner
+ *
+ * Runs several sequences on a schedule, each one in its own folder
+ * Compositions of captured sequences are queued and run while
+ * next ones are computed and captured, number of waiting
+ * compositions is bounded
+ */
+class BatchRunner : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit BatchRunner(Config *config = nullptr, Sequence *seq = nullptr,
+                         QObject *parent = nullptr);
+
+    void setCount(int n);
+    void setInterval(int seconds);
+    bool setCron(QString expr);
+    void setBacklog(int n);
+    void setCompose(bool compose);
+    bool backlogFull(int waiting);
+
+  signals:
+    /* Compute (or reuse) and capture a sequence */
+    void runRequested(int run);
+    void finished(int code);
+
+  public slots:
+    void start();
+    void captureFinished(int total);
+    void runFailed();
+    void compositionFinished(int id, int code);
+    void compositionError(int id, QString msg);
+
+  private slots:
+    void startRun();
+
+  private:
+    Config *conf;
+    Sequence *s;
+    CompositionQueue *queue;
+    QTimer *timer;
+
+    /* Schedule */
+    int count;
+    int interval;
+    bool useCron;
+    CronSchedule cron;
+    int backlog;
+    bool compose;
+
+    /* Progress */
+    int run;
+    bool running;
+    bool waitingBacklog;
+    int failures;
+    QDateTime lastStart;
+    QDateTime nextStart;
+    QString captureBase;
+    QString compBase;
+    QString runCompFolder;
+
+    void runDone();
+    void scheduleNext();
+    void armTimer();
+    void compositionDone();
+    void checkFinished();
+};
+
+#endif // BATCH_H
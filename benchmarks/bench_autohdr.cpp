@@ -0,0 +1,1277 @@
+#include "align.h"
+#include "analysis.h"
+#include "autotune.h"
+#include "batch.h"
+#include "bufferpool.h"
+#include "composition.h"
+#include "config.h"
+#include "fusion.h"
+#include "hdrmerge.h"
+#include "imagewriter.h"
+#include "parallel.h"
+#include "planarimage.h"
+#include "response.h"
+#include "sequence.h"
+#include "tonemap.h"
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDomDocument>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <math.h>
+#include <string.h>
+
+/* Standard fixture sizes */
+#define LIVEVIEW_WIDTH 640
+#define LIVEVIEW_HEIGHT 424
+#define FULL_WIDTH 6000
+#define FULL_HEIGHT 4000
+/* Replayed camera exposure range, in 1/3 EV steps */
+#define SEARCH_STEPS 30
+/* Composition fixture */
+#define COMP_SHOTS 5
+#define COMP_WIDTH 1500
+#define COMP_HEIGHT 1000
+
+/* Camera replaying the search range, no body needed
+ *
+ * Exposures are steps, longest first as a camera lists them.
+ * Parameters are applied at once, nothing is captured
+ */
+class ReplayCamera : public CameraControl
+{
+  public:
+    ReplayCamera(QStringList steps, int start)
+    {
+        exposures = steps;
+        exposure = steps.at(start);
+    }
+
+    QString getCurrentISO() override { return ISO; }
+    QString getCurrentAperture() override { return aperture; }
+    QString getCurrentExposure() override { return exposure; }
+    int setCurrentISO(QString &value) override
+    {
+        ISO = value;
+        return GP_OK;
+    }
+    int setCurrentAperture(QString &value) override
+    {
+        aperture = value;
+        return GP_OK;
+    }
+    int setCurrentExposure(QString &value) override
+    {
+        exposure = value;
+        return GP_OK;
+    }
+    int increaseExposure(QString &next) override
+    {
+        return step(-1, next);
+    }
+    int decreaseExposure(QString &next) override
+    {
+        return step(1, next);
+    }
+    void distributeExposures(QString &first, QString &last, int spacing,
+                             QList<QString> &list) override
+    {
+        for (int i = exposures.indexOf(first) - spacing;
+             i > exposures.indexOf(last); i -= spacing)
+            list.append(exposures.at(i));
+    }
+    int captureShot(QString &) override { return GP_ERROR; }
+
+  private:
+    QStringList exposures;
+    QString ISO;
+    QString aperture;
+    QString exposure;
+
+    int step(int direction, QString &next)
+    {
+        int index = exposures.indexOf(exposure) + direction;
+        if (index < 0 || index >= exposures.size())
+            return GP_ERROR;
+        next = exposure = exposures.at(index);
+        return GP_OK;
+    }
+};
+
+/*! \brief Check merged radiance follows the scene ramp
+ *
+ * Samples a row off the dark band, skipping highlight cells :
+ * radiance doubles every 1/14 of the width
+ */
+static bool followsRamp(const RadianceMap &hdr)
+{
+    int y = hdr.height() / 4;
+
+    for (int c = 0; c < hdr.channels(); c++) {
+        const float *row = hdr.row(c, y);
+        int prev = -1;
+        for (int x = 32; x < hdr.width(); x += hdr.width() / 8) {
+            if (((x / 64) + (y / 64)) % 11 == 0)
+                continue;
+            if (!qIsFinite(row[x]) || row[x] <= 0)
+                return false;
+            if (prev >= 0) {
+                double stops = log2(row[x] / row[prev]);
+                double expected = 14.0 * (x - prev) / hdr.width();
+                if (fabs(stops - expected) > expected / 2)
+                    return false;
+            }
+            prev = x;
+        }
+    }
+    return true;
+}
+
+/*! \brief Mean radiance difference of two merges over rect, in stops
+ */
+static double stopsApart(const RadianceMap &a, const RadianceMap &b,
+                         QRect rect)
+{
+    double sum = 0;
+
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        const float *ra = a.row(1, y);
+        const float *rb = b.row(1, y);
+        for (int x = rect.left(); x <= rect.right(); x++)
+            sum += fabs(log2(ra[x] / rb[x]));
+    }
+    return sum / (rect.width() * rect.height());
+}
+
+/*! \brief Mean level of a channel over rect, 0 red to 2 blue
+ */
+static double meanLevel(const QImage &img, QRect rect, int c)
+{
+    double sum = 0;
+
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        for (int x = rect.left(); x <= rect.right(); x++) {
+            QRgb px = img.pixel(x, y);
+            sum += c == 0 ? qRed(px) : c == 1 ? qGreen(px) : qBlue(px);
+        }
+    }
+    return sum / (rect.width() * rect.height());
+}
+
+/*! \brief Check an LDR rendering keeps the scene layout
+ *
+ * Off the dark band, quarters of the width get brighter along
+ * the ramp, and red stays above blue as in the scene
+ */
+static bool keepsScene(const QImage &ldr)
+{
+    int w = ldr.width();
+    int h = ldr.height();
+    double prev = -1;
+
+    for (int i = 0; i < 4; i++) {
+        QRect strip(i * w / 4, h / 8, w / 4, h / 8);
+        double level = meanLevel(ldr, strip, 1);
+        if (level <= prev)
+            return false;
+        prev = level;
+    }
+
+    QRect mid(w / 4, h / 8, w / 2, h / 8);
+    return meanLevel(ldr, mid, 0) > meanLevel(ldr, mid, 2);
+}
+
+static quint32 get32(const uchar *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (quint32(p[3]) << 24);
+}
+
+static quint64 get64(const uchar *p)
+{
+    return get32(p) | (quint64(get32(p + 4)) << 32);
+}
+
+/*! \brief Decode a Radiance .hdr file, as RGBEWriter lays it
+ *
+ * Header, resolution line, then flat or run length encoded
+ * scanlines. Returns false on anything unexpected
+ */
+static bool readRGBE(QString path, RadianceMap &hdr)
+{
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+    int end = data.indexOf("\n\n");
+    if (!data.startsWith("#?RADIANCE\n") || end < 0 ||
+        !data.left(end).contains("\nFORMAT=32-bit_rle_rgbe"))
+        return false;
+    int eol = data.indexOf('\n', end + 2);
+    if (eol < 0)
+        return false;
+    QStringList res =
+        QString::fromLatin1(data.mid(end + 2, eol - end - 2)).split(' ');
+    if (res.size() != 4 || res.at(0) != "-Y" || res.at(2) != "+X")
+        return false;
+    int h = res.at(1).toInt();
+    int w = res.at(3).toInt();
+    if (w <= 0 || h <= 0)
+        return false;
+
+    const uchar *p = (const uchar *)data.constData() + eol + 1;
+    const uchar *stop = (const uchar *)data.constData() + data.size();
+    QByteArray planes(w * 4, 0);
+    uchar *pl = (uchar *)planes.data();
+
+    hdr = RadianceMap(w, h, 3);
+    for (int y = 0; y < h; y++) {
+        if (w < 8 || w >= 32768) {
+            if (stop - p < w * 4)
+                return false;
+            for (int x = 0; x < w; x++)
+                for (int c = 0; c < 4; c++)
+                    pl[c * w + x] = *p++;
+        } else {
+            /* Scanline marker, then each component separately */
+            if (stop - p < 4 || p[0] != 2 || p[1] != 2 ||
+                ((p[2] << 8) | p[3]) != w)
+                return false;
+            p += 4;
+            for (int c = 0; c < 4; c++) {
+                uchar *dst = pl + c * w;
+                int x = 0;
+                while (x < w) {
+                    if (p >= stop)
+                        return false;
+                    int n = *p++;
+                    if (n > 128) {
+                        n -= 128;
+                        if (x + n > w || p >= stop)
+                            return false;
+                        memset(dst + x, *p++, n);
+                    } else {
+                        if (n == 0 || x + n > w || stop - p < n)
+                            return false;
+                        memcpy(dst + x, p, n);
+                        p += n;
+                    }
+                    x += n;
+                }
+            }
+        }
+
+        float *r = hdr.row(0, y);
+        float *g = hdr.row(1, y);
+        float *b = hdr.row(2, y);
+        for (int x = 0; x < w; x++) {
+            int e = pl[3 * w + x];
+            float f = e ? ldexpf(1.0f, e - 136) : 0;
+            r[x] = (pl[x] + 0.5f) * f;
+            g[x] = (pl[w + x] + 0.5f) * f;
+            b[x] = (pl[2 * w + x] + 0.5f) * f;
+        }
+    }
+
+    return p == stop;
+}
+
+static float fromHalf(quint16 h)
+{
+    int e = (h >> 10) & 0x1F;
+    int m = h & 0x3FF;
+    float v = e ? ldexpf(float(1024 + m), e - 25) : ldexpf(float(m), -24);
+
+    return (h & 0x8000) ? -v : v;
+}
+
+/*! \brief Decode tile (tx, ty) of an OpenEXR file, as ExrWriter lays it
+ *
+ * Header attributes, offset table and tile chunk are checked on
+ * the way : ZIP data is inflated, its predictor undone and its
+ * bytes interleaved back. Returns false on anything unexpected
+ */
+static bool readExrTile(const QByteArray &data, int tx, int ty,
+                        RadianceMap &tile)
+{
+    const uchar *p = (const uchar *)data.constData();
+    int size = data.size();
+    int pos = 8;
+    QMap<QByteArray, QByteArray> values;
+    QMap<QByteArray, QByteArray> types;
+
+    if (size < 8 || get32(p) != 20000630 || get32(p + 4) != (2 | 0x200))
+        return false;
+
+    /* Name, type, size and value, up to an empty name */
+    while (pos < size && p[pos]) {
+        QByteArray name(data.constData() + pos);
+        pos += name.size() + 1;
+        if (pos >= size)
+            return false;
+        QByteArray type(data.constData() + pos);
+        pos += type.size() + 1;
+        if (pos + 4 > size)
+            return false;
+        int n = get32(p + pos);
+        pos += 4;
+        if (n < 0 || pos + n > size)
+            return false;
+        values.insert(name, data.mid(pos, n));
+        types.insert(name, type);
+        pos += n;
+    }
+    pos++;
+
+    /* B, G and R channels, all half or all float */
+    QByteArray ch = values.value("channels");
+    if (types.value("channels") != "chlist" || ch.size() != 3 * 18 + 1)
+        return false;
+    const uchar *c = (const uchar *)ch.constData();
+    int pixelType = get32(c + 2);
+    for (int i = 0; i < 3; i++, c += 18)
+        if (c[0] != "BGR"[i] || c[1] || get32(c + 2) != quint32(pixelType) ||
+            get32(c + 10) != 1 || get32(c + 14) != 1)
+            return false;
+    if (c[0] || (pixelType != 1 && pixelType != 2))
+        return false;
+
+    QByteArray comp = values.value("compression");
+    QByteArray box = values.value("dataWindow");
+    QByteArray desc = values.value("tiles");
+    if (comp.size() != 1 || (comp[0] != 0 && comp[0] != 3) ||
+        types.value("dataWindow") != "box2i" || box.size() != 16 ||
+        types.value("tiles") != "tiledesc" || desc.size() != 9 ||
+        values.value("lineOrder") != QByteArray(1, 0))
+        return false;
+    const uchar *b = (const uchar *)box.constData();
+    const uchar *d = (const uchar *)desc.constData();
+    int w = get32(b + 8) + 1;
+    int h = get32(b + 12) + 1;
+    int ts = get32(d);
+    if (get32(b) || get32(b + 4) || w <= 0 || h <= 0 || ts <= 0 ||
+        get32(d + 4) != quint32(ts) || d[8])
+        return false;
+
+    /* Offsets follow each other, past the table */
+    int tilesX = (w + ts - 1) / ts;
+    int tilesY = (h + ts - 1) / ts;
+    if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY ||
+        pos + 8 * tilesX * tilesY > size)
+        return false;
+    qint64 prev = pos + 8 * tilesX * tilesY - 1;
+    for (int t = 0; t < tilesX * tilesY; t++) {
+        qint64 offset = get64(p + pos + 8 * t);
+        if (offset <= prev || offset + 20 > size)
+            return false;
+        prev = offset;
+    }
+
+    /* Tile chunk : coordinates, levels, data size, data */
+    qint64 offset = get64(p + pos + 8 * (ty * tilesX + tx));
+    const uchar *chunk = p + offset;
+    int n = get32(chunk + 16);
+    if (int(get32(chunk)) != tx || int(get32(chunk + 4)) != ty ||
+        get32(chunk + 8) || get32(chunk + 12) || n < 0 ||
+        offset + 20 + n > size)
+        return false;
+
+    int tw = qMin(ts, w - tx * ts);
+    int th = qMin(ts, h - ty * ts);
+    int bytes = pixelType == 1 ? 2 : 4;
+    int raw = tw * th * 3 * bytes;
+    QByteArray pixels = data.mid(offset + 20, n);
+    if (n != raw) {
+        if (comp[0] != 3)
+            return false;
+        /* qUncompress expects the size first */
+        QByteArray z(4, 0);
+        z[0] = char(raw >> 24);
+        z[1] = char(raw >> 16);
+        z[2] = char(raw >> 8);
+        z[3] = char(raw);
+        QByteArray pred = qUncompress(z + pixels);
+        if (pred.size() != raw)
+            return false;
+        uchar *q = (uchar *)pred.data();
+        for (int i = 1; i < raw; i++)
+            q[i] = uchar(q[i - 1] + q[i] - 128);
+        pixels = QByteArray(raw, 0);
+        uchar *out = (uchar *)pixels.data();
+        for (int i = 0; i < raw; i++)
+            out[i] = q[(i & 1) ? (raw + 1) / 2 + i / 2 : i / 2];
+    }
+
+    const uchar *s = (const uchar *)pixels.constData();
+    tile = RadianceMap(tw, th, 3);
+    for (int y = 0; y < th; y++) {
+        for (int k = 2; k >= 0; k--) {
+            float *dst = tile.row(k, y);
+            for (int x = 0; x < tw; x++, s += bytes) {
+                if (bytes == 2) {
+                    dst[x] = fromHalf(s[0] | (s[1] << 8));
+                } else {
+                    quint32 bits = get32(s);
+                    memcpy(dst + x, &bits, 4);
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+/*! \brief Check a decoded radiance map against its source
+ *
+ * Error allowed is rel times the value, or times the largest
+ * channel of the pixel when channels share an exponent (RGBE).
+ * Values below the smallest normal half are taken as that
+ */
+static bool closeRadiance(const RadianceMap &src, const RadianceMap &dec,
+                          float rel, bool shared)
+{
+    if (dec.width() != src.width() || dec.height() != src.height() ||
+        dec.channels() != 3)
+        return false;
+
+    for (int y = 0; y < src.height(); y++) {
+        for (int x = 0; x < src.width(); x++) {
+            float top = 0;
+            for (int c = 0; c < 3; c++)
+                top = qMax(top, src.row(c, y)[x]);
+            for (int c = 0; c < 3; c++) {
+                float v = qMax(src.row(c, y)[x], 0.0f);
+                float ref = qMax(shared ? top : v, 6.1e-5f);
+                if (fabsf(dec.row(c, y)[x] - v) > rel * ref)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+class AutoHDRBenchmark : public QObject
+{
+    Q_OBJECT
+
+  private:
+    Config conf;
+    QImage liveView;
+    QImage fullSize;
+    QByteArray liveViewJpeg;
+    QByteArray fullSizeJpeg;
+    /* Replayed camera : one liveview frame per exposure step */
+    QList<QImage> replay;
+    QTemporaryDir tmp;
+    QString sequencePath;
+    QStringList compShots;
+
+    void loadCompShots(QList<QImage> &images, QList<double> &times);
+    QList<shotParameters> compShotParameters();
+    bool mergeCompShots(RadianceMap &hdr);
+
+  private slots:
+    void initTestCase();
+
+    void rateExposition_data();
+    void rateExposition();
+    void jpegDecode_data();
+    void jpegDecode();
+    void sequenceSave();
+    void sequenceLoad();
+    void sequenceSearch();
+    void previewFusion();
+    void composition();
+    void incrementalMerge();
+    void incrementalCancel();
+    void nativeMerge();
+    void deghostMerge();
+    void responseCalibration();
+    void exposureFusion();
+    void alignment();
+    void planarConversion();
+    void bufferAllocation_data();
+    void bufferAllocation();
+    void parallelDispatch();
+    void toneMapping_data();
+    void toneMapping();
+    void hdrWrite_data();
+    void hdrWrite();
+    void cronParse_data();
+    void cronParse();
+    void cronNext_data();
+    void cronNext();
+    void batchBacklog();
+};
+
+/*! \brief Build standardized fixtures
+ *
+ * Every fixture is generated, nothing depends on files
+ * or hardware available on the build host
+ */
+void AutoHDRBenchmark::initTestCase()
+{
+    QVERIFY(tmp.isValid());
+
+    liveView = renderScene(LIVEVIEW_WIDTH, LIVEVIEW_HEIGHT, 0);
+    fullSize = renderScene(FULL_WIDTH, FULL_HEIGHT, 0);
+
+    QBuffer lvBuffer(&liveViewJpeg);
+    lvBuffer.open(QIODevice::WriteOnly);
+    liveView.save(&lvBuffer, "JPG", 90);
+    QBuffer fullBuffer(&fullSizeJpeg);
+    fullBuffer.open(QIODevice::WriteOnly);
+    fullSize.save(&fullBuffer, "JPG", 90);
+
+    for (int i = 0; i <= SEARCH_STEPS; i++)
+        replay.append(renderScene(LIVEVIEW_WIDTH, LIVEVIEW_HEIGHT,
+                                  (i - SEARCH_STEPS / 2) / 3.0));
+
+    /* Typical 7 shots sequence file */
+    Sequence s(nullptr, &conf);
+    s.setCriterias(5, 5, 7);
+    for (int i = 0; i < 7; i++) {
+        shotParameters sp = {.ISO = "100",
+                             .aperture = "8",
+                             .exposure = QString("1/%1").arg(1000 >> i),
+                             .preview = QImage(),
+                             .path = QString()};
+        s.setShot(sp);
+    }
+    sequencePath = tmp.filePath("sequence.xml");
+    conf.saveSequence(sequencePath, &s);
+
+    for (int i = 0; i < COMP_SHOTS; i++) {
+        QString path = tmp.filePath(QString("Image_%1.jpg").arg(i));
+        renderScene(COMP_WIDTH, COMP_HEIGHT, 2.0 * (i - COMP_SHOTS / 2))
+            .save(path, "JPG", 95);
+        compShots << path;
+    }
+}
+
+void AutoHDRBenchmark::rateExposition_data()
+{
+    QTest::addColumn<bool>("full");
+    QTest::addColumn<int>("type");
+
+    QTest::newRow("liveview_under") << false << int(UNDER_EXPOSITION);
+    QTest::newRow("liveview_over") << false << int(OVER_EXPOSITION);
+    QTest::newRow("24mp_under") << true << int(UNDER_EXPOSITION);
+    QTest::newRow("24mp_over") << true << int(OVER_EXPOSITION);
+}
+
+/*! \brief Exposition rating, as run on every liveview frame
+ */
+void AutoHDRBenchmark::rateExposition()
+{
+    QFETCH(bool, full);
+    QFETCH(int, type);
+    QImage &img = full ? fullSize : liveView;
+    int rate = 0;
+
+    QBENCHMARK {
+        rate = rateImageExposition(&conf, img, ExpositionType(type));
+    }
+    QVERIFY(rate >= 0);
+}
+
+void AutoHDRBenchmark::jpegDecode_data()
+{
+    QTest::addColumn<bool>("full");
+
+    QTest::newRow("liveview") << false;
+    QTest::newRow("24mp") << true;
+}
+
+/*! \brief JPEG decode, as done for liveview and captured shots
+ */
+void AutoHDRBenchmark::jpegDecode()
+{
+    QFETCH(bool, full);
+    const QByteArray &data = full ? fullSizeJpeg : liveViewJpeg;
+    QImage img;
+
+    QBENCHMARK {
+        img = QImage::fromData(data, "JPG");
+    }
+    QVERIFY(!img.isNull());
+}
+
+/*! \brief Sequence XML writing
+ */
+void AutoHDRBenchmark::sequenceSave()
+{
+    Sequence s(nullptr, &conf);
+    conf.loadSequence(sequencePath, &s);
+    QString path = tmp.filePath("sequence_save.xml");
+
+    QBENCHMARK {
+        conf.saveSequence(path, &s);
+    }
+    QCOMPARE(s.getShotsNb(), 7);
+}
+
+/*! \brief Sequence XML parsing
+ */
+void AutoHDRBenchmark::sequenceLoad()
+{
+    Sequence s(nullptr, &conf);
+
+    QBENCHMARK {
+        conf.loadSequence(sequencePath, &s);
+    }
+    QCOMPARE(s.getShotsNb(), 7);
+}
+
+/*! \brief Full sequence search against a replayed camera
+ *
+ * Sequence::runStateMachine() drives the camera, each liveview
+ * frame is the replayed one of its current exposure
+ */
+void AutoHDRBenchmark::sequenceSearch()
+{
+    QStringList exposures;
+    bool computed = false;
+
+    for (int i = 0; i <= SEARCH_STEPS; i++)
+        exposures << QString("step%1").arg(SEARCH_STEPS - i);
+    ReplayCamera camera(exposures, SEARCH_STEPS / 2);
+    Sequence s(&camera, &conf);
+    connect(&s, &Sequence::sequenceComputed, [&]() { computed = true; });
+    s.setCriterias(5, 5, SEARCH_STEPS + 1);
+    s.setStartParameters("100", "8", exposures.at(SEARCH_STEPS / 2));
+
+    QBENCHMARK {
+        computed = false;
+        s.startComputing();
+        /* Each step takes a frame, plus state changes */
+        for (int i = 0; i < 2 * SEARCH_STEPS + 8 && !computed; i++) {
+            int step = exposures.indexOf(camera.getCurrentExposure());
+            QImage frame = replay.at(SEARCH_STEPS - step);
+            s.runStateMachine(&frame);
+        }
+    }
+    QVERIFY(computed);
+    QVERIFY(s.getShotsNb() >= 2);
+}
+
+/*! \brief Fused HDR preview of the exposure search
+ *
+ * Every replayed liveview frame is fused, as a full search
+ * range would be, then the preview is built
+ */
+void AutoHDRBenchmark::previewFusion()
+{
+    FusionPreview preview;
+    QImage result;
+
+    QBENCHMARK {
+        preview.reset();
+        for (int i = 0; i < replay.size(); i++)
+            QVERIFY(preview.add(replay.at(i)));
+        result = preview.result();
+    }
+    QCOMPARE(result.width(), FUSION_PREVIEW_WIDTH);
+}
+
+/*! \brief Composition throughput
+ *
+ * Runs the composition command line as Composition does
+ */
+void AutoHDRBenchmark::composition()
+{
+    QString program = QStandardPaths::findExecutable("luminance-hdr-cli");
+    if (program.isEmpty())
+        QSKIP("luminance-hdr-cli not available");
+
+    QStringList arguments;
+    arguments << "--save" << tmp.filePath("hdr_result.tif");
+    arguments << "--output" << tmp.filePath("ldr_result.tif");
+    arguments << compShots;
+
+    QBENCHMARK_ONCE {
+        QProcess p;
+        p.start(program, arguments);
+        QVERIFY(p.waitForFinished(-1));
+        QCOMPARE(p.exitCode(), 0);
+    }
+}
+
+/*! \brief Shots merged while a sequence is captured
+ *
+ * Search, then capture of the composition fixture shots : each
+ * shot is merged as it comes, without the composition being
+ * resumed, the end of capture only writes results
+ */
+void AutoHDRBenchmark::incrementalMerge()
+{
+    Sequence s(nullptr, &conf);
+    Composition *comp = s.getComposition();
+    QSignalSpy finished(comp, &Composition::compositionFinished);
+    QSignalSpy failed(comp, &Composition::compositionError);
+    QList<shotParameters> shots = compShotParameters();
+    QString folder = tmp.path() + "/incremental/";
+
+    QVERIFY(QDir().mkpath(folder));
+    QBENCHMARK_ONCE {
+        s.startComputing();
+        s.abortComputing();
+        for (int i = 0; i < COMP_SHOTS; i++)
+            s.setShot(shots.at(i));
+        comp->beginIncremental();
+        for (int i = 0; i < COMP_SHOTS; i++)
+            comp->addShot(shots.at(i));
+        comp->startComposition(shots, folder);
+        QTRY_COMPARE_WITH_TIMEOUT(finished.count() + failed.count(), 1,
+                                  60000);
+    }
+    QCOMPARE(finished.count(), 1);
+    QVERIFY(QFileInfo(folder + conf.getHdrFileName()).exists());
+}
+
+/*! \brief Incremental merge dropped during capture
+ *
+ * A capture fails after two shots : the stream is dropped and
+ * the whole sequence is merged again from its shots
+ */
+void AutoHDRBenchmark::incrementalCancel()
+{
+    Sequence s(nullptr, &conf);
+    Composition *comp = s.getComposition();
+    QSignalSpy finished(comp, &Composition::compositionFinished);
+    QSignalSpy failed(comp, &Composition::compositionError);
+    QList<shotParameters> shots = compShotParameters();
+    QString folder = tmp.path() + "/cancelled/";
+
+    QVERIFY(QDir().mkpath(folder));
+    for (int i = 0; i < COMP_SHOTS; i++)
+        s.setShot(shots.at(i));
+
+    QBENCHMARK_ONCE {
+        comp->beginIncremental();
+        comp->addShot(shots.at(0));
+        comp->addShot(shots.at(1));
+        comp->cancelIncremental();
+        comp->startComposition(shots, folder);
+        QTRY_COMPARE_WITH_TIMEOUT(finished.count() + failed.count(), 1,
+                                  60000);
+    }
+    QCOMPARE(finished.count(), 1);
+    QVERIFY(!comp->isRunning());
+    QVERIFY(QFileInfo(folder + conf.getHdrFileName()).exists());
+}
+
+/*! \brief In-process merge throughput
+ *
+ * Same shots as composition(), already decoded
+ */
+void AutoHDRBenchmark::nativeMerge()
+{
+    QList<QImage> images;
+    QList<double> times;
+    RadianceMap hdr;
+
+    loadCompShots(images, times);
+
+    QBENCHMARK {
+        QVERIFY(mergeExposures(images, times, hdr));
+    }
+    QCOMPARE(hdr.width(), COMP_WIDTH);
+    QVERIFY(followsRamp(hdr));
+}
+
+/*! \brief In-process merge with deghosting
+ *
+ * Same as nativeMerge(), difference is the deghosting cost.
+ * A dark square then moves into a shot after the reference one :
+ * deghosting must keep it out of the merge
+ */
+void AutoHDRBenchmark::deghostMerge()
+{
+    QList<QImage> images;
+    QList<double> times;
+    RadianceMap hdr, ghost, plain, plainGhost;
+    /* Well exposed in the reference shot, off highlight cells */
+    QRect rect(576, 896, 128, 64);
+
+    loadCompShots(images, times);
+
+    QBENCHMARK {
+        QVERIFY(mergeExposures(images, times, hdr, QList<QPoint>(),
+                               DEGHOST_SIGMA));
+    }
+    QCOMPARE(hdr.width(), COMP_WIDTH);
+
+    QVERIFY(mergeExposures(images, times, plain));
+    for (int y = rect.top(); y <= rect.bottom(); y++)
+        for (int x = rect.left(); x <= rect.right(); x++)
+            images[COMP_SHOTS / 2 + 1].setPixel(x, y, qRgb(40, 40, 40));
+    QVERIFY(mergeExposures(images, times, ghost, QList<QPoint>(),
+                           DEGHOST_SIGMA));
+    QVERIFY(mergeExposures(images, times, plainGhost));
+
+    double kept = stopsApart(ghost, hdr, rect);
+    double merged = stopsApart(plainGhost, plain, rect);
+    QVERIFY(merged > 0.25);
+    QVERIFY(kept < merged / 4);
+}
+
+/*! \brief Camera response calibration
+ *
+ * One-off cost, on the first bracket of a body and ISO. Later
+ * merges only look the saved response up, as nativeMerge()
+ */
+void AutoHDRBenchmark::responseCalibration()
+{
+    QList<QImage> images;
+    QList<double> times;
+    cameraResponse response;
+    QString file = tmp.filePath(RESPONSE_FILE);
+
+    loadCompShots(images, times);
+
+    QBENCHMARK {
+        QVERIFY(calibrateResponse(images, times, QList<QPoint>(), response));
+    }
+    QVERIFY(saveResponse(file, "benchmark", "100", response));
+    QVERIFY(loadResponse(file, "benchmark", "100", response));
+    /* A response never decreases, and spans the bracket */
+    for (int c = 0; c < 3; c++) {
+        for (int z = 1; z < 256; z++)
+            QVERIFY(response.g[c][z] >= response.g[c][z - 1]);
+        QVERIFY(response.g[c][200] > response.g[c][100]);
+    }
+}
+
+/*! \brief Tiled exposure fusion throughput
+ *
+ * Same shots as composition(), decoded once, fused band by band
+ */
+void AutoHDRBenchmark::exposureFusion()
+{
+    QString output = tmp.filePath("ldr_fusion.tif");
+
+    QBENCHMARK_ONCE {
+        QVERIFY(fuseExposures(compShots, output));
+    }
+
+    QImage fused(output);
+    QCOMPARE(fused.size(), QSize(COMP_WIDTH, COMP_HEIGHT));
+    QVERIFY(keepsScene(fused));
+}
+
+/*! \brief MTB alignment at full resolution
+ *
+ * Reference pyramid is built once, as in incremental merge
+ */
+void AutoHDRBenchmark::alignment()
+{
+    QImage shifted = fullSize.copy(5, 3, FULL_WIDTH, FULL_HEIGHT);
+    grayPyramid ref, pyr;
+    QPoint offset;
+
+    buildGrayPyramid(fullSize, ref);
+    QBENCHMARK {
+        buildGrayPyramid(shifted, pyr);
+        offset = computeShift(ref, pyr);
+    }
+    QCOMPARE(offset, QPoint(5, 3));
+}
+
+/*! \brief Full size frame to planes and back
+ *
+ * Cost paid at the edges, where a QImage meets planar kernels
+ */
+void AutoHDRBenchmark::planarConversion()
+{
+    PlanarImage<uchar> planes;
+    QImage back;
+
+    QBENCHMARK {
+        planes = planarFromImage(fullSize);
+        back = planarToImage(planes);
+    }
+    QCOMPARE(planes.channels(), 3);
+    QCOMPARE(back, fullSize);
+}
+
+void AutoHDRBenchmark::bufferAllocation_data()
+{
+    QTest::addColumn<bool>("pooled");
+
+    QTest::newRow("system") << false;
+    QTest::newRow("pool") << true;
+}
+
+/*! \brief Full size image allocated and written, as a decoded shot
+ *
+ * Pool reuses mapped pages, system allocation faults them in
+ * every time
+ */
+void AutoHDRBenchmark::bufferAllocation()
+{
+    QFETCH(bool, pooled);
+
+    QBENCHMARK {
+        QImage img = pooled ? pooledImage(FULL_WIDTH, FULL_HEIGHT,
+                                          QImage::Format_RGBX64)
+                            : QImage(FULL_WIDTH, FULL_HEIGHT,
+                                     QImage::Format_RGBX64);
+        QVERIFY(!img.isNull());
+        img.fill(0);
+    }
+}
+
+/*! \brief Executor overhead, on liveview sized rows
+ *
+ * Chunks do little work : time is mostly queueing and stealing
+ */
+void AutoHDRBenchmark::parallelDispatch()
+{
+    QVector<int> rows(LIVEVIEW_HEIGHT);
+
+    QBENCHMARK {
+        parallelFor(0, LIVEVIEW_HEIGHT, [&](int first, int last) {
+            for (int y = first; y < last; y++)
+                rows[y] = y;
+        });
+    }
+    QCOMPARE(rows.last(), LIVEVIEW_HEIGHT - 1);
+}
+
+/*! \brief Decode composition fixture shots, with exposure times
+ */
+void AutoHDRBenchmark::loadCompShots(QList<QImage> &images,
+                                     QList<double> &times)
+{
+    for (int i = 0; i < COMP_SHOTS; i++) {
+        images.append(QImage(compShots.at(i)));
+        times.append(pow(2.0, 2.0 * (i - COMP_SHOTS / 2)));
+    }
+}
+
+/*! \brief Composition fixture shots, as captured
+ */
+QList<shotParameters> AutoHDRBenchmark::compShotParameters()
+{
+    QList<shotParameters> shots;
+
+    for (int i = 0; i < COMP_SHOTS; i++) {
+        double ev = 2.0 * (i - COMP_SHOTS / 2);
+        shotParameters sp = {
+            .ISO = "100",
+            .aperture = "8",
+            .exposure = ev < 0 ? QString("1/%1").arg(pow(2.0, -ev))
+                               : QString::number(pow(2.0, ev)),
+            .preview = QImage(),
+            .path = compShots.at(i)};
+        shots << sp;
+    }
+    return shots;
+}
+
+/*! \brief Merge composition fixture shots
+ */
+bool AutoHDRBenchmark::mergeCompShots(RadianceMap &hdr)
+{
+    QList<QImage> images;
+    QList<double> times;
+
+    loadCompShots(images, times);
+
+    return mergeExposures(images, times, hdr);
+}
+
+void AutoHDRBenchmark::toneMapping_data()
+{
+    QTest::addColumn<int>("op");
+
+    QTest::newRow("reinhard") << int(TM_REINHARD);
+    QTest::newRow("drago") << int(TM_DRAGO);
+    QTest::newRow("local") << int(TM_LOCAL);
+}
+
+/*! \brief Tone mapping of a merged radiance map
+ *
+ * What an extra LDR variant costs once the sequence is merged
+ */
+void AutoHDRBenchmark::toneMapping()
+{
+    QFETCH(int, op);
+    RadianceMap hdr;
+    QImage ldr;
+
+    QVERIFY(mergeCompShots(hdr));
+    QBENCHMARK {
+        ldr = toneMapImage(hdr, ToneMapOperator(op));
+    }
+    QCOMPARE(ldr.size(), QSize(COMP_WIDTH, COMP_HEIGHT));
+    QVERIFY(keepsScene(ldr));
+
+    /* Dark band, 4 stops under, stays darker */
+    QRect lit(COMP_WIDTH / 4, COMP_HEIGHT / 8, COMP_WIDTH / 2, COMP_HEIGHT / 8);
+    QRect dark(COMP_WIDTH / 4, 3 * COMP_HEIGHT / 8, COMP_WIDTH / 2,
+               COMP_HEIGHT / 16);
+    QVERIFY(meanLevel(ldr, dark, 1) < meanLevel(ldr, lit, 1));
+}
+
+void AutoHDRBenchmark::hdrWrite_data()
+{
+    QTest::addColumn<QString>("format");
+
+    QTest::newRow("rgbe") << "rgbe";
+    QTest::newRow("exr_half") << "exr_half";
+    QTest::newRow("exr_float") << "exr_float";
+}
+
+/*! \brief HDR result encoding and writing
+ *
+ * File size is reported along with time
+ */
+void AutoHDRBenchmark::hdrWrite()
+{
+    QFETCH(QString, format);
+    RadianceMap hdr;
+    QString path = tmp.filePath("hdr_write." + format);
+
+    QVERIFY(mergeCompShots(hdr));
+    QBENCHMARK {
+        if (format == "rgbe")
+            QVERIFY(writeRGBE(path, hdr));
+        else
+            QVERIFY(writeEXR(path, hdr, EXR_TILE, format == "exr_half"));
+    }
+    qInfo("%s : %lld bytes", format.toStdString().c_str(),
+          QFileInfo(path).size());
+
+    if (format == "rgbe") {
+        RadianceMap back;
+        QVERIFY(readRGBE(path, back));
+        /* 8 bit mantissas share an exponent */
+        QVERIFY(closeRadiance(hdr, back, 1.0f / 128, true));
+        return;
+    }
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray data = file.readAll();
+    int tilesX = (hdr.width() + EXR_TILE - 1) / EXR_TILE;
+    int tilesY = (hdr.height() + EXR_TILE - 1) / EXR_TILE;
+    /* Half floats keep 11 bits, floats are stored as is */
+    float rel = format == "exr_half" ? 1.0f / 1024 : 0;
+
+    /* A middle tile, and the last one, partial */
+    for (QPoint t : {QPoint(tilesX / 2, tilesY / 2),
+                     QPoint(tilesX - 1, tilesY - 1)}) {
+        RadianceMap tile;
+        QVERIFY(readExrTile(data, t.x(), t.y(), tile));
+        QRect rect(t.x() * EXR_TILE, t.y() * EXR_TILE,
+                   qMin(EXR_TILE, hdr.width() - t.x() * EXR_TILE),
+                   qMin(EXR_TILE, hdr.height() - t.y() * EXR_TILE));
+        QVERIFY(closeRadiance(hdr.view(rect), tile, rel, false));
+    }
+}
+
+void AutoHDRBenchmark::cronParse_data()
+{
+    QTest::addColumn<QString>("expr");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("every_minute") << "* * * * *" << true;
+    QTest::newRow("spaces") << "  0  6 * *   1-5 " << true;
+    QTest::newRow("list_range_step") << "0,30 8-18/2 1,15 */3 *" << true;
+    QTest::newRow("start_step") << "5/15 * * * *" << true;
+    QTest::newRow("sunday_7") << "0 0 * * 7" << true;
+    QTest::newRow("four_fields") << "* * * *" << false;
+    QTest::newRow("six_fields") << "* * * * * *" << false;
+    QTest::newRow("minute_60") << "60 * * * *" << false;
+    QTest::newRow("hour_24") << "0 24 * * *" << false;
+    QTest::newRow("day_0") << "0 0 0 * *" << false;
+    QTest::newRow("month_13") << "0 0 * 13 *" << false;
+    QTest::newRow("weekday_8") << "0 0 * * 8" << false;
+    QTest::newRow("reversed_range") << "0 0 * * 5-1" << false;
+    QTest::newRow("zero_step") << "*/0 * * * *" << false;
+    QTest::newRow("empty_item") << "0, * * * *" << false;
+    QTest::newRow("word") << "0 0 * * mon" << false;
+}
+
+/*! \brief Cron expression parsing
+ */
+void AutoHDRBenchmark::cronParse()
+{
+    QFETCH(QString, expr);
+    QFETCH(bool, valid);
+    CronSchedule cron;
+
+    QCOMPARE(cron.parse(expr), valid);
+}
+
+void AutoHDRBenchmark::cronNext_data()
+{
+    QTest::addColumn<QString>("expr");
+    QTest::addColumn<QDateTime>("expected");
+
+    /* From Sunday 2026-10-18 12:00 */
+    QDate sun(2026, 10, 18);
+
+    QTest::newRow("next_minute")
+        << "* * * * *" << QDateTime(sun, QTime(12, 1));
+    QTest::newRow("quarter")
+        << "*/15 * * * *" << QDateTime(sun, QTime(12, 15));
+    QTest::newRow("tomorrow")
+        << "30 6 * * *" << QDateTime(sun.addDays(1), QTime(6, 30));
+    QTest::newRow("first_of_month")
+        << "0 6 1 * *" << QDateTime(QDate(2026, 11, 1), QTime(6, 0));
+    QTest::newRow("sunday_7")
+        << "0 0 * * 7" << QDateTime(sun.addDays(7), QTime(0, 0));
+    QTest::newRow("weekday_step")
+        << "0 0 * * */3" << QDateTime(sun.addDays(3), QTime(0, 0));
+    /* Day and weekday both restricted : either one fires */
+    QTest::newRow("day_or_monday")
+        << "0 6 1 * 1" << QDateTime(sun.addDays(1), QTime(6, 0));
+    QTest::newRow("day_or_saturday")
+        << "0 6 1 * 6" << QDateTime(sun.addDays(6), QTime(6, 0));
+    QTest::newRow("day_or_sunday")
+        << "0 6 19 * 0" << QDateTime(sun.addDays(1), QTime(6, 0));
+    QTest::newRow("february_30_or_monday")
+        << "0 0 30 2 1" << QDateTime(QDate(2027, 2, 1), QTime(0, 0));
+    QTest::newRow("february_31") << "0 0 31 2 *" << QDateTime();
+}
+
+/*! \brief Next scheduled run, as computed between batch runs
+ */
+void AutoHDRBenchmark::cronNext()
+{
+    QFETCH(QString, expr);
+    QFETCH(QDateTime, expected);
+    CronSchedule cron;
+    QDateTime from(QDate(2026, 10, 18), QTime(12, 0, 30));
+    QDateTime next;
+
+    QVERIFY(cron.parse(expr));
+    QBENCHMARK {
+        next = cron.next(from);
+    }
+    QCOMPARE(next, expected);
+    if (next.isValid())
+        QVERIFY(cron.matches(next));
+}
+
+/*! \brief Batch capture delayed by waiting compositions
+ */
+void AutoHDRBenchmark::batchBacklog()
+{
+    Sequence s(nullptr, &conf);
+    BatchRunner batch(&conf, &s);
+
+    /* Backlog is at least one composition */
+    batch.setCompose(true);
+    batch.setBacklog(0);
+    QVERIFY(!batch.backlogFull(0));
+    QVERIFY(batch.backlogFull(1));
+
+    batch.setBacklog(3);
+    QVERIFY(!batch.backlogFull(2));
+    QVERIFY(batch.backlogFull(3));
+    QVERIFY(batch.backlogFull(4));
+
+    /* Nothing is queued without composition */
+    batch.setCompose(false);
+    QVERIFY(!batch.backlogFull(10));
+}
+
+/*! \brief Convert QTest XML log to JSON
+ *
+ * One entry per benchmark result, along with what is needed
+ * to track trends per commit (AUTOHDR_COMMIT environment variable)
+ */
+static bool writeJsonResults(QString xmlPath, QString jsonPath)
+{
+    QDomDocument log;
+    QFile xmlFile(xmlPath);
+
+    if (!xmlFile.open(QIODevice::ReadOnly) || !log.setContent(&xmlFile)) {
+        fprintf(stderr, "Could not read benchmark log %s\n",
+                xmlPath.toStdString().c_str());
+        return false;
+    }
+
+    QJsonArray results;
+    QDomNodeList functions = log.elementsByTagName("TestFunction");
+    for (int i = 0; i < functions.size(); i++) {
+        QDomElement f = functions.at(i).toElement();
+        QDomNodeList benchs = f.elementsByTagName("BenchmarkResult");
+        for (int j = 0; j < benchs.size(); j++) {
+            QDomElement b = benchs.at(j).toElement();
+            QJsonObject r;
+            double value = b.attribute("value").toDouble();
+            int iterations = b.attribute("iterations").toInt();
+            r["name"] = f.attribute("name");
+            r["tag"] = b.attribute("tag");
+            r["metric"] = b.attribute("metric");
+            r["iterations"] = iterations;
+            r["value"] = iterations ? value / iterations : value;
+            results.append(r);
+        }
+    }
+
+    QJsonObject root;
+    root["commit"] = QString(qgetenv("AUTOHDR_COMMIT"));
+    root["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["host"] = QSysInfo::machineHostName();
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["qt"] = QString(qVersion());
+    root["results"] = results;
+
+    QFile jsonFile(jsonPath);
+    if (!jsonFile.open(QIODevice::WriteOnly)) {
+        fprintf(stderr, "Could not write %s\n", jsonPath.toStdString().c_str());
+        return false;
+    }
+    jsonFile.write(QJsonDocument(root).toJson());
+    jsonFile.close();
+    return true;
+}
+
+/*! \brief Benchmarks entry point
+ *
+ * Takes usual QTest arguments, plus "--json <file>"
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QString jsonPath;
+    QTemporaryDir logDir;
+
+    int idx = args.indexOf("--json");
+    if (idx > 0 && idx + 1 < args.size()) {
+        jsonPath = args.at(idx + 1);
+        args.removeAt(idx + 1);
+        args.removeAt(idx);
+        /* Keep console output along with XML log */
+        args << "-o" << logDir.filePath("bench.xml") + ",xml";
+        args << "-o" << "-,txt";
+    }
+
+    AutoHDRBenchmark bench;
+    int ret = QTest::qExec(&bench, args);
+
+    if (!jsonPath.isEmpty() &&
+        !writeJsonResults(logDir.filePath("bench.xml"), jsonPath))
+        ret = 1;
+
+    return ret;
+}
+
+#include "bench_autohdr.moc"
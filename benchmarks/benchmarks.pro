@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# AutoHDR benchmarks
+#
+# Run with: ./benchmarks --json results.json
+#
+#-------------------------------------------------
+
+QT       += core gui xml testlib
+QT       -= widgets
+
+TARGET = benchmarks
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../core.pri)
+
+SOURCES += \
+    bench_autohdr.cpp
@@ -0,0 +1,208 @@
+#include "bufferpool.h"
+#include "log.h"
+#include "memorybudget.h"
+#include <sys/mman.h>
+
+/*! \brief Get the process buffer pool
+ *
+ * Never destroyed : buffers may be released by static objects
+ * at exit
+ */
+BufferPool &bufferPool()
+{
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+}
+
+/*! \brief Allocate an image from the buffer pool
+ *
+ * Rows are 64 bytes aligned, buffer goes back to the pool when
+ * the last copy of the image is destroyed. An image detached
+ * (written while shared) gets a regular buffer
+ */
+QImage pooledImage(int width, int height, QImage::Format format)
+{
+    if (width <= 0 || height <= 0)
+        return QImage();
+
+    int bits = QImage::toPixelFormat(format).bitsPerPixel();
+    int bpl = ((width * bits + 7) / 8 + 63) / 64 * 64;
+    uchar *data = static_cast<uchar *>(
+        bufferPool().allocate(qint64(bpl) * height));
+    if (!data)
+        return QImage();
+
+    return QImage(
+        data, width, height, bpl, format,
+        [](void *p) { bufferPool().release(p); }, data);
+}
+
+/*! \brief BufferPool constructor
+ *
+ * POOL_CACHE MB of released buffers kept, no huge pages
+ */
+BufferPool::BufferPool()
+{
+    cacheLimit = qint64(POOL_CACHE) * 1024 * 1024;
+    hugePages = false;
+    counters = {0, 0, 0, 0, 0, 0};
+}
+
+/*! \brief Set cache of released buffers, in MB
+ *
+ * 0 releases buffers to the system at once (no reuse)
+ */
+void BufferPool::setCacheLimit(int mb)
+{
+    {
+        QMutexLocker locker(&mutex);
+        cacheLimit = qint64(qMax(0, mb)) * 1024 * 1024;
+        if (counters.cached <= cacheLimit)
+            return;
+    }
+    trim();
+}
+
+/*! \brief Back new buffers by transparent huge pages
+ *
+ * Sizes are then rounded to huge pages. Fewer TLB misses and
+ * page faults on large buffers, at the cost of some memory
+ */
+void BufferPool::setHugePages(bool enable)
+{
+    QMutexLocker locker(&mutex);
+    hugePages = enable;
+}
+
+/*! \brief Round size up to its class size
+ *
+ * Four classes per power of two, multiple of a page
+ */
+qint64 BufferPool::classSize(qint64 size)
+{
+    qint64 page = hugePages ? POOL_HUGE_PAGE : POOL_PAGE;
+    qint64 p = 1;
+
+    while (2 * p < size)
+        p *= 2;
+    qint64 step = qMax(p / 4, page);
+
+    return (size + step - 1) / step * step;
+}
+
+/*! \brief Borrow a buffer of at least size bytes
+ *
+ * Content is not initialized, buffer is 64 bytes aligned.
+ * Returns nullptr if memory is exhausted
+ */
+void *BufferPool::allocate(qint64 size)
+{
+    if (size <= 0)
+        return nullptr;
+    if (size < POOL_MIN_SIZE)
+        return qMallocAligned(size, 64);
+
+    QMutexLocker locker(&mutex);
+    qint64 cls = classSize(size);
+    void *p = nullptr;
+
+    QList<void *> &free = cache[cls];
+    if (!free.isEmpty()) {
+        p = free.takeLast();
+        counters.cached -= cls;
+        counters.hits++;
+    } else {
+        p = mmap(nullptr, cls, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            LOG_ERROR("[BufferPool] Could not map %lld bytes\n",
+                      (long long)cls);
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugePages)
+            madvise(p, cls, MADV_HUGEPAGE);
+#endif
+        counters.misses++;
+    }
+
+    borrowed.insert(p, cls);
+    memoryBudget().charge(cls);
+    counters.used += cls;
+    counters.peakUsed = qMax(counters.peakUsed, counters.used);
+    counters.peakMapped =
+        qMax(counters.peakMapped, counters.used + counters.cached);
+
+    return p;
+}
+
+/*! \brief Give a buffer back to the pool
+ *
+ * Kept for reuse while cache limit allows, unmapped otherwise
+ */
+void BufferPool::release(void *p)
+{
+    if (!p)
+        return;
+
+    QMutexLocker locker(&mutex);
+    qint64 cls = borrowed.value(p, 0);
+    if (!cls) {
+        /* Below POOL_MIN_SIZE */
+        locker.unlock();
+        qFreeAligned(p);
+        return;
+    }
+
+    borrowed.remove(p);
+    memoryBudget().credit(cls);
+    counters.used -= cls;
+    if (counters.cached + cls > cacheLimit) {
+        unmap(p, cls);
+        return;
+    }
+    cache[cls].append(p);
+    counters.cached += cls;
+}
+
+/*! \brief Give cached buffers back to the system
+ */
+void BufferPool::trim()
+{
+    QMutexLocker locker(&mutex);
+
+    for (QMap<qint64, QList<void *>>::iterator it = cache.begin();
+         it != cache.end(); ++it)
+        for (void *p : it.value())
+            unmap(p, it.key());
+    cache.clear();
+    counters.cached = 0;
+}
+
+void BufferPool::unmap(void *p, qint64 size)
+{
+    if (munmap(p, size))
+        LOG_ERROR("[BufferPool] Could not unmap %lld bytes\n", (long long)size);
+}
+
+/*! \brief Get pool usage
+ */
+bufferPoolStats BufferPool::stats()
+{
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+/*! \brief Print high-water marks, to size hosts
+ */
+void BufferPool::report()
+{
+    bufferPoolStats s = stats();
+
+    LOG_INFO("[BufferPool] Peak %lld MB borrowed, %lld MB mapped, "
+             "%lld reused / %lld mapped buffers\n",
+             (long long)(s.peakUsed >> 20), (long long)(s.peakMapped >> 20),
+             (long long)s.hits, (long long)s.misses);
+    LOG_INFO("[MemoryBudget] Peak %lld MB tracked\n",
+             (long long)(memoryBudget().peak() >> 20));
+}
@@ -0,0 +1,74 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+
+/* Smaller buffers are not pooled, in bytes */
+#define POOL_MIN_SIZE (256 * 1024)
+/* Default cache of released buffers, in MB */
+#define POOL_CACHE 256
+/* Pooled buffers granularity, in bytes */
+#define POOL_PAGE (4 * 1024)
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+/* Buffer pool statistics, in bytes */
+typedef struct {
+    /* Borrowed now */
+    qint64 used;
+    /* Released, kept for reuse */
+    qint64 cached;
+    /* High-water marks */
+    qint64 peakUsed;
+    qint64 peakMapped;
+    /* Allocations served from cache, or newly mapped */
+    qint64 hits;
+    qint64 misses;
+} bufferPoolStats;
+
+/* Process-wide pool of large buffers
+ *
+ * Decoded shots, merge accumulators and tone mapped images are
+ * borrowed from the pool and returned to it, so consecutive
+ * compositions reuse the same mapped pages instead of going
+ * through the allocator each time.
+ * Sizes are rounded up to size classes (four per power of two,
+ * 25% waste at most), released buffers are kept per class up to
+ * a cache limit. Pages can be backed by transparent huge pages.
+ * Borrowed buffers count in the memory budget (see MemoryBudget).
+ * Thread safe
+ */
+class BufferPool
+{
+  public:
+    BufferPool();
+
+    void setCacheLimit(int mb);
+    void setHugePages(bool enable);
+    void *allocate(qint64 size);
+    void release(void *p);
+    void trim();
+    bufferPoolStats stats();
+    void report();
+
+  private:
+    QMutex mutex;
+    qint64 cacheLimit;
+    bool hugePages;
+    /* Class size of borrowed buffers */
+    QHash<void *, qint64> borrowed;
+    /* Released buffers per class size, most recent last */
+    QMap<qint64, QList<void *>> cache;
+    bufferPoolStats counters;
+
+    qint64 classSize(qint64 size);
+    void unmap(void *p, qint64 size);
+};
+
+BufferPool &bufferPool();
+QImage pooledImage(int width, int height, QImage::Format format);
+
+#endif // BUFFERPOOL_H
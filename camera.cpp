@@ -1,4 +1,6 @@
 #include "camera.h"
+#include "log.h"
+#include "trace.h"
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -6,6 +8,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 /*! \brief RemoteCamera constructor
  *
@@ -21,6 +24,12 @@ RemoteCamera::RemoteCamera(Config *config, QObject *parent) : QObject(parent)
     context = gp_context_new();
     /* libGphoto2 camera */
     gp_camera_new(&camera);
+    gp_file_new(&preview);
+    /* Helper is started on connection */
+    host = nullptr;
+
+    /* Model is unknown until connection */
+    stats = CameraStats::forModel("unknown");
 
     /* Camera connection polling */
     retry = new QTimer(this);
@@ -33,36 +42,115 @@ RemoteCamera::~RemoteCamera()
     if (cameraConfig.root != NULL)
         gp_widget_free(cameraConfig.root);
 
+    delete host;
+    gp_file_unref(preview);
     gp_camera_exit(camera, context);
     gp_camera_free(camera);
     gp_context_unref(context);
 
     delete retry;
+
+    for (QString line : stats.load()->report().split('\n'))
+        if (!line.isEmpty())
+            LOG_INFO("%s\n", line.toStdString().c_str());
 }
 
 /*! \brief Camera connection routine
  *
- * Connect camera and load camera capabilities
+ * Connect camera and load camera capabilities,
+ * tried again every 2s until it succeeds
  */
 void RemoteCamera::connectCamera()
 {
     retry->stop();
 
-    /* Init camera */
-    if (gp_camera_init(camera, context) != GP_OK) {
+    if (openCamera() != GP_OK) {
         /* Retry 2s later */
         retry->start(2000);
         return;
     }
 
-    /* Get config */
-    if (initCameraConfig() != GP_OK) {
-        /* Retry 2s later */
-        retry->start(2000);
-        return;
+    emit connected();
+}
+
+/*! \brief Connect camera and load camera capabilities
+ *
+ * Through the camera helper if enabled and installed
+ */
+int RemoteCamera::openCamera()
+{
+    CameraAbilities abilities;
+    int ret;
+
+    if (!host && conf && conf->getCameraHost()) {
+        if (CameraHost::isAvailable())
+            host = new CameraHost();
+        else {
+            LOG_ERROR("[Camera] %s not found, camera runs in process\n",
+                      CAMERA_HOST_EXECUTABLE);
+            conf->setCameraHost(false);
+        }
     }
 
-    emit connected();
+    if (host) {
+        hostCamera description;
+        mutex.lock();
+        ret = GP_PROFILED(stats, OP_INIT,
+                          host->open(cameraKeys(), description));
+        mutex.unlock();
+        if (ret != GP_OK)
+            return ret;
+        /* Account latencies to camera model from now on */
+        stats = CameraStats::forModel(description.model);
+        mutex.setStats(stats);
+        setHostCamera(description);
+    } else {
+        /* Init camera */
+        ret = GP_PROFILED(stats, OP_INIT, gp_camera_init(camera, context));
+        if (ret != GP_OK)
+            return ret;
+
+        /* Account latencies to camera model from now on */
+        if (gp_camera_get_abilities(camera, &abilities) == GP_OK) {
+            stats = CameraStats::forModel(QString(abilities.model));
+            mutex.setStats(stats);
+        }
+
+        /* Get config */
+        ret = initCameraConfig();
+        if (ret != GP_OK)
+            return ret;
+    }
+
+    /* Body identity, calibrated responses are kept per body */
+    QString id = stats.load()->getModel();
+    QString serial = getSerialNumber();
+    if (!serial.isEmpty())
+        id += " #" + serial;
+    conf->setCameraId(id);
+
+    return GP_OK;
+}
+
+/*! \brief Config keys of ISO, aperture and exposure
+ */
+QStringList RemoteCamera::cameraKeys()
+{
+    return QStringList() << conf->getISOKey() << conf->getApertureKey()
+                         << conf->getExposureKey();
+}
+
+/*! \brief Apply camera description sent by the helper
+ */
+void RemoteCamera::setHostCamera(const hostCamera &camera)
+{
+    cameraCapabilities.ISO = camera.ISO;
+    cameraCapabilities.aperture = camera.aperture;
+    cameraCapabilities.exposure = camera.exposure;
+    currentParams.ISO = camera.currentISO;
+    currentParams.aperture = camera.currentAperture;
+    currentParams.exposure = camera.currentExposure;
+    serialNumber = camera.serial;
 }
 
 /*! \brief Set current value to camera config
@@ -78,24 +166,36 @@ int RemoteCamera::setCurrentCameraParam(CameraWidget *config,
 
     /* We assume root config and intermediate nodes did not change since init */
 
-    if (!config || !value)
+    if ((!config && !host) || !value)
         return GP_ERROR;
 
+    TRACE_SCOPE("set_config", "camera");
+
     mutex.lock();
 
+    if (host) {
+        ret = GP_PROFILED(stats, OP_SET_SINGLE_CONFIG,
+                          host->set(configStr, value));
+        goto out;
+    }
+
     ret = gp_widget_set_value(config, value);
     if (ret < GP_OK) {
-        fprintf(stderr, "could not set widget %s with value %s (%d)\n",
-                configStr, value, ret);
+        LOG_ERROR("could not set widget %s with value %s (%d)\n", configStr,
+                  value, ret);
         goto out;
     }
 
-    ret = gp_camera_set_single_config(camera, configStr, config, context);
+    ret = GP_PROFILED(
+        stats, OP_SET_SINGLE_CONFIG,
+        gp_camera_set_single_config(camera, configStr, config, context));
     if (ret != GP_OK) {
         /* This stores it on the camera again */
-        ret = gp_camera_set_config(camera, cameraConfig.root, context);
+        ret = GP_PROFILED(
+            stats, OP_SET_CONFIG,
+            gp_camera_set_config(camera, cameraConfig.root, context));
         if (ret < GP_OK) {
-            fprintf(stderr, "camera_set_config failed: %d\n", ret);
+            LOG_ERROR("camera_set_config failed: %d\n", ret);
         }
     }
 
@@ -118,7 +218,7 @@ int RemoteCamera::getCurrentCameraParam(CameraWidget *config,
     /* Get current value from config */
     ret = gp_widget_get_value(config, &current);
     if (ret != GP_OK) {
-        fprintf(stderr, "Failed to retrieve current value\n");
+        LOG_ERROR("Failed to retrieve current value\n");
         return GP_ERROR;
     }
     currentParam = QString(current);
@@ -143,8 +243,7 @@ int RemoteCamera::getCameraConfig(CameraWidget **config, QString configStr_,
         ret =
             gp_widget_get_child_by_label(cameraConfig.root, configStr, config);
     if (ret < GP_OK) {
-        fprintf(stderr, "Config %s does not exist for this camera\n",
-                configStr);
+        LOG_ERROR("Config %s does not exist for this camera\n", configStr);
         goto out;
     }
 
@@ -153,7 +252,7 @@ int RemoteCamera::getCameraConfig(CameraWidget **config, QString configStr_,
     if (ret != GP_OK)
         goto out;
     if (type != GP_WIDGET_RADIO) {
-        fprintf(stderr, "Expected a list config for %s\n", configStr);
+        LOG_ERROR("Expected a list config for %s\n", configStr);
         ret = GP_ERROR;
         goto out;
     }
@@ -171,8 +270,7 @@ int RemoteCamera::getCameraConfig(CameraWidget **config, QString configStr_,
             const char *choice;
             ret = gp_widget_get_choice(*config, i, &choice);
             if (ret != GP_OK) {
-                fprintf(stderr,
-                        "Failed to retrieve all values from radio widget\n");
+                LOG_ERROR("Failed to retrieve all values from radio widget\n");
                 goto out;
             }
             capabilities.push_back(QString(choice));
@@ -188,9 +286,24 @@ int RemoteCamera::initCameraConfig()
 {
     int ret;
 
+    TRACE_SCOPE("init_config", "camera");
+
+    if (host) {
+        hostCamera description;
+        mutex.lock();
+        ret = GP_PROFILED(stats, OP_GET_CONFIG,
+                          host->configure(cameraKeys(), description));
+        mutex.unlock();
+        if (ret == GP_OK)
+            setHostCamera(description);
+        return ret;
+    }
+
     /* Get global config */
     mutex.lock();
-    ret = gp_camera_get_config(camera, &cameraConfig.root, context);
+    ret = GP_PROFILED(
+        stats, OP_GET_CONFIG,
+        gp_camera_get_config(camera, &cameraConfig.root, context));
     mutex.unlock();
     if (ret != GP_OK)
         return ret;
@@ -214,7 +327,7 @@ int RemoteCamera::initCameraConfig()
         if (ret != GP_OK)
             goto out;
     } else
-        fprintf(stdout, "Camera does not support automatic aperture\n");
+        LOG_INFO("Camera does not support automatic aperture\n");
 
     /* Get all possible shutter speeds */
     ret = getCameraConfig(&cameraConfig.exposure, conf->getExposureKey(),
@@ -244,76 +357,181 @@ static QString getFileExtension(char *fileName)
     return "." + fi.completeSuffix();
 }
 
-/*! \brief Take a photo and save it to filesystem
+/*! \brief Trigger a shot, file is left on camera
+ *
+ * Called with mutex held
  */
-int RemoteCamera::captureShot(QString &capturePath)
+int RemoteCamera::triggerShot(CameraFilePath &cam_fp)
 {
-    int fd, ret;
-    CameraFile *file;
-    CameraFilePath cam_fp;
-
-    mutex.lock();
+    TRACE_SCOPE("gp_camera_capture", "camera");
 
     /* Camera file path modified as camera entends it */
-    ret = gp_camera_capture(camera, GP_CAPTURE_IMAGE, &cam_fp, context);
-    if (ret != GP_OK)
-        return ret;
+    return GP_PROFILED(
+        stats, OP_CAPTURE,
+        gp_camera_capture(camera, GP_CAPTURE_IMAGE, &cam_fp, context));
+}
+
+/*! \brief Get a shot from camera to fd, then delete it on camera
+ *
+ * fd is closed afterwards. Called with mutex held
+ */
+int RemoteCamera::downloadShot(CameraFilePath &cam_fp, int fd)
+{
+    CameraFile *file;
+    int ret;
 
-    /* Create captured file */
-    capturePath = capturePath + getFileExtension(cam_fp.name);
-    fd = open(capturePath.toStdString().c_str(), O_CREAT | O_WRONLY, 0644);
     ret = gp_file_new_from_fd(&file, fd);
-    if (ret != GP_OK)
+    if (ret != GP_OK) {
+        if (fd >= 0)
+            close(fd);
         return ret;
+    }
 
     /* Get file from camera */
-    ret = gp_camera_file_get(camera, cam_fp.folder, cam_fp.name,
-                             GP_FILE_TYPE_NORMAL, file, context);
+    {
+        TRACE_SCOPE("gp_camera_file_get", "camera");
+        ret = GP_PROFILED(stats, OP_FILE_GET,
+                          gp_camera_file_get(camera, cam_fp.folder,
+                                             cam_fp.name, GP_FILE_TYPE_NORMAL,
+                                             file, context));
+    }
     if (ret != GP_OK)
         goto out;
 
     /* Delete file on camera */
-    ret = gp_camera_file_delete(camera, cam_fp.folder, cam_fp.name, context);
-
-    fprintf(stdout, "[Camera] Captured %s\n",
-            capturePath.toStdString().c_str());
+    {
+        TRACE_SCOPE("gp_camera_file_delete", "camera");
+        ret = GP_PROFILED(stats, OP_FILE_DELETE,
+                          gp_camera_file_delete(camera, cam_fp.folder,
+                                                cam_fp.name, context));
+    }
 
 out:
-    mutex.unlock();
     gp_file_free(file);
     return ret;
 }
 
+/*! \brief Take a photo and save it to filesystem
+ *
+ * File suffix is appended to capturePath
+ */
+int RemoteCamera::captureShot(QString &capturePath)
+{
+    CameraFilePath cam_fp;
+    int fd, ret;
+
+    TRACE_SCOPE("capture_shot", "camera");
+
+    mutex.lock();
+
+    if (host) {
+        ret = GP_PROFILED(stats, OP_CAPTURE, host->captureShot(capturePath));
+    } else {
+        ret = triggerShot(cam_fp);
+        if (ret == GP_OK) {
+            /* Create captured file */
+            capturePath = capturePath + getFileExtension(cam_fp.name);
+            fd = open(capturePath.toStdString().c_str(), O_CREAT | O_WRONLY,
+                      0644);
+            ret = downloadShot(cam_fp, fd);
+        }
+    }
+
+    mutex.unlock();
+
+    if (ret == GP_OK)
+        LOG_INFO("[Camera] Captured %s\n", capturePath.toStdString().c_str());
+
+    return ret;
+}
+
+/*! \brief Take a photo and write it to fd
+ *
+ * Used by the camera helper, fd is a shared memory slot.
+ * suffix is set to the file suffix, in ".<suffix>" format
+ */
+int RemoteCamera::captureShot(int fd, QString &suffix)
+{
+    CameraFilePath cam_fp;
+    int ret;
+
+    TRACE_SCOPE("capture_shot", "camera");
+
+    mutex.lock();
+    ret = triggerShot(cam_fp);
+    if (ret == GP_OK) {
+        suffix = getFileExtension(cam_fp.name);
+        ret = downloadShot(cam_fp, dup(fd));
+    }
+    mutex.unlock();
+
+    return ret;
+}
+
 /*! \brief Take a photo preview
  *
  * Photo preview is a smaller picture associated to
- * the camera live view.
- * Preview is saved to /tmp/liveview.jpg
- * It is then read by the liveViewWorker thread.
+ * the camera live view. frame points to the JPEG data,
+ * no copy is made : it stays valid until next call.
+ * It is then decoded by the liveViewWorker thread.
  */
-int RemoteCamera::captureLiveView()
+int RemoteCamera::captureLiveView(QByteArray &frame)
 {
-    CameraFile *file;
-    int fd;
+    const char *data;
+    unsigned long size;
     int ret;
 
-    /* Create file */
-    fd = open("/tmp/liveview.jpg", O_CREAT | O_WRONLY, 0644);
-    ret = gp_file_new_from_fd(&file, fd);
-    if (ret != GP_OK) {
-        fprintf(stderr, "gp_file_new_from_fd failed\n");
+    TRACE_SCOPE("capture_preview", "camera");
+
+    mutex.lock();
+    if (host) {
+        ret = GP_PROFILED(stats, OP_CAPTURE_PREVIEW,
+                          host->captureLiveView(frame));
+        mutex.unlock();
         return ret;
     }
 
-    mutex.lock();
-    ret = gp_camera_capture_preview(camera, file, context);
+    gp_file_clean(preview);
+    ret = GP_PROFILED(stats, OP_CAPTURE_PREVIEW,
+                      gp_camera_capture_preview(camera, preview, context));
     mutex.unlock();
     if (ret < 0) {
-        fprintf(stderr, "gp_camera_capture_preview failed\n");
-        gp_file_unref(file);
+        LOG_ERROR("gp_camera_capture_preview failed\n");
         return ret;
     }
 
+    ret = gp_file_get_data_and_size(preview, &data, &size);
+    if (ret < 0)
+        return ret;
+    frame = QByteArray::fromRawData(data, size);
+
+    return ret;
+}
+
+/*! \brief Take a photo preview and write it to fd
+ *
+ * Used by the camera helper, fd is a shared memory slot
+ */
+int RemoteCamera::captureLiveView(int fd)
+{
+    CameraFile *file;
+    int ret;
+
+    TRACE_SCOPE("capture_preview", "camera");
+
+    ret = gp_file_new_from_fd(&file, dup(fd));
+    if (ret != GP_OK) {
+        LOG_ERROR("gp_file_new_from_fd failed\n");
+        return ret;
+    }
+
+    mutex.lock();
+    ret = GP_PROFILED(stats, OP_CAPTURE_PREVIEW,
+                      gp_camera_capture_preview(camera, file, context));
+    mutex.unlock();
+    if (ret < 0)
+        LOG_ERROR("gp_camera_capture_preview failed\n");
+
     gp_file_unref(file);
     return ret;
 }
@@ -381,35 +599,47 @@ void RemoteCamera::distributeExposures(QString &first, QString &last,
 
 /*! \brief Set and applies an ISO value to camera
  */
-void RemoteCamera::setCurrentISO(QString &ISO)
+int RemoteCamera::setCurrentISO(QString &ISO)
 {
-    if (setCurrentCameraParam(cameraConfig.ISO, "iso",
-                              ISO.toStdString().c_str()) == GP_OK)
+    int ret = setCurrentCameraParam(cameraConfig.ISO, "iso",
+                                    ISO.toStdString().c_str());
+
+    if (ret == GP_OK)
         currentParams.ISO = ISO;
     else
-        fprintf(stderr, "Could not set ISO value\n");
+        LOG_ERROR("Could not set ISO value\n");
+
+    return ret;
 }
 
 /*! \brief Set and applies an aperture value to camera
  */
-void RemoteCamera::setCurrentAperture(QString &aperture)
+int RemoteCamera::setCurrentAperture(QString &aperture)
 {
-    if (setCurrentCameraParam(cameraConfig.aperture, "aperture",
-                              aperture.toStdString().c_str()) == GP_OK)
+    int ret = setCurrentCameraParam(cameraConfig.aperture, "aperture",
+                                    aperture.toStdString().c_str());
+
+    if (ret == GP_OK)
         currentParams.aperture = aperture;
     else
-        fprintf(stderr, "Could not set aperture value\n");
+        LOG_ERROR("Could not set aperture value\n");
+
+    return ret;
 }
 
 /*! \brief Set and applies an exposure value to camera
  */
-void RemoteCamera::setCurrentExposure(QString &exposure)
+int RemoteCamera::setCurrentExposure(QString &exposure)
 {
-    if (setCurrentCameraParam(cameraConfig.exposure, "exposure",
-                              exposure.toStdString().c_str()) == GP_OK)
+    int ret = setCurrentCameraParam(cameraConfig.exposure, "exposure",
+                                    exposure.toStdString().c_str());
+
+    if (ret == GP_OK)
         currentParams.exposure = exposure;
     else
-        fprintf(stderr, "Could not set exposure value\n");
+        LOG_ERROR("Could not set exposure value\n");
+
+    return ret;
 }
 
 /*! \brief Set max exposure attribute for increaseExposure() use
@@ -443,7 +673,9 @@ QStringList RemoteCamera::getCapabilitiesExposure()
  */
 QString RemoteCamera::getCurrentISO()
 {
-    getCurrentCameraParam(cameraConfig.ISO, currentParams.ISO);
+    /* Kept up to date by the helper otherwise */
+    if (!host)
+        getCurrentCameraParam(cameraConfig.ISO, currentParams.ISO);
 
     return currentParams.ISO;
 }
@@ -451,7 +683,8 @@ QString RemoteCamera::getCurrentISO()
  */
 QString RemoteCamera::getCurrentAperture()
 {
-    getCurrentCameraParam(cameraConfig.aperture, currentParams.aperture);
+    if (!host)
+        getCurrentCameraParam(cameraConfig.aperture, currentParams.aperture);
 
     return currentParams.aperture;
 }
@@ -459,7 +692,35 @@ QString RemoteCamera::getCurrentAperture()
  */
 QString RemoteCamera::getCurrentExposure()
 {
-    getCurrentCameraParam(cameraConfig.exposure, currentParams.exposure);
+    if (!host)
+        getCurrentCameraParam(cameraConfig.exposure, currentParams.exposure);
 
     return currentParams.exposure;
 }
+
+/*! \brief Get camera body serial number
+ *
+ * Empty if the camera does not tell it
+ */
+QString RemoteCamera::getSerialNumber()
+{
+    CameraWidget *widget = NULL;
+    QString serial;
+
+    if (host)
+        return serialNumber;
+
+    if (cameraConfig.root &&
+        gp_widget_get_child_by_name(cameraConfig.root, "serialnumber",
+                                    &widget) == GP_OK)
+        getCurrentCameraParam(widget, serial);
+
+    return serial;
+}
+
+/*! \brief Get latency statistics of current camera model
+ */
+CameraStats *RemoteCamera::getStats()
+{
+    return stats;
+}
@@ -1,8 +1,10 @@
 #ifndef CAMERA_H
 #define CAMERA_H
+#include "cameracontrol.h"
+#include "camerahost.h"
+#include "camerastats.h"
 #include "config.h"
 #include <QImage>
-#include <QMutex>
 #include <QObject>
 #include <QStringList>
 #include <QTimer>
@@ -10,7 +12,7 @@
 /* libgphoto2 */
 #include <gphoto2/gphoto2-camera.h>
 
-class RemoteCamera : public QObject
+class RemoteCamera : public QObject, public CameraControl
 {
     Q_OBJECT
 
@@ -18,28 +20,34 @@ class RemoteCamera : public QObject
     explicit RemoteCamera(Config *config = nullptr, QObject *parent = nullptr);
     ~RemoteCamera();
 
+    int openCamera();
     int initCameraConfig();
-    int captureShot(QString &capturePath);
-    int captureLiveView();
-    int increaseExposure(QString &next);
-    int decreaseExposure(QString &next);
+    int captureShot(QString &capturePath) override;
+    int captureShot(int fd, QString &suffix);
+    int captureLiveView(QByteArray &frame);
+    int captureLiveView(int fd);
+    int increaseExposure(QString &next) override;
+    int decreaseExposure(QString &next) override;
 
     void distributeExposures(QString &first, QString &last, int spacing,
-                             QList<QString> &list);
+                             QList<QString> &list) override;
 
     /* Getters */
     QStringList getCapabilitiesISO();
     QStringList getCapabilitiesAperture();
     QStringList getCapabilitiesExposure();
-    QString getCurrentISO();
-    QString getCurrentAperture();
-    QString getCurrentExposure();
+    QString getCurrentISO() override;
+    QString getCurrentAperture() override;
+    QString getCurrentExposure() override;
+    QString getSerialNumber();
     /* Setters */
-    void setCurrentISO(QString &ISO);
-    void setCurrentAperture(QString &aperture);
-    void setCurrentExposure(QString &exposure);
+    int setCurrentISO(QString &ISO) override;
+    int setCurrentAperture(QString &aperture) override;
+    int setCurrentExposure(QString &exposure) override;
     void setMaxExposure(QString exposure);
 
+    CameraStats *getStats();
+
   public slots:
     void connectCamera();
 
@@ -59,9 +67,16 @@ class RemoteCamera : public QObject
         CameraWidget *exposure = NULL;
     } cameraConfig;
     /* Context accessibility */
-    QMutex mutex;
+    ProfiledMutex mutex;
+    /* libgphoto2 calls and mutex latencies, model is known once opened
+     * while liveview may already be profiling */
+    std::atomic<CameraStats *> stats;
     /* Connection */
     QTimer *retry;
+    /* Camera helper process, nullptr when libgphoto2 runs here */
+    CameraHost *host;
+    /* Liveview frame, reused */
+    CameraFile *preview;
 
     /* Lists what the camera can do */
     struct {
@@ -76,12 +91,17 @@ class RemoteCamera : public QObject
         QString exposure;
     } currentParams;
     QString maxExposure;
+    QString serialNumber;
 
     int getCameraConfig(CameraWidget **config, QString configStr,
                         QStringList &capabilities);
     int getCurrentCameraParam(CameraWidget *config, QString &currentParam);
     int setCurrentCameraParam(CameraWidget *config, const char *configStr,
                               const char *value);
+    int triggerShot(CameraFilePath &cam_fp);
+    int downloadShot(CameraFilePath &cam_fp, int fd);
+    QStringList cameraKeys();
+    void setHostCamera(const hostCamera &camera);
 };
 
 #endif // CAMERA_H
@@ -0,0 +1,30 @@
+#ifndef CAMERACONTROL_H
+#define CAMERACONTROL_H
+
+#include <QList>
+#include <QString>
+
+/* Exposure parameters and capture of a body
+ *
+ * What sequence search and capture drive, RemoteCamera
+ * implements it. Return codes are libgphoto2 ones
+ */
+class CameraControl
+{
+  public:
+    virtual ~CameraControl() {}
+
+    virtual QString getCurrentISO() = 0;
+    virtual QString getCurrentAperture() = 0;
+    virtual QString getCurrentExposure() = 0;
+    virtual int setCurrentISO(QString &ISO) = 0;
+    virtual int setCurrentAperture(QString &aperture) = 0;
+    virtual int setCurrentExposure(QString &exposure) = 0;
+    virtual int increaseExposure(QString &next) = 0;
+    virtual int decreaseExposure(QString &next) = 0;
+    virtual void distributeExposures(QString &first, QString &last,
+                                     int spacing, QList<QString> &list) = 0;
+    virtual int captureShot(QString &capturePath) = 0;
+};
+
+#endif // CAMERACONTROL_H
@@ -0,0 +1,552 @@
+#include "camerahost.h"
+#include "camera.h"
+#include "config.h"
+#include "log.h"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*! \brief Path of the helper executable
+ */
+static QString executablePath()
+{
+    return QCoreApplication::applicationDirPath() + "/" +
+           CAMERA_HOST_EXECUTABLE;
+}
+
+/*! \brief Move fd out of the descriptors of the helper
+ *
+ * Duplicating to the helper descriptors would otherwise
+ * overwrite it before it is duplicated itself
+ */
+static int outOfHelperRange(int fd)
+{
+    if (fd < CAMERA_HOST_FD || fd > CAMERA_HOST_FD + CAMERA_HOST_SLOTS)
+        return fd;
+
+    int moved =
+        fcntl(fd, F_DUPFD_CLOEXEC, CAMERA_HOST_FD + CAMERA_HOST_SLOTS + 1);
+    close(fd);
+    return moved;
+}
+
+/*! \brief Write size bytes to a socket
+ */
+static bool sendAll(int socket, const void *data, qint64 size)
+{
+    const char *p = static_cast<const char *>(data);
+
+    while (size > 0) {
+        ssize_t n = send(socket, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/*! \brief Read size bytes from a socket
+ *
+ * Fails past timeout ms (-1 to wait forever) or on end of stream
+ */
+static bool receiveAll(int socket, void *data, qint64 size, int timeout)
+{
+    char *p = static_cast<char *>(data);
+    QElapsedTimer timer;
+
+    timer.start();
+    while (size > 0) {
+        struct pollfd pfd = {socket, POLLIN, 0};
+        int wait = timeout < 0 ? -1 : qMax(0, timeout - int(timer.elapsed()));
+        int ret = poll(&pfd, 1, wait);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+
+        ssize_t n = recv(socket, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/*! \brief Serialize camera description
+ */
+static QByteArray packCamera(const hostCamera &camera)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+
+    out << camera.model << camera.serial << camera.ISO << camera.aperture
+        << camera.exposure << camera.currentISO << camera.currentAperture
+        << camera.currentExposure;
+
+    return data;
+}
+
+/*! \brief Deserialize camera description
+ */
+static void unpackCamera(const QByteArray &data, hostCamera &camera)
+{
+    QDataStream in(data);
+
+    in >> camera.model >> camera.serial >> camera.ISO >> camera.aperture >>
+        camera.exposure >> camera.currentISO >> camera.currentAperture >>
+        camera.currentExposure;
+}
+
+/*! \brief CameraHost constructor
+ *
+ * Creates shared memory slots. The helper is started by the
+ * first request
+ */
+CameraHost::CameraHost()
+{
+    pid = -1;
+    socket = -1;
+    nextLiveView = 0;
+    nextFile = 0;
+    restarts = 0;
+
+    for (int i = 0; i < CAMERA_HOST_SLOTS; i++) {
+        slotFds[i] =
+            outOfHelperRange(memfd_create("autohdr-camera", MFD_CLOEXEC));
+        mappings[i].data = nullptr;
+        mappings[i].size = 0;
+    }
+}
+
+/*! \brief CameraHost destructor
+ *
+ * Lets the helper release the camera
+ */
+CameraHost::~CameraHost()
+{
+    stop(false);
+
+    for (int i = 0; i < CAMERA_HOST_SLOTS; i++) {
+        if (mappings[i].data)
+            munmap(mappings[i].data, mappings[i].size);
+        if (slotFds[i] >= 0)
+            close(slotFds[i]);
+    }
+
+    if (restarts)
+        LOG_INFO("[CameraHost] Helper restarted %d times\n", restarts);
+}
+
+/*! \brief Check the helper executable is installed
+ */
+bool CameraHost::isAvailable()
+{
+    return QFileInfo(executablePath()).isExecutable();
+}
+
+/*! \brief Start the helper
+ *
+ * Reconnects the camera if a previous helper had it
+ */
+bool CameraHost::start()
+{
+    QByteArray path = executablePath().toLocal8Bit();
+    QByteArray socketArg = QByteArray::number(CAMERA_HOST_FD);
+    QByteArray slotsArg;
+    posix_spawn_file_actions_t actions;
+    int fds[2];
+    int ret;
+
+    for (int i = 0; i < CAMERA_HOST_SLOTS; i++)
+        if (slotFds[i] < 0) {
+            LOG_ERROR("[CameraHost] Could not create shared memory\n");
+            return false;
+        }
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) {
+        LOG_ERROR("[CameraHost] Could not create socket\n");
+        return false;
+    }
+    fds[1] = outOfHelperRange(fds[1]);
+
+    /* Socket and slots are the only descriptors the helper inherits,
+     * at fixed numbers */
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], CAMERA_HOST_FD);
+    for (int i = 0; i < CAMERA_HOST_SLOTS; i++) {
+        posix_spawn_file_actions_adddup2(&actions, slotFds[i],
+                                         CAMERA_HOST_FD + 1 + i);
+        if (i)
+            slotsArg += ',';
+        slotsArg += QByteArray::number(CAMERA_HOST_FD + 1 + i);
+    }
+
+    char socketOption[] = "--socket";
+    char slotsOption[] = "--slots";
+    char *argv[] = {path.data(), socketOption,    socketArg.data(),
+                    slotsOption, slotsArg.data(), nullptr};
+    /* No fork : nothing of this process is copied */
+    ret = posix_spawn(&pid, path.constData(), &actions, nullptr, argv,
+                      environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (ret) {
+        LOG_ERROR("[CameraHost] Could not start %s\n", path.constData());
+        pid = -1;
+        close(fds[0]);
+        return false;
+    }
+    socket = fds[0];
+    LOG_INFO("[CameraHost] Helper %d started\n", int(pid));
+
+    if (!openKeys.isEmpty()) {
+        hostCamera camera;
+        if (open(openKeys, camera) != GP_OK) {
+            stop(false);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*! \brief Stop the helper
+ *
+ * Closing the socket makes it release the camera and exit.
+ * Killed if force is set or if it does not exit in time
+ */
+void CameraHost::stop(bool force)
+{
+    if (socket >= 0)
+        close(socket);
+    socket = -1;
+    if (pid <= 0)
+        return;
+
+    if (!force) {
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < CAMERA_HOST_EXIT_TIMEOUT) {
+            if (waitpid(pid, nullptr, WNOHANG) == pid) {
+                pid = -1;
+                return;
+            }
+            QThread::msleep(10);
+        }
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    pid = -1;
+}
+
+/*! \brief Send a command to the helper and wait for its answer
+ *
+ * A helper failing to answer within timeout ms is killed.
+ * If retry is set the command is sent once again to a new
+ * helper, otherwise the next request starts it.
+ * Returns the libgphoto2 status of the command
+ */
+int CameraHost::request(qint32 command, qint32 slot,
+                        const QByteArray &payload, QByteArray &answer,
+                        qint64 &slotSize, int timeout, bool retry)
+{
+    hostRequest req = {command, slot, qint32(payload.size())};
+    hostReply reply;
+
+    if (socket < 0 && !start())
+        return GP_ERROR;
+
+    if (sendAll(socket, &req, sizeof(req)) &&
+        sendAll(socket, payload.constData(), payload.size()) &&
+        receiveAll(socket, &reply, sizeof(reply), timeout)) {
+        answer.resize(reply.size);
+        if (receiveAll(socket, answer.data(), reply.size, timeout)) {
+            slotSize = reply.slotSize;
+            return reply.ret;
+        }
+    }
+
+    LOG_ERROR("[CameraHost] Helper lost, killed\n");
+    stop(true);
+    restarts++;
+    if (retry)
+        return request(command, slot, payload, answer, slotSize, timeout,
+                       false);
+
+    return GP_ERROR;
+}
+
+/*! \brief Map a slot for reading
+ *
+ * Mapping is kept between calls, grown when size exceeds it
+ */
+const char *CameraHost::mapSlot(int slot, qint64 size)
+{
+    if (size > mappings[slot].size) {
+        if (mappings[slot].data)
+            munmap(mappings[slot].data, mappings[slot].size);
+        qint64 length = (size + CAMERA_HOST_MAP_GRAIN - 1) &
+                        ~qint64(CAMERA_HOST_MAP_GRAIN - 1);
+        void *data =
+            mmap(nullptr, length, PROT_READ, MAP_SHARED, slotFds[slot], 0);
+        if (data == MAP_FAILED) {
+            LOG_ERROR("[CameraHost] Could not map slot %d\n", slot);
+            mappings[slot].data = nullptr;
+            mappings[slot].size = 0;
+            return nullptr;
+        }
+        mappings[slot].data = static_cast<char *>(data);
+        mappings[slot].size = length;
+    }
+
+    return mappings[slot].data;
+}
+
+/*! \brief Connect camera
+ *
+ * keys are ISO, aperture and exposure config keys.
+ * camera is set to its description
+ */
+int CameraHost::open(QStringList keys, hostCamera &camera)
+{
+    QByteArray payload, answer;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    qint64 size;
+    int ret;
+
+    out << keys;
+    ret = request(HOST_OPEN, -1, payload, answer, size, CAMERA_HOST_TIMEOUT,
+                  false);
+    if (ret == GP_OK) {
+        unpackCamera(answer, camera);
+        openKeys = keys;
+    }
+
+    return ret;
+}
+
+/*! \brief Read camera config again
+ *
+ * Same as open() on a connected camera
+ */
+int CameraHost::configure(QStringList keys, hostCamera &camera)
+{
+    QByteArray payload, answer;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    qint64 size;
+    int ret;
+
+    out << keys;
+    ret = request(HOST_CONFIG, -1, payload, answer, size,
+                  CAMERA_HOST_TIMEOUT, true);
+    if (ret == GP_OK) {
+        unpackCamera(answer, camera);
+        openKeys = keys;
+    }
+
+    return ret;
+}
+
+/*! \brief Set "iso", "aperture" or "exposure" on camera
+ */
+int CameraHost::set(QString name, QString value)
+{
+    QByteArray payload, answer;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    qint64 size;
+
+    out << name << value;
+
+    return request(HOST_SET, -1, payload, answer, size, CAMERA_HOST_TIMEOUT,
+                   true);
+}
+
+/*! \brief Take a photo and save it to filesystem
+ *
+ * Never tried twice : a second shot would not be the one asked.
+ * File suffix is appended to capturePath
+ */
+int CameraHost::captureShot(QString &capturePath)
+{
+    int slot = CAMERA_HOST_LIVEVIEW_SLOTS + nextFile;
+    QByteArray answer;
+    QString suffix;
+    qint64 size = 0;
+    int ret;
+
+    nextFile = (nextFile + 1) % CAMERA_HOST_FILE_SLOTS;
+    ret = request(HOST_CAPTURE, slot, QByteArray(), answer, size,
+                  CAMERA_HOST_CAPTURE_TIMEOUT, false);
+    if (ret != GP_OK)
+        return ret;
+
+    QDataStream in(answer);
+    in >> suffix;
+    capturePath = capturePath + suffix;
+
+    const char *data = mapSlot(slot, size);
+    QFile file(capturePath);
+    if (!data || !file.open(QIODevice::WriteOnly) ||
+        file.write(data, size) != size) {
+        LOG_ERROR("[CameraHost] Could not write %s\n",
+                  capturePath.toStdString().c_str());
+        ret = GP_ERROR_IO;
+    }
+
+    /* Shots are large : give slot memory back */
+    if (ftruncate(slotFds[slot], 0))
+        LOG_ERROR("[CameraHost] Could not release slot %d\n", slot);
+
+    return ret;
+}
+
+/*! \brief Take a photo preview
+ *
+ * frame points to the slot it was written to, no copy is made.
+ * It stays valid until next call
+ */
+int CameraHost::captureLiveView(QByteArray &frame)
+{
+    int slot = nextLiveView;
+    QByteArray answer;
+    qint64 size = 0;
+    int ret;
+
+    nextLiveView = (nextLiveView + 1) % CAMERA_HOST_LIVEVIEW_SLOTS;
+    ret = request(HOST_LIVEVIEW, slot, QByteArray(), answer, size,
+                  CAMERA_HOST_TIMEOUT, true);
+    if (ret < GP_OK)
+        return ret;
+
+    const char *data = mapSlot(slot, size);
+    if (!data)
+        return GP_ERROR;
+    frame = QByteArray::fromRawData(data, size);
+
+    return ret;
+}
+
+/*! \brief Describe the camera served by the helper
+ */
+static QByteArray describeCamera(RemoteCamera &camera)
+{
+    hostCamera d;
+
+    d.model = camera.getStats()->getModel();
+    d.serial = camera.getSerialNumber();
+    d.ISO = camera.getCapabilitiesISO();
+    d.aperture = camera.getCapabilitiesAperture();
+    d.exposure = camera.getCapabilitiesExposure();
+    d.currentISO = camera.getCurrentISO();
+    if (!d.aperture.isEmpty())
+        d.currentAperture = camera.getCurrentAperture();
+    d.currentExposure = camera.getCurrentExposure();
+
+    return packCamera(d);
+}
+
+/*! \brief Bytes written to a slot since it was rewound
+ */
+static qint64 writtenSize(int fd)
+{
+    off_t pos = fd < 0 ? -1 : lseek(fd, 0, SEEK_CUR);
+
+    return qMax(off_t(0), pos);
+}
+
+/*! \brief Helper side : serve camera requests
+ *
+ * Runs in autohdr-camerahost until the socket is closed.
+ * libgphoto2 writes frames and shots straight to the slots
+ */
+int runCameraHost(int socket, QList<int> slotFds)
+{
+    Config conf;
+    conf.setCameraHost(false);
+    RemoteCamera camera(&conf);
+    hostRequest req;
+
+    while (receiveAll(socket, &req, sizeof(req), -1)) {
+        QByteArray payload(qMax(0, req.size), 0);
+        if (!receiveAll(socket, payload.data(), payload.size(), -1))
+            break;
+
+        QDataStream in(payload);
+        QByteArray answer;
+        QDataStream out(&answer, QIODevice::WriteOnly);
+        hostReply reply = {GP_ERROR, 0, 0};
+        int fd = req.slot >= 0 && req.slot < slotFds.size()
+                     ? slotFds.at(req.slot)
+                     : -1;
+
+        switch (req.command) {
+        case HOST_OPEN:
+        case HOST_CONFIG: {
+            QStringList keys;
+            in >> keys;
+            if (keys.size() == 3)
+                conf.setCameraKeys(keys.at(0), keys.at(1), keys.at(2));
+            reply.ret = req.command == HOST_OPEN ? camera.openCamera()
+                                                 : camera.initCameraConfig();
+            if (reply.ret == GP_OK)
+                answer = describeCamera(camera);
+            break;
+        }
+        case HOST_SET: {
+            QString name, value;
+            in >> name >> value;
+            if (name == "iso")
+                reply.ret = camera.setCurrentISO(value);
+            else if (name == "aperture")
+                reply.ret = camera.setCurrentAperture(value);
+            else if (name == "exposure")
+                reply.ret = camera.setCurrentExposure(value);
+            break;
+        }
+        case HOST_CAPTURE: {
+            QString suffix;
+            if (fd >= 0 && !ftruncate(fd, 0) && lseek(fd, 0, SEEK_SET) == 0)
+                reply.ret = camera.captureShot(fd, suffix);
+            reply.slotSize = writtenSize(fd);
+            out << suffix;
+            break;
+        }
+        case HOST_LIVEVIEW:
+            if (fd >= 0 && lseek(fd, 0, SEEK_SET) == 0)
+                reply.ret = camera.captureLiveView(fd);
+            reply.slotSize = writtenSize(fd);
+            break;
+        default:
+            LOG_ERROR("[CameraHost] Unknown command %d\n", req.command);
+        }
+
+        reply.size = answer.size();
+        if (!sendAll(socket, &reply, sizeof(reply)) ||
+            !sendAll(socket, answer.constData(), answer.size()))
+            break;
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#ifndef CAMERAHOST_H
+#define CAMERAHOST_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <sys/types.h>
+
+/* Helper executable, next to the application one */
+#define CAMERA_HOST_EXECUTABLE "autohdr-camerahost"
+/* Shared memory slots : liveview frames, then captured files */
+#define CAMERA_HOST_LIVEVIEW_SLOTS 2
+#define CAMERA_HOST_FILE_SLOTS 1
+#define CAMERA_HOST_SLOTS (CAMERA_HOST_LIVEVIEW_SLOTS + CAMERA_HOST_FILE_SLOTS)
+/* Descriptor of the socket in the helper, slots follow */
+#define CAMERA_HOST_FD 100
+/* Slots are mapped by multiples of this size */
+#define CAMERA_HOST_MAP_GRAIN (1 << 20)
+/* Longest answer of the helper before it is deemed hung, in ms */
+#define CAMERA_HOST_TIMEOUT 15000
+/* Same for a capture : exposure and download */
+#define CAMERA_HOST_CAPTURE_TIMEOUT 90000
+/* Grace period of the helper to release the camera on stop, in ms */
+#define CAMERA_HOST_EXIT_TIMEOUT 2000
+
+enum CameraHostCommand {
+    HOST_OPEN = 0, /* Connect camera, answers its description */
+    HOST_CONFIG,   /* Read camera config again, answers its description */
+    HOST_SET,      /* Set "iso", "aperture" or "exposure" */
+    HOST_CAPTURE,  /* Shot into a slot, answers file suffix */
+    HOST_LIVEVIEW  /* Liveview frame into a slot */
+};
+
+/* Request to the helper, followed by size bytes of payload */
+typedef struct {
+    qint32 command;
+    qint32 slot;
+    qint32 size;
+} hostRequest;
+
+/* Answer of the helper, followed by size bytes of payload */
+typedef struct {
+    /* libgphoto2 status */
+    qint32 ret;
+    /* Bytes written to the slot */
+    qint64 slotSize;
+    qint32 size;
+} hostReply;
+
+/* Camera as seen by the helper */
+typedef struct {
+    QString model;
+    QString serial;
+    QStringList ISO;
+    QStringList aperture;
+    QStringList exposure;
+    QString currentISO;
+    QString currentAperture;
+    QString currentExposure;
+} hostCamera;
+
+/* Out-of-process camera
+ *
+ * libgphoto2 runs in a helper process (autohdr-camerahost) : a
+ * hang or a crash in a camera call takes down the helper only,
+ * running compositions and the GUI go on.
+ * Commands go through a Unix socket. Image bytes go through a
+ * ring of memfd slots shared with the helper : libgphoto2 writes
+ * liveview frames and shots to them, they are mapped here and
+ * read in place, nothing is copied or serialized on the way.
+ * A helper not answering in time is killed. The failed call
+ * returns an error, idempotent ones are tried once again, and
+ * the next call starts a new helper and reconnects the camera.
+ * Not thread safe : calls are serialized by RemoteCamera
+ */
+class CameraHost
+{
+  public:
+    CameraHost();
+    ~CameraHost();
+
+    static bool isAvailable();
+    int open(QStringList keys, hostCamera &camera);
+    int configure(QStringList keys, hostCamera &camera);
+    int set(QString name, QString value);
+    int captureShot(QString &capturePath);
+    int captureLiveView(QByteArray &frame);
+
+  private:
+    pid_t pid;
+    int socket;
+    int slotFds[CAMERA_HOST_SLOTS];
+    /* Slot mappings, grown on demand */
+    struct {
+        char *data;
+        qint64 size;
+    } mappings[CAMERA_HOST_SLOTS];
+    int nextLiveView;
+    int nextFile;
+    /* Camera keys, to reconnect a new helper */
+    QStringList openKeys;
+    int restarts;
+
+    bool start();
+    void stop(bool force);
+    int request(qint32 command, qint32 slot, const QByteArray &payload,
+                QByteArray &answer, qint64 &slotSize, int timeout,
+                bool retry);
+    const char *mapSlot(int slot, qint64 size);
+};
+
+int runCameraHost(int socket, QList<int> slotFds);
+
+#endif // CAMERAHOST_H
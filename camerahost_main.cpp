@@ -0,0 +1,33 @@
+#include "camerahost.h"
+#include "log.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName(CAMERA_HOST_EXECUTABLE);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "AutoHDR camera helper, started by AutoHDR and autohdr-daemon.");
+    parser.addHelpOption();
+    QCommandLineOption socketOption("socket", "Request socket descriptor.",
+                                    "fd");
+    QCommandLineOption slotsOption(
+        "slots", "Comma separated shared memory slot descriptors.", "fds");
+    parser.addOption(socketOption);
+    parser.addOption(slotsOption);
+    parser.process(a);
+
+    if (!parser.isSet(socketOption) || !parser.isSet(slotsOption)) {
+        LOG_ERROR("[CameraHost] Started without socket or slots\n");
+        return 1;
+    }
+
+    QList<int> slotFds;
+    for (QString fd : parser.value(slotsOption).split(','))
+        slotFds << fd.toInt();
+
+    return runCameraHost(parser.value(socketOption).toInt(), slotFds);
+}
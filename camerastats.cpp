@@ -0,0 +1,237 @@
+#include "camerastats.h"
+#include <QHash>
+#include <QList>
+#include <chrono>
+
+static const char *operationNames[OP_NB] = {
+    "gp_camera_init",
+    "gp_camera_get_config",
+    "gp_camera_set_single_config",
+    "gp_camera_set_config",
+    "gp_camera_capture",
+    "gp_camera_file_get",
+    "gp_camera_file_delete",
+    "gp_camera_capture_preview",
+    "mutex wait",
+    "mutex hold"};
+
+/*! \brief Get histogram bucket of a value
+ */
+static int bucketIndex(quint64 v)
+{
+    if (v < HISTOGRAM_SUB_BUCKETS)
+        return v;
+
+    int magnitude = 63 - __builtin_clzll(v); /* >= 5 */
+    int shift = magnitude - 5;
+    if (shift >= HISTOGRAM_MAGNITUDES)
+        return HISTOGRAM_BUCKETS - 1;
+
+    int sub = (v >> shift) - HISTOGRAM_SUB_BUCKETS;
+    return HISTOGRAM_SUB_BUCKETS * (shift + 1) + sub;
+}
+
+/*! \brief Get highest value of a histogram bucket
+ */
+static quint64 bucketValue(int index)
+{
+    if (index < HISTOGRAM_SUB_BUCKETS)
+        return index;
+
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    quint64 sub = index % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+/*! \brief Record a latency, in microseconds
+ */
+void LatencyHistogram::record(quint64 us)
+{
+    buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(us, std::memory_order_relaxed);
+
+    quint64 m = maximum.load(std::memory_order_relaxed);
+    while (us > m &&
+           !maximum.compare_exchange_weak(m, us, std::memory_order_relaxed))
+        ;
+}
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        buckets[i].store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    maximum.store(0, std::memory_order_relaxed);
+}
+
+quint64 LatencyHistogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+quint64 LatencyHistogram::max() const
+{
+    return maximum.load(std::memory_order_relaxed);
+}
+
+quint64 LatencyHistogram::mean() const
+{
+    quint64 n = count();
+    return n ? sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+/*! \brief Get value at given percentile (0 - 100)
+ *
+ * Result is the upper bound of the matching bucket,
+ * never more than recorded maximum
+ */
+quint64 LatencyHistogram::percentile(double p) const
+{
+    quint64 n = count();
+    if (!n)
+        return 0;
+
+    quint64 rank = quint64(p / 100.0 * n + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    quint64 seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return qMin(bucketValue(i), max());
+    }
+    return max();
+}
+
+/* Statistics are never freed, pointers stay valid until exit */
+static QMutex registryLock;
+static QHash<QString, CameraStats *> registry;
+
+CameraStats::CameraStats(QString model) : model(model)
+{
+}
+
+/*! \brief Get statistics of a camera model
+ *
+ * Created on first request
+ */
+CameraStats *CameraStats::forModel(QString model)
+{
+    QMutexLocker locker(&registryLock);
+
+    CameraStats *s = registry.value(model, nullptr);
+    if (!s) {
+        s = new CameraStats(model);
+        registry.insert(model, s);
+    }
+    return s;
+}
+
+/*! \brief Get monotonic timestamp in microseconds
+ */
+quint64 CameraStats::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+QString CameraStats::getModel()
+{
+    return model;
+}
+
+LatencyHistogram *CameraStats::histogram(CameraOperation op)
+{
+    return &histograms[op];
+}
+
+/*! \brief Format statistics of this camera model
+ *
+ * One line per operation : count, mean, p50, p99, max (ms)
+ */
+QString CameraStats::report()
+{
+    QString r = "[Camera] Latency statistics for " + model + "\n";
+    r += QString("\t%1 %2 %3 %4 %5 %6\n")
+             .arg(QString("operation"), -28)
+             .arg(QString("count"), 8)
+             .arg(QString("mean"), 9)
+             .arg(QString("p50"), 9)
+             .arg(QString("p99"), 9)
+             .arg(QString("max"), 9);
+
+    for (int i = 0; i < OP_NB; i++) {
+        LatencyHistogram &h = histograms[i];
+        if (!h.count())
+            continue;
+        r += QString("\t%1 %2 %3 %4 %5 %6\n")
+                 .arg(QString(operationNames[i]), -28)
+                 .arg(h.count(), 8)
+                 .arg(h.mean() / 1000.0, 9, 'f', 1)
+                 .arg(h.percentile(50) / 1000.0, 9, 'f', 1)
+                 .arg(h.percentile(99) / 1000.0, 9, 'f', 1)
+                 .arg(h.max() / 1000.0, 9, 'f', 1);
+    }
+    return r;
+}
+
+/*! \brief Format statistics of every camera model seen
+ */
+QString CameraStats::reportAll()
+{
+    QMutexLocker locker(&registryLock);
+    QString r;
+
+    QList<CameraStats *> all = registry.values();
+    for (int i = 0; i < all.size(); i++)
+        r += all.at(i)->report();
+    return r;
+}
+
+ProfiledMutex::ProfiledMutex()
+{
+    stats = nullptr;
+    lockedAt = 0;
+}
+
+/*! \brief Set statistics to record to
+ *
+ * Nothing is recorded until then
+ */
+void ProfiledMutex::setStats(CameraStats *s)
+{
+    stats.store(s);
+}
+
+void ProfiledMutex::lock()
+{
+    CameraStats *s = stats.load(std::memory_order_relaxed);
+    if (!s) {
+        mutex.lock();
+        lockedAt = 0;
+        return;
+    }
+
+    quint64 start = CameraStats::now();
+    mutex.lock();
+    lockedAt = CameraStats::now();
+    s->histogram(OP_MUTEX_WAIT)->record(lockedAt - start);
+}
+
+void ProfiledMutex::unlock()
+{
+    CameraStats *s = stats.load(std::memory_order_relaxed);
+
+    if (s && lockedAt)
+        s->histogram(OP_MUTEX_HOLD)->record(CameraStats::now() - lockedAt);
+    mutex.unlock();
+}
@@ -0,0 +1,110 @@
+#ifndef CAMERASTATS_H
+#define CAMERASTATS_H
+
+#include <QMutex>
+#include <QString>
+#include <atomic>
+
+/* Latency histogram, HDR-histogram style
+ *
+ * Values are microseconds. Exact below 32us, then 32 linear
+ * sub-buckets per power of two (about 3% precision)
+ * Recording is lock-free and can be done from any thread
+ */
+#define HISTOGRAM_SUB_BUCKETS 32
+#define HISTOGRAM_MAGNITUDES 36
+#define HISTOGRAM_BUCKETS                                                      \
+    (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAGNITUDES + 1))
+
+class LatencyHistogram
+{
+  public:
+    LatencyHistogram();
+
+    void record(quint64 us);
+    void reset();
+
+    quint64 count() const;
+    quint64 max() const;
+    quint64 mean() const;
+    quint64 percentile(double p) const;
+
+  private:
+    std::atomic<quint64> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<quint64> total;
+    std::atomic<quint64> sum;
+    std::atomic<quint64> maximum;
+};
+
+enum CameraOperation {
+    OP_INIT = 0,
+    OP_GET_CONFIG,
+    OP_SET_SINGLE_CONFIG,
+    OP_SET_CONFIG,
+    OP_CAPTURE,
+    OP_FILE_GET,
+    OP_FILE_DELETE,
+    OP_CAPTURE_PREVIEW,
+    OP_MUTEX_WAIT,
+    OP_MUTEX_HOLD,
+    OP_NB
+};
+
+/* Latency statistics of one camera model
+ *
+ * One instance per model, shared by every RemoteCamera
+ * driving such a body, alive until exit
+ */
+class CameraStats
+{
+  public:
+    static CameraStats *forModel(QString model);
+    static QString reportAll();
+
+    QString getModel();
+    LatencyHistogram *histogram(CameraOperation op);
+    QString report();
+
+    /*! \brief Time a libgphoto2 call
+     */
+    template <typename F> int measure(CameraOperation op, F call)
+    {
+        quint64 start = now();
+        int ret = call();
+        histograms[op].record(now() - start);
+        return ret;
+    }
+
+    static quint64 now();
+
+  private:
+    explicit CameraStats(QString model);
+
+    QString model;
+    LatencyHistogram histograms[OP_NB];
+};
+
+/* stats may be an atomic pointer */
+#define GP_PROFILED(stats, op, call)                                           \
+    (static_cast<CameraStats *>(stats)->measure(op, [&]() { return call; }))
+
+/* Camera access mutex recording wait and hold times
+ *
+ * Same interface as QMutex for what RemoteCamera uses
+ */
+class ProfiledMutex
+{
+  public:
+    ProfiledMutex();
+
+    void setStats(CameraStats *s);
+    void lock();
+    void unlock();
+
+  private:
+    QMutex mutex;
+    std::atomic<CameraStats *> stats;
+    quint64 lockedAt;
+};
+
+#endif // CAMERASTATS_H
@@ -1,12 +1,13 @@
 #include "captureworker.h"
 #include "config.h"
+#include "trace.h"
 
 /*! \brief CaptureWorker constructor
  *
  * Uses references to instances of Sequence, RemoteCamera
  * and Config created by AutoHDR_MainWindow
  */
-CaptureWorker::CaptureWorker(Config *config, RemoteCamera *camera,
+CaptureWorker::CaptureWorker(Config *config, CameraControl *camera,
                              Sequence *seq, QObject *parent)
     : QObject(parent)
 {
@@ -28,14 +29,21 @@ void CaptureWorker::captureSequence()
 
     int n = s->getShotsNb();
 
+    Trace::setThreadName("capture");
+    TRACE_SCOPE("sequence", "capture");
+
     for (int i = 0; i < n; i++) {
         if (!captureRun)
             break;
+        TRACE_SCOPE("shot", "capture");
         /* Set up camera */
         shotParameters sp = s->getShotParameters(i);
-        c->setCurrentISO(sp.ISO);
-        c->setCurrentAperture(sp.aperture);
-        c->setCurrentExposure(sp.exposure);
+        {
+            TRACE_SCOPE("setup", "capture");
+            c->setCurrentISO(sp.ISO);
+            c->setCurrentAperture(sp.aperture);
+            c->setCurrentExposure(sp.exposure);
+        }
         /* Capture */
         QString fp = conf->getCaptureFolder() + conf->getShotName(i);
         if (c->captureShot(fp) == GP_OK) {
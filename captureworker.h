@@ -12,7 +12,7 @@ class CaptureWorker : public QObject
     Q_OBJECT
   public:
     explicit CaptureWorker(Config *config = nullptr,
-                           RemoteCamera *camera = nullptr,
+                           CameraControl *camera = nullptr,
                            Sequence *seq = nullptr, QObject *parent = nullptr);
 
     void setCaptureRunState(bool state);
@@ -25,7 +25,7 @@ class CaptureWorker : public QObject
     void captureSequence();
 
   private:
-    RemoteCamera *c;
+    CameraControl *c;
     Sequence *s;
     Config *conf;
     bool captureRun;
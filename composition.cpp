@@ -1,11 +1,28 @@
 #include "composition.h"
-#include <QMessageBox>
+#include "log.h"
+#include "mergeworker.h"
+#include "trace.h"
+#include <signal.h>
+
+/*! \brief Get ISO a bracket is calibrated at
+ *
+ * Middle shot one, brackets usually keep ISO
+ */
+static QString responseISO(const QList<shotParameters> &shots)
+{
+    return shots.isEmpty() ? QString() : shots.at(shots.size() / 2).ISO;
+}
 
 Composition::Composition(Sequence *seq, Config *config, QObject *parent)
     : QObject(parent)
 {
     s = seq;
     conf = config;
+    traceStart = 0;
+    merging = 0;
+    draft = true;
+    incremental = true;
+    streaming = false;
     p = new QProcess(this);
 
     /* Link with process */
@@ -14,88 +31,337 @@ Composition::Composition(Sequence *seq, Config *config, QObject *parent)
     connect(p, SIGNAL(finished(int, QProcess::ExitStatus)), this,
             SLOT(handleFinished(int, QProcess::ExitStatus)));
 
-    /* Link with compose dialog */
-    connect(&composeDialog, &AutoHDR_Compose::abortCompose, this,
-            &Composition::abortComposition);
+    /* Merge thread */
+    mergeWorker = new MergeWorker(conf);
+    mergeWorker->moveToThread(&mergeThread);
+    connect(&mergeThread, &QThread::finished, mergeWorker,
+            &QObject::deleteLater);
+    connect(this, &Composition::startDraft, mergeWorker, &MergeWorker::draft);
+    connect(this, &Composition::startMerge, mergeWorker, &MergeWorker::merge);
+    connect(this, &Composition::startStream, mergeWorker,
+            &MergeWorker::beginStream);
+    connect(this, &Composition::streamShot, mergeWorker,
+            &MergeWorker::addShot);
+    connect(this, &Composition::finishStream, mergeWorker,
+            &MergeWorker::finishStream);
+    connect(this, &Composition::dropStream, mergeWorker,
+            &MergeWorker::cancelStream);
+    connect(this, &Composition::startToneMap, mergeWorker,
+            &MergeWorker::toneMap);
+    connect(mergeWorker, &MergeWorker::mergeDraft, this,
+            &Composition::compositionDraft);
+    connect(mergeWorker, &MergeWorker::mergeProgress, this,
+            &Composition::compositionProgress);
+    connect(mergeWorker, &MergeWorker::mergeFinished, this,
+            &Composition::handleMergeFinished);
+    connect(mergeWorker, &MergeWorker::mergeError, this,
+            &Composition::handleMergeError);
+    mergeThread.start();
 }
 
 /*! \brief Composition destructor
  *
  * Kills any ongoing composition process
+ * Stops merge thread
  */
 Composition::~Composition()
 {
     p->kill();
+    mergeWorker->setMergeRunState(false);
+    mergeThread.quit();
+    mergeThread.wait();
 
     delete p;
 }
 
-/*! \brief Start composition
- *
- * Create a luminance-hdr-cli command line process
- * and executes it
+/*! \brief Start composition of current sequence
  *
  * Saves HDR and LDR files accordingly to config
  */
 void Composition::startComposition()
 {
-    QString program = "luminance-hdr-cli";
-    QStringList arguments;
+    QList<shotParameters> shots;
     int n = s->getShotsNb();
 
-    arguments << "--save" << conf->getCompFolder() + "hdr_result.tif";
-    arguments << "--output" << conf->getCompFolder() + "ldr_result.tif";
     for (int i = 0; i < n; i++)
-        arguments << s->getShotParameters(i).path;
+        shots << s->getShotParameters(i);
+
+    startComposition(shots, conf->getCompFolder());
+}
+
+/*! \brief Start composition of given shots
+ *
+ * RAW shots are decoded as set in config, shots come from
+ * connected camera
+ */
+void Composition::startComposition(QList<shotParameters> shots,
+                                   QString folder)
+{
+    startComposition(shots, folder, conf->getRawMode(), conf->getCameraId());
+}
+
+/*! \brief Start composition of given shots
+ *
+ * Merges shots in process, or creates a luminance-hdr-cli
+ * command line process and executes it
+ * raw sets how an in-process merge decodes RAW shots
+ * (luminance-hdr-cli always demosaics them fully), camera is the
+ * body shots come from, for its calibrated response
+ *
+ * Saves HDR (and LDR with luminance-hdr-cli) files to given folder,
+ * HDR format is given by config
+ * In process, a draft is notified first if enabled (see setDraft())
+ * Shots list is a snapshot : sequence can go on with other shots
+ */
+void Composition::startComposition(QList<shotParameters> shots,
+                                   QString folder, RawDecodeMode raw,
+                                   QString camera)
+{
+    QStringList paths;
+    QStringList exposures;
+
+    for (int i = 0; i < shots.size(); i++) {
+        paths << shots.at(i).path;
+        exposures << shots.at(i).exposure;
+    }
+
+    if (conf->getCompEngine() == COMP_NATIVE) {
+        merging++;
+        if (streaming && paths == streamPaths) {
+            /* Shots were merged while captured */
+            streaming = false;
+            emit finishStream(paths, folder);
+        } else {
+            cancelIncremental();
+            mergeWorker->setMergeRunState(true);
+            if (draft && conf->getDraftWidth() > 0)
+                emit startDraft(paths, exposures, folder, camera,
+                                responseISO(shots));
+            emit startMerge(paths, exposures, folder, raw, camera,
+                            responseISO(shots));
+        }
+        emit compositionStarted();
+        return;
+    }
+    cancelIncremental();
 
+    QString program = "luminance-hdr-cli";
+    QStringList arguments;
+
+    arguments << "--save" << folder + conf->getHdrFileName();
+    arguments << "--output" << folder + "ldr_result.tif";
+    if (conf->getCompAlign())
+        arguments << "--align" << "MTB";
+    arguments << paths;
+
+    traceStart = Trace::isEnabled() ? Trace::now() : 0;
     p->start(program, arguments);
 
-    composeDialog.show();
+    emit compositionStarted();
+}
+
+/*! \brief Enable or disable incremental merge
+ *
+ * Disabled when compositions of captured sequences
+ * are queued (batch mode), config may disable it too
+ */
+void Composition::setIncremental(bool enable)
+{
+    incremental = enable;
+}
+
+/*! \brief Start merging a sequence being captured
+ *
+ * Native engine only, shots are then given by addShot()
+ * Previous incremental merge, if any, is dropped
+ */
+void Composition::beginIncremental()
+{
+    streaming = false;
+    streamPaths.clear();
+    if (!incremental || !conf->getCompIncremental() ||
+        conf->getCompEngine() != COMP_NATIVE || merging > 0)
+        return;
+
+    QList<shotParameters> shots;
+    for (int i = 0; i < s->getShotsNb(); i++)
+        shots << s->getShotParameters(i);
+
+    streaming = true;
+    mergeWorker->setMergeRunState(true);
+    emit startStream(conf->getCameraId(), responseISO(shots));
+}
+
+/*! \brief Merge a shot as soon as it is captured
+ */
+void Composition::addShot(shotParameters sp)
+{
+    if (!streaming)
+        return;
+
+    streamPaths << sp.path;
+    emit streamShot(sp.path, sp.exposure);
+}
+
+/*! \brief Drop incremental merge
+ *
+ * Capture failed, or shots are composed otherwise
+ */
+void Composition::cancelIncremental()
+{
+    if (!streaming)
+        return;
+
+    streaming = false;
+    streamPaths.clear();
+    mergeWorker->setMergeRunState(false);
+    /* Worker releases accumulated shots */
+    emit dropStream();
+}
+
+/*! \brief Tone map an already composed folder
+ *
+ * Merged radiance map is taken from cache, shots are not merged
+ * again : one LDR image is written per operator
+ * Ends as a composition does
+ */
+void Composition::startToneMapping(QString folder, QStringList operators)
+{
+    merging++;
+    mergeWorker->setMergeRunState(true);
+    emit startToneMap(folder, operators);
+    emit compositionStarted();
+}
+
+/*! \brief Set number of threads an in-process merge may use
+ *
+ * 0 for all cores. luminance-hdr-cli is not limited
+ */
+void Composition::setThreadBudget(int threads)
+{
+    mergeWorker->setThreadBudget(threads);
+}
+
+/*! \brief Enable or disable drafts
+ *
+ * Disabled when nobody looks at them (batch mode),
+ * config may disable them too
+ */
+void Composition::setDraft(bool enable)
+{
+    draft = enable;
+}
+
+/*! \brief Suspend ongoing composition
+ *
+ * While another sequence is computed and captured : in-process
+ * work waits at its next step, luminance-hdr-cli is stopped.
+ * Nothing is lost, resumeComposition() goes on from there
+ */
+void Composition::suspendComposition()
+{
+    mergeWorker->suspend();
+    if (p->state() == QProcess::Running)
+        kill(p->processId(), SIGSTOP);
+}
+
+/*! \brief Resume suspended composition
+ */
+void Composition::resumeComposition()
+{
+    mergeWorker->resume();
+    if (p->state() == QProcess::Running)
+        kill(p->processId(), SIGCONT);
+}
+
+/*! \brief Close composition trace span
+ */
+static void traceComposition(quint64 &traceStart)
+{
+    if (traceStart)
+        Trace::complete("luminance-hdr-cli", "composition", traceStart,
+                        Trace::now() - traceStart);
+    traceStart = 0;
 }
 
 /*! \brief Stop composition
  *
- * Abort luminance-hdr-cli process
+ * Abort luminance-hdr-cli process or in-process merge
  */
 void Composition::abortComposition()
 {
-    composeDialog.close();
+    resumeComposition();
     p->kill();
+    mergeWorker->setMergeRunState(false);
+}
+
+/*! \brief Check if a composition is ongoing
+ */
+bool Composition::isRunning()
+{
+    return merging > 0 || p->state() != QProcess::NotRunning;
 }
 
 /*! \brief Handle composition error
  *
- * Gets the luminance-hdr-cli return error value
- * and shows an adapted error message
+ * Only a failed start ends the composition here : a crash or an
+ * I/O error is followed by finished(), handleFinished() reports it
+ * once the process has exited
  */
 void Composition::handleError(QProcess::ProcessError error)
 {
-    composeDialog.close();
+    QString msg;
 
     switch (error) {
     case QProcess::FailedToStart:
-        QMessageBox::critical(&composeDialog, "Error",
-                              "Failed to start HDR composition");
+        traceComposition(traceStart);
+        msg = "Failed to start HDR composition";
+        LOG_ERROR("[Composition] %s\n", msg.toStdString().c_str());
+        emit compositionError(msg);
         break;
     case QProcess::Crashed:
-        QMessageBox::critical(&composeDialog, "Error",
-                              "HDR composition crashed");
         break;
     default:
-        QMessageBox::critical(&composeDialog, "Error", "HDR composition error");
+        LOG_ERROR("[Composition] HDR composition error %d\n", int(error));
         break;
     }
 }
 
-/*! \brief Handle composition success
+/*! \brief Handle composition end
+ *
+ * Process has exited : success or crash
  */
 void Composition::handleFinished(int code, QProcess::ExitStatus status)
 {
-    composeDialog.close();
+    QString msg = "HDR composition crashed";
+
+    traceComposition(traceStart);
 
     if (status == QProcess::NormalExit) {
-        QString statusStr =
-            "HDR composition ended with code " + QString::number(code);
-        QMessageBox::information(&composeDialog, "Information", statusStr);
+        LOG_INFO("[Composition] HDR composition ended with code %d\n", code);
+        emit compositionFinished(code);
+    } else {
+        LOG_ERROR("[Composition] %s\n", msg.toStdString().c_str());
+        emit compositionError(msg);
     }
 }
+
+/*! \brief Handle in-process merge success
+ */
+void Composition::handleMergeFinished(int code)
+{
+    merging--;
+
+    LOG_INFO("[Composition] HDR composition ended with code %d\n", code);
+    emit compositionFinished(code);
+}
+
+/*! \brief Handle in-process merge error
+ */
+void Composition::handleMergeError(QString msg)
+{
+    merging--;
+
+    LOG_ERROR("[Composition] %s\n", msg.toStdString().c_str());
+    emit compositionError(msg);
+}
@@ -1,11 +1,14 @@
 #ifndef COMPOSITION_H
 #define COMPOSITION_H
 
-#include "autohdr_compose.h"
 #include "config.h"
+#include "rawloader.h"
 #include "sequence.h"
 #include <QObject>
 #include <QProcess>
+#include <QThread>
+
+class MergeWorker;
 
 class Composition : public QObject
 {
@@ -16,17 +19,61 @@ class Composition : public QObject
                          QObject *parent = nullptr);
     ~Composition();
 
+    void startComposition(QList<shotParameters> shots, QString folder);
+    void startComposition(QList<shotParameters> shots, QString folder,
+                          RawDecodeMode raw, QString camera);
+    bool isRunning();
+    void setIncremental(bool enable);
+    void beginIncremental();
+    void addShot(shotParameters sp);
+    void cancelIncremental();
+    void startToneMapping(QString folder, QStringList operators);
+    void setThreadBudget(int threads);
+    void setDraft(bool enable);
+    void suspendComposition();
+    void resumeComposition();
+
+  signals:
+    void compositionStarted();
+    /* In-process merge only */
+    void compositionDraft(QImage draft);
+    void compositionProgress(int percent);
+    void compositionFinished(int code);
+    void compositionError(QString msg);
+    void startDraft(QStringList paths, QStringList exposures, QString folder,
+                    QString camera, QString ISO);
+    void startMerge(QStringList paths, QStringList exposures, QString folder,
+                    int rawMode, QString camera, QString ISO);
+    void startStream(QString camera, QString ISO);
+    void streamShot(QString path, QString exposure);
+    void finishStream(QStringList paths, QString folder);
+    void dropStream();
+    void startToneMap(QString folder, QStringList operators);
+
   public slots:
     void startComposition();
     void abortComposition();
     void handleError(QProcess::ProcessError error);
     void handleFinished(int code, QProcess::ExitStatus status);
+    void handleMergeFinished(int code);
+    void handleMergeError(QString msg);
 
   private:
-    AutoHDR_Compose composeDialog;
     QProcess *p;
     Config *conf;
     Sequence *s;
+    /* In-process merge */
+    QThread mergeThread;
+    MergeWorker *mergeWorker;
+    /* Merge and tone mapping requests not ended yet */
+    int merging;
+    bool draft;
+    /* Incremental merge of shots being captured */
+    bool incremental;
+    bool streaming;
+    QStringList streamPaths;
+    /* Trace span start, process is asynchronous */
+    quint64 traceStart;
 };
 
 #endif // COMPOSITION_H
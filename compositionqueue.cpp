@@ -0,0 +1,330 @@
+#include "compositionqueue.h"
+#include "log.h"
+#include "trace.h"
+#include <QDomDocument>
+#include <QFile>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThread>
+
+/*! \brief CompositionQueue constructor
+ *
+ * Number of concurrent jobs and budgets come from config,
+ * Composition instances are created when first needed
+ */
+CompositionQueue::CompositionQueue(Config *config, QObject *parent)
+    : QObject(parent)
+{
+    conf = config;
+    maxJobs = qMax(1, conf->getQueueJobs());
+    nextId = 1;
+}
+
+/*! \brief Set number of jobs run at the same time
+ */
+void CompositionQueue::setMaxJobs(int n)
+{
+    maxJobs = qMax(1, n);
+    schedule();
+}
+
+/*! \brief Load jobs saved by a previous instance
+ *
+ * Jobs that were running are started again from scratch
+ * Returns number of jobs queued
+ */
+int CompositionQueue::load()
+{
+    QDomDocument doc;
+    QFile file(conf->getQueueFile());
+    QList<compositionJob> jobs;
+
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    if (!doc.setContent(&file) ||
+        doc.documentElement().tagName() != "autohdr_queue") {
+        LOG_ERROR("[Queue] Could not read %s\n",
+                  conf->getQueueFile().toStdString().c_str());
+        return 0;
+    }
+    file.close();
+
+    QDomNode node = doc.documentElement().firstChild();
+    while (!node.isNull()) {
+        QDomElement e = node.toElement();
+        if (!e.isNull() && e.tagName() == "job") {
+            compositionJob job;
+            job.folder = e.attribute("folder");
+            if (!rawDecodeMode(e.attribute("raw"), job.raw))
+                job.raw = conf->getRawMode();
+            job.camera = e.attribute("camera");
+            QDomNode s_node = node.firstChild();
+            while (!s_node.isNull()) {
+                QDomElement s_e = s_node.toElement();
+                if (!s_e.isNull() && s_e.tagName() == "shot") {
+                    shotParameters sp = {
+                        .ISO = s_e.attribute("ISO"),
+                        .aperture = s_e.attribute("aperture"),
+                        .exposure = s_e.attribute("exposure"),
+                        .preview = QImage(),
+                        .path = s_e.attribute("path")};
+                    job.shots << sp;
+                }
+                s_node = s_node.nextSibling();
+            }
+            if (!job.shots.isEmpty())
+                jobs << job;
+        }
+        node = node.nextSibling();
+    }
+
+    for (int i = 0; i < jobs.size(); i++)
+        enqueue(jobs.at(i).shots, jobs.at(i).folder, jobs.at(i).raw,
+                jobs.at(i).camera);
+    if (!jobs.isEmpty())
+        LOG_INFO("[Queue] %d compositions resumed\n", jobs.size());
+
+    return jobs.size();
+}
+
+/*! \brief Queue composition of given shots in given folder
+ *
+ * RAW shots are decoded as set in config, shots come from
+ * connected camera. Returns job id
+ */
+int CompositionQueue::enqueue(QList<shotParameters> shots, QString folder)
+{
+    return enqueue(shots, folder, conf->getRawMode(), conf->getCameraId());
+}
+
+/*! \brief Queue composition of given shots in given folder
+ *
+ * Shots list is a snapshot, raw sets how RAW shots are decoded,
+ * camera is the body they come from
+ * Returns job id
+ */
+int CompositionQueue::enqueue(QList<shotParameters> shots, QString folder,
+                              RawDecodeMode raw, QString camera)
+{
+    compositionJob job;
+
+    job.id = nextId++;
+    job.shots = shots;
+    job.folder = folder;
+    job.raw = raw;
+    job.camera = camera;
+    job.memory = estimateMemory(shots);
+    pending.append(job);
+
+    LOG_INFO("[Queue] Job %d queued : %s (%d MB)\n", job.id,
+             folder.toStdString().c_str(), job.memory);
+    emit jobQueued(job.id);
+    schedule();
+
+    return job.id;
+}
+
+/*! \brief Get number of jobs waiting for a free worker
+ */
+int CompositionQueue::pendingCount()
+{
+    return pending.size();
+}
+
+/*! \brief Get number of running jobs
+ */
+int CompositionQueue::runningCount()
+{
+    int n = 0;
+
+    for (int i = 0; i < workers.size(); i++)
+        if (workers.at(i).busy)
+            n++;
+
+    return n;
+}
+
+/*! \brief Check if all jobs are done
+ */
+bool CompositionQueue::isIdle()
+{
+    return pending.isEmpty() && !runningCount();
+}
+
+/*! \brief Estimate peak memory of an in-process merge, in MB
+ *
+ * All shots decoded, merge sums and radiance map, from
+ * first shot size (header only is read)
+ */
+int CompositionQueue::estimateMemory(const QList<shotParameters> &shots)
+{
+    if (shots.isEmpty())
+        return 0;
+
+    QSize size = QImageReader(shots.first().path).size();
+    if (!size.isValid())
+        return 0;
+
+    qint64 pixels = qint64(size.width()) * size.height();
+    qint64 bytes = pixels * (4 * shots.size() + 6 * 4 + 3 * 4);
+
+    return int(bytes >> 20);
+}
+
+/*! \brief Create a Composition instance
+ *
+ * Returns its index
+ */
+int CompositionQueue::addWorker()
+{
+    int i = workers.size();
+    compositionWorker w;
+
+    w.comp = new Composition(nullptr, conf, this);
+    /* Shots are already captured, nobody waits for a draft */
+    w.comp->setIncremental(false);
+    w.comp->setDraft(false);
+    w.busy = false;
+    w.job.id = -1;
+    workers.append(w);
+
+    connect(w.comp, &Composition::compositionProgress, this,
+            [this, i](int percent) {
+                emit jobProgress(workers.at(i).job.id, percent);
+            });
+    connect(w.comp, &Composition::compositionFinished, this,
+            [this, i](int code) {
+                int id = jobDone(i);
+                emit jobFinished(id, code);
+                if (isIdle())
+                    emit drained();
+            });
+    connect(w.comp, &Composition::compositionError, this,
+            [this, i](QString msg) {
+                int id = jobDone(i);
+                emit jobFailed(id, msg);
+                if (isIdle())
+                    emit drained();
+            });
+
+    return i;
+}
+
+/*! \brief Start waiting jobs while budgets allow it
+ *
+ * Jobs start in order. A job always runs if nothing else does,
+ * whatever its memory estimate. Thread budget is split evenly
+ * between job slots
+ */
+void CompositionQueue::schedule()
+{
+    int running = runningCount();
+    int used = 0;
+    int budget = conf->getQueueMemory();
+    int threads = conf->getQueueThreads();
+
+    if (threads <= 0)
+        threads = conf->getMergeThreads();
+    if (threads <= 0)
+        threads = QThread::idealThreadCount();
+
+    for (int i = 0; i < workers.size(); i++)
+        if (workers.at(i).busy)
+            used += workers.at(i).job.memory;
+
+    while (!pending.isEmpty() && running < maxJobs) {
+        if (budget > 0 && running > 0 &&
+            used + pending.first().memory > budget)
+            break;
+
+        /* A worker whose process has not exited yet cannot start
+         * another one */
+        int w = 0;
+        while (w < workers.size() &&
+               (workers.at(w).busy || workers.at(w).comp->isRunning()))
+            w++;
+        if (w == workers.size())
+            w = addWorker();
+
+        compositionJob job = pending.takeFirst();
+        workers[w].busy = true;
+        workers[w].job = job;
+        used += job.memory;
+        running++;
+
+        LOG_INFO("[Queue] Job %d started : %s\n", job.id,
+                 job.folder.toStdString().c_str());
+        workers[w].comp->setThreadBudget(qMax(1, threads / maxJobs));
+        emit jobStarted(job.id);
+        workers[w].comp->startComposition(job.shots, job.folder, job.raw,
+                                          job.camera);
+    }
+
+    save();
+}
+
+/*! \brief Free a worker and start next jobs
+ *
+ * Returns id of the job that was running
+ */
+int CompositionQueue::jobDone(int worker)
+{
+    int id = workers.at(worker).job.id;
+
+    workers[worker].busy = false;
+    workers[worker].job = compositionJob();
+    workers[worker].job.id = -1;
+    schedule();
+
+    return id;
+}
+
+/*! \brief Save running and pending jobs
+ *
+ * File is replaced atomically
+ */
+bool CompositionQueue::save()
+{
+    TRACE_SCOPE("save_queue", "composition");
+
+    QSaveFile file(conf->getQueueFile());
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[Queue] Could not write %s\n",
+                  conf->getQueueFile().toStdString().c_str());
+        return false;
+    }
+
+    QDomDocument doc("XML");
+    QDomElement root = doc.createElement("autohdr_queue");
+    doc.appendChild(root);
+
+    QList<compositionJob> jobs;
+    for (int i = 0; i < workers.size(); i++)
+        if (workers.at(i).busy)
+            jobs << workers.at(i).job;
+    jobs << pending;
+
+    for (int i = 0; i < jobs.size(); i++) {
+        QDomElement job = doc.createElement("job");
+        job.setAttribute("folder", jobs.at(i).folder);
+        job.setAttribute("raw", jobs.at(i).raw == RAW_HALF ? "half" : "full");
+        job.setAttribute("camera", jobs.at(i).camera);
+        for (int j = 0; j < jobs.at(i).shots.size(); j++) {
+            const shotParameters &sp = jobs.at(i).shots.at(j);
+            QDomElement shot = doc.createElement("shot");
+            shot.setAttribute("ISO", sp.ISO);
+            shot.setAttribute("aperture", sp.aperture);
+            shot.setAttribute("exposure", sp.exposure);
+            shot.setAttribute("path", sp.path);
+            job.appendChild(shot);
+        }
+        root.appendChild(job);
+    }
+
+    QTextStream stream(&file);
+    stream << doc.toString();
+    stream.flush();
+
+    return file.commit();
+}
@@ -0,0 +1,76 @@
+#ifndef COMPOSITIONQUEUE_H
+#define COMPOSITIONQUEUE_H
+
+#include "composition.h"
+#include "config.h"
+#include "sequence.h"
+#include <QList>
+#include <QObject>
+
+/* Queued composition of a captured sequence */
+typedef struct {
+    int id;
+    QList<shotParameters> shots;
+    QString folder;
+    RawDecodeMode raw;
+    /* Camera body, for its calibrated response */
+    QString camera;
+    /* Estimated peak memory, in MB */
+    int memory;
+} compositionJob;
+
+/* Composition instance running a job */
+typedef struct {
+    Composition *comp;
+    bool busy;
+    compositionJob job;
+} compositionWorker;
+
+/* Composition job queue
+ *
+ * Jobs run in order, up to a number of them at the same time,
+ * each one on its own Composition instance. Running jobs share
+ * a thread budget, a job waits while memory budget is used up.
+ * Pending and running jobs are saved to a file after each change
+ * and can be loaded back after a restart
+ */
+class CompositionQueue : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit CompositionQueue(Config *config = nullptr,
+                              QObject *parent = nullptr);
+
+    void setMaxJobs(int n);
+    int load();
+    int enqueue(QList<shotParameters> shots, QString folder);
+    int enqueue(QList<shotParameters> shots, QString folder,
+                RawDecodeMode raw, QString camera);
+    int pendingCount();
+    int runningCount();
+    bool isIdle();
+
+  signals:
+    void jobQueued(int id);
+    void jobStarted(int id);
+    void jobProgress(int id, int percent);
+    void jobFinished(int id, int code);
+    void jobFailed(int id, QString msg);
+    void drained();
+
+  private:
+    Config *conf;
+    QList<compositionJob> pending;
+    QList<compositionWorker> workers;
+    int maxJobs;
+    int nextId;
+
+    int estimateMemory(const QList<shotParameters> &shots);
+    int addWorker();
+    void schedule();
+    int jobDone(int worker);
+    bool save();
+};
+
+#endif // COMPOSITIONQUEUE_H
@@ -1,55 +1,118 @@
 #include "config.h"
+#include "bufferpool.h"
+#include "fusion.h"
+#include "hdrmerge.h"
+#include "imagewriter.h"
+#include "log.h"
+#include "mergeworker.h"
+#include "response.h"
 #include "sequence.h"
+#include "trace.h"
 #include <QDir>
 #include <QDomDocument>
-#include <QMessageBox>
+#include <QFileInfo>
 #include <QTextStream>
 
 /*! \brief Config constructor
  *
  * Sets default general config
  */
-Config::Config(QWidget *parent) : QWidget(parent)
+Config::Config(QObject *parent) : QObject(parent)
 {
     /* Default libghoto2 config */
     gpConfig = {"iso", "aperture", "shutterspeed"};
+    /* A camera hang or crash only takes down the helper */
+    cameraHost = true;
     /* Shots capture at executable level by default */
     captureFolder = QDir::currentPath() + "/";
     compFolder = QDir::currentPath() + "/";
+    compEngine = COMP_NATIVE;
+    compFusion = true;
+    compIncremental = true;
+    compAlign = true;
+    deghost = DEGHOST_SIGMA;
+    rawMode = RAW_FULL;
+    /* Response calibrated once per camera body and ISO */
+    responseCalibration = true;
+    responseFile = QDir::currentPath() + "/" + RESPONSE_FILE;
+    /* Tile sides from tuning profile, built-in until measured */
+    fusionTile = 0;
+    draftWidth = DRAFT_WIDTH;
+    /* Fused LDR only, merged radiance kept for later tone mapping */
+    radianceCache = true;
+    /* Tiled half float OpenEXR */
+    hdrFormat = HDR_EXR;
+    exrHalf = true;
+    exrTile = 0;
     /* Default thresholds */
     whiteThreshold = 254;
     blackThreshold = 5;
     shotsGap = 6;
+    /* Always search from selected exposure by default */
+    warmStart = false;
+    sceneChange = 10;
+    defaultProfile(tuning);
+    profileFile = QDir::currentPath() + "/" + PROFILE_FILE;
+    tuner = nullptr;
+    /* No tracing by default */
+    traceEnabled = false;
+    traceFile = QDir::currentPath() + "/autohdr_trace.json";
+    /* Single sequence, back to back, two compositions waiting at most */
+    batch = {1, 0, QString(), 2};
+    /* One composition at a time, on all cores, no memory limit */
+    queue = {1, 0, 0, QDir::currentPath() + "/autohdr_queue.xml"};
+    /* Released buffers kept for next compositions, regular pages,
+     * no memory budget */
+    memory = {POOL_CACHE, false, 0, QDir::tempPath()};
+    /* Rotated log file, in current folder */
+    logging = {QDir::currentPath() + "/autohdr.log", LOG_FILE_SIZE, LOG_FILES};
+}
+
+/*! \brief Config destructor
+ *
+ * Waits for background autotuning, it reads thresholds
+ */
+Config::~Config()
+{
+    if (tuner) {
+        tuner->wait();
+        delete tuner;
+    }
 }
 
 /*! \brief Load general config
  *
  * Open and parse config file
  * Default path is a "autohdr_config.xml" file at executable level
+ * Returns false if config could not be read (defaults are kept)
  */
-void Config::load(QString configPath)
+bool Config::load(QString configPath)
 {
     QDomDocument config;
     QFile configFile(configPath);
 
     if (!configFile.open(QIODevice::ReadOnly)) {
         /* No config, use default */
-        fprintf(stdout, "[Config] No configuration file\n");
-        return;
+        LOG_INFO("[Config] No configuration file\n");
+        return false;
     }
     if (!config.setContent(&configFile)) {
         /* Corrupted config, use default */
-        QMessageBox::critical(this, "Error", "Could not read config file");
+        reportError("Could not read config file");
         configFile.close();
-        return;
+        return false;
     }
 
+    /* Calibrated responses are kept next to config */
+    responseFile = QFileInfo(configPath).absolutePath() + "/" + RESPONSE_FILE;
+    profileFile = QFileInfo(configPath).absolutePath() + "/" + PROFILE_FILE;
+
     QDomElement root = config.documentElement();
     if (root.tagName() != "autohdr_config") {
         /* Cannot find XML root node */
-        QMessageBox::critical(this, "Error", "Invalid config file root node");
+        reportError("Invalid config file root node");
         configFile.close();
-        return;
+        return false;
     }
 
     /* Find elements in config file */
@@ -61,6 +124,7 @@ void Config::load(QString configPath)
                 gpConfig.ISO = e.attribute("key_iso", "iso");
                 gpConfig.aperture = e.attribute("key_ap", "aperture");
                 gpConfig.exposure = e.attribute("key_exp", "shutterspeed");
+                cameraHost = e.attribute("host", "1").toInt();
             }
             if (e.tagName() == "analysis") {
                 QString wth = e.attribute("white_threshold", "254");
@@ -70,6 +134,8 @@ void Config::load(QString configPath)
                 QString ev_gap = e.attribute("ev_gap", "2");
                 QString ev_exp = e.attribute("ev_exp", "3");
                 shotsGap = ev_gap.toInt() * ev_exp.toInt();
+                warmStart = e.attribute("warm_start", "0").toInt();
+                sceneChange = e.attribute("scene_change", "10").toInt();
             }
             if (e.tagName() == "capture") {
                 captureFolder = e.attribute("folder", "default");
@@ -80,49 +146,184 @@ void Config::load(QString configPath)
                 compFolder = e.attribute("folder", "default");
                 if (compFolder == "default")
                     compFolder = QDir::currentPath() + "/";
+                /* luminance-hdr-cli is kept as a fallback */
+                if (e.attribute("engine", "native") == "luminance")
+                    compEngine = COMP_LUMINANCE;
+                else
+                    compEngine = COMP_NATIVE;
+                compFusion = e.attribute("fusion", "1").toInt();
+                compIncremental = e.attribute("incremental", "1").toInt();
+                compAlign = e.attribute("align", "1").toInt();
+                deghost = e.attribute("deghost", QString::number(DEGHOST_SIGMA))
+                              .toFloat();
+                if (!rawDecodeMode(e.attribute("raw", "full"), rawMode))
+                    rawMode = RAW_FULL;
+                responseCalibration = e.attribute("response", "1").toInt();
+                fusionTile = e.attribute("tile", "0").toInt();
+                draftWidth =
+                    e.attribute("draft", QString::number(DRAFT_WIDTH)).toInt();
+                toneMapOperators = e.attribute("tonemap", "").split(',');
+                toneMapOperators.removeAll("");
+                radianceCache = e.attribute("cache", "1").toInt();
+                if (e.attribute("hdr", "exr") == "rgbe")
+                    hdrFormat = HDR_RGBE;
+                else
+                    hdrFormat = HDR_EXR;
+                exrHalf = e.attribute("half", "1").toInt();
+                exrTile = e.attribute("exr_tile", "0").toInt();
+            }
+            if (e.tagName() == "trace") {
+                traceEnabled = e.attribute("enabled", "0").toInt();
+                traceFile = e.attribute("file", "default");
+                if (traceFile == "default")
+                    traceFile = QDir::currentPath() + "/autohdr_trace.json";
+            }
+            if (e.tagName() == "batch") {
+                batch.count = e.attribute("count", "1").toInt();
+                batch.interval = e.attribute("interval", "0").toInt();
+                batch.cron = e.attribute("cron", "");
+                batch.backlog = e.attribute("backlog", "2").toInt();
+            }
+            if (e.tagName() == "queue") {
+                queue.jobs = e.attribute("jobs", "1").toInt();
+                queue.threads = e.attribute("threads", "0").toInt();
+                queue.memory = e.attribute("memory", "0").toInt();
+                queue.file = e.attribute("file", "default");
+                if (queue.file == "default")
+                    queue.file = QDir::currentPath() + "/autohdr_queue.xml";
+            }
+            if (e.tagName() == "memory") {
+                memory.pool =
+                    e.attribute("pool", QString::number(POOL_CACHE)).toInt();
+                memory.hugePages = e.attribute("huge_pages", "0").toInt();
+                memory.budget = e.attribute("budget", "0").toInt();
+                memory.spill = e.attribute("spill", "default");
+                if (memory.spill == "default")
+                    memory.spill = QDir::tempPath();
+            }
+            if (e.tagName() == "log") {
+                logging.file = e.attribute("file", "default");
+                if (logging.file == "default")
+                    logging.file = QDir::currentPath() + "/autohdr.log";
+                logging.size =
+                    e.attribute("size", QString::number(LOG_FILE_SIZE)).toInt();
+                logging.files =
+                    e.attribute("files", QString::number(LOG_FILES)).toInt();
             }
         }
         node = node.nextSibling();
     }
 
-    fprintf(stdout, "[Config] Current AutoHDR configuration :\n");
-    fprintf(stdout, "\tAnalysis thresholds : white %d, black %d\n",
-            whiteThreshold, blackThreshold);
-    fprintf(stdout, "\tGap between shots : %d\n", shotsGap);
-    fprintf(stdout, "\tCapture folder : %s\n",
-            captureFolder.toStdString().c_str());
-    fprintf(stdout, "\tComposition folder : %s\n",
-            compFolder.toStdString().c_str());
+    LOG_INFO("[Config] Current AutoHDR configuration :\n");
+    LOG_INFO("\tAnalysis thresholds : white %d, black %d\n", whiteThreshold,
+             blackThreshold);
+    LOG_INFO("\tGap between shots : %d\n", shotsGap);
+    if (warmStart)
+        LOG_INFO("\tWarm start below %d%% scene change\n", sceneChange);
+    LOG_INFO("\tCapture folder : %s\n", captureFolder.toStdString().c_str());
+    LOG_INFO("\tComposition folder : %s\n", compFolder.toStdString().c_str());
+    LOG_INFO("\tComposition engine : %s\n",
+             compEngine == COMP_NATIVE ? "native" : "luminance-hdr-cli");
+    LOG_INFO("\tHDR result : %s\n", getHdrFileName().toStdString().c_str());
+    if (traceEnabled)
+        LOG_INFO("\tTrace file : %s\n", traceFile.toStdString().c_str());
+    if (!logging.file.isEmpty())
+        LOG_INFO("\tLog file : %s\n", logging.file.toStdString().c_str());
+
+    return true;
+}
+
+/*! \brief Load tuning profile of this machine
+ *
+ * Returns false if there is none, built-in parameters are kept
+ */
+bool Config::loadProfile()
+{
+    tuningProfile profile;
+
+    if (!::loadProfile(profileFile, profile))
+        return false;
+    tuning = profile;
+
+    return true;
+}
+
+/*! \brief Measure kernel parameters and save them
+ *
+ * Takes a few seconds, see runAutotune()
+ * Returns false if profile could not be measured or saved
+ */
+bool Config::autotune()
+{
+    tuningProfile profile;
+
+    if (!runAutotune(this, profile))
+        return false;
+    tuning = profile;
+
+    return saveProfile(profileFile, tuning);
+}
+
+/*! \brief Measure kernel parameters in a background thread
+ *
+ * Built-in parameters are used meanwhile. The profile is applied
+ * and saved in the thread of this object, then tuned() is emitted
+ */
+void Config::startAutotune()
+{
+    if (tuner) {
+        if (tuner->isRunning())
+            return;
+        delete tuner;
+    }
+
+    tuner = QThread::create([this]() {
+        tuningProfile profile;
+        if (!runAutotune(this, profile))
+            return;
+        QMetaObject::invokeMethod(
+            this,
+            [this, profile]() {
+                tuning = profile;
+                saveProfile(profileFile, tuning);
+                emit tuned();
+            },
+            Qt::QueuedConnection);
+    });
+    tuner->setObjectName("autotune");
+    tuner->start();
 }
 
 /*! \brief Load sequence file
  *
  * Open and parse file (no default path)
  * Set attributes to sequence (criterias, shots)
- * If all went well, start sequence capture automatically
+ * If all went well (returns true), caller can start sequence capture
  */
-void Config::loadSequence(QString sequencePath, Sequence *s)
+bool Config::loadSequence(QString sequencePath, Sequence *s)
 {
+    TRACE_SCOPE("load_sequence", "config");
+
     QDomDocument config;
     QFile configFile(sequencePath);
 
     if (!configFile.open(QIODevice::ReadOnly)) {
-        QMessageBox::critical(this, "Error", "Could not open sequence file");
-        return;
+        reportError("Could not open sequence file");
+        return false;
     }
     if (!config.setContent(&configFile)) {
         /* Corrupted file */
-        QMessageBox::critical(this, "Error", "Could not read sequence file");
+        reportError("Could not read sequence file");
         configFile.close();
-        return;
+        return false;
     }
 
     QDomElement root = config.documentElement();
     if (root.tagName() != "autohdr_sequence") {
         /* Cannot find XML root node */
-        QMessageBox::critical(this, "Error", "Invalid sequence file root node");
+        reportError("Invalid sequence file root node");
         configFile.close();
-        return;
+        return false;
     }
 
     /* Find elements in config file */
@@ -157,20 +358,25 @@ void Config::loadSequence(QString sequencePath, Sequence *s)
         }
         node = node.nextSibling();
     }
+
+    return true;
 }
 
 /*! \brief Save sequence file
  *
  * Save criterias and analysis (distributed shots) to a XML file
+ * Returns false if file could not be written
  */
-void Config::saveSequence(QString sequencePath, Sequence *s)
+bool Config::saveSequence(QString sequencePath, Sequence *s)
 {
+    TRACE_SCOPE("save_sequence", "config");
+
     /* Create file */
     QFile sequenceFile(sequencePath);
     if (!sequenceFile.open(QIODevice::WriteOnly)) {
         sequenceFile.close();
-        QMessageBox::critical(this, "Error", "Unable to write sequence file");
-        return;
+        reportError("Unable to write sequence file");
+        return false;
     }
 
     /* Create content */
@@ -202,6 +408,18 @@ void Config::saveSequence(QString sequencePath, Sequence *s)
     QTextStream stream(&sequenceFile);
     stream << fileContent;
     sequenceFile.close();
+
+    return true;
+}
+
+/*! \brief Report a configuration error
+ *
+ * Printed, and notified to whoever displays errors (UI)
+ */
+void Config::reportError(QString msg)
+{
+    LOG_ERROR("[Config] %s\n", msg.toStdString().c_str());
+    emit error(msg);
 }
 
 /*! \brief Get ISO camera dictionnary key
@@ -225,6 +443,15 @@ QString Config::getExposureKey()
     return gpConfig.exposure;
 }
 
+/*! \brief Get out-of-process camera state
+ *
+ * If true, libgphoto2 runs in autohdr-camerahost (see CameraHost)
+ */
+bool Config::getCameraHost()
+{
+    return cameraHost;
+}
+
 /*! \brief Get capture folder
  */
 QString Config::getCaptureFolder()
@@ -258,6 +485,23 @@ unsigned int Config::getShotsGap()
     return shotsGap;
 }
 
+/*! \brief Get warm start state
+ *
+ * If set, sequence computing starts from previous sequence
+ * boundaries when the scene did not change
+ */
+bool Config::getWarmStart()
+{
+    return warmStart;
+}
+
+/*! \brief Get scene change percentage above which warm start is not used
+ */
+int Config::getSceneChangeThreshold()
+{
+    return sceneChange;
+}
+
 /*! \brief Get composition folder
  */
 QString Config::getCompFolder()
@@ -265,6 +509,192 @@ QString Config::getCompFolder()
     return compFolder;
 }
 
+/*! \brief Get composition engine
+ *
+ * In-process merge, or luminance-hdr-cli process
+ */
+CompositionEngine Config::getCompEngine()
+{
+    return compEngine;
+}
+
+/*! \brief Get exposure fusion state
+ *
+ * If set, native engine also writes an LDR image
+ * fused from the shots
+ */
+bool Config::getCompFusion()
+{
+    return compFusion;
+}
+
+/*! \brief Get incremental merge state
+ *
+ * If set, native engine merges shots while they are captured
+ */
+bool Config::getCompIncremental()
+{
+    return compIncremental;
+}
+
+/*! \brief Get shots alignment state
+ *
+ * If set, shots are translated to match each other before
+ * merging (luminance-hdr-cli aligns them itself)
+ */
+bool Config::getCompAlign()
+{
+    return compAlign;
+}
+
+/*! \brief Get deghosting tolerance
+ *
+ * Difference allowed between a shot and the reference shot,
+ * in ln radiance units, before the shot is discarded
+ * 0 if deghosting is disabled
+ */
+float Config::getDeghost()
+{
+    return deghost;
+}
+
+/*! \brief Get RAW shots decoding for in-process merge
+ *
+ * Full demosaic, or half size
+ */
+RawDecodeMode Config::getRawMode()
+{
+    return rawMode;
+}
+
+/*! \brief Get camera response calibration state
+ *
+ * If set, response of 8 bit shots is calibrated on the first
+ * bracket of a camera body and ISO, and used by later merges
+ * Else the sRGB curve is used
+ */
+bool Config::getResponseCalibration()
+{
+    return responseCalibration;
+}
+
+/*! \brief Get calibrated camera responses file
+ *
+ * "autohdr_responses.xml", in config file folder
+ */
+QString Config::getResponseFile()
+{
+    return responseFile;
+}
+
+/*! \brief Get connected camera body
+ *
+ * Model and serial number, empty until a camera is connected
+ */
+QString Config::getCameraId()
+{
+    return cameraId;
+}
+
+/*! \brief Get exposure fusion tile side, in pixels
+ *
+ * Tuned one unless set in config
+ */
+int Config::getFusionTile()
+{
+    return fusionTile > 0 ? fusionTile : tuning.fusionTile;
+}
+
+/*! \brief Get threads of a merge not given a budget
+ *
+ * Tuned, 0 for all cores
+ */
+int Config::getMergeThreads()
+{
+    return tuning.threads;
+}
+
+/*! \brief Get liveview JPEG decode downscale
+ *
+ * Tuned : 1, 2 or 4
+ */
+int Config::getLiveViewScale()
+{
+    return tuning.decodeScale;
+}
+
+/*! \brief Get tuning profile file, next to config file
+ */
+QString Config::getProfileFile()
+{
+    return profileFile;
+}
+
+/*! \brief Get draft width, in pixels
+ *
+ * Native engine shows a low resolution draft before full
+ * resolution result, 0 if disabled
+ */
+int Config::getDraftWidth()
+{
+    return draftWidth;
+}
+
+/*! \brief Get tone mapping operators
+ *
+ * Native engine writes one LDR image per operator,
+ * from the merged radiance map
+ */
+QStringList Config::getToneMapOperators()
+{
+    return toneMapOperators;
+}
+
+/*! \brief Get radiance cache state
+ *
+ * If set, merged radiance map is saved next to HDR result, and
+ * the last one kept in memory while budget allows, so other
+ * tone mapped images can be made without merging
+ */
+bool Config::getRadianceCache()
+{
+    return radianceCache;
+}
+
+/*! \brief Get HDR result format
+ *
+ * OpenEXR or Radiance RGBE
+ */
+HdrFormat Config::getHdrFormat()
+{
+    return hdrFormat;
+}
+
+/*! \brief Get HDR result file name, in composition folder
+ */
+QString Config::getHdrFileName()
+{
+    return hdrFormat == HDR_EXR ? "hdr_result.exr" : "hdr_result.hdr";
+}
+
+/*! \brief Get OpenEXR precision
+ *
+ * If set, half float, else 32 bit float
+ */
+bool Config::getExrHalf()
+{
+    return exrHalf;
+}
+
+/*! \brief Get OpenEXR tile side, in pixels
+ *
+ * Tuned one unless set in config
+ */
+int Config::getExrTile()
+{
+    return exrTile > 0 ? exrTile : tuning.exrTile;
+}
+
 /*! \brief Get file naming for capture
  *
  * Default for now is "Image_<number>"
@@ -273,3 +703,201 @@ QString Config::getShotName(int shotNb)
 {
     return QString("Image_" + QString::number(shotNb));
 }
+
+/*! \brief Get pipeline tracing state
+ */
+bool Config::getTraceEnabled()
+{
+    return traceEnabled;
+}
+
+/*! \brief Get Chrome trace-event output file
+ */
+QString Config::getTraceFile()
+{
+    return traceFile;
+}
+
+/*! \brief Get number of sequences of a batch
+ *
+ * 0 means no limit (timelapse)
+ */
+int Config::getBatchCount()
+{
+    return batch.count;
+}
+
+/*! \brief Get delay between two batch sequences starts, in seconds
+ */
+int Config::getBatchInterval()
+{
+    return batch.interval;
+}
+
+/*! \brief Get batch cron-like schedule
+ *
+ * "minute hour day month weekday", empty if interval is used
+ */
+QString Config::getBatchCron()
+{
+    return batch.cron;
+}
+
+/*! \brief Get maximum number of compositions waiting in batch mode
+ */
+int Config::getBatchBacklog()
+{
+    return batch.backlog;
+}
+
+/*! \brief Get number of compositions run at the same time
+ */
+int Config::getQueueJobs()
+{
+    return queue.jobs;
+}
+
+/*! \brief Get number of threads shared by running compositions
+ *
+ * 0 for all cores
+ */
+int Config::getQueueThreads()
+{
+    return queue.threads;
+}
+
+/*! \brief Get memory shared by running compositions, in MB
+ *
+ * 0 for no limit
+ */
+int Config::getQueueMemory()
+{
+    return queue.memory;
+}
+
+/*! \brief Get file keeping pending compositions across restarts
+ */
+QString Config::getQueueFile()
+{
+    return queue.file;
+}
+
+/*! \brief Get buffers kept for reuse by the buffer pool, in MB
+ *
+ * 0 gives every buffer back to the system
+ */
+int Config::getPoolCache()
+{
+    return memory.pool;
+}
+
+/*! \brief Get huge pages use by the buffer pool
+ */
+bool Config::getPoolHugePages()
+{
+    return memory.hugePages;
+}
+
+/*! \brief Get memory budget of large buffers, in MB
+ *
+ * Producers wait and cold images spill to disk past it.
+ * 0 for no limit
+ */
+int Config::getMemoryBudget()
+{
+    return memory.budget;
+}
+
+/*! \brief Get folder of spilled images
+ */
+QString Config::getSpillFolder()
+{
+    return memory.spill;
+}
+
+/*! \brief Get log file
+ *
+ * Empty for console only
+ */
+QString Config::getLogFile()
+{
+    return logging.file;
+}
+
+/*! \brief Get log file size before rotation, in MB
+ *
+ * 0 for no rotation
+ */
+int Config::getLogSize()
+{
+    return logging.size;
+}
+
+/*! \brief Get number of rotated log files kept
+ */
+int Config::getLogFiles()
+{
+    return logging.files;
+}
+
+/*! \brief Set warm start state
+ */
+void Config::setWarmStart(bool enable)
+{
+    warmStart = enable;
+}
+
+/*! \brief Set tone mapping operators
+ */
+void Config::setToneMapOperators(QStringList operators)
+{
+    toneMapOperators = operators;
+}
+
+/*! \brief Set number of compositions run at the same time
+ */
+void Config::setQueueJobs(int jobs)
+{
+    queue.jobs = jobs;
+}
+
+/*! \brief Set RAW shots decoding
+ */
+void Config::setRawMode(RawDecodeMode mode)
+{
+    rawMode = mode;
+}
+
+/*! \brief Set connected camera body
+ */
+void Config::setCameraId(QString id)
+{
+    cameraId = id;
+}
+
+/*! \brief Set camera dictionnary keys
+ *
+ * Used by camera helper, keys come from main process config
+ */
+void Config::setCameraKeys(QString ISO, QString aperture, QString exposure)
+{
+    gpConfig.ISO = ISO;
+    gpConfig.aperture = aperture;
+    gpConfig.exposure = exposure;
+}
+
+/*! \brief Set out-of-process camera state
+ */
+void Config::setCameraHost(bool enable)
+{
+    cameraHost = enable;
+}
+
+/*! \brief Set capture folder
+ *
+ * Used by batch mode to capture each sequence in its own folder
+ */
+void Config::setCaptureFolder(QString folder)
+{
+    captureFolder = folder;
+}
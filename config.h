@@ -1,50 +1,174 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "autotune.h"
+#include "rawloader.h"
+#include <QObject>
+#include <QThread>
 #include <QString>
-#include <QWidget>
+#include <QStringList>
 
 class Sequence;
 
 #define CONFIG_FILENAME "autohdr_config.xml"
 
-class Config : public QWidget
+enum CompositionEngine { COMP_NATIVE, COMP_LUMINANCE };
+enum HdrFormat { HDR_EXR, HDR_RGBE };
+
+class Config : public QObject
 {
     Q_OBJECT
 
   public:
-    explicit Config(QWidget *parent = nullptr);
+    explicit Config(QObject *parent = nullptr);
+    ~Config();
 
-    void load(QString configPath = CONFIG_FILENAME);
-    void loadSequence(QString sequencePath, Sequence *s);
-    void saveSequence(QString sequencePath, Sequence *s);
+    bool load(QString configPath = CONFIG_FILENAME);
+    bool loadSequence(QString sequencePath, Sequence *s);
+    bool loadProfile();
+    bool autotune();
+    void startAutotune();
+    bool saveSequence(QString sequencePath, Sequence *s);
 
     /* Getters */
     QString getISOKey();
     QString getApertureKey();
     QString getExposureKey();
+    bool getCameraHost();
     QString getCaptureFolder();
     unsigned char getWhiteThreshold();
     unsigned char getBlackThreshold();
     unsigned int getShotsGap();
+    bool getWarmStart();
+    int getSceneChangeThreshold();
     QString getCompFolder();
+    CompositionEngine getCompEngine();
+    bool getCompFusion();
+    bool getCompIncremental();
+    bool getCompAlign();
+    float getDeghost();
+    RawDecodeMode getRawMode();
+    bool getResponseCalibration();
+    QString getResponseFile();
+    QString getCameraId();
+    int getFusionTile();
+    int getMergeThreads();
+    int getLiveViewScale();
+    QString getProfileFile();
+    int getDraftWidth();
+    QStringList getToneMapOperators();
+    bool getRadianceCache();
+    HdrFormat getHdrFormat();
+    QString getHdrFileName();
+    bool getExrHalf();
+    int getExrTile();
     QString getShotName(int shotNb);
+    bool getTraceEnabled();
+    QString getTraceFile();
+    int getBatchCount();
+    int getBatchInterval();
+    QString getBatchCron();
+    int getBatchBacklog();
+    int getQueueJobs();
+    int getQueueThreads();
+    int getQueueMemory();
+    QString getQueueFile();
+    int getPoolCache();
+    bool getPoolHugePages();
+    int getMemoryBudget();
+    QString getSpillFolder();
+    QString getLogFile();
+    int getLogSize();
+    int getLogFiles();
+
+    /* Setters */
+    void setCaptureFolder(QString folder);
+    void setWarmStart(bool enable);
+    void setToneMapOperators(QStringList operators);
+    void setQueueJobs(int jobs);
+    void setRawMode(RawDecodeMode mode);
+    void setCameraId(QString id);
+    void setCameraKeys(QString ISO, QString aperture, QString exposure);
+    void setCameraHost(bool enable);
+
+  signals:
+    void error(QString msg);
+    void tuned();
 
   private:
+    void reportError(QString msg);
+
     /* Camera */
     struct {
         QString ISO;
         QString aperture;
         QString exposure;
     } gpConfig;
+    /* Camera driven by a helper process */
+    bool cameraHost;
     /* Analysis */
     unsigned char whiteThreshold;
     unsigned char blackThreshold;
     unsigned int shotsGap;
+    bool warmStart;
+    int sceneChange;
     /* Capture */
     QString captureFolder;
     /* Composition */
     QString compFolder;
+    CompositionEngine compEngine;
+    bool compFusion;
+    bool compIncremental;
+    bool compAlign;
+    float deghost;
+    RawDecodeMode rawMode;
+    bool responseCalibration;
+    QString responseFile;
+    /* Connected camera body, model and serial number */
+    QString cameraId;
+    /* 0 for tuned tile sides */
+    int fusionTile;
+    int draftWidth;
+    QStringList toneMapOperators;
+    bool radianceCache;
+    HdrFormat hdrFormat;
+    bool exrHalf;
+    int exrTile;
+    /* Kernel parameters measured on this machine */
+    tuningProfile tuning;
+    QString profileFile;
+    /* Background autotuning, see startAutotune() */
+    QThread *tuner;
+    /* Tracing */
+    bool traceEnabled;
+    QString traceFile;
+    /* Batch mode */
+    struct {
+        int count;
+        int interval;
+        QString cron;
+        int backlog;
+    } batch;
+    /* Composition queue */
+    struct {
+        int jobs;
+        int threads;
+        int memory;
+        QString file;
+    } queue;
+    /* Memory */
+    struct {
+        int pool;
+        bool hugePages;
+        int budget;
+        QString spill;
+    } memory;
+    /* Log file */
+    struct {
+        QString file;
+        int size;
+        int files;
+    } logging;
 };
 
 #endif // CONFIG_H
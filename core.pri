@@ -0,0 +1,16 @@
+# Link against the AutoHDR core library (autohdr_core.pro)
+
+CORE_BUILD_DIR = $$shadowed($$PWD)
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+LIBS += -L$$CORE_BUILD_DIR -lautohdr-core
+PRE_TARGETDEPS += $$CORE_BUILD_DIR/libautohdr-core.a
+
+LIBS += -lgphoto2 -lgphoto2_port
+
+packagesExist(libraw_r) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libraw_r
+}
@@ -0,0 +1,395 @@
+#include "daemon.h"
+#include "bufferpool.h"
+#include "executor.h"
+#include "log.h"
+#include "memorybudget.h"
+#include "composition.h"
+#include "trace.h"
+#include <QCommandLineParser>
+#include <QTimer>
+
+/*! \brief Daemon constructor
+ *
+ * Creates instances of Config, RemoteCamera and Sequence
+ * and wires them as AutoHDR_MainWindow does, without UI
+ * Manages LiveView thread
+ */
+Daemon::Daemon(QObject *parent) : QObject(parent)
+{
+    conf = new Config();
+    c = new RemoteCamera(conf);
+    s = new Sequence(c, conf);
+
+    /* Camera connection */
+    connect(c, &RemoteCamera::connected, this, &Daemon::cameraConnected);
+
+    /* Sequence progress */
+    connect(s, &Sequence::sequenceComputed, this, &Daemon::sequenceComputed);
+    connect(s, &Sequence::sequenceError, this, &Daemon::sequenceError);
+    connect(s, &Sequence::captureProgress, this, &Daemon::captureProgress);
+    connect(s, &Sequence::captureFinished, this, &Daemon::captureFinished);
+    connect(s, &Sequence::captureFailed, this, &Daemon::captureFailed);
+
+    /* Composition progress */
+    connect(s->getComposition(), &Composition::compositionFinished, this,
+            &Daemon::compositionFinished);
+    connect(s->getComposition(), &Composition::compositionError, this,
+            &Daemon::compositionError);
+
+    /* Live View thread */
+    liveViewWorker = new LiveViewWorker();
+    liveViewWorker->setCamera(c);
+    liveViewWorker->moveToThread(&liveViewAcquisition);
+    connect(&liveViewAcquisition, &QThread::finished, liveViewWorker,
+            &QObject::deleteLater);
+    connect(this, &Daemon::startLiveView, liveViewWorker,
+            &LiveViewWorker::captureLiveView);
+    liveViewAcquisition.start();
+
+    /* State machine is sequenced by liveview acquisition */
+    connect(liveViewWorker, &LiveViewWorker::analysisReady, s,
+            &Sequence::runStateMachine);
+
+    batch = nullptr;
+    queue = nullptr;
+}
+
+/*! \brief Daemon destructor
+ *
+ * Stops LiveView thread
+ * Deletes instances of Config, RemoteCamera and Sequence
+ */
+Daemon::~Daemon()
+{
+    liveViewWorker->setLiveViewRunState(false);
+    liveViewAcquisition.quit();
+    liveViewAcquisition.wait();
+
+    delete batch;
+    delete queue;
+    delete s;
+    delete c;
+    delete conf;
+}
+
+/*! \brief Parse command line, load config, connect camera
+ *
+ * Returns false if daemon cannot run
+ */
+bool Daemon::init(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Headless AutoHDR : computes (or loads) a sequence, captures it "
+        "and composes it.");
+    parser.addHelpOption();
+
+    QCommandLineOption configOption(
+        "config", "Configuration file.", "file", CONFIG_FILENAME);
+    QCommandLineOption sequenceOption(
+        "sequence", "Capture a saved sequence instead of computing one.",
+        "file");
+    QCommandLineOption lowerOption(
+        "lower", "Overexposition criteria of the darkest shot (%).",
+        "percent", "5");
+    QCommandLineOption upperOption(
+        "upper", "Underexposition criteria of the brightest shot (%).",
+        "percent", "5");
+    QCommandLineOption maxShotsOption(
+        "max-shots", "Maximum number of shots in sequence.", "n", "7");
+    QCommandLineOption isoOption("iso", "ISO (default: camera setting).",
+                                 "value");
+    QCommandLineOption apertureOption(
+        "aperture", "Aperture (default: camera setting).", "value");
+    QCommandLineOption exposureOption(
+        "exposure", "Start exposure (default: camera setting).", "value");
+    QCommandLineOption maxExposureOption(
+        "max-exposure", "Exposure the search won't reach.", "value");
+    QCommandLineOption noComposeOption("no-compose",
+                                       "Capture only, skip composition.");
+    QCommandLineOption warmStartOption(
+        "warm-start", "Start search from previous sequence if scene is "
+                      "unchanged.");
+    QCommandLineOption batchOption(
+        "batch", "Run n sequences, each in its own folder (0: no limit).",
+        "n");
+    QCommandLineOption intervalOption(
+        "interval", "Batch : delay between sequences starts.", "seconds");
+    QCommandLineOption cronOption(
+        "cron", "Batch : schedule as \"minute hour day month weekday\".",
+        "expr");
+    QCommandLineOption backlogOption(
+        "backlog", "Batch : compositions waiting before capture stalls.",
+        "n");
+    QCommandLineOption toneMapOption(
+        "tonemap", "Tone mapping operators, among reinhard, drago, local.",
+        "list");
+    QCommandLineOption retoneOption(
+        "retone", "Only tone map an already composed folder, no capture.",
+        "folder");
+    QCommandLineOption jobsOption(
+        "jobs", "Compositions run at the same time.", "n");
+    QCommandLineOption rawOption(
+        "raw", "RAW shots decoding : full, or half (faster, half size).",
+        "mode");
+    QCommandLineOption resumeOption(
+        "resume", "Only run compositions left pending, no capture.");
+    QCommandLineOption autotuneOption(
+        "autotune", "Measure kernel parameters of this machine again.");
+
+    parser.addOption(configOption);
+    parser.addOption(sequenceOption);
+    parser.addOption(lowerOption);
+    parser.addOption(upperOption);
+    parser.addOption(maxShotsOption);
+    parser.addOption(isoOption);
+    parser.addOption(apertureOption);
+    parser.addOption(exposureOption);
+    parser.addOption(maxExposureOption);
+    parser.addOption(noComposeOption);
+    parser.addOption(warmStartOption);
+    parser.addOption(batchOption);
+    parser.addOption(intervalOption);
+    parser.addOption(cronOption);
+    parser.addOption(backlogOption);
+    parser.addOption(toneMapOption);
+    parser.addOption(retoneOption);
+    parser.addOption(jobsOption);
+    parser.addOption(rawOption);
+    parser.addOption(resumeOption);
+    parser.addOption(autotuneOption);
+    parser.process(app);
+
+    options.sequenceFile = parser.value(sequenceOption);
+    options.lower = parser.value(lowerOption).toInt();
+    options.upper = parser.value(upperOption).toInt();
+    options.maxShots = parser.value(maxShotsOption).toInt();
+    options.ISO = parser.value(isoOption);
+    options.aperture = parser.value(apertureOption);
+    options.exposure = parser.value(exposureOption);
+    options.maxExposure = parser.value(maxExposureOption);
+    options.compose = !parser.isSet(noComposeOption);
+
+    /* Default config file is optional, an explicit one is not */
+    if (!conf->load(parser.value(configOption)) && parser.isSet(configOption))
+        return false;
+    Trace::setEnabled(conf->getTraceEnabled());
+    Trace::setThreadName("daemon");
+    bufferPool().setCacheLimit(conf->getPoolCache());
+    bufferPool().setHugePages(conf->getPoolHugePages());
+    memoryBudget().setLimit(conf->getMemoryBudget());
+    memoryBudget().setSpillFolder(conf->getSpillFolder());
+    Log::setFile(conf->getLogFile(), conf->getLogSize(), conf->getLogFiles());
+    if (parser.isSet(autotuneOption) || !conf->loadProfile())
+        conf->autotune();
+    liveViewWorker->setDecodeScale(conf->getLiveViewScale());
+    if (parser.isSet(warmStartOption))
+        conf->setWarmStart(true);
+    if (parser.isSet(toneMapOption))
+        conf->setToneMapOperators(parser.value(toneMapOption).split(','));
+    if (parser.isSet(jobsOption))
+        conf->setQueueJobs(parser.value(jobsOption).toInt());
+    if (parser.isSet(rawOption)) {
+        RawDecodeMode mode;
+        if (!rawDecodeMode(parser.value(rawOption), mode)) {
+            LOG_ERROR("[Daemon] Unknown RAW decoding %s\n",
+                      parser.value(rawOption).toStdString().c_str());
+            return false;
+        }
+        conf->setRawMode(mode);
+    }
+
+    /* Shots are on disk, camera is not needed */
+    if (parser.isSet(resumeOption)) {
+        queue = new CompositionQueue(conf);
+        connect(queue, &CompositionQueue::drained, this, [this]() {
+            finish(0);
+        });
+        if (!queue->load())
+            QTimer::singleShot(0, this, [this]() { finish(0); });
+        return true;
+    }
+
+    /* Merged radiance map is cached, camera is not needed */
+    if (parser.isSet(retoneOption)) {
+        QString folder = parser.value(retoneOption);
+        if (!folder.endsWith('/'))
+            folder += "/";
+        QStringList operators = conf->getToneMapOperators();
+        if (operators.isEmpty())
+            operators << "reinhard";
+        QTimer::singleShot(0, this, [this, folder, operators]() {
+            s->getComposition()->startToneMapping(folder, operators);
+        });
+        return true;
+    }
+
+    /* Batch from command line or config */
+    bool batchMode = parser.isSet(batchOption) ||
+                     parser.isSet(intervalOption) ||
+                     parser.isSet(cronOption) || conf->getBatchCount() != 1 ||
+                     !conf->getBatchCron().isEmpty();
+    if (batchMode) {
+        batch = new BatchRunner(conf, s);
+        if (parser.isSet(batchOption))
+            batch->setCount(parser.value(batchOption).toInt());
+        if (parser.isSet(intervalOption))
+            batch->setInterval(parser.value(intervalOption).toInt());
+        if (parser.isSet(cronOption) &&
+            !batch->setCron(parser.value(cronOption)))
+            return false;
+        if (parser.isSet(backlogOption))
+            batch->setBacklog(parser.value(backlogOption).toInt());
+        batch->setCompose(options.compose);
+
+        connect(batch, &BatchRunner::runRequested, this, &Daemon::startRun);
+        connect(batch, &BatchRunner::finished, this, &Daemon::finish);
+        connect(s, &Sequence::captureFinished, batch,
+                &BatchRunner::captureFinished);
+        connect(s, &Sequence::captureFailed, batch, &BatchRunner::runFailed);
+        connect(s, &Sequence::sequenceError, batch, &BatchRunner::runFailed);
+    }
+
+    /* Connect once event loop runs */
+    LOG_INFO("[Daemon] Connecting camera...\n");
+    QTimer::singleShot(0, c, &RemoteCamera::connectCamera);
+
+    return true;
+}
+
+/*! \brief Camera connection signal reception
+ *
+ * Loads sequence if any, then starts single sequence or batch
+ */
+void Daemon::cameraConnected()
+{
+    LOG_INFO("[Daemon] Camera ready\n");
+
+    if (!options.sequenceFile.isEmpty()) {
+        if (!conf->loadSequence(options.sequenceFile, s)) {
+            finish(1);
+            return;
+        }
+        s->setStartParameters(c->getCurrentISO(), c->getCurrentAperture(),
+                              c->getCurrentExposure());
+    }
+
+    if (batch)
+        batch->start();
+    else
+        startRun();
+}
+
+/*! \brief Run one sequence
+ *
+ * Captures the loaded sequence, or computes a new one
+ */
+void Daemon::startRun()
+{
+    if (options.sequenceFile.isEmpty())
+        startComputing();
+    else
+        s->sequenceAccepted();
+}
+
+/*! \brief Start sequence analysis
+ *
+ * Same as AutoHDR_MainWindow::handleStart(), with parameters
+ * from command line or camera
+ */
+void Daemon::startComputing()
+{
+    QString ISO = options.ISO.isEmpty() ? c->getCurrentISO() : options.ISO;
+    QString ap =
+        options.aperture.isEmpty() ? c->getCurrentAperture() : options.aperture;
+    QString exp =
+        options.exposure.isEmpty() ? c->getCurrentExposure() : options.exposure;
+
+    /* Set search criterias for sequence computing */
+    s->setCriterias(options.lower, options.upper, options.maxShots);
+    /* Set current parameters for reset */
+    s->setStartParameters(ISO, ap, exp);
+    /* Set exposure beyond which sequence computing
+     * won't be able to go */
+    c->setMaxExposure(options.maxExposure);
+
+    LOG_INFO("[Daemon] Computing sequence from %s (ISO %s)\n",
+             exp.toStdString().c_str(), ISO.toStdString().c_str());
+
+    liveViewWorker->setLiveViewRunState(true);
+    emit startLiveView();
+    s->startComputing();
+}
+
+/*! \brief Sequence computed, start capture right away
+ */
+void Daemon::sequenceComputed()
+{
+    /* Liveview is not needed anymore, leave camera to capture */
+    liveViewWorker->setLiveViewRunState(false);
+
+    s->sequenceAccepted();
+}
+
+void Daemon::sequenceError(QString msg)
+{
+    Q_UNUSED(msg);
+    liveViewWorker->setLiveViewRunState(false);
+
+    /* Batch goes on with next sequence */
+    if (!batch)
+        finish(1);
+}
+
+void Daemon::captureProgress(int nbImg, int total)
+{
+    LOG_INFO("[Daemon] Took shot %d of %d\n", nbImg, total);
+}
+
+/*! \brief Capture finished, start composition if requested
+ */
+void Daemon::captureFinished(int total)
+{
+    LOG_INFO("[Daemon] %d images successfully captured\n", total);
+
+    /* Batch composes in background */
+    if (batch)
+        return;
+    if (!options.compose) {
+        finish(0);
+        return;
+    }
+    s->getComposition()->startComposition();
+}
+
+void Daemon::captureFailed()
+{
+    if (!batch)
+        finish(1);
+}
+
+void Daemon::compositionFinished(int code)
+{
+    finish(code ? 1 : 0);
+}
+
+void Daemon::compositionError(QString msg)
+{
+    Q_UNUSED(msg);
+    finish(1);
+}
+
+/*! \brief Stop event loop with given exit code
+ */
+void Daemon::finish(int code)
+{
+    liveViewWorker->setLiveViewRunState(false);
+
+    if (Trace::isEnabled())
+        Trace::dump(conf->getTraceFile());
+    bufferPool().report();
+    executor().report();
+    Log::flush();
+
+    QCoreApplication::exit(code);
+}
@@ -0,0 +1,74 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "batch.h"
+#include "camera.h"
+#include "config.h"
+#include "liveviewworker.h"
+#include "sequence.h"
+#include <QCoreApplication>
+#include <QObject>
+#include <QThread>
+
+/* Headless AutoHDR
+ *
+ * Drives the same core objects as AutoHDR_MainWindow,
+ * from command line and config instead of dialogs :
+ * compute (or load) a sequence, capture it, compose it, exit
+ * In batch mode, sequences are run on a schedule by a BatchRunner
+ * Compositions left pending by a previous run can be resumed alone
+ */
+class Daemon : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit Daemon(QObject *parent = nullptr);
+    ~Daemon();
+
+    bool init(QCoreApplication &app);
+
+  signals:
+    void startLiveView();
+
+  public slots:
+    void cameraConnected();
+    void sequenceComputed();
+    void sequenceError(QString msg);
+    void captureProgress(int nbImg, int total);
+    void captureFinished(int total);
+    void captureFailed();
+    void compositionFinished(int code);
+    void compositionError(QString msg);
+    void startRun();
+
+  private:
+    Config *conf;
+    RemoteCamera *c;
+    Sequence *s;
+    /* Liveview feeds sequence state machine */
+    QThread liveViewAcquisition;
+    LiveViewWorker *liveViewWorker;
+    /* Null if single sequence */
+    BatchRunner *batch;
+    /* Null unless resuming compositions */
+    CompositionQueue *queue;
+
+    /* Command line */
+    struct {
+        QString sequenceFile;
+        int lower;
+        int upper;
+        int maxShots;
+        QString ISO;
+        QString aperture;
+        QString exposure;
+        QString maxExposure;
+        bool compose;
+    } options;
+
+    void startComputing();
+    void finish(int code);
+};
+
+#endif // DAEMON_H
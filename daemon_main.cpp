@@ -0,0 +1,14 @@
+#include "daemon.h"
+#include <QCoreApplication>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("autohdr-daemon");
+
+    Daemon d;
+    if (!d.init(a))
+        return 1;
+
+    return a.exec();
+}
@@ -0,0 +1,210 @@
+#include "executor.h"
+#include "log.h"
+#include "trace.h"
+#include <QThread>
+#include <stdio.h>
+
+/* Worker index of the calling thread, -1 out of the executor */
+static thread_local int currentWorker = -1;
+
+static const char *priorityNames[TASK_PRIORITIES] = {"realtime",
+                                                     "background"};
+
+/*! \brief Get the process executor
+ *
+ * One worker per core. Never destroyed : tasks may be
+ * submitted by static objects at exit
+ */
+Executor &executor()
+{
+    static Executor *e = new Executor();
+    return *e;
+}
+
+/*! \brief Executor constructor
+ *
+ * threads workers, 0 for one per core
+ */
+Executor::Executor(int threads)
+{
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount());
+
+    stopping = false;
+    nextQueue = 0;
+    steals = 0;
+    for (int p = 0; p < TASK_PRIORITIES; p++) {
+        pending[p] = 0;
+        maxPending[p] = 0;
+        executed[p] = 0;
+    }
+
+    for (int i = 0; i < threads; i++)
+        queues.push_back(new workerQueue());
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(&Executor::run, this, i);
+}
+
+/*! \brief Executor destructor
+ *
+ * Queued tasks are run before workers stop
+ */
+Executor::~Executor()
+{
+    {
+        QMutexLocker locker(&idleLock);
+        stopping = true;
+        wake.wakeAll();
+    }
+    for (std::thread &t : workers)
+        t.join();
+    for (workerQueue *q : queues)
+        delete q;
+}
+
+/*! \brief Get number of workers
+ */
+int Executor::threadCount()
+{
+    return workers.size();
+}
+
+/*! \brief Check if calling thread is an executor worker
+ */
+bool Executor::isWorkerThread()
+{
+    return currentWorker >= 0;
+}
+
+/*! \brief Queue a task
+ *
+ * Returns at once, task runs on a worker
+ */
+void Executor::submit(std::function<void()> task, TaskPriority priority)
+{
+    int i = currentWorker;
+
+    if (i < 0)
+        i = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        QMutexLocker locker(&queues[i]->lock);
+        queues[i]->tasks[priority].push_back(std::move(task));
+    }
+
+    int depth = pending[priority].fetch_add(1) + 1;
+    int max = maxPending[priority].load(std::memory_order_relaxed);
+    while (depth > max && !maxPending[priority].compare_exchange_weak(
+                              max, depth, std::memory_order_relaxed))
+        ;
+    traceDepth(priority, depth);
+
+    QMutexLocker locker(&idleLock);
+    wake.wakeOne();
+}
+
+/*! \brief Take next task for a worker
+ *
+ * Realtime first : own newest task, then oldest task of another
+ * worker. Background then, same order.
+ * Returns false if every queue is empty
+ */
+bool Executor::take(int index, std::function<void()> &task)
+{
+    int n = queues.size();
+
+    for (int p = 0; p < TASK_PRIORITIES; p++) {
+        if (!pending[p].load())
+            continue;
+        for (int k = 0; k < n; k++) {
+            workerQueue *q = queues[(index + k) % n];
+            QMutexLocker locker(&q->lock);
+            std::deque<std::function<void()>> &tasks = q->tasks[p];
+            if (tasks.empty())
+                continue;
+            if (k == 0) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            } else {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                steals++;
+            }
+            locker.unlock();
+            traceDepth(p, pending[p].fetch_sub(1) - 1);
+            executed[p]++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*! \brief Worker loop
+ */
+void Executor::run(int index)
+{
+    std::function<void()> task;
+
+    currentWorker = index;
+    Trace::setThreadName("executor");
+
+    for (;;) {
+        if (take(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        QMutexLocker locker(&idleLock);
+        bool idle = true;
+        for (int p = 0; p < TASK_PRIORITIES; p++)
+            idle = idle && !pending[p].load();
+        if (idle && stopping)
+            return;
+        if (idle)
+            wake.wait(&idleLock);
+    }
+}
+
+/*! \brief Record queue depth in traces
+ */
+void Executor::traceDepth(int priority, int depth)
+{
+    if (!Trace::isEnabled())
+        return;
+
+    if (priority == TASK_REALTIME)
+        Trace::counter("realtime_queue", "executor", depth);
+    else
+        Trace::counter("background_queue", "executor", depth);
+}
+
+/*! \brief Get executor usage
+ */
+executorStats Executor::stats()
+{
+    executorStats s;
+
+    for (int p = 0; p < TASK_PRIORITIES; p++) {
+        s.depth[p] = pending[p].load();
+        s.maxDepth[p] = maxPending[p].load();
+        s.executed[p] = executed[p].load();
+    }
+    s.steals = steals.load();
+
+    return s;
+}
+
+/*! \brief Print queue depths and steal count
+ */
+void Executor::report()
+{
+    executorStats s = stats();
+
+    for (int p = 0; p < TASK_PRIORITIES; p++)
+        LOG_INFO("[Executor] %s : %llu tasks, queue depth %d max\n",
+                 priorityNames[p], (unsigned long long)s.executed[p],
+                 s.maxDepth[p]);
+    LOG_INFO("[Executor] %d workers, %llu steals\n", threadCount(),
+             (unsigned long long)s.steals);
+}
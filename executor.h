@@ -0,0 +1,76 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+enum TaskPriority {
+    TASK_REALTIME = 0, /* Liveview, analysis, sequence search */
+    TASK_BACKGROUND,   /* Merge, tone mapping, output files */
+    TASK_PRIORITIES
+};
+
+/* Executor statistics, since start */
+typedef struct {
+    /* Queued tasks now and at most, per priority */
+    int depth[TASK_PRIORITIES];
+    int maxDepth[TASK_PRIORITIES];
+    quint64 executed[TASK_PRIORITIES];
+    /* Tasks taken from another worker queue */
+    quint64 steals;
+} executorStats;
+
+/* Work-stealing task executor
+ *
+ * One worker per core, each with its own queues (one per
+ * priority). A task submitted from a worker goes to its queue,
+ * from any other thread to the next queue in turn. A worker runs
+ * its newest task first, then steals the oldest task of another
+ * worker ; every realtime task, queued anywhere, runs before any
+ * background one. Running tasks are never preempted.
+ * Shared by every parallel stage (see parallelFor()), so
+ * concurrent stages do not oversubscribe the cores
+ */
+class Executor
+{
+  public:
+    explicit Executor(int threads = 0);
+    ~Executor();
+
+    int threadCount();
+    bool isWorkerThread();
+    void submit(std::function<void()> task, TaskPriority priority);
+    executorStats stats();
+    void report();
+
+  private:
+    typedef struct {
+        QMutex lock;
+        std::deque<std::function<void()>> tasks[TASK_PRIORITIES];
+    } workerQueue;
+
+    std::vector<workerQueue *> queues;
+    std::vector<std::thread> workers;
+    /* Idle workers sleep here */
+    QMutex idleLock;
+    QWaitCondition wake;
+    bool stopping;
+    std::atomic<unsigned> nextQueue;
+    std::atomic<int> pending[TASK_PRIORITIES];
+    std::atomic<int> maxPending[TASK_PRIORITIES];
+    std::atomic<quint64> executed[TASK_PRIORITIES];
+    std::atomic<quint64> steals;
+
+    void run(int index);
+    bool take(int index, std::function<void()> &task);
+    void traceDepth(int priority, int depth);
+};
+
+Executor &executor();
+
+#endif // EXECUTOR_H
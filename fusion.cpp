@@ -0,0 +1,525 @@
+#include "fusion.h"
+#include "imagewriter.h"
+#include "log.h"
+#include "memorybudget.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QImage>
+#include <QImageReader>
+#include <QRect>
+#include <QVector>
+#include <math.h>
+
+/* Pyramid depth, tile margin covers most of its support */
+#define FUSION_LEVELS 6
+#define FUSION_MARGIN (2 << FUSION_LEVELS)
+
+/* Single channel float plane */
+typedef struct {
+    int w;
+    int h;
+    QVector<float> d;
+} plane;
+
+static void resizePlane(plane &p, int w, int h)
+{
+    p.w = w;
+    p.h = h;
+    p.d.resize(w * h);
+}
+
+static inline int clampIndex(int i, int n)
+{
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+/*! \brief Blur and decimate a plane (one pyramid level down)
+ *
+ * Separable 5 taps binomial kernel, edges are clamped
+ */
+static void reduce(const plane &in, plane &out)
+{
+    static const float k[5] = {1 / 16.f, 4 / 16.f, 6 / 16.f, 4 / 16.f,
+                               1 / 16.f};
+    plane tmp;
+
+    resizePlane(tmp, (in.w + 1) / 2, in.h);
+    for (int y = 0; y < in.h; y++) {
+        const float *src = in.d.constData() + y * in.w;
+        float *dst = tmp.d.data() + y * tmp.w;
+        for (int x = 0; x < tmp.w; x++) {
+            float s = 0;
+            for (int i = -2; i <= 2; i++)
+                s += k[i + 2] * src[clampIndex(2 * x + i, in.w)];
+            dst[x] = s;
+        }
+    }
+
+    resizePlane(out, tmp.w, (in.h + 1) / 2);
+    for (int y = 0; y < out.h; y++) {
+        float *dst = out.d.data() + y * out.w;
+        for (int x = 0; x < out.w; x++)
+            dst[x] = 0;
+        for (int i = -2; i <= 2; i++) {
+            const float *src =
+                tmp.d.constData() + clampIndex(2 * y + i, in.h) * tmp.w;
+            for (int x = 0; x < out.w; x++)
+                dst[x] += k[i + 2] * src[x];
+        }
+    }
+}
+
+/*! \brief Upsample a plane to w x h (one pyramid level up)
+ *
+ * Same kernel as reduce(), even and odd phases computed apart
+ */
+static void expand(const plane &in, int w, int h, plane &out)
+{
+    plane tmp;
+
+    resizePlane(tmp, w, in.h);
+    for (int y = 0; y < in.h; y++) {
+        const float *src = in.d.constData() + y * in.w;
+        float *dst = tmp.d.data() + y * w;
+        for (int x = 0; x < w; x++) {
+            int m = x / 2;
+            if (x & 1)
+                dst[x] = (src[m] + src[clampIndex(m + 1, in.w)]) * 0.5f;
+            else
+                dst[x] = (src[clampIndex(m - 1, in.w)] + 6 * src[m] +
+                          src[clampIndex(m + 1, in.w)]) *
+                         0.125f;
+        }
+    }
+
+    resizePlane(out, w, h);
+    for (int y = 0; y < h; y++) {
+        int m = y / 2;
+        const float *r0 = tmp.d.constData() + clampIndex(m - 1, in.h) * w;
+        const float *r1 = tmp.d.constData() + m * w;
+        const float *r2 = tmp.d.constData() + clampIndex(m + 1, in.h) * w;
+        float *dst = out.d.data() + y * w;
+        if (y & 1)
+            for (int x = 0; x < w; x++)
+                dst[x] = (r1[x] + r2[x]) * 0.5f;
+        else
+            for (int x = 0; x < w; x++)
+                dst[x] = (r0[x] + 6 * r1[x] + r2[x]) * 0.125f;
+    }
+}
+
+/*! \brief Mertens quality measures of a shot over a region
+ *
+ * Contrast (laplacian of gray), saturation (deviation
+ * of components) and well-exposedness (closeness to mid gray)
+ */
+static void computeWeight(const QImage &band, int bandY, QRect region,
+                          plane &weight)
+{
+    int w = region.width();
+    int h = region.height();
+    plane gray;
+
+    resizePlane(gray, w, h);
+    resizePlane(weight, w, h);
+    for (int y = 0; y < h; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(
+                               band.constScanLine(region.y() + y - bandY)) +
+                           region.x();
+        float *pg = gray.d.data() + y * w;
+        float *pw = weight.d.data() + y * w;
+        for (int x = 0; x < w; x++) {
+            float r = qRed(line[x]) / 255.f;
+            float g = qGreen(line[x]) / 255.f;
+            float b = qBlue(line[x]) / 255.f;
+            float mean = (r + g + b) / 3;
+            float sat = sqrtf(((r - mean) * (r - mean) +
+                               (g - mean) * (g - mean) +
+                               (b - mean) * (b - mean)) /
+                              3);
+            float well = expf(-((r - 0.5f) * (r - 0.5f) +
+                                (g - 0.5f) * (g - 0.5f) +
+                                (b - 0.5f) * (b - 0.5f)) /
+                              (2 * 0.2f * 0.2f));
+            pg[x] = mean;
+            pw[x] = sat * well;
+        }
+    }
+
+    for (int y = 0; y < h; y++) {
+        const float *up = gray.d.constData() + clampIndex(y - 1, h) * w;
+        const float *mid = gray.d.constData() + y * w;
+        const float *down = gray.d.constData() + clampIndex(y + 1, h) * w;
+        float *pw = weight.d.data() + y * w;
+        for (int x = 0; x < w; x++) {
+            float lap = up[x] + down[x] + mid[clampIndex(x - 1, w)] +
+                        mid[clampIndex(x + 1, w)] - 4 * mid[x];
+            pw[x] = pw[x] * fabsf(lap) + 1e-12f;
+        }
+    }
+}
+
+/*! \brief Extract one color channel of a shot over a region
+ */
+static void extractChannel(const QImage &band, int bandY, QRect region,
+                           int channel, plane &p)
+{
+    int w = region.width();
+    int shift = 16 - 8 * channel;
+
+    resizePlane(p, w, region.height());
+    for (int y = 0; y < p.h; y++) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(
+                               band.constScanLine(region.y() + y - bandY)) +
+                           region.x();
+        float *dst = p.d.data() + y * w;
+        for (int x = 0; x < w; x++)
+            dst[x] = ((line[x] >> shift) & 0xFF) / 255.f;
+    }
+}
+
+/*! \brief Fuse one tile
+ *
+ * Shots are read over region (tile and its margin), pyramids
+ * are blended, only the tile itself is written to output band
+ */
+static void fuseTile(const QList<QImage> &bands, int bandY, QRect region,
+                     QRect tile, uchar *out, int outStride)
+{
+    int n = bands.size();
+    int levels = 0;
+    QVector<plane> weights(n);
+    /* Blended laplacian pyramid, per channel */
+    QVector<plane> result[3];
+
+    TRACE_SCOPE("fusion_tile", "composition");
+
+    for (int w = region.width(), h = region.height();
+         levels < FUSION_LEVELS && qMin(w, h) > 8; levels++) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    /* Normalized weights */
+    for (int k = 0; k < n; k++)
+        computeWeight(bands.at(k), bandY, region, weights[k]);
+    for (int i = 0; i < weights[0].d.size(); i++) {
+        float sum = 0;
+        for (int k = 0; k < n; k++)
+            sum += weights[k].d[i];
+        for (int k = 0; k < n; k++)
+            weights[k].d[i] /= sum;
+    }
+
+    for (int k = 0; k < n; k++) {
+        /* Gaussian pyramid of weights */
+        QVector<plane> gw(levels + 1);
+        gw[0] = weights[k];
+        weights[k].d = QVector<float>();
+        for (int l = 0; l < levels; l++)
+            reduce(gw[l], gw[l + 1]);
+
+        for (int c = 0; c < 3; c++) {
+            QVector<plane> gi(levels + 1);
+            plane up;
+            extractChannel(bands.at(k), bandY, region, c, gi[0]);
+            for (int l = 0; l < levels; l++)
+                reduce(gi[l], gi[l + 1]);
+
+            if (!k) {
+                result[c].resize(levels + 1);
+                for (int l = 0; l <= levels; l++) {
+                    resizePlane(result[c][l], gi[l].w, gi[l].h);
+                    result[c][l].d.fill(0);
+                }
+            }
+            /* Laplacian level l = G(l) - expand(G(l + 1)) */
+            for (int l = 0; l <= levels; l++) {
+                float *pr = result[c][l].d.data();
+                const float *pi = gi[l].d.constData();
+                const float *pw = gw[l].d.constData();
+                int size = gi[l].d.size();
+                if (l < levels) {
+                    expand(gi[l + 1], gi[l].w, gi[l].h, up);
+                    const float *pu = up.d.constData();
+                    for (int i = 0; i < size; i++)
+                        pr[i] += pw[i] * (pi[i] - pu[i]);
+                } else
+                    for (int i = 0; i < size; i++)
+                        pr[i] += pw[i] * pi[i];
+            }
+        }
+    }
+
+    /* Collapse pyramids and write tile */
+    for (int c = 0; c < 3; c++) {
+        plane cur = result[c][levels];
+        plane up;
+        for (int l = levels - 1; l >= 0; l--) {
+            expand(cur, result[c][l].w, result[c][l].h, up);
+            const float *pr = result[c][l].d.constData();
+            float *pu = up.d.data();
+            for (int i = 0; i < up.d.size(); i++)
+                pu[i] += pr[i];
+            cur = up;
+        }
+
+        for (int y = tile.top(); y <= tile.bottom(); y++) {
+            const float *src = cur.d.constData() +
+                               (y - region.y()) * cur.w +
+                               (tile.x() - region.x());
+            uchar *dst = out + (y - tile.y()) * outStride + tile.x() * 3 + c;
+            for (int x = 0; x < tile.width(); x++) {
+                float v = src[x] * 255 + 0.5f;
+                dst[3 * x] = v <= 0 ? 0 : (v >= 255 ? 255 : (uchar)v);
+            }
+        }
+    }
+}
+
+/*! \brief Fuse exposures into an LDR image (Mertens exposure fusion)
+ *
+ * Each shot is decoded once, as a spillable image : under memory
+ * budget pressure its pixels go to a mapped file and are read
+ * back band by band. Image is then processed band by band of
+ * tileSize rows, written to a TIFF file as soon as they are
+ * fused. Each band is cut in overlapping tiles fused in parallel.
+ * Fusion buffers depend on image width and tile size, not on
+ * image height.
+ *
+ * run is checked between bands, false aborts fusion
+ */
+bool fuseExposures(QStringList paths, QString output, int tileSize,
+                   const std::atomic<bool> *run)
+{
+    int n = paths.size();
+    TiffWriter writer;
+
+    TRACE_SCOPE("fusion", "composition");
+
+    if (!n)
+        return false;
+
+    QSize size = QImageReader(paths.first()).size();
+    for (int k = 1; k < n; k++)
+        if (QImageReader(paths.at(k)).size() != size) {
+            LOG_ERROR("[Fusion] Shots have different sizes\n");
+            return false;
+        }
+    if (!size.isValid()) {
+        LOG_ERROR("[Fusion] Could not read %s\n",
+                  paths.first().toStdString().c_str());
+        return false;
+    }
+    if (tileSize < 64)
+        tileSize = 64;
+
+    int w = size.width();
+    int h = size.height();
+    if (!writer.open(output, w, h))
+        return false;
+
+    /* JPEG decoders cannot seek to a band : decode shots once */
+    QVector<SpillImage> shots(n);
+    {
+        TRACE_SCOPE("fusion_decode", "composition");
+        parallelFor(0, n, [&](int first, int last) {
+            for (int k = first; k < last; k++) {
+                MemoryReservation reservation(qint64(w) * h * 4);
+                QImage image(paths.at(k));
+                shots[k] = SpillImage(
+                    image.convertToFormat(QImage::Format_RGB32));
+            }
+        });
+    }
+    for (int k = 0; k < n; k++)
+        if (shots.at(k).isNull()) {
+            LOG_ERROR("[Fusion] Could not read %s\n",
+                      paths.at(k).toStdString().c_str());
+            return false;
+        }
+
+    for (int y0 = 0; y0 < h; y0 += tileSize) {
+        if (run && !*run)
+            return false;
+
+        int th = qMin(tileSize, h - y0);
+        int by0 = qMax(0, y0 - FUSION_MARGIN);
+        int by1 = qMin(h, y0 + th + FUSION_MARGIN);
+        /* Held for this band only, shots may be spilled between */
+        QList<QImage> images;
+        for (int k = 0; k < n; k++)
+            images.append(shots.at(k).image());
+
+        QImage out(w, th, QImage::Format_RGB888);
+        uchar *bits = out.bits();
+        int stride = out.bytesPerLine();
+        parallelForTiles(QRect(0, y0, w, th), tileSize, [&](QRect tile) {
+            int rx0 = qMax(0, tile.x() - FUSION_MARGIN);
+            int rx1 = qMin(w, tile.x() + tile.width() + FUSION_MARGIN);
+            QRect region(rx0, by0, rx1 - rx0, by1 - by0);
+            fuseTile(images, 0, region, tile, bits, stride);
+        });
+
+        if (!writer.writeRows(out)) {
+            LOG_ERROR("[Fusion] Could not write %s\n",
+                      output.toStdString().c_str());
+            return false;
+        }
+    }
+
+    return writer.close();
+}
+
+/*! \brief FusionPreview constructor
+ *
+ * Frames wider than width are downscaled
+ */
+FusionPreview::FusionPreview(int width)
+{
+    maxWidth = width;
+    reset();
+}
+
+/*! \brief Forget fused frames
+ */
+void FusionPreview::reset()
+{
+    frames = 0;
+    sizes.clear();
+    for (int c = 0; c < 3; c++)
+        num[c].clear();
+    den.clear();
+}
+
+/*! \brief Get number of fused frames
+ */
+int FusionPreview::count()
+{
+    return frames;
+}
+
+/*! \brief Fuse one frame
+ *
+ * Returns false if frame does not match previous ones
+ */
+bool FusionPreview::add(const QImage &frame)
+{
+    TRACE_SCOPE("fusion_preview", "sequence");
+
+    if (frame.isNull())
+        return false;
+    QImage img = frame.width() > maxWidth
+                     ? frame.scaledToWidth(maxWidth, Qt::SmoothTransformation)
+                     : frame;
+    img = img.convertToFormat(QImage::Format_RGB32);
+    QRect region(0, 0, img.width(), img.height());
+
+    if (!frames) {
+        int w = img.width(), h = img.height();
+        sizes.clear();
+        sizes.append(QSize(w, h));
+        while (sizes.size() <= FUSION_LEVELS && qMin(w, h) > 8) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            sizes.append(QSize(w, h));
+        }
+        den.resize(sizes.size());
+        for (int l = 0; l < sizes.size(); l++)
+            den[l].fill(0, sizes.at(l).width() * sizes.at(l).height());
+        for (int c = 0; c < 3; c++)
+            num[c] = den;
+    } else if (img.size() != sizes.first())
+        return false;
+    int levels = sizes.size() - 1;
+
+    /* Gaussian pyramid of weights */
+    QVector<plane> gw(levels + 1);
+    computeWeight(img, 0, region, gw[0]);
+    for (int l = 0; l < levels; l++)
+        reduce(gw[l], gw[l + 1]);
+    for (int l = 0; l <= levels; l++) {
+        float *pd = den[l].data();
+        const float *pw = gw[l].d.constData();
+        for (int i = 0; i < den[l].size(); i++)
+            pd[i] += pw[i];
+    }
+
+    for (int c = 0; c < 3; c++) {
+        QVector<plane> gi(levels + 1);
+        plane up;
+        extractChannel(img, 0, region, c, gi[0]);
+        for (int l = 0; l < levels; l++)
+            reduce(gi[l], gi[l + 1]);
+        for (int l = 0; l <= levels; l++) {
+            float *pn = num[c][l].data();
+            const float *pi = gi[l].d.constData();
+            const float *pw = gw[l].d.constData();
+            int size = gi[l].d.size();
+            if (l < levels) {
+                expand(gi[l + 1], gi[l].w, gi[l].h, up);
+                const float *pu = up.d.constData();
+                for (int i = 0; i < size; i++)
+                    pn[i] += pw[i] * (pi[i] - pu[i]);
+            } else
+                for (int i = 0; i < size; i++)
+                    pn[i] += pw[i] * pi[i];
+        }
+    }
+    frames++;
+
+    return true;
+}
+
+/*! \brief Build preview from fused frames
+ *
+ * Fusion goes on, more frames can be added
+ * Returns a null image if no frame was fused
+ */
+QImage FusionPreview::result()
+{
+    if (!frames)
+        return QImage();
+
+    TRACE_SCOPE("fusion_preview_result", "sequence");
+
+    int levels = sizes.size() - 1;
+    QImage out(sizes.first(), QImage::Format_RGB32);
+    out.fill(Qt::black);
+
+    for (int c = 0; c < 3; c++) {
+        QVector<plane> result(levels + 1);
+        for (int l = 0; l <= levels; l++) {
+            resizePlane(result[l], sizes.at(l).width(), sizes.at(l).height());
+            float *pr = result[l].d.data();
+            const float *pn = num[c][l].constData();
+            const float *pd = den[l].constData();
+            for (int i = 0; i < result[l].d.size(); i++)
+                pr[i] = pd[i] > 0 ? pn[i] / pd[i] : 0;
+        }
+
+        plane cur = result[levels];
+        plane up;
+        for (int l = levels - 1; l >= 0; l--) {
+            expand(cur, result[l].w, result[l].h, up);
+            const float *pr = result[l].d.constData();
+            float *pu = up.d.data();
+            for (int i = 0; i < up.d.size(); i++)
+                pu[i] += pr[i];
+            cur = up;
+        }
+
+        int shift = 16 - 8 * c;
+        for (int y = 0; y < cur.h; y++) {
+            const float *src = cur.d.constData() + y * cur.w;
+            QRgb *dst = reinterpret_cast<QRgb *>(out.scanLine(y));
+            for (int x = 0; x < cur.w; x++) {
+                float v = src[x] * 255 + 0.5f;
+                uint z = v <= 0 ? 0 : (v >= 255 ? 255 : (uint)v);
+                dst[x] |= z << shift;
+            }
+        }
+    }
+
+    return out;
+}
@@ -0,0 +1,48 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <atomic>
+
+/* Default tile side, in pixels */
+#define FUSION_TILE 512
+/* Preview width, in pixels */
+#define FUSION_PREVIEW_WIDTH 320
+
+/* Incremental low resolution exposure fusion
+ *
+ * Frames are fused one by one as they come (liveview frames of
+ * the exposure search), only weighted pyramid sums are kept so
+ * a preview is available at any time. Weights are normalized
+ * per pyramid level when the preview is built, instead of per
+ * pixel as fuseExposures() does
+ */
+class FusionPreview
+{
+  public:
+    FusionPreview(int width = FUSION_PREVIEW_WIDTH);
+
+    void reset();
+    bool add(const QImage &frame);
+    int count();
+    QImage result();
+
+  private:
+    int maxWidth;
+    int frames;
+    /* Level sizes, full preview size first */
+    QVector<QSize> sizes;
+    /* Weighted laplacian sums per channel, weight sums, per level */
+    QVector<QVector<float>> num[3];
+    QVector<QVector<float>> den;
+};
+
+bool fuseExposures(QStringList paths, QString output,
+                   int tileSize = FUSION_TILE,
+                   const std::atomic<bool> *run = nullptr);
+
+#endif // FUSION_H
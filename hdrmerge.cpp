@@ -0,0 +1,447 @@
+#include "hdrmerge.h"
+#include "bufferpool.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QRgba64>
+#include <math.h>
+#include <string.h>
+
+/* Deghosting : pixels are compared where both shots have
+ * at least this confidence */
+#define DEGHOST_MIN_WEIGHT 0.05f
+
+/* Camera response, indexed by 8 bit pixel value */
+typedef struct {
+    float g[256]; /* ln of linear exposure */
+    float w[256]; /* Confidence weight */
+} responseLUT;
+
+/*! \brief Build default camera response
+ *
+ * No calibration available : sRGB decoding curve,
+ * hat weighting that discards clipped values
+ */
+static responseLUT buildDefaultResponse()
+{
+    responseLUT lut;
+
+    for (int z = 0; z < 256; z++) {
+        double v = z / 255.0;
+        double lin = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+        lut.g[z] = log(qMax(lin, 1e-6));
+        lut.w[z] = qMin(z, 255 - z) / 127.5f;
+    }
+
+    return lut;
+}
+
+static const responseLUT &defaultResponse()
+{
+    static const responseLUT lut = buildDefaultResponse();
+
+    return lut;
+}
+
+/* Linear 16 bit response (decoded RAW), indexed by pixel value */
+typedef struct {
+    float g[65536];
+    float w[65536];
+    uchar srgb[65536]; /* 8 bit sRGB code of the same value */
+} linearLUT;
+
+/*! \brief Build linear response
+ *
+ * Weights are the hat of the sRGB encoded value, as for 8 bit shots
+ */
+static linearLUT *buildLinearResponse()
+{
+    linearLUT *lut = new linearLUT;
+
+    for (int z = 0; z < 65536; z++) {
+        double v = qMax(z, 1) / 65535.0;
+        double e = v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1 / 2.4) - 0.055;
+        lut->g[z] = log(v);
+        lut->w[z] = 2 * qMin(e, 1 - e);
+        lut->srgb[z] = uchar(e * 255 + 0.5);
+    }
+
+    return lut;
+}
+
+static const linearLUT &linearResponse()
+{
+    static const linearLUT *lut = buildLinearResponse();
+
+    return *lut;
+}
+
+/*! \brief Encode a linear 16 bit image to 8 bit sRGB
+ */
+static QImage encodeLinear(const QImage &image)
+{
+    const linearLUT &lin = linearResponse();
+    QImage out =
+        pooledImage(image.width(), image.height(), QImage::Format_RGB32);
+
+    for (int y = 0; y < image.height(); y++) {
+        const QRgba64 *src =
+            reinterpret_cast<const QRgba64 *>(image.constScanLine(y));
+        QRgb *dst = reinterpret_cast<QRgb *>(out.scanLine(y));
+        for (int x = 0; x < image.width(); x++)
+            dst[x] = qRgb(lin.srgb[src[x].red()], lin.srgb[src[x].green()],
+                          lin.srgb[src[x].blue()]);
+    }
+
+    return out;
+}
+
+/*! \brief Convert a camera exposure value to seconds
+ *
+ * Accepts "1/250", "0.5", "2", "30s"...
+ * Returns 0 if value cannot be read (bulb...)
+ */
+double exposureTime(QString exposure)
+{
+    QString e = exposure.trimmed().replace(',', '.');
+    bool ok = false, okDen = false;
+
+    if (e.endsWith('s'))
+        e.chop(1);
+
+    int slash = e.indexOf('/');
+    if (slash >= 0) {
+        double num = e.left(slash).toDouble(&ok);
+        double den = e.mid(slash + 1).toDouble(&okDen);
+        if (!ok || !okDen || num <= 0 || den <= 0)
+            return 0;
+        return num / den;
+    }
+
+    double t = e.toDouble(&ok);
+    return ok && t > 0 ? t : 0;
+}
+
+/*! \brief MergeAccumulator constructor
+ */
+MergeAccumulator::MergeAccumulator()
+{
+    ghostSigma = 0;
+    setResponse(nullptr);
+    reset();
+}
+
+/*! \brief Forget accumulated shots and release buffers
+ */
+void MergeAccumulator::reset()
+{
+    width = height = 0;
+    shots = 0;
+    num = PlanarImage<float>();
+    den = PlanarImage<float>();
+    shortest = QImage();
+    longest = QImage();
+    shortestTime = longestTime = 0;
+    shortestLinear = longestLinear = false;
+    refGray = QVector<uchar>();
+    refTime = 0;
+}
+
+/*! \brief Enable deghosting of next merges
+ *
+ * sigma is the tolerated difference between a shot and the
+ * reference, in ln radiance units, 0 disables deghosting
+ */
+void MergeAccumulator::setDeghosting(float sigma)
+{
+    ghostSigma = sigma;
+}
+
+/*! \brief Set camera response of next merges
+ *
+ * Calibrated response of 8 bit shots (see ResponseSampler),
+ * nullptr for the sRGB decoding curve. Linear shots do not use it
+ */
+void MergeAccumulator::setResponse(const cameraResponse *response)
+{
+    const responseLUT &lut = defaultResponse();
+
+    if (response) {
+        curve = *response;
+        return;
+    }
+    for (int c = 0; c < 3; c++)
+        memcpy(curve.g[c], lut.g, sizeof(lut.g));
+}
+
+/*! \brief Get number of accumulated shots
+ */
+int MergeAccumulator::count()
+{
+    return shots;
+}
+
+/*! \brief Get memory held by sums and kept shots, in bytes
+ */
+qint64 MergeAccumulator::memory()
+{
+    return num.bytes() + den.bytes() + shortest.sizeInBytes() +
+           longest.sizeInBytes() + refGray.size();
+}
+
+/*! \brief Accumulate one exposure
+ *
+ * Debevec weighted merge in log domain :
+ * ln E = sum(w(Z) * (g(Z) - ln dt)) / sum(w(Z))
+ * Numerator and denominator are accumulated as shots come,
+ * in any order. Shortest and longest exposures are kept
+ * for pixels clipped in every shot.
+ *
+ * Rows are accumulated in parallel. For each row, pixels are first
+ * looked up into float planes, so that accumulation loops
+ * only run over contiguous floats and can be vectorized.
+ *
+ * Image is translated by offset (see alignExposures()),
+ * borders are extended
+ *
+ * Shots are 8 bit, decoded by the camera response (see
+ * setResponse()), or linear 16 bit (Format_RGBX64, see loadRaw()).
+ * Both kinds can be mixed.
+ *
+ * With deghosting, weights of a shot are scaled by its consistency
+ * with the reference : exposure normalized luminances are compared,
+ * c = (s^2 / (s^2 + d^2))^2, where both pixels are well exposed
+ * Returns false if image does not match previous ones
+ */
+bool MergeAccumulator::add(QImage image, double time, QPoint offset)
+{
+    const responseLUT &lut = defaultResponse();
+
+    TRACE_SCOPE("accumulate", "composition");
+
+    if (image.isNull() || time <= 0)
+        return false;
+    if (!shots) {
+        width = image.width();
+        height = image.height();
+        num = PlanarImage<float>(width, height, 3);
+        den = PlanarImage<float>(width, height, 3);
+        num.fill(0);
+        den.fill(0);
+        if (ghostSigma > 0) {
+            refGray.resize(width * height);
+            refTime = time;
+        }
+    } else if (image.width() != width || image.height() != height)
+        return false;
+
+    bool linear = image.format() == QImage::Format_RGBX64 ||
+                  image.format() == QImage::Format_RGBA64;
+    if (!linear && image.format() != QImage::Format_RGB32 &&
+        image.format() != QImage::Format_ARGB32)
+        image = image.convertToFormat(QImage::Format_RGB32);
+    const linearLUT *lin = linear ? &linearResponse() : nullptr;
+    const float *cr = curve.g[0];
+    const float *cg = curve.g[1];
+    const float *cb = curve.g[2];
+
+    int w = width;
+    int h = height;
+    int dx = offset.x();
+    float l = log(time);
+    /* Reference is stored, others are compared to it */
+    bool storeRef = !shots && !refGray.isEmpty();
+    bool deghost = shots && !refGray.isEmpty();
+    uchar *ref = refGray.data();
+    float lr = deghost ? log(refTime) : 0;
+    float s2 = ghostSigma * ghostSigma;
+
+    parallelFor(0, height, [&](int y0, int y1) {
+        QVector<float> buffer(w * 6);
+        QVector<float> ghost(deghost ? w * 3 : 0);
+        QVector<uchar> gray(w);
+        float *gz[3], *wz[3];
+        for (int c = 0; c < 3; c++) {
+            gz[c] = buffer.data() + w * c;
+            wz[c] = buffer.data() + w * (3 + c);
+        }
+        uchar *gy = gray.data();
+
+        for (int y = y0; y < y1; y++) {
+            int sy = qBound(0, y - offset.y(), h - 1);
+            if (linear) {
+                const QRgba64 *line = reinterpret_cast<const QRgba64 *>(
+                    image.constScanLine(sy));
+                for (int x = 0; x < w; x++) {
+                    QRgba64 px = dx ? line[qBound(0, x - dx, w - 1)] : line[x];
+                    int zr = px.red();
+                    int zg = px.green();
+                    int zb = px.blue();
+                    gz[0][x] = lin->g[zr];
+                    gz[1][x] = lin->g[zg];
+                    gz[2][x] = lin->g[zb];
+                    wz[0][x] = lin->w[zr];
+                    wz[1][x] = lin->w[zg];
+                    wz[2][x] = lin->w[zb];
+                    gy[x] = lin->srgb[(zr * 54 + zg * 183 + zb * 19) >> 8];
+                }
+            } else {
+                const QRgb *line =
+                    reinterpret_cast<const QRgb *>(image.constScanLine(sy));
+                for (int x = 0; x < w; x++) {
+                    QRgb px = dx ? line[qBound(0, x - dx, w - 1)] : line[x];
+                    int zr = qRed(px);
+                    int zg = qGreen(px);
+                    int zb = qBlue(px);
+                    gz[0][x] = cr[zr];
+                    gz[1][x] = cg[zg];
+                    gz[2][x] = cb[zb];
+                    wz[0][x] = lut.w[zr];
+                    wz[1][x] = lut.w[zg];
+                    wz[2][x] = lut.w[zb];
+                    gy[x] = (zr * 54 + zg * 183 + zb * 19) >> 8;
+                }
+            }
+            if (storeRef)
+                memcpy(ref + y * w, gy, w);
+            if (deghost) {
+                /* Lookups, then a branchless loop over floats
+                 * Luminance codes are compared with the sRGB curve,
+                 * linear shots are coded so too */
+                float *dl = ghost.data();
+                float *wi = dl + w;
+                float *wr = dl + 2 * w;
+                const uchar *gr = ref + y * w;
+                for (int x = 0; x < w; x++) {
+                    dl[x] = (lut.g[gy[x]] - l) - (lut.g[gr[x]] - lr);
+                    wi[x] = lut.w[gy[x]];
+                    wr[x] = lut.w[gr[x]];
+                }
+                for (int x = 0; x < w; x++) {
+                    float k = s2 / (s2 + dl[x] * dl[x]);
+                    bool valid = wi[x] * wr[x] > DEGHOST_MIN_WEIGHT;
+                    float cw = valid ? k * k : 1.0f;
+                    wz[0][x] *= cw;
+                    wz[1][x] *= cw;
+                    wz[2][x] *= cw;
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                float *n = num.row(c, y), *d = den.row(c, y);
+                const float *g = gz[c], *wt = wz[c];
+                for (int x = 0; x < w; x++) {
+                    n[x] += wt[x] * (g[x] - l);
+                    d[x] += wt[x];
+                }
+            }
+        }
+    });
+
+    /* Kept as 8 bit, clipped pixels do not need more */
+    if (!shots || time < shortestTime) {
+        shortest = linear ? encodeLinear(image) : image;
+        shortestLinear = linear;
+        shortestOffset = offset;
+        shortestTime = time;
+    }
+    if (!shots || time > longestTime) {
+        longest = linear ? encodeLinear(image) : image;
+        longestLinear = linear;
+        longestOffset = offset;
+        longestTime = time;
+    }
+    shots++;
+
+    return true;
+}
+
+/*! \brief Compute radiance map from accumulated shots
+ *
+ * A pixel clipped in every shot takes its value from the shortest
+ * (bright pixel) or longest (dark pixel) exposure.
+ * Accumulator is reset, its buffers are reused for the result
+ */
+bool MergeAccumulator::result(RadianceMap &hdr)
+{
+    const responseLUT &lut = defaultResponse();
+
+    TRACE_SCOPE("radiance", "composition");
+
+    if (!shots)
+        return false;
+
+    int w = width;
+    float ls = log(shortestTime);
+    float ll = log(longestTime);
+
+    parallelFor(0, height, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const QRgb *dark = reinterpret_cast<const QRgb *>(
+                shortest.constScanLine(
+                    qBound(0, y - shortestOffset.y(), height - 1)));
+            const QRgb *bright = reinterpret_cast<const QRgb *>(
+                longest.constScanLine(
+                    qBound(0, y - longestOffset.y(), height - 1)));
+            for (int c = 0; c < 3; c++) {
+                float *po = num.row(c, y);
+                const float *d = den.row(c, y);
+                const float *gd = shortestLinear ? lut.g : curve.g[c];
+                const float *gb = longestLinear ? lut.g : curve.g[c];
+                int shift = 16 - 8 * c;
+                for (int x = 0; x < w; x++) {
+                    if (d[x] > 0) {
+                        po[x] = expf(po[x] / d[x]);
+                        continue;
+                    }
+                    /* Clipped everywhere */
+                    QRgb pxd = dark[qBound(0, x - shortestOffset.x(), w - 1)];
+                    QRgb pxb = bright[qBound(0, x - longestOffset.x(), w - 1)];
+                    int z = (pxd >> shift) & 0xFF;
+                    if (z >= 128)
+                        po[x] = expf(gd[z] - ls);
+                    else
+                        po[x] = expf(gb[(pxb >> shift) & 0xFF] - ll);
+                }
+            }
+        }
+    });
+
+    /* Radiance planes are the numerator planes, not copied */
+    hdr = num;
+    reset();
+
+    return true;
+}
+
+/*! \brief Merge exposures into a radiance map
+ *
+ * All shots at once, see MergeAccumulator
+ * offsets, if given, translate each shot
+ * If deghost is not 0, middle shot is the deghosting reference,
+ * deghost being its tolerance
+ * response is the calibrated camera response, if any
+ * Returns false if images cannot be merged together
+ */
+bool mergeExposures(QList<QImage> &images, QList<double> &times,
+                    RadianceMap &hdr, const QList<QPoint> &offsets,
+                    float deghost, const cameraResponse *response)
+{
+    MergeAccumulator acc;
+    int n = images.size();
+
+    TRACE_SCOPE("merge", "composition");
+
+    if (images.isEmpty() || n != times.size())
+        return false;
+
+    /* Reference first, merge does not depend on order */
+    acc.setDeghosting(deghost);
+    acc.setResponse(response);
+    for (int k = 0; k < n; k++) {
+        int i = k == 0 ? n / 2 : (k <= n / 2 ? k - 1 : k);
+        if (!acc.add(images.at(i), times.at(i),
+                     i < offsets.size() ? offsets.at(i) : QPoint(0, 0)))
+            return false;
+    }
+
+    return acc.result(hdr);
+}
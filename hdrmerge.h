@@ -0,0 +1,73 @@
+#ifndef HDRMERGE_H
+#define HDRMERGE_H
+
+#include "planarimage.h"
+#include <QImage>
+#include <QList>
+#include <QPoint>
+#include <QString>
+#include <QVector>
+
+/* Default deghosting tolerance, in ln radiance units */
+#define DEGHOST_SIGMA 0.5f
+
+/* Linear radiance, red, green and blue float planes */
+typedef PlanarImage<float> RadianceMap;
+
+/* Inverse camera response of 8 bit shots */
+typedef struct {
+    float g[3][256]; /* ln of linear exposure, per channel and value */
+} cameraResponse;
+
+/* Streaming Debevec merge
+ *
+ * Shots are accumulated one by one as they are available,
+ * only the weighted sums are kept
+ * With deghosting, first shot is the reference : only its
+ * luminance is kept too
+ */
+class MergeAccumulator
+{
+  public:
+    MergeAccumulator();
+
+    void reset();
+    void setDeghosting(float sigma);
+    void setResponse(const cameraResponse *response);
+    bool add(QImage image, double time, QPoint offset = QPoint(0, 0));
+    bool result(RadianceMap &hdr);
+    int count();
+    qint64 memory();
+
+  private:
+    /* Response of 8 bit shots, sRGB if not calibrated */
+    cameraResponse curve;
+    int width;
+    int height;
+    int shots;
+    /* Weighted log radiance and weights sums, per channel */
+    PlanarImage<float> num;
+    PlanarImage<float> den;
+    /* For pixels clipped in every shot */
+    QImage shortest;
+    QImage longest;
+    QPoint shortestOffset;
+    QPoint longestOffset;
+    bool shortestLinear;
+    bool longestLinear;
+    double shortestTime;
+    double longestTime;
+    /* Deghosting, reference luminance in merged coordinates */
+    float ghostSigma;
+    QVector<uchar> refGray;
+    double refTime;
+};
+
+double exposureTime(QString exposure);
+bool mergeExposures(QList<QImage> &images, QList<double> &times,
+                    RadianceMap &hdr,
+                    const QList<QPoint> &offsets = QList<QPoint>(),
+                    float deghost = 0,
+                    const cameraResponse *response = nullptr);
+
+#endif // HDRMERGE_H
@@ -0,0 +1,683 @@
+#include "imagewriter.h"
+#include "log.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QByteArray>
+#include <QFile>
+#include <QVector>
+#include <math.h>
+#include <string.h>
+
+/*! \brief Encode a linear RGB value to Radiance RGBE
+ */
+static void toRGBE(float r, float g, float b, unsigned char *rgbe)
+{
+    float v = qMax(r, qMax(g, b));
+    int e;
+
+    if (v < 1e-32f) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+    v = frexpf(v, &e) * 256.0f / v;
+    rgbe[0] = (unsigned char)(qMax(r, 0.0f) * v);
+    rgbe[1] = (unsigned char)(qMax(g, 0.0f) * v);
+    rgbe[2] = (unsigned char)(qMax(b, 0.0f) * v);
+    rgbe[3] = (unsigned char)(e + 128);
+}
+
+/*! \brief Run length encode one component of a scanline
+ *
+ * Radiance "new" RLE : runs of at least 4 identical bytes
+ * (count | 128, value), literal dumps otherwise (count, values)
+ */
+static void encodeRLE(const unsigned char *data, int n, QByteArray &out)
+{
+    int cur = 0;
+
+    while (cur < n) {
+        /* Look for next run */
+        int run = cur, runLen = 0;
+        while (run < n) {
+            runLen = 1;
+            while (run + runLen < n && runLen < 127 &&
+                   data[run + runLen] == data[run])
+                runLen++;
+            if (runLen >= 4)
+                break;
+            run += runLen;
+        }
+        if (run >= n)
+            runLen = 0;
+
+        /* Dump literals before run */
+        while (cur < run) {
+            int len = qMin(run - cur, 128);
+            out.append((char)len);
+            out.append((const char *)data + cur, len);
+            cur += len;
+        }
+        if (runLen >= 4) {
+            out.append((char)(128 + runLen));
+            out.append((char)data[run]);
+            cur += runLen;
+        }
+    }
+}
+
+/*! \brief Encode one scanline of a radiance map to RGBE
+ *
+ * Scanline is run length encoded when width allows it
+ */
+static void encodeScanline(const RadianceMap &hdr, int y, QByteArray &line)
+{
+    int w = hdr.width();
+    QByteArray pixels(w * 4, 0);
+    unsigned char *px = (unsigned char *)pixels.data();
+    const float *r = hdr.row(0, y);
+    const float *g = hdr.row(1, y);
+    const float *b = hdr.row(2, y);
+
+    for (int x = 0; x < w; x++)
+        toRGBE(r[x], g[x], b[x], px + 4 * x);
+
+    if (w < 8 || w >= 32768) {
+        line = pixels;
+        return;
+    }
+
+    /* Scanline marker, then each component separately */
+    QByteArray planes(w * 4, 0);
+    unsigned char *pl = (unsigned char *)planes.data();
+    for (int x = 0; x < w; x++)
+        for (int c = 0; c < 4; c++)
+            pl[c * w + x] = px[4 * x + c];
+    line.clear();
+    line.append((char)2);
+    line.append((char)2);
+    line.append((char)(w >> 8));
+    line.append((char)(w & 0xFF));
+    for (int c = 0; c < 4; c++)
+        encodeRLE(pl + c * w, w, line);
+}
+
+RGBEWriter::RGBEWriter()
+{
+    width = height = 0;
+    rowsWritten = 0;
+}
+
+/*! \brief RGBEWriter destructor
+ *
+ * An unfinished file is left truncated
+ */
+RGBEWriter::~RGBEWriter()
+{
+    if (file.isOpen())
+        file.close();
+}
+
+/*! \brief Create file and write header
+ */
+bool RGBEWriter::open(QString path, int w, int h)
+{
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[ImageWriter] Could not open %s\n",
+                  path.toStdString().c_str());
+        return false;
+    }
+
+    width = w;
+    height = h;
+    rowsWritten = 0;
+
+    QByteArray header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n";
+    header += QString("-Y %1 +X %2\n").arg(h).arg(w).toLatin1();
+
+    return file.write(header) == header.size();
+}
+
+/*! \brief Append rows [y0, y1) of a radiance map
+ *
+ * Scanlines are encoded in parallel, then written in order
+ */
+bool RGBEWriter::writeRows(const RadianceMap &hdr, int y0, int y1)
+{
+    int n = y1 - y0;
+
+    if (!file.isOpen() || hdr.width() != width || n <= 0 || y0 < 0 ||
+        y1 > hdr.height() || rowsWritten + n > height)
+        return false;
+
+    QVector<QByteArray> lines(n);
+    QByteArray *out = lines.data();
+    parallelFor(0, n, [&](int first, int last) {
+        for (int i = first; i < last; i++)
+            encodeScanline(hdr, y0 + i, out[i]);
+    });
+    for (int i = 0; i < n; i++)
+        if (file.write(lines.at(i)) != lines.at(i).size())
+            return false;
+    rowsWritten += n;
+
+    return true;
+}
+
+/*! \brief Close file
+ *
+ * Returns false if some rows are missing
+ */
+bool RGBEWriter::close()
+{
+    if (!file.isOpen())
+        return false;
+
+    bool ok = rowsWritten == height && file.error() == QFileDevice::NoError;
+    file.close();
+
+    return ok;
+}
+
+/*! \brief Write a radiance map to a Radiance .hdr file
+ *
+ * Written by bands of IMAGE_BAND rows
+ */
+bool writeRGBE(QString path, const RadianceMap &hdr)
+{
+    RGBEWriter writer;
+
+    TRACE_SCOPE("write_rgbe", "composition");
+
+    if (!writer.open(path, hdr.width(), hdr.height()))
+        return false;
+    for (int y = 0; y < hdr.height(); y += IMAGE_BAND)
+        if (!writer.writeRows(hdr, y, qMin(y + IMAGE_BAND, hdr.height())))
+            break;
+    if (!writer.close()) {
+        LOG_ERROR("[ImageWriter] Could not write %s\n",
+                  path.toStdString().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/* TIFF field types */
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_RATIONAL 5
+
+static void put16(QByteArray &b, quint16 v)
+{
+    b.append((char)(v & 0xFF));
+    b.append((char)(v >> 8));
+}
+
+static void put32(QByteArray &b, quint32 v)
+{
+    put16(b, v & 0xFFFF);
+    put16(b, v >> 16);
+}
+
+/*! \brief Append a TIFF directory entry
+ *
+ * Values that do not fit in 4 bytes are given by offset
+ */
+static void putEntry(QByteArray &b, quint16 tag, quint16 type, quint32 count,
+                     quint32 value)
+{
+    put16(b, tag);
+    put16(b, type);
+    put32(b, count);
+    if (type == TIFF_SHORT && count == 1) {
+        put16(b, value);
+        put16(b, 0);
+    } else
+        put32(b, value);
+}
+
+TiffWriter::TiffWriter()
+{
+    width = height = 0;
+    rowsWritten = rowsPerStrip = 0;
+}
+
+/*! \brief TiffWriter destructor
+ *
+ * An unfinished file is left invalid
+ */
+TiffWriter::~TiffWriter()
+{
+    if (file.isOpen())
+        file.close();
+}
+
+/*! \brief Create file and write header
+ */
+bool TiffWriter::open(QString path, int w, int h)
+{
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[ImageWriter] Could not open %s\n",
+                  path.toStdString().c_str());
+        return false;
+    }
+
+    width = w;
+    height = h;
+    rowsWritten = rowsPerStrip = 0;
+    stripOffsets.clear();
+    stripCounts.clear();
+
+    /* Little endian, directory offset patched on close */
+    QByteArray header("II*\0", 4);
+    put32(header, 0);
+
+    return file.write(header) == header.size();
+}
+
+/*! \brief Append rows as a new strip
+ *
+ * rows must be as wide as the image
+ */
+bool TiffWriter::writeRows(const QImage &rows)
+{
+    int n = rows.height();
+
+    if (!file.isOpen() || rows.width() != width ||
+        rowsWritten + n > height)
+        return false;
+    if (!rowsPerStrip)
+        rowsPerStrip = n;
+    else if (n != rowsPerStrip && rowsWritten + n != height)
+        return false;
+
+    QImage rgb = rows.format() == QImage::Format_RGB888
+                     ? rows
+                     : rows.convertToFormat(QImage::Format_RGB888);
+    stripOffsets.append(file.pos());
+    stripCounts.append(width * 3 * n);
+    for (int y = 0; y < n; y++)
+        if (file.write((const char *)rgb.constScanLine(y), width * 3) !=
+            width * 3)
+            return false;
+    rowsWritten += n;
+
+    return true;
+}
+
+/*! \brief Write image directory and close file
+ */
+bool TiffWriter::close()
+{
+    if (!file.isOpen())
+        return false;
+    if (rowsWritten != height) {
+        file.close();
+        return false;
+    }
+
+    int strips = stripOffsets.size();
+    quint32 base = file.pos();
+    if (base & 1) {
+        file.write("", 1);
+        base++;
+    }
+
+    /* Directory, then out of line values */
+    const int entries = 13;
+    quint32 extra = base + 2 + entries * 12 + 4;
+    quint32 bpsOffset = extra;
+    quint32 resOffset = bpsOffset + 6 + 2;
+    quint32 offsetsOffset = resOffset + 8;
+    quint32 countsOffset = offsetsOffset + 4 * strips;
+
+    QByteArray ifd;
+    put16(ifd, entries);
+    putEntry(ifd, 256, TIFF_LONG, 1, width);
+    putEntry(ifd, 257, TIFF_LONG, 1, height);
+    putEntry(ifd, 258, TIFF_SHORT, 3, bpsOffset);
+    putEntry(ifd, 259, TIFF_SHORT, 1, 1);
+    putEntry(ifd, 262, TIFF_SHORT, 1, 2);
+    putEntry(ifd, 273, TIFF_LONG, strips,
+             strips == 1 ? stripOffsets.first() : offsetsOffset);
+    putEntry(ifd, 277, TIFF_SHORT, 1, 3);
+    putEntry(ifd, 278, TIFF_LONG, 1, rowsPerStrip);
+    putEntry(ifd, 279, TIFF_LONG, strips,
+             strips == 1 ? stripCounts.first() : countsOffset);
+    putEntry(ifd, 282, TIFF_RATIONAL, 1, resOffset);
+    putEntry(ifd, 283, TIFF_RATIONAL, 1, resOffset);
+    putEntry(ifd, 284, TIFF_SHORT, 1, 1);
+    putEntry(ifd, 296, TIFF_SHORT, 1, 2);
+    put32(ifd, 0);
+    /* BitsPerSample 8,8,8 and padding */
+    put16(ifd, 8);
+    put16(ifd, 8);
+    put16(ifd, 8);
+    put16(ifd, 0);
+    /* 72 dpi */
+    put32(ifd, 72);
+    put32(ifd, 1);
+    if (strips > 1) {
+        for (int i = 0; i < strips; i++)
+            put32(ifd, stripOffsets.at(i));
+        for (int i = 0; i < strips; i++)
+            put32(ifd, stripCounts.at(i));
+    }
+    file.write(ifd);
+
+    /* Patch header */
+    QByteArray offset;
+    put32(offset, base);
+    file.seek(4);
+    file.write(offset);
+
+    bool ok = file.error() == QFileDevice::NoError;
+    file.close();
+
+    return ok;
+}
+
+/* OpenEXR pixel types and compressions */
+#define EXR_HALF 1
+#define EXR_FLOAT 2
+#define EXR_NO_COMPRESSION 0
+#define EXR_ZIP_COMPRESSION 3
+
+static void put64(QByteArray &b, quint64 v)
+{
+    put32(b, v & 0xFFFFFFFF);
+    put32(b, v >> 32);
+}
+
+static void putFloat(QByteArray &b, float v)
+{
+    quint32 bits;
+    memcpy(&bits, &v, 4);
+    put32(b, bits);
+}
+
+/*! \brief Append an OpenEXR header attribute
+ */
+static void putAttribute(QByteArray &b, const char *name, const char *type,
+                         const QByteArray &value)
+{
+    b.append(name, strlen(name) + 1);
+    b.append(type, strlen(type) + 1);
+    put32(b, value.size());
+    b.append(value);
+}
+
+/*! \brief Convert a non negative float to half float
+ *
+ * Rounded to nearest, saturated to the largest half value,
+ * denormals are kept
+ */
+static quint16 toHalf(float f)
+{
+    quint32 x;
+
+    if (!(f > 0))
+        return 0;
+    memcpy(&x, &f, 4);
+    int e = int((x >> 23) & 0xFF) - 127 + 15;
+    quint32 m = x & 0x7FFFFF;
+
+    if (e >= 31)
+        return 0x7BFF;
+    if (e <= 0) {
+        if (e < -10)
+            return 0;
+        m |= 0x800000;
+        int shift = 14 - e;
+        quint32 h = m >> shift;
+        if ((m >> (shift - 1)) & 1)
+            h++;
+        return h;
+    }
+
+    quint32 h = (e << 10) | (m >> 13);
+    if (m & 0x1000)
+        h++;
+    return h > 0x7BFF ? 0x7BFF : h;
+}
+
+ExrWriter::ExrWriter()
+{
+    width = height = 0;
+    tileSize = EXR_TILE;
+    halfFloat = true;
+    zip = true;
+    rowsWritten = 0;
+    tableOffset = 0;
+}
+
+/*! \brief ExrWriter destructor
+ *
+ * An unfinished file is left invalid
+ */
+ExrWriter::~ExrWriter()
+{
+    if (file.isOpen())
+        file.close();
+}
+
+/*! \brief Create file, write header and room for tile offsets
+ *
+ * RGB, single level tiles of tile x tile pixels, half or
+ * 32 bit float, ZIP compressed or not
+ */
+bool ExrWriter::open(QString path, int w, int h, int tile, bool half,
+                     bool compress)
+{
+    if (w <= 0 || h <= 0 || tile <= 0)
+        return false;
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[ImageWriter] Could not open %s\n",
+                  path.toStdString().c_str());
+        return false;
+    }
+
+    width = w;
+    height = h;
+    tileSize = tile;
+    halfFloat = half;
+    zip = compress;
+    rowsWritten = 0;
+    tileOffsets.clear();
+
+    /* Magic number, version 2 with tiled flag */
+    QByteArray header;
+    put32(header, 20000630);
+    put32(header, 2 | 0x200);
+
+    /* Channels are sorted by name */
+    QByteArray v;
+    for (const char *c : {"B", "G", "R"}) {
+        v.append(c, 2);
+        put32(v, halfFloat ? EXR_HALF : EXR_FLOAT);
+        put32(v, 0);
+        put32(v, 1);
+        put32(v, 1);
+    }
+    v.append((char)0);
+    putAttribute(header, "channels", "chlist", v);
+    v.clear();
+    v.append((char)(zip ? EXR_ZIP_COMPRESSION : EXR_NO_COMPRESSION));
+    putAttribute(header, "compression", "compression", v);
+    v.clear();
+    put32(v, 0);
+    put32(v, 0);
+    put32(v, w - 1);
+    put32(v, h - 1);
+    putAttribute(header, "dataWindow", "box2i", v);
+    putAttribute(header, "displayWindow", "box2i", v);
+    v.clear();
+    v.append((char)0);
+    putAttribute(header, "lineOrder", "lineOrder", v);
+    v.clear();
+    putFloat(v, 1);
+    putAttribute(header, "pixelAspectRatio", "float", v);
+    v.clear();
+    putFloat(v, 0);
+    putFloat(v, 0);
+    putAttribute(header, "screenWindowCenter", "v2f", v);
+    v.clear();
+    putFloat(v, 1);
+    putAttribute(header, "screenWindowWidth", "float", v);
+    /* One level, rounded down */
+    v.clear();
+    put32(v, tile);
+    put32(v, tile);
+    v.append((char)0);
+    putAttribute(header, "tiles", "tiledesc", v);
+    header.append((char)0);
+
+    /* Tile offsets, patched on close */
+    int tiles = ((w + tile - 1) / tile) * ((h + tile - 1) / tile);
+    tableOffset = header.size();
+    header.append(QByteArray(tiles * 8, 0));
+
+    return file.write(header) == header.size();
+}
+
+/*! \brief Encode tile (tx, ty) of the file as a chunk
+ *
+ * Its first row is row first of hdr. Tile rows are B, G and R
+ * samples in sequence. ZIP compression splits even and odd bytes,
+ * stores differences, then deflates; data is stored raw when it
+ * does not shrink.
+ */
+void ExrWriter::encodeTile(const RadianceMap &hdr, int tx, int ty, int first,
+                           QByteArray &chunk) const
+{
+    int x0 = tx * tileSize;
+    int tw = qMin(tileSize, width - x0);
+    int th = qMin(tileSize, height - ty * tileSize);
+    int bytes = halfFloat ? 2 : 4;
+
+    QByteArray raw;
+    raw.reserve(th * tw * 3 * bytes);
+    for (int y = first; y < first + th; y++) {
+        for (int c = 2; c >= 0; c--) {
+            const float *src = hdr.row(c, y) + x0;
+            for (int x = 0; x < tw; x++) {
+                if (halfFloat)
+                    put16(raw, toHalf(src[x]));
+                else
+                    putFloat(raw, qMax(src[x], 0.0f));
+            }
+        }
+    }
+
+    QByteArray data = raw;
+    if (zip) {
+        int n = raw.size();
+        QByteArray pred(n, 0);
+        const uchar *in = (const uchar *)raw.constData();
+        uchar *out = (uchar *)pred.data();
+        for (int i = 0; i < n; i++)
+            out[(i & 1) ? (n + 1) / 2 + i / 2 : i / 2] = in[i];
+        for (int i = n - 1; i > 0; i--)
+            out[i] = (uchar)(out[i] - out[i - 1] + 128);
+        /* qCompress prefixes zlib stream with its size */
+        QByteArray z = qCompress(pred);
+        if (z.size() - 4 < n)
+            data = z.mid(4);
+    }
+
+    chunk.clear();
+    put32(chunk, tx);
+    put32(chunk, ty);
+    put32(chunk, 0);
+    put32(chunk, 0);
+    put32(chunk, data.size());
+    chunk.append(data);
+}
+
+/*! \brief Append rows [y0, y1) of a radiance map
+ *
+ * All bands but the last one must be a multiple of tile size
+ * Tiles of the band are encoded and compressed in parallel,
+ * then written in order
+ */
+bool ExrWriter::writeRows(const RadianceMap &hdr, int y0, int y1)
+{
+    int n = y1 - y0;
+
+    if (!file.isOpen() || hdr.width() != width || n <= 0 || y0 < 0 ||
+        y1 > hdr.height() || rowsWritten + n > height)
+        return false;
+    if (n % tileSize && rowsWritten + n != height)
+        return false;
+
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int firstRow = rowsWritten / tileSize;
+    int tileRows = (n + tileSize - 1) / tileSize;
+    QVector<QByteArray> chunks(tilesX * tileRows);
+    QByteArray *out = chunks.data();
+
+    parallelFor(0, chunks.size(), [&](int first, int last) {
+        for (int t = first; t < last; t++)
+            encodeTile(hdr, t % tilesX, firstRow + t / tilesX,
+                       y0 + (t / tilesX) * tileSize, out[t]);
+    });
+    for (int t = 0; t < chunks.size(); t++) {
+        tileOffsets.append(file.pos());
+        if (file.write(chunks.at(t)) != chunks.at(t).size())
+            return false;
+    }
+    rowsWritten += n;
+
+    return true;
+}
+
+/*! \brief Write tile offsets and close file
+ */
+bool ExrWriter::close()
+{
+    if (!file.isOpen())
+        return false;
+    if (rowsWritten != height) {
+        file.close();
+        return false;
+    }
+
+    QByteArray table;
+    for (quint64 offset : tileOffsets)
+        put64(table, offset);
+    file.seek(tableOffset);
+    file.write(table);
+
+    bool ok = file.error() == QFileDevice::NoError;
+    file.close();
+
+    return ok;
+}
+
+/*! \brief Write a radiance map to a tiled OpenEXR file
+ *
+ * Written by bands of one tile row
+ */
+bool writeEXR(QString path, const RadianceMap &hdr, int tileSize, bool half)
+{
+    ExrWriter writer;
+
+    TRACE_SCOPE("write_exr", "composition");
+
+    if (!writer.open(path, hdr.width(), hdr.height(), tileSize, half))
+        return false;
+    for (int y = 0; y < hdr.height(); y += tileSize)
+        if (!writer.writeRows(hdr, y, qMin(y + tileSize, hdr.height())))
+            break;
+    if (!writer.close()) {
+        LOG_ERROR("[ImageWriter] Could not write %s\n",
+                  path.toStdString().c_str());
+        return false;
+    }
+
+    return true;
+}
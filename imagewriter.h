@@ -0,0 +1,98 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include "hdrmerge.h"
+#include <QFile>
+#include <QImage>
+#include <QList>
+#include <QString>
+
+/* Rows written at once by writeRGBE() */
+#define IMAGE_BAND 64
+/* Default OpenEXR tile side, in pixels */
+#define EXR_TILE 64
+
+bool writeRGBE(QString path, const RadianceMap &hdr);
+bool writeEXR(QString path, const RadianceMap &hdr, int tileSize = EXR_TILE,
+              bool half = true);
+
+/* Radiance RGBE .hdr, written by bands of rows
+ *
+ * Scanlines of a band are run length encoded in parallel
+ */
+class RGBEWriter
+{
+  public:
+    RGBEWriter();
+    ~RGBEWriter();
+
+    bool open(QString path, int w, int h);
+    bool writeRows(const RadianceMap &hdr, int y0, int y1);
+    bool close();
+
+  private:
+    QFile file;
+    int width;
+    int height;
+    int rowsWritten;
+};
+
+/* Tiled OpenEXR, RGB half or 32 bit float, written by bands of rows
+ *
+ * Tiles of a band are encoded and ZIP compressed in parallel,
+ * tile offsets are written on close : only one band of
+ * compressed tiles is held in memory
+ */
+class ExrWriter
+{
+  public:
+    ExrWriter();
+    ~ExrWriter();
+
+    bool open(QString path, int w, int h, int tile = EXR_TILE,
+              bool half = true, bool compress = true);
+    bool writeRows(const RadianceMap &hdr, int y0, int y1);
+    bool close();
+
+  private:
+    QFile file;
+    int width;
+    int height;
+    int tileSize;
+    bool halfFloat;
+    bool zip;
+    int rowsWritten;
+    qint64 tableOffset;
+    QList<quint64> tileOffsets;
+
+    void encodeTile(const RadianceMap &hdr, int tx, int ty, int first,
+                    QByteArray &chunk) const;
+};
+
+/* Baseline 8 bit RGB TIFF, written strip by strip
+ *
+ * Rows are appended as they are produced, directory is written
+ * on close : whole image is never held in memory
+ * All strips but the last one must have the same height
+ */
+class TiffWriter
+{
+  public:
+    TiffWriter();
+    ~TiffWriter();
+
+    bool open(QString path, int w, int h);
+    bool writeRows(const QImage &rows);
+    bool close();
+
+  private:
+    QFile file;
+    int width;
+    int height;
+    int rowsWritten;
+    int rowsPerStrip;
+    QList<quint32> stripOffsets;
+    QList<quint32> stripCounts;
+};
+
+#endif // IMAGEWRITER_H
@@ -1,4 +1,7 @@
 #include "liveviewworker.h"
+#include "trace.h"
+#include <QBuffer>
+#include <QImageReader>
 
 /*! \brief LiveViewWorker constructor
  *
@@ -7,6 +10,8 @@
 LiveViewWorker::LiveViewWorker(QObject *parent) : QObject(parent)
 {
     liveViewRun = true;
+    decodeScale = 1;
+    display = false;
 }
 
 void LiveViewWorker::setCamera(RemoteCamera *camera)
@@ -20,12 +25,36 @@ void LiveViewWorker::setCamera(RemoteCamera *camera)
  */
 void LiveViewWorker::captureLiveView()
 {
+    Trace::setThreadName("liveview");
+
     while (liveViewRun) {
-        if (c->captureLiveView() < 0)
+        TRACE_SCOPE("frame", "liveview");
+
+        /* Frame is read where the camera wrote it */
+        QByteArray frame;
+        if (c->captureLiveView(frame) < 0)
             break;
 
-        liveView = QImage("/tmp/liveview.jpg");
-        emit imageReady(&liveView);
+        {
+            TRACE_SCOPE("decode", "liveview");
+            QBuffer buffer(&frame);
+            buffer.open(QIODevice::ReadOnly);
+            QImageReader reader(&buffer, "JPG");
+            /* Downscaled while decoded when nothing is displayed */
+            if (!display && decodeScale > 1)
+                reader.setScaledSize(reader.size() / decodeScale);
+            liveView = reader.read();
+        }
+        if (display) {
+            emit imageReady(&liveView);
+            analysisView = decodeScale > 1
+                               ? liveView.scaled(liveView.size() / decodeScale,
+                                                 Qt::IgnoreAspectRatio,
+                                                 Qt::FastTransformation)
+                               : liveView;
+        } else
+            analysisView = liveView;
+        emit analysisReady(&analysisView);
     }
 }
 
@@ -37,3 +66,23 @@ void LiveViewWorker::setLiveViewRunState(bool state)
 {
     liveViewRun = state;
 }
+
+/*! \brief Set liveview decode downscale
+ *
+ * Frames are analysed at 1/scale of their size : exposure
+ * ratings need far less than full liveview resolution
+ */
+void LiveViewWorker::setDecodeScale(int scale)
+{
+    decodeScale = qMax(1, scale);
+}
+
+/*! \brief Set whether frames are displayed
+ *
+ * Displayed frames are decoded at full size, only the copy
+ * handed to analysis is downscaled
+ */
+void LiveViewWorker::setDisplay(bool enable)
+{
+    display = enable;
+}
@@ -13,9 +13,14 @@ class LiveViewWorker : public QObject
 
     void setCamera(RemoteCamera *camera);
     void setLiveViewRunState(bool state);
+    void setDecodeScale(int scale);
+    void setDisplay(bool enable);
 
   signals:
+    /* Full size frame, for display */
     void imageReady(QImage *image);
+    /* Frame at decode scale, for exposure analysis */
+    void analysisReady(QImage *image);
 
   public slots:
     void captureLiveView();
@@ -23,7 +28,10 @@ class LiveViewWorker : public QObject
   private:
     RemoteCamera *c;
     QImage liveView;
+    QImage analysisView;
     bool liveViewRun;
+    int decodeScale;
+    bool display;
 };
 
 #endif // LIVEVIEWWORKER_H
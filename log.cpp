@@ -0,0 +1,345 @@
+#include "log.h"
+#include <QList>
+#include <QMutex>
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+typedef struct {
+    logEvent events[LOG_RING_SIZE];
+    /* Written by the owner thread only */
+    std::atomic<quint64> head;
+    /* Written by the drain thread only */
+    std::atomic<quint64> tail;
+    std::atomic<quint64> dropped;
+    /* Owner thread exited, freed once drained */
+    std::atomic<bool> closed;
+} logRing;
+
+/* Drain state. Never destroyed : the drain thread runs until
+ * the process exits */
+typedef struct {
+    /* Only contended when a thread logs for the first time */
+    QMutex registryLock;
+    QList<logRing *> registry;
+    /* One drain at a time : drain thread or flush() */
+    QMutex drainLock;
+    std::vector<logEvent> batch;
+    FILE *file;
+    QString path;
+    qint64 fileSize;
+    qint64 maxSize;
+    int files;
+} logState;
+
+static const char levelNames[] = {'D', 'I', 'W', 'E'};
+
+/* Marks the ring of an exiting thread as closed */
+class ringOwner
+{
+  public:
+    logRing *ring = nullptr;
+    ~ringOwner()
+    {
+        if (ring)
+            ring->closed.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local ringOwner localRing;
+
+static void drainLoop();
+
+/*! \brief Get the drain state
+ *
+ * Starts the drain thread on first use
+ */
+static logState *state()
+{
+    static logState *s = []() {
+        logState *n = new logState();
+        n->file = nullptr;
+        n->fileSize = 0;
+        n->maxSize = qint64(LOG_FILE_SIZE) << 20;
+        n->files = LOG_FILES;
+        std::thread(drainLoop).detach();
+        atexit(Log::flush);
+        return n;
+    }();
+    return s;
+}
+
+/*! \brief Get the calling thread ring
+ *
+ * Allocates and registers it on first use
+ */
+static logRing *getLocalRing()
+{
+    if (!localRing.ring) {
+        logState *s = state();
+        logRing *r = new logRing();
+        r->head = 0;
+        r->tail = 0;
+        r->dropped = 0;
+        r->closed = false;
+        s->registryLock.lock();
+        s->registry.append(r);
+        s->registryLock.unlock();
+        localRing.ring = r;
+    }
+    return localRing.ring;
+}
+
+/*! \brief Reserve next event of the calling thread
+ *
+ * Returns nullptr if its ring is full, the message is dropped
+ */
+logEvent *Log::reserve(LogLevel level, const char *format)
+{
+    logRing *r = getLocalRing();
+    quint64 head = r->head.load(std::memory_order_relaxed);
+
+    if (head - r->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    logEvent *e = &r->events[head & (LOG_RING_SIZE - 1)];
+    auto t = std::chrono::system_clock::now().time_since_epoch();
+    e->time = std::chrono::duration_cast<std::chrono::microseconds>(t).count();
+    e->format = format;
+    e->level = level;
+    e->argc = 0;
+    e->textSize = 0;
+
+    return e;
+}
+
+/*! \brief Publish the event reserved by the calling thread
+ */
+void Log::commit()
+{
+    logRing *r = localRing.ring;
+
+    r->head.store(r->head.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+}
+
+/*! \brief Format one conversion of a printf format
+ *
+ * spec is the conversion without length modifiers, arguments
+ * are converted to the type it expects
+ */
+static void formatArg(QByteArray &out, QByteArray spec, char conv,
+                      const logEvent &e, int i)
+{
+    char buf[256];
+    quint8 type = e.types[i];
+
+    if (conv == 's') {
+        if (type == LOG_ARG_STRING)
+            snprintf(buf, sizeof(buf), (spec + 's').constData(),
+                     e.text + e.args[i].u);
+        else
+            snprintf(buf, sizeof(buf), "<?>");
+    } else if (strchr("fFeEgGaA", conv)) {
+        double v = type == LOG_ARG_DOUBLE ? e.args[i].d
+                   : type == LOG_ARG_UINT ? double(e.args[i].u)
+                                          : double(e.args[i].i);
+        snprintf(buf, sizeof(buf), (spec + conv).constData(), v);
+    } else if (conv == 'c') {
+        snprintf(buf, sizeof(buf), (spec + 'c').constData(),
+                 int(e.args[i].i));
+    } else {
+        long long v = type == LOG_ARG_DOUBLE ? (long long)e.args[i].d
+                                             : (long long)e.args[i].i;
+        snprintf(buf, sizeof(buf), (spec + "ll" + conv).constData(), v);
+    }
+    out += buf;
+}
+
+/*! \brief Format an event message, as printf would
+ */
+static QByteArray formatEvent(const logEvent &e)
+{
+    QByteArray out;
+    int arg = 0;
+
+    for (const char *p = e.format; *p;) {
+        if (*p != '%') {
+            out += *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out += '%';
+            p += 2;
+            continue;
+        }
+        const char *start = p++;
+        while (*p && strchr("-+ #0", *p))
+            p++;
+        while (isdigit(*p) || *p == '.')
+            p++;
+        QByteArray spec(start, p - start);
+        while (*p && strchr("hlLqjzt", *p))
+            p++;
+        if (!*p)
+            break;
+        char conv = *p++;
+        if (arg < e.argc)
+            formatArg(out, spec, conv, e, arg++);
+        else
+            out += "<?>";
+    }
+    if (!out.endsWith('\n'))
+        out += '\n';
+
+    return out;
+}
+
+/*! \brief Open log file, rotating previous ones
+ *
+ * path becomes path.1, path.1 becomes path.2 and so on,
+ * up to the number of kept files
+ */
+static void rotate(logState *s)
+{
+    QByteArray path = s->path.toLocal8Bit();
+
+    if (s->file)
+        fclose(s->file);
+    s->file = nullptr;
+    s->fileSize = 0;
+    if (path.isEmpty())
+        return;
+
+    for (int i = s->files - 1; i > 0; i--)
+        rename((path + "." + QByteArray::number(i)).constData(),
+               (path + "." + QByteArray::number(i + 1)).constData());
+    if (s->files > 0)
+        rename(path.constData(), (path + ".1").constData());
+
+    s->file = fopen(path.constData(), "w");
+    if (!s->file)
+        fprintf(stderr, "[Log] Could not write %s\n", path.constData());
+}
+
+/*! \brief Write drained events to the console and the log file
+ *
+ * Called with drainLock held
+ */
+static void writeBatch(logState *s)
+{
+    std::stable_sort(s->batch.begin(), s->batch.end(),
+                     [](const logEvent &a, const logEvent &b) {
+                         return a.time < b.time;
+                     });
+
+    for (const logEvent &e : s->batch) {
+        QByteArray message = formatEvent(e);
+        FILE *console = e.level >= LOG_LEVEL_WARNING ? stderr : stdout;
+        fwrite(message.constData(), 1, message.size(), console);
+
+        if (!s->file)
+            continue;
+        char stamp[32];
+        time_t seconds = e.time / 1000000;
+        struct tm local;
+        localtime_r(&seconds, &local);
+        int n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+        n += snprintf(stamp + n, sizeof(stamp) - n, ".%03d %c ",
+                      int(e.time / 1000 % 1000), levelNames[e.level]);
+        fwrite(stamp, 1, n, s->file);
+        fwrite(message.constData(), 1, message.size(), s->file);
+        s->fileSize += n + message.size();
+        if (s->maxSize > 0 && s->fileSize >= s->maxSize)
+            rotate(s);
+    }
+    s->batch.clear();
+
+    fflush(stdout);
+    fflush(stderr);
+    if (s->file)
+        fflush(s->file);
+}
+
+/*! \brief Drain every ring once
+ *
+ * Rings of exited threads are freed once empty
+ */
+static void drain(logState *s)
+{
+    QMutexLocker locker(&s->drainLock);
+    QList<logRing *> rings;
+
+    s->registryLock.lock();
+    rings = s->registry;
+    s->registryLock.unlock();
+
+    for (logRing *r : rings) {
+        bool closed = r->closed.load(std::memory_order_acquire);
+        quint64 tail = r->tail.load(std::memory_order_relaxed);
+        quint64 head = r->head.load(std::memory_order_acquire);
+        for (; tail < head; tail++)
+            s->batch.push_back(r->events[tail & (LOG_RING_SIZE - 1)]);
+        r->tail.store(tail, std::memory_order_release);
+
+        quint64 dropped = r->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped)
+            fprintf(stderr, "[Log] %llu messages dropped, ring full\n",
+                    (unsigned long long)dropped);
+
+        if (closed) {
+            s->registryLock.lock();
+            s->registry.removeOne(r);
+            s->registryLock.unlock();
+            delete r;
+        }
+    }
+
+    if (!s->batch.empty())
+        writeBatch(s);
+}
+
+/*! \brief Drain thread loop
+ */
+static void drainLoop()
+{
+    for (;;) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(LOG_DRAIN_INTERVAL));
+        drain(state());
+    }
+}
+
+/*! \brief Set log file
+ *
+ * Rotated past sizeMb (0 for no limit), files previous ones kept.
+ * Empty path for console only
+ */
+void Log::setFile(QString path, int sizeMb, int files)
+{
+    logState *s = state();
+    QMutexLocker locker(&s->drainLock);
+
+    s->maxSize = qint64(sizeMb) << 20;
+    s->files = qMax(0, files);
+    if (path == s->path && s->file)
+        return;
+    s->path = path;
+    rotate(s);
+}
+
+/*! \brief Write every recorded message now
+ *
+ * Called at exit, so nothing recorded is lost
+ */
+void Log::flush()
+{
+    drain(state());
+}
@@ -0,0 +1,165 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <QString>
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+/* Lowest level compiled in, calls below are removed by the compiler
+ * (DEFINES += LOG_LEVEL=0 for debug messages) */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/* Events per thread ring, a power of two */
+#define LOG_RING_SIZE 512
+/* Arguments of an event */
+#define LOG_MAX_ARGS 8
+/* Copied string arguments of an event, in bytes */
+#define LOG_TEXT_SIZE 160
+/* Drain period, in ms */
+#define LOG_DRAIN_INTERVAL 20
+/* Log file size before rotation, in MB */
+#define LOG_FILE_SIZE 10
+/* Rotated log files kept */
+#define LOG_FILES 3
+
+enum LogArgType { LOG_ARG_INT, LOG_ARG_UINT, LOG_ARG_DOUBLE, LOG_ARG_STRING };
+
+/* Event as recorded : printf format and raw arguments,
+ * formatted by the drain thread. String arguments are copied
+ * to text, their value is an offset in it */
+typedef struct {
+    /* Wall clock, in microseconds since epoch */
+    qint64 time;
+    const char *format;
+    quint8 level;
+    quint8 argc;
+    quint8 types[LOG_MAX_ARGS];
+    quint16 textSize;
+    union {
+        qint64 i;
+        quint64 u;
+        double d;
+    } args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+} logEvent;
+
+/* Asynchronous logging
+ *
+ * A message is recorded into a lock-free ring of the calling
+ * thread (single producer, single consumer) : format pointer,
+ * timestamp and arguments, nothing is formatted or written.
+ * A background thread drains every ring, formats messages in
+ * time order and writes them to the console and to a rotating
+ * log file. A full ring drops messages (counted) rather than
+ * block : logging never waits for the console or the disk.
+ *
+ * Formats must be string literals, printf conversions only
+ * (no '*' width). Messages below LOG_LEVEL are compiled out.
+ */
+namespace Log
+{
+void setFile(QString path, int sizeMb = LOG_FILE_SIZE, int files = LOG_FILES);
+void flush();
+logEvent *reserve(LogLevel level, const char *format);
+void commit();
+
+inline void packText(logEvent *e, const char *s)
+{
+    int offset = e->textSize;
+    int room = LOG_TEXT_SIZE - offset - 1;
+    int n = 0;
+
+    if (!s)
+        s = "(null)";
+    if (room > 0) {
+        n = strnlen(s, room);
+        memcpy(e->text + offset, s, n);
+    } else
+        offset = LOG_TEXT_SIZE - 1;
+    e->text[offset + n] = '\0';
+    e->textSize = qMin(offset + n + 1, LOG_TEXT_SIZE);
+    e->types[e->argc] = LOG_ARG_STRING;
+    e->args[e->argc++].u = offset;
+}
+
+inline void pack(logEvent *e, const char *s)
+{
+    packText(e, s);
+}
+
+inline void pack(logEvent *e, char *s)
+{
+    packText(e, s);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+pack(logEvent *e, T v)
+{
+    e->types[e->argc] = LOG_ARG_DOUBLE;
+    e->args[e->argc++].d = v;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value ||
+                               std::is_enum<T>::value>::type
+pack(logEvent *e, T v)
+{
+    if (std::is_unsigned<T>::value) {
+        e->types[e->argc] = LOG_ARG_UINT;
+        e->args[e->argc++].u = quint64(v);
+    } else {
+        e->types[e->argc] = LOG_ARG_INT;
+        e->args[e->argc++].i = qint64(v);
+    }
+}
+
+inline void packAll(logEvent *) {}
+
+template <typename T, typename... A>
+inline void packAll(logEvent *e, T v, A... rest)
+{
+    pack(e, v);
+    packAll(e, rest...);
+}
+
+template <typename... A>
+inline void record(LogLevel level, const char *format, A... args)
+{
+    static_assert(sizeof...(A) <= LOG_MAX_ARGS, "Too many log arguments");
+
+    logEvent *e = reserve(level, format);
+    if (!e)
+        return;
+    packAll(e, args...);
+    commit();
+}
+
+/* Never called : lets the compiler check formats against arguments */
+inline void __attribute__((format(printf, 1, 2))) check(const char *, ...) {}
+} // namespace Log
+
+#define LOG_EVENT(level, ...)                                                  \
+    do {                                                                       \
+        if (level >= LOG_LEVEL) {                                              \
+            if (false)                                                         \
+                Log::check(__VA_ARGS__);                                       \
+            Log::record(level, __VA_ARGS__);                                   \
+        }                                                                      \
+    } while (0)
+#define LOG_DEBUG(...) LOG_EVENT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_EVENT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_EVENT(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_EVENT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif // LOG_H
@@ -0,0 +1,366 @@
+#include "memorybudget.h"
+#include "log.h"
+#include "trace.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+
+/* Pixels of a SpillImage, resident or mapped from a file */
+class spillData
+{
+  public:
+    spillData(const QImage &image);
+    ~spillData();
+
+    QImage spill(QString folder);
+
+    QMutex mutex;
+    QImage resident;
+    QTemporaryFile *file;
+    uchar *map;
+    int width;
+    int height;
+    int bytesPerLine;
+    QImage::Format format;
+    qint64 bytes;
+    /* Counted in the budget, guarded by its mutex */
+    bool charged;
+};
+
+/*! \brief Get the process memory budget
+ *
+ * Never destroyed : images may be released by static objects
+ * at exit
+ */
+MemoryBudget &memoryBudget()
+{
+    static MemoryBudget *budget = new MemoryBudget();
+    return *budget;
+}
+
+/*! \brief MemoryBudget constructor
+ *
+ * No limit, spill files in system temporary folder
+ */
+MemoryBudget::MemoryBudget()
+{
+    limit = 0;
+    tracked = 0;
+    peakTracked = 0;
+    spillFolder = QDir::tempPath();
+}
+
+/*! \brief Set budget, in MB
+ *
+ * 0 for no limit
+ */
+void MemoryBudget::setLimit(int mb)
+{
+    QMutexLocker locker(&mutex);
+    limit = qint64(qMax(0, mb)) * 1024 * 1024;
+    released.wakeAll();
+}
+
+/*! \brief Set folder of spill files
+ */
+void MemoryBudget::setSpillFolder(QString folder)
+{
+    QMutexLocker locker(&mutex);
+    spillFolder = folder;
+}
+
+QString MemoryBudget::getSpillFolder()
+{
+    QMutexLocker locker(&mutex);
+    return spillFolder;
+}
+
+/*! \brief Track a large buffer
+ */
+void MemoryBudget::charge(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    tracked += bytes;
+    peakTracked = qMax(peakTracked, tracked);
+}
+
+/*! \brief Forget a large buffer, wakes waiting producers
+ */
+void MemoryBudget::credit(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    tracked -= bytes;
+    released.wakeAll();
+}
+
+bool MemoryBudget::fits(qint64 bytes, qint64 owned)
+{
+    return limit <= 0 || tracked <= owned || tracked + bytes <= limit;
+}
+
+/*! \brief Wait until bytes fit in budget, then charge them
+ *
+ * Caches are dropped first, then cold images are spilled,
+ * oldest first, without the lock held. owned is what caller
+ * holds itself, nobody else would release it.
+ * Returns false after timeout ms : bytes are charged anyway,
+ * caller goes on over budget. Caller credits them once released
+ */
+bool MemoryBudget::reserve(qint64 bytes, qint64 owned, int timeout)
+{
+    QElapsedTimer timer;
+    QMutexLocker locker(&mutex);
+    bool ok = true;
+    int next = 0;
+
+    timer.start();
+    while (!fits(bytes, owned)) {
+        if (next < reclaimers.size()) {
+            MemoryReclaimer *r = reclaimers.at(next++);
+            reclaiming.append(r);
+            locker.unlock();
+            {
+                TRACE_SCOPE("memory_reclaim", "memory");
+                r->reclaim();
+            }
+            locker.relock();
+            reclaiming.removeOne(r);
+            spilled.wakeAll();
+            continue;
+        }
+        if (!cold.isEmpty()) {
+            spillData *d = cold.takeFirst();
+            QString folder = spillFolder;
+            QImage dropped;
+            spilling.append(d);
+            locker.unlock();
+            {
+                TRACE_SCOPE("memory_spill", "memory");
+                dropped = d->spill(folder);
+            }
+            locker.relock();
+            /* If it failed, image stays resident and tracked, it is
+             * not tried again */
+            if (!dropped.isNull()) {
+                d->charged = false;
+                tracked -= d->bytes;
+            }
+            spilling.removeOne(d);
+            spilled.wakeAll();
+            /* Pixels may go back to the buffer pool, which
+             * credits the budget */
+            locker.unlock();
+            dropped = QImage();
+            locker.relock();
+            continue;
+        }
+
+        TRACE_SCOPE("memory_wait", "memory");
+        qint64 left = timeout - timer.elapsed();
+        if (left <= 0 || !released.wait(&mutex, left)) {
+            LOG_WARNING("[MemoryBudget] %lld MB used, going on over budget\n",
+                        (long long)(tracked >> 20));
+            ok = false;
+            break;
+        }
+    }
+
+    tracked += bytes;
+    peakTracked = qMax(peakTracked, tracked);
+
+    return ok;
+}
+
+/*! \brief Get tracked bytes
+ */
+qint64 MemoryBudget::used()
+{
+    QMutexLocker locker(&mutex);
+    return tracked;
+}
+
+/*! \brief Get high-water mark of tracked bytes
+ */
+qint64 MemoryBudget::peak()
+{
+    QMutexLocker locker(&mutex);
+    return peakTracked;
+}
+
+/*! \brief Track a resident spillable image
+ */
+void MemoryBudget::addCold(spillData *d)
+{
+    QMutexLocker locker(&mutex);
+    cold.append(d);
+    d->charged = true;
+    tracked += d->bytes;
+    peakTracked = qMax(peakTracked, tracked);
+}
+
+/*! \brief Forget a spillable image, about to be destroyed
+ *
+ * Waits for an ongoing spill of it. A spilled image is not
+ * tracked anymore
+ */
+void MemoryBudget::removeCold(spillData *d)
+{
+    QMutexLocker locker(&mutex);
+    while (spilling.contains(d))
+        spilled.wait(&mutex);
+    cold.removeOne(d);
+    if (d->charged) {
+        d->charged = false;
+        tracked -= d->bytes;
+        released.wakeAll();
+    }
+}
+
+/*! \brief Ask a cache to drop its buffers when room is needed
+ */
+void MemoryBudget::addReclaimer(MemoryReclaimer *r)
+{
+    QMutexLocker locker(&mutex);
+    reclaimers.append(r);
+}
+
+/*! \brief Forget a cache, about to be destroyed
+ *
+ * Waits for an ongoing reclaim of it
+ */
+void MemoryBudget::removeReclaimer(MemoryReclaimer *r)
+{
+    QMutexLocker locker(&mutex);
+    while (reclaiming.contains(r))
+        spilled.wait(&mutex);
+    reclaimers.removeOne(r);
+}
+
+/*! \brief Reserve bytes, waiting for them to fit in budget
+ */
+MemoryReservation::MemoryReservation(qint64 bytes, qint64 owned)
+{
+    this->bytes = bytes;
+    memoryBudget().reserve(bytes, owned);
+}
+
+/*! \brief Give reserved bytes back
+ */
+MemoryReservation::~MemoryReservation()
+{
+    memoryBudget().credit(bytes);
+}
+
+/*! \brief Give part of reserved bytes back
+ *
+ * As soon as buffers are freed, or charged otherwise
+ */
+void MemoryReservation::release(qint64 part)
+{
+    part = qMin(part, bytes);
+    bytes -= part;
+    memoryBudget().credit(part);
+}
+
+/*! \brief spillData constructor
+ *
+ * Keeps image resident
+ */
+spillData::spillData(const QImage &image)
+{
+    resident = image;
+    file = nullptr;
+    map = nullptr;
+    width = image.width();
+    height = image.height();
+    bytesPerLine = image.bytesPerLine();
+    format = image.format();
+    bytes = image.sizeInBytes();
+    charged = false;
+}
+
+spillData::~spillData()
+{
+    memoryBudget().removeCold(this);
+    if (file) {
+        file->unmap(map);
+        delete file;
+    }
+}
+
+/*! \brief Write pixels to a temporary file and map it
+ *
+ * Returns the resident image, to be dropped by caller, or
+ * a null image if pixels could not be spilled (kept resident)
+ */
+QImage spillData::spill(QString folder)
+{
+    QMutexLocker locker(&mutex);
+
+    if (file || resident.isNull())
+        return QImage();
+
+    QTemporaryFile *f = new QTemporaryFile(folder + "/autohdr_spill_XXXXXX");
+    if (!f->open() ||
+        f->write((const char *)resident.constBits(), bytes) != bytes ||
+        !f->flush() || !(map = f->map(0, bytes))) {
+        LOG_ERROR("[MemoryBudget] Could not spill to %s\n",
+                  folder.toStdString().c_str());
+        delete f;
+        return QImage();
+    }
+    file = f;
+
+    QImage dropped = resident;
+    resident = QImage();
+
+    return dropped;
+}
+
+SpillImage::SpillImage()
+{
+}
+
+/*! \brief Track an image, it can be spilled from now on
+ */
+SpillImage::SpillImage(const QImage &image)
+{
+    if (image.isNull())
+        return;
+    d = QSharedPointer<spillData>(new spillData(image));
+    memoryBudget().addCold(d.data());
+}
+
+bool SpillImage::isNull() const
+{
+    return !d;
+}
+
+bool SpillImage::isSpilled() const
+{
+    if (!d)
+        return false;
+    QMutexLocker locker(&d->mutex);
+    return d->file;
+}
+
+/*! \brief Get image, resident or mapped from its spill file
+ *
+ * A mapped image is read only and keeps the file mapped
+ * as long as it lives
+ */
+QImage SpillImage::image() const
+{
+    if (!d)
+        return QImage();
+
+    QMutexLocker locker(&d->mutex);
+    if (!d->file)
+        return d->resident;
+
+    return QImage(
+        (const uchar *)d->map, d->width, d->height, d->bytesPerLine,
+        d->format,
+        [](void *p) { delete static_cast<QSharedPointer<spillData> *>(p); },
+        new QSharedPointer<spillData>(d));
+}
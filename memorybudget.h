@@ -0,0 +1,121 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QWaitCondition>
+
+/* Longest wait of a producer for memory, in ms */
+#define MEMORY_WAIT_TIMEOUT 60000
+
+class spillData;
+
+/* Holder of buffers it can read again (caches)
+ *
+ * Asked to drop them when budget needs room, before cold
+ * images are spilled. Called from any thread
+ */
+class MemoryReclaimer
+{
+  public:
+    virtual ~MemoryReclaimer() {}
+    virtual void reclaim() = 0;
+};
+
+/* Process-wide memory budget
+ *
+ * Tracks large buffers : pooled buffers (see BufferPool),
+ * resident spillable images and reservations. Producers reserve
+ * what they are about to allocate (see MemoryReservation) : caches
+ * are first dropped, cold images are then spilled to memory-mapped
+ * temporary files, then the producer blocks until enough is
+ * released.
+ * A producer never waits when all tracked buffers are its own,
+ * or past a timeout : a budget too small for a single job slows
+ * it down, it does not deadlock it.
+ * Thread safe
+ */
+class MemoryBudget
+{
+  public:
+    MemoryBudget();
+
+    void setLimit(int mb);
+    void setSpillFolder(QString folder);
+    QString getSpillFolder();
+    void charge(qint64 bytes);
+    void credit(qint64 bytes);
+    bool reserve(qint64 bytes, qint64 owned = 0,
+                 int timeout = MEMORY_WAIT_TIMEOUT);
+    qint64 used();
+    qint64 peak();
+
+    void addCold(spillData *d);
+    void removeCold(spillData *d);
+    void addReclaimer(MemoryReclaimer *r);
+    void removeReclaimer(MemoryReclaimer *r);
+
+  private:
+    QMutex mutex;
+    QWaitCondition released;
+    QWaitCondition spilled;
+    qint64 limit;
+    qint64 tracked;
+    qint64 peakTracked;
+    QString spillFolder;
+    /* Resident spillable images, oldest first */
+    QList<spillData *> cold;
+    /* Images being written to disk, without the lock held */
+    QList<spillData *> spilling;
+    QList<MemoryReclaimer *> reclaimers;
+    /* Reclaimers dropping buffers, without the lock held */
+    QList<MemoryReclaimer *> reclaiming;
+
+    bool fits(qint64 bytes, qint64 owned);
+};
+
+MemoryBudget &memoryBudget();
+
+/* Buffers about to be allocated outside of the buffer pool
+ * (decoded shots), charged to the memory budget until released
+ * or destroyed */
+class MemoryReservation
+{
+  public:
+    explicit MemoryReservation(qint64 bytes, qint64 owned = 0);
+    ~MemoryReservation();
+
+    void release(qint64 part);
+
+  private:
+    qint64 bytes;
+
+    Q_DISABLE_COPY(MemoryReservation)
+};
+
+/* Image that can be spilled to disk
+ *
+ * Holds an image until memory budget needs room, its pixels
+ * are then written to a temporary file and mapped back : image()
+ * keeps working, pages are read in on access and belong to the
+ * page cache, not to the budget.
+ * Copies share the same image, spilled once
+ */
+class SpillImage
+{
+  public:
+    SpillImage();
+    SpillImage(const QImage &image);
+
+    bool isNull() const;
+    bool isSpilled() const;
+    QImage image() const;
+
+  private:
+    QSharedPointer<spillData> d;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,565 @@
+#include "mergeworker.h"
+#include "config.h"
+#include "fusion.h"
+#include "hdrmerge.h"
+#include "imagewriter.h"
+#include "log.h"
+#include "memorybudget.h"
+#include "parallel.h"
+#include "rawloader.h"
+#include "tonemap.h"
+#include "trace.h"
+#include <QImage>
+#include <QImageReader>
+
+/*! \brief MergeWorker constructor
+ *
+ * In-process HDR composition, runs in Composition thread
+ * Uses reference to Config instance for LDR output
+ */
+MergeWorker::MergeWorker(Config *config, QObject *parent) : QObject(parent)
+{
+    conf = config;
+    mergeRun = true;
+    threadBudget = 0;
+}
+
+/*! \brief Set merge state
+ *
+ * If state = false merge stops at next step,
+ * no result is written and an error is notified
+ * A suspended merge is resumed to stop
+ */
+void MergeWorker::setMergeRunState(bool state)
+{
+    mergeRun = state;
+    if (!state)
+        gate.resume();
+}
+
+/*! \brief Set number of threads a merge may use
+ *
+ * 0 for all cores. Applies from next merge step
+ */
+void MergeWorker::setThreadBudget(int threads)
+{
+    threadBudget = threads;
+}
+
+/*! \brief Get number of threads of next merge step
+ *
+ * Thread budget if set, else tuned thread count (0 for all cores)
+ */
+int MergeWorker::mergeThreads()
+{
+    if (threadBudget > 0 || !conf)
+        return threadBudget;
+
+    return conf->getMergeThreads();
+}
+
+/*! \brief Suspend full resolution work
+ *
+ * Ongoing merge, tone mapping or fusion waits at its next
+ * parallel step, keeping its state. Drafts are not suspended
+ */
+void MergeWorker::suspend()
+{
+    gate.suspend();
+}
+
+/*! \brief Resume suspended work
+ */
+void MergeWorker::resume()
+{
+    gate.resume();
+}
+
+/*! \brief Decode a shot for a draft
+ *
+ * JPEG shots are downscaled while decoded, RAW shots are
+ * decoded at half size, then both are scaled to width
+ */
+static QImage loadDraft(QString path, int width)
+{
+    QImage image;
+
+    if (isRawFile(path)) {
+        loadShot(path, RAW_HALF, image);
+    } else {
+        QImageReader reader(path);
+        QSize size = reader.size();
+        if (size.width() > width)
+            reader.setScaledSize(
+                QSize(width, size.height() * width / size.width()));
+        image = reader.read();
+    }
+    if (image.width() > width)
+        image = image.scaledToWidth(width, Qt::SmoothTransformation);
+
+    return image;
+}
+
+/*! \brief Average radiance over blocks, down to width
+ */
+static RadianceMap shrinkRadiance(const RadianceMap &hdr, int width)
+{
+    int f = (hdr.width() + width - 1) / width;
+
+    if (f <= 1)
+        return hdr;
+
+    RadianceMap out(hdr.width() / f, hdr.height() / f, 3);
+    out.fill(0);
+    for (int c = 0; c < 3; c++) {
+        for (int y = 0; y < out.height() * f; y++) {
+            const float *pi = hdr.row(c, y);
+            float *po = out.row(c, y / f);
+            for (int x = 0; x < out.width() * f; x++)
+                po[x / f] += pi[x];
+        }
+        for (int y = 0; y < out.height(); y++) {
+            float *po = out.row(c, y);
+            for (int x = 0; x < out.width(); x++)
+                po[x] /= f * f;
+        }
+    }
+
+    return out;
+}
+
+/*! \brief Write and notify a draft of a radiance map
+ *
+ * Global operator at draft width, saved as <folder>ldr_draft.jpg
+ * Draft failures are not notified, merge goes on
+ */
+void MergeWorker::writeDraft(const RadianceMap &hdr, QString folder)
+{
+    TRACE_SCOPE("draft_tonemap", "composition");
+
+    QImage ldr = toneMapImage(
+        shrinkRadiance(hdr, conf ? conf->getDraftWidth() : DRAFT_WIDTH),
+        TM_REINHARD);
+    if (ldr.isNull())
+        return;
+    if (ldr.save(folder + "ldr_draft.jpg", "JPG", 90))
+        LOG_INFO("[Composition] Draft written to %sldr_draft.jpg\n",
+                 folder.toStdString().c_str());
+    else
+        LOG_ERROR("[Composition] Could not write draft\n");
+    emit mergeDraft(ldr);
+}
+
+/*! \brief Compose a fast low resolution draft
+ *
+ * Shots are decoded downscaled and merged without deghosting,
+ * with the calibrated response if there is one (never calibrated
+ * here), see writeDraft()
+ * Runs before full resolution merge and is never suspended
+ */
+void MergeWorker::draft(QStringList paths, QStringList exposures,
+                        QString folder, QString camera, QString ISO)
+{
+    QList<QImage> images;
+    QList<double> times;
+    int n = paths.size();
+    int width = conf ? conf->getDraftWidth() : DRAFT_WIDTH;
+
+    Trace::setThreadName("composition");
+    TRACE_SCOPE("draft", "composition");
+    parallelThreadLimit() = mergeThreads();
+    parallelGate() = nullptr;
+    parallelPriority() = TASK_BACKGROUND;
+
+    /* Errors are reported by full resolution merge */
+    for (int i = 0; i < n; i++) {
+        times.append(exposureTime(exposures.at(i)));
+        if (times.last() <= 0)
+            return;
+        images.append(QImage());
+    }
+    parallelFor(0, n, [&](int first, int last) {
+        for (int i = first; i < last; i++)
+            images[i] = loadDraft(paths.at(i), width);
+    });
+    for (int i = 0; i < n; i++)
+        if (images.at(i).isNull() || !mergeRun)
+            return;
+
+    QList<QPoint> offsets;
+    if (conf && conf->getCompAlign())
+        offsets = alignExposures(images);
+    cameraResponse response;
+    bool calibrated = conf && conf->getResponseCalibration() &&
+                      loadResponse(conf->getResponseFile(), camera, ISO,
+                                   response);
+
+    RadianceMap hdr;
+    if (!mergeExposures(images, times, hdr, offsets, 0,
+                        calibrated ? &response : nullptr))
+        return;
+    images.clear();
+
+    writeDraft(hdr, folder);
+}
+
+/*! \brief Merge shots into an HDR image
+ *
+ * Decodes all shots in parallel (RAW files in rawMode, see
+ * RawDecodeMode), aligns them if enabled,
+ * merges them with the response calibrated for camera and ISO
+ * (calibrated on these shots if there is none yet),
+ * and saves the radiance map as <folder>hdr_result.exr (or .hdr)
+ * If enabled, then fuses them into <folder>ldr_result.tif
+ */
+void MergeWorker::merge(QStringList paths, QStringList exposures,
+                        QString folder, int rawMode, QString camera,
+                        QString ISO)
+{
+    QList<QImage> images;
+    QList<double> times;
+    int n = paths.size();
+
+    Trace::setThreadName("composition");
+    TRACE_SCOPE("native_merge", "composition");
+    parallelThreadLimit() = mergeThreads();
+    parallelGate() = &gate;
+    parallelPriority() = TASK_BACKGROUND;
+
+    for (int i = 0; i < n; i++) {
+        times.append(exposureTime(exposures.at(i)));
+        if (times.last() <= 0) {
+            emit mergeError("Unknown exposure time " + exposures.at(i));
+            return;
+        }
+        images.append(QImage());
+    }
+
+    /* Decoded shots are the largest buffers of a merge. Once room
+     * is made, RAW ones are charged by the buffer pool itself */
+    qint64 bytes = 0, pooled = 0;
+    for (int i = 0; i < n; i++) {
+        qint64 b = shotBytes(paths.at(i), RawDecodeMode(rawMode));
+        bytes += b;
+        if (isRawFile(paths.at(i)))
+            pooled += b;
+    }
+    MemoryReservation reservation(bytes);
+    reservation.release(pooled);
+
+    {
+        TRACE_SCOPE("decode", "composition");
+        parallelFor(0, n, [&](int first, int last) {
+            for (int i = first; i < last; i++)
+                loadShot(paths.at(i), RawDecodeMode(rawMode), images[i]);
+        });
+    }
+    for (int i = 0; i < n; i++) {
+        if (images.at(i).isNull()) {
+            emit mergeError("Could not read " + paths.at(i));
+            return;
+        }
+    }
+    if (!mergeRun) {
+        emit mergeError("HDR composition aborted");
+        return;
+    }
+    emit mergeProgress(30);
+
+    QList<QPoint> offsets;
+    if (conf && conf->getCompAlign()) {
+        offsets = alignExposures(images);
+        emit mergeProgress(40);
+    }
+
+    cameraResponse response;
+    bool calibrated = false;
+    if (conf && conf->getResponseCalibration() && !camera.isEmpty()) {
+        calibrated = loadResponse(conf->getResponseFile(), camera, ISO,
+                                  response);
+        if (!calibrated) {
+            ResponseSampler sampler;
+            for (int i = 0; i < n; i++)
+                sampler.add(images.at(i), times.at(i),
+                            i < offsets.size() ? offsets.at(i) : QPoint(0, 0));
+            if (sampler.count() == n)
+                calibrated = storeResponse(sampler, camera, ISO, response);
+        }
+    }
+
+    RadianceMap hdr;
+    if (!mergeExposures(images, times, hdr, offsets,
+                        conf ? conf->getDeghost() : 0,
+                        calibrated ? &response : nullptr)) {
+        emit mergeError("Shots cannot be merged together");
+        return;
+    }
+    images.clear();
+    reservation.release(bytes);
+    emit mergeProgress(60);
+
+    if (writeResults(hdr, paths, folder))
+        emit mergeFinished(0);
+}
+
+/*! \brief Start an incremental merge
+ *
+ * Forgets any previous stream
+ * First shot is the deghosting reference
+ * Shots are merged with the response calibrated for camera
+ * and ISO. Shots are already merged when the whole bracket is
+ * known : if there is no response yet, stream is merged with
+ * the sRGB curve and sampled to calibrate the next ones
+ */
+void MergeWorker::beginStream(QString camera, QString ISO)
+{
+    cameraResponse response;
+
+    Trace::setThreadName("composition");
+
+    accumulator.reset();
+    accumulator.setDeghosting(conf ? conf->getDeghost() : 0);
+    streamSampler.reset();
+    streamCamera.clear();
+    streamISO.clear();
+    if (conf && conf->getResponseCalibration() && !camera.isEmpty()) {
+        if (loadResponse(conf->getResponseFile(), camera, ISO, response)) {
+            accumulator.setResponse(&response);
+        } else {
+            accumulator.setResponse(nullptr);
+            streamCamera = camera;
+            streamISO = ISO;
+        }
+    } else
+        accumulator.setResponse(nullptr);
+    streamError.clear();
+    streamPyramid.clear();
+    streamOffset = QPoint(0, 0);
+}
+
+/*! \brief Accumulate a shot as soon as it is captured
+ *
+ * If enabled, shot is aligned on previous one (first shot
+ * is the reference)
+ * Errors are kept for finishStream(), capture goes on
+ */
+void MergeWorker::addShot(QString path, QString exposure)
+{
+    if (!mergeRun || !streamError.isEmpty())
+        return;
+
+    TRACE_SCOPE("incremental_shot", "composition");
+    parallelThreadLimit() = mergeThreads();
+    parallelGate() = &gate;
+    parallelPriority() = TASK_BACKGROUND;
+
+    double time = exposureTime(exposure);
+    if (time <= 0) {
+        streamError = "Unknown exposure time " + exposure;
+        return;
+    }
+    QImage image;
+    RawDecodeMode mode = conf ? conf->getRawMode() : RAW_FULL;
+    qint64 bytes = shotBytes(path, mode);
+    MemoryReservation reservation(bytes, accumulator.memory());
+    /* Once room is made, buffer pool charges RAW shots itself */
+    if (isRawFile(path))
+        reservation.release(bytes);
+    loadShot(path, mode, image);
+    if (image.isNull()) {
+        streamError = "Could not read " + path;
+        return;
+    }
+    if (conf && conf->getCompAlign()) {
+        grayPyramid pyr;
+        buildGrayPyramid(image, pyr);
+        if (!streamPyramid.isEmpty())
+            streamOffset += computeShift(streamPyramid, pyr);
+        streamPyramid = pyr;
+    }
+    if (!accumulator.add(image, time, streamOffset))
+        streamError = "Shots cannot be merged together";
+    /* RAW shots are not calibrated */
+    if (!streamCamera.isEmpty() &&
+        !streamSampler.add(image, time, streamOffset))
+        streamCamera.clear();
+}
+
+/*! \brief End an incremental merge
+ *
+ * All shots were accumulated during capture : only radiance
+ * computing and outputs are left, draft is the radiance map
+ * shrunk (see writeDraft())
+ */
+void MergeWorker::finishStream(QStringList paths, QString folder)
+{
+    RadianceMap hdr;
+
+    TRACE_SCOPE("incremental_finish", "composition");
+    parallelThreadLimit() = mergeThreads();
+    parallelGate() = &gate;
+    parallelPriority() = TASK_BACKGROUND;
+
+    if (!streamError.isEmpty()) {
+        emit mergeError(streamError);
+        return;
+    }
+    if (accumulator.count() != paths.size() || !accumulator.result(hdr)) {
+        accumulator.reset();
+        emit mergeError(mergeRun ? "Incomplete incremental merge"
+                                 : "HDR composition aborted");
+        return;
+    }
+    emit mergeProgress(60);
+    /* Shots were merged during capture, draft comes from result */
+    if (conf && conf->getDraftWidth() > 0)
+        writeDraft(hdr, folder);
+
+    if (!streamCamera.isEmpty() && streamSampler.count() == paths.size()) {
+        cameraResponse response;
+        storeResponse(streamSampler, streamCamera, streamISO, response);
+    }
+    streamSampler.reset();
+
+    if (writeResults(hdr, paths, folder))
+        emit mergeFinished(0);
+}
+
+/*! \brief Drop an incremental merge
+ *
+ * Accumulated shots, samples and alignment are released
+ */
+void MergeWorker::cancelStream()
+{
+    accumulator.reset();
+    streamSampler.reset();
+    streamPyramid.clear();
+    streamOffset = QPoint(0, 0);
+    streamCamera.clear();
+    streamISO.clear();
+    streamError.clear();
+}
+
+/*! \brief Tone map a merged folder again
+ *
+ * Radiance map comes from cache (memory or folder cache file),
+ * shots are not read nor merged
+ */
+void MergeWorker::toneMap(QString folder, QStringList operators)
+{
+    RadianceMap hdr;
+
+    Trace::setThreadName("composition");
+    TRACE_SCOPE("cached_tonemap", "composition");
+    parallelThreadLimit() = mergeThreads();
+    parallelGate() = &gate;
+    parallelPriority() = TASK_BACKGROUND;
+
+    cache.setEnabled(conf && conf->getRadianceCache());
+    if (!cache.lookup(folder, hdr)) {
+        emit mergeError("No merged radiance map for " + folder);
+        return;
+    }
+
+    if (writeToneMapped(hdr, operators, folder))
+        emit mergeFinished(0);
+}
+
+/*! \brief Calibrate camera response and save it
+ *
+ * Response is recovered from sampled shots, then kept for
+ * camera and ISO in responses file
+ * Returns false if shots cannot be calibrated
+ */
+bool MergeWorker::storeResponse(ResponseSampler &sampler, QString camera,
+                                QString ISO, cameraResponse &response)
+{
+    if (!sampler.calibrate(response))
+        return false;
+
+    LOG_INFO("[Composition] Response calibrated for %s at ISO %s\n",
+             camera.toStdString().c_str(), ISO.toStdString().c_str());
+    /* Failing file is not fatal, response is calibrated again */
+    if (!saveResponse(conf->getResponseFile(), camera, ISO, response))
+        LOG_ERROR("[Composition] Could not save camera response\n");
+
+    return true;
+}
+
+/*! \brief Write one LDR image per operator
+ *
+ * Saved as <folder>ldr_<operator>.tif
+ * Notifies error and returns false on failure
+ */
+bool MergeWorker::writeToneMapped(const RadianceMap &hdr,
+                                  QStringList operators, QString folder)
+{
+    for (QString name : operators) {
+        ToneMapOperator op;
+        if (!toneMapOperator(name, op)) {
+            emit mergeError("Unknown tone mapping operator " + name);
+            return false;
+        }
+        QString output = folder + "ldr_" + toneMapName(op) + ".tif";
+        if (!::toneMap(hdr, op, output, &mergeRun)) {
+            emit mergeError(mergeRun ? "Could not write " + output
+                                     : "HDR composition aborted");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*! \brief Write HDR result, then LDR results if enabled
+ *
+ * Radiance map is cached, tone mapped with configured operators,
+ * then shots are fused
+ * Notifies error and returns false on failure
+ */
+bool MergeWorker::writeResults(RadianceMap &hdr, QStringList paths,
+                               QString folder)
+{
+    if (!mergeRun) {
+        emit mergeError("HDR composition aborted");
+        return false;
+    }
+    bool written;
+    if (!conf)
+        written = writeEXR(folder + "hdr_result.exr", hdr);
+    else if (conf->getHdrFormat() == HDR_RGBE)
+        written = writeRGBE(folder + conf->getHdrFileName(), hdr);
+    else
+        written = writeEXR(folder + conf->getHdrFileName(), hdr,
+                           conf->getExrTile(), conf->getExrHalf());
+    if (!written) {
+        emit mergeError("Could not write HDR result");
+        return false;
+    }
+    emit mergeProgress(75);
+    /* Failing cache file is not fatal, folder is merged again */
+    cache.setEnabled(conf && conf->getRadianceCache());
+    cache.store(folder, hdr);
+    if (conf && !writeToneMapped(hdr, conf->getToneMapOperators(), folder))
+        return false;
+    emit mergeProgress(85);
+    /* Fusion streams shots again, only cached map is kept */
+    hdr = RadianceMap();
+
+    /* Fusion decodes shots with Qt, RAW files cannot be */
+    bool raw = false;
+    for (int i = 0; i < paths.size(); i++)
+        raw |= isRawFile(paths.at(i));
+    if (raw && conf && conf->getCompFusion())
+        LOG_INFO("[Composition] RAW shots, exposure fusion skipped\n");
+
+    if (conf && conf->getCompFusion() && !raw &&
+        !fuseExposures(paths, folder + "ldr_result.tif",
+                       conf->getFusionTile(), &mergeRun)) {
+        emit mergeError(mergeRun ? "Could not fuse exposures"
+                                 : "HDR composition aborted");
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef MERGEWORKER_H
+#define MERGEWORKER_H
+
+#include "align.h"
+#include "hdrmerge.h"
+#include "parallel.h"
+#include "radiancecache.h"
+#include "response.h"
+#include <QImage>
+#include <QObject>
+#include <QStringList>
+#include <atomic>
+
+/* Default draft width, in pixels */
+#define DRAFT_WIDTH 1024
+
+class Config;
+
+class MergeWorker : public QObject
+{
+    Q_OBJECT
+  public:
+    explicit MergeWorker(Config *config = nullptr, QObject *parent = nullptr);
+
+    void setMergeRunState(bool state);
+    void setThreadBudget(int threads);
+    void suspend();
+    void resume();
+
+  signals:
+    void mergeDraft(QImage draft);
+    void mergeProgress(int percent);
+    void mergeFinished(int code);
+    void mergeError(QString msg);
+
+  public slots:
+    void merge(QStringList paths, QStringList exposures, QString folder,
+               int rawMode, QString camera, QString ISO);
+    /* Fast low resolution result, before merge */
+    void draft(QStringList paths, QStringList exposures, QString folder,
+               QString camera, QString ISO);
+    /* Incremental merge, as shots are captured */
+    void beginStream(QString camera, QString ISO);
+    void addShot(QString path, QString exposure);
+    void finishStream(QStringList paths, QString folder);
+    void cancelStream();
+    /* LDR variants of an already merged folder */
+    void toneMap(QString folder, QStringList operators);
+
+  private:
+    Config *conf;
+    MergeAccumulator accumulator;
+    /* First error of current stream, reported on finish */
+    QString streamError;
+    /* Previous streamed shot, shots are aligned on it */
+    grayPyramid streamPyramid;
+    QPoint streamOffset;
+    /* Stream without calibrated response samples its shots */
+    ResponseSampler streamSampler;
+    QString streamCamera;
+    QString streamISO;
+    /* Merged radiance maps, by folder */
+    RadianceCache cache;
+
+    bool storeResponse(ResponseSampler &sampler, QString camera, QString ISO,
+                       cameraResponse &response);
+    int mergeThreads();
+    void writeDraft(const RadianceMap &hdr, QString folder);
+    bool writeResults(RadianceMap &hdr, QStringList paths, QString folder);
+    bool writeToneMapped(const RadianceMap &hdr, QStringList operators,
+                         QString folder);
+    /* Set from Composition thread */
+    std::atomic<bool> mergeRun;
+    std::atomic<int> threadBudget;
+    /* Full resolution work yields to sequences */
+    PreemptGate gate;
+};
+
+#endif // MERGEWORKER_H
@@ -0,0 +1,224 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "executor.h"
+#include <QMutex>
+#include <QRect>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <memory>
+
+/* Chunks per thread of a parallelFor() range, for stealing */
+#define PARALLEL_CHUNKS 4
+
+/*! \brief Maximum threads used by parallelFor() from calling thread
+ *
+ * 0 (default) for all cores. Lets concurrent jobs share the cores.
+ */
+inline int &parallelThreadLimit()
+{
+    static thread_local int limit = 0;
+    return limit;
+}
+
+/*! \brief Priority of parallelFor() chunks from calling thread
+ *
+ * TASK_REALTIME (default) for liveview and analysis, merge
+ * threads use TASK_BACKGROUND
+ */
+inline TaskPriority &parallelPriority()
+{
+    static thread_local TaskPriority priority = TASK_REALTIME;
+    return priority;
+}
+
+/* Pause point of background work
+ *
+ * A thread given a gate (see parallelGate()) waits at each
+ * parallelFor() chunk while gate is suspended, work goes on
+ * from there once resumed. Executor workers never wait : they
+ * leave gated chunks, or run them if they own the job
+ */
+class PreemptGate
+{
+  public:
+    PreemptGate() : suspended(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void suspend()
+    {
+        QMutexLocker locker(&mutex);
+        *suspended = true;
+    }
+
+    void resume()
+    {
+        QMutexLocker locker(&mutex);
+        *suspended = false;
+        resumed.wakeAll();
+    }
+
+    void wait()
+    {
+        QMutexLocker locker(&mutex);
+        while (*suspended)
+            resumed.wait(&mutex);
+    }
+
+    /* Gate state, outlives the gate : executor tasks still queued
+     * when the gate is destroyed only read it */
+    std::shared_ptr<const std::atomic<bool>> state() { return suspended; }
+
+  private:
+    QMutex mutex;
+    QWaitCondition resumed;
+    std::shared_ptr<std::atomic<bool>> suspended;
+};
+
+/*! \brief Gate parallelFor() waits at from calling thread
+ *
+ * nullptr (default) for work that is never preempted
+ */
+inline PreemptGate *&parallelGate()
+{
+    static thread_local PreemptGate *gate = nullptr;
+    return gate;
+}
+
+/* Chunks of a parallelFor() range, shared with executor tasks */
+typedef struct {
+    /* Gate state, null without gate */
+    std::shared_ptr<const std::atomic<bool>> suspended;
+    int chunks;
+    std::atomic<int> next;
+    std::atomic<int> done;
+    std::function<void(int)> run;
+    QMutex lock;
+    QWaitCondition finished;
+} parallelJob;
+
+/*! \brief Run chunks of a job until none is left
+ *
+ * With yield, stops before a chunk while job gate is suspended.
+ * Helpers queued after the last chunk only return
+ * Returns false if stopped at the gate
+ */
+inline bool parallelWork(parallelJob &job, bool yield)
+{
+    for (;;) {
+        /* Queued helpers may run after parallelFor() returned */
+        if (job.next.load() >= job.chunks)
+            return true;
+        if (yield && job.suspended &&
+            job.suspended->load(std::memory_order_relaxed))
+            return false;
+        int c = job.next++;
+        if (c >= job.chunks)
+            return true;
+        job.run(c);
+        if (++job.done == job.chunks) {
+            QMutexLocker locker(&job.lock);
+            job.finished.wakeAll();
+        }
+    }
+}
+
+/*! \brief Run f(begin, end) over a range split on all cores
+ *
+ * Range [first, last) is cut in PARALLEL_CHUNKS contiguous chunks
+ * per core. Calling thread runs chunks too, helpers queued on the
+ * executor at calling thread priority take the others : a busy
+ * core leaves its share to idle ones. Blocks until all chunks
+ * are done. f must only write to data of its own chunk.
+ * Helpers keep calling thread limit, gate and priority, for
+ * nested calls. While calling thread gate is suspended, helpers
+ * leave chunks they have not started and calling thread waits
+ * before its next chunk, then queues helpers again. Nested in an
+ * executor task, calling thread runs the chunks left instead.
+ */
+template <typename F> void parallelFor(int first, int last, F f)
+{
+    int n = last - first;
+    int threads = executor().threadCount();
+    /* Only the submitting thread may park, never a worker */
+    bool yield = parallelGate() && !executor().isWorkerThread();
+
+    if (yield)
+        parallelGate()->wait();
+
+    if (parallelThreadLimit() > 0 && threads > parallelThreadLimit())
+        threads = parallelThreadLimit();
+
+    if (threads > n)
+        threads = n;
+    if (threads <= 1) {
+        if (n > 0)
+            f(first, last);
+        return;
+    }
+
+    std::shared_ptr<parallelJob> job = std::make_shared<parallelJob>();
+    if (parallelGate())
+        job->suspended = parallelGate()->state();
+    job->chunks = qMin(n, threads * PARALLEL_CHUNKS);
+    job->next = 0;
+    job->done = 0;
+    int chunks = job->chunks;
+    job->run = [&f, first, n, chunks](int c) {
+        f(first + qint64(n) * c / chunks, first + qint64(n) * (c + 1) / chunks);
+    };
+
+    int limit = parallelThreadLimit();
+    PreemptGate *gate = parallelGate();
+    TaskPriority priority = parallelPriority();
+    auto help = [&]() {
+        for (int i = 1; i < threads; i++)
+            executor().submit(
+                [job, limit, gate, priority]() {
+                    int oldLimit = parallelThreadLimit();
+                    PreemptGate *oldGate = parallelGate();
+                    TaskPriority oldPriority = parallelPriority();
+                    parallelThreadLimit() = limit;
+                    parallelGate() = gate;
+                    parallelPriority() = priority;
+                    parallelWork(*job, true);
+                    parallelThreadLimit() = oldLimit;
+                    parallelGate() = oldGate;
+                    parallelPriority() = oldPriority;
+                },
+                priority);
+    };
+
+    help();
+    while (!parallelWork(*job, yield)) {
+        gate->wait();
+        help();
+    }
+
+    QMutexLocker locker(&job->lock);
+    while (job->done < job->chunks)
+        job->finished.wait(&job->lock);
+}
+
+/*! \brief Run f(tile) over tiles of an area, on all cores
+ *
+ * Tiles are tileSize squares, clipped to area, in row order.
+ * Same rules as parallelFor()
+ */
+template <typename F> void parallelForTiles(QRect area, int tileSize, F f)
+{
+    if (area.isEmpty() || tileSize <= 0)
+        return;
+
+    int tx = (area.width() + tileSize - 1) / tileSize;
+    int ty = (area.height() + tileSize - 1) / tileSize;
+    parallelFor(0, tx * ty, [&](int t0, int t1) {
+        for (int t = t0; t < t1; t++) {
+            QRect tile(area.x() + (t % tx) * tileSize,
+                       area.y() + (t / tx) * tileSize, tileSize, tileSize);
+            f(tile.intersected(area));
+        }
+    });
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,166 @@
+#include "planarimage.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QRgba64>
+
+/*! \brief Split an 8 bit image into red, green and blue planes
+ *
+ * Alpha is dropped. Null image if image is null
+ */
+PlanarImage<uchar> planarFromImage(const QImage &image)
+{
+    PlanarImage<uchar> planes;
+
+    if (image.isNull())
+        return planes;
+
+    TRACE_SCOPE("planar_from_image", "image");
+
+    QImage rgb = image;
+    if (rgb.format() != QImage::Format_RGB32 &&
+        rgb.format() != QImage::Format_ARGB32)
+        rgb = rgb.convertToFormat(QImage::Format_RGB32);
+    planes = PlanarImage<uchar>(rgb.width(), rgb.height(), 3);
+
+    int w = rgb.width();
+    parallelFor(0, rgb.height(), [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const QRgb *src =
+                reinterpret_cast<const QRgb *>(rgb.constScanLine(y));
+            uchar *r = planes.row(0, y);
+            uchar *g = planes.row(1, y);
+            uchar *b = planes.row(2, y);
+            for (int x = 0; x < w; x++) {
+                r[x] = qRed(src[x]);
+                g[x] = qGreen(src[x]);
+                b[x] = qBlue(src[x]);
+            }
+        }
+    });
+
+    return planes;
+}
+
+/*! \brief Split a 16 bit image into red, green and blue planes
+ *
+ * 8 bit images are expanded. Null image if image is null
+ */
+PlanarImage<quint16> planarFromImage16(const QImage &image)
+{
+    PlanarImage<quint16> planes;
+
+    if (image.isNull())
+        return planes;
+
+    TRACE_SCOPE("planar_from_image", "image");
+
+    QImage rgb = image;
+    if (rgb.format() != QImage::Format_RGBX64 &&
+        rgb.format() != QImage::Format_RGBA64)
+        rgb = rgb.convertToFormat(QImage::Format_RGBX64);
+    planes = PlanarImage<quint16>(rgb.width(), rgb.height(), 3);
+
+    int w = rgb.width();
+    parallelFor(0, rgb.height(), [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const QRgba64 *src =
+                reinterpret_cast<const QRgba64 *>(rgb.constScanLine(y));
+            quint16 *r = planes.row(0, y);
+            quint16 *g = planes.row(1, y);
+            quint16 *b = planes.row(2, y);
+            for (int x = 0; x < w; x++) {
+                r[x] = src[x].red();
+                g[x] = src[x].green();
+                b[x] = src[x].blue();
+            }
+        }
+    });
+
+    return planes;
+}
+
+/*! \brief Interleave red, green and blue planes to an RGB32 image
+ *
+ * A single plane is taken as gray
+ */
+QImage planarToImage(const PlanarImage<uchar> &planes)
+{
+    if (planes.isNull())
+        return QImage();
+
+    TRACE_SCOPE("planar_to_image", "image");
+
+    QImage out(planes.width(), planes.height(), QImage::Format_RGB32);
+    int w = planes.width();
+    int cg = planes.channels() > 1 ? 1 : 0;
+    int cb = planes.channels() > 2 ? 2 : 0;
+    uchar *bits = out.bits();
+    int bpl = out.bytesPerLine();
+    parallelFor(0, planes.height(), [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            QRgb *dst = reinterpret_cast<QRgb *>(bits + y * bpl);
+            const uchar *r = planes.row(0, y);
+            const uchar *g = planes.row(cg, y);
+            const uchar *b = planes.row(cb, y);
+            for (int x = 0; x < w; x++)
+                dst[x] = qRgb(r[x], g[x], b[x]);
+        }
+    });
+
+    return out;
+}
+
+/*! \brief Interleave red, green and blue planes to an RGBX64 image
+ *
+ * A single plane is taken as gray
+ */
+QImage planarToImage(const PlanarImage<quint16> &planes)
+{
+    if (planes.isNull())
+        return QImage();
+
+    TRACE_SCOPE("planar_to_image", "image");
+
+    QImage out(planes.width(), planes.height(), QImage::Format_RGBX64);
+    int w = planes.width();
+    int cg = planes.channels() > 1 ? 1 : 0;
+    int cb = planes.channels() > 2 ? 2 : 0;
+    uchar *bits = out.bits();
+    int bpl = out.bytesPerLine();
+    parallelFor(0, planes.height(), [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            QRgba64 *dst = reinterpret_cast<QRgba64 *>(bits + y * bpl);
+            const quint16 *r = planes.row(0, y);
+            const quint16 *g = planes.row(cg, y);
+            const quint16 *b = planes.row(cb, y);
+            for (int x = 0; x < w; x++)
+                dst[x] = QRgba64::fromRgba64(r[x], g[x], b[x], 0xFFFF);
+        }
+    });
+
+    return out;
+}
+
+/*! \brief Convert float planes to half float planes
+ *
+ * Same channels and size, values out of half range saturate
+ * to infinity
+ */
+PlanarImage<qfloat16> planarToHalf(const PlanarImage<float> &planes)
+{
+    PlanarImage<qfloat16> out(planes.width(), planes.height(),
+                              planes.channels());
+    int w = planes.width();
+
+    parallelFor(0, planes.height(), [&](int y0, int y1) {
+        for (int c = 0; c < planes.channels(); c++)
+            for (int y = y0; y < y1; y++) {
+                const float *src = planes.row(c, y);
+                qfloat16 *dst = out.row(c, y);
+                for (int x = 0; x < w; x++)
+                    dst[x] = qfloat16(src[x]);
+            }
+    });
+
+    return out;
+}
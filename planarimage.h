@@ -0,0 +1,204 @@
+#ifndef PLANARIMAGE_H
+#define PLANARIMAGE_H
+
+#include "bufferpool.h"
+#include <QImage>
+#include <QRect>
+#include <QtGlobal>
+#include <memory>
+#include <qfloat16.h>
+#include <string.h>
+
+/* Rows and planes start on this boundary, in bytes */
+#define PLANAR_ALIGN 64
+
+/* Planar image, one plane of T per channel
+ *
+ * For uchar, quint16, qfloat16 or float pixels. Every row starts
+ * on a PLANAR_ALIGN boundary, so row loops run over aligned
+ * contiguous values and can be vectorized.
+ * Pixels are shared, never copied behind the caller's back :
+ * copies, view() and channel() refer to the same pixels,
+ * clone() is the only deep copy
+ */
+template <typename T> class PlanarImage
+{
+  public:
+    PlanarImage();
+    PlanarImage(int width, int height, int channels);
+
+    bool isNull() const;
+    int width() const;
+    int height() const;
+    int channels() const;
+    /* Values between two rows, at least width */
+    int stride() const;
+    qint64 bytes() const;
+
+    T *row(int channel, int y);
+    const T *row(int channel, int y) const;
+
+    PlanarImage view(QRect rect) const;
+    PlanarImage channel(int c) const;
+    PlanarImage clone() const;
+    void fill(T value);
+
+  private:
+    std::shared_ptr<T> buffer;
+    T *origin;
+    int w;
+    int h;
+    int nc;
+    int rowStride;
+    int planeStride;
+};
+
+/*! \brief Null image constructor
+ */
+template <typename T> PlanarImage<T>::PlanarImage()
+{
+    origin = nullptr;
+    w = h = nc = 0;
+    rowStride = planeStride = 0;
+}
+
+/*! \brief Allocate an image, pixels are not initialized
+ *
+ * Pixels are borrowed from the buffer pool.
+ * Null image if a dimension is not positive or memory is exhausted
+ */
+template <typename T>
+PlanarImage<T>::PlanarImage(int width, int height, int channels)
+    : PlanarImage()
+{
+    if (width <= 0 || height <= 0 || channels <= 0)
+        return;
+
+    int align = PLANAR_ALIGN / sizeof(T);
+    w = width;
+    h = height;
+    nc = channels;
+    rowStride = (width + align - 1) / align * align;
+    planeStride = rowStride * height;
+    T *data = static_cast<T *>(
+        bufferPool().allocate(qint64(planeStride) * channels * sizeof(T)));
+    if (!data) {
+        *this = PlanarImage();
+        return;
+    }
+    buffer = std::shared_ptr<T>(data, [](T *p) { bufferPool().release(p); });
+    origin = data;
+}
+
+template <typename T> bool PlanarImage<T>::isNull() const
+{
+    return !origin;
+}
+
+template <typename T> int PlanarImage<T>::width() const
+{
+    return w;
+}
+
+template <typename T> int PlanarImage<T>::height() const
+{
+    return h;
+}
+
+template <typename T> int PlanarImage<T>::channels() const
+{
+    return nc;
+}
+
+template <typename T> int PlanarImage<T>::stride() const
+{
+    return rowStride;
+}
+
+/*! \brief Get size of pixels, row padding included
+ */
+template <typename T> qint64 PlanarImage<T>::bytes() const
+{
+    return qint64(planeStride) * nc * sizeof(T);
+}
+
+/*! \brief Get first pixel of a row of a channel
+ */
+template <typename T> T *PlanarImage<T>::row(int channel, int y)
+{
+    return origin + size_t(planeStride) * channel + size_t(rowStride) * y;
+}
+
+template <typename T>
+const T *PlanarImage<T>::row(int channel, int y) const
+{
+    return origin + size_t(planeStride) * channel + size_t(rowStride) * y;
+}
+
+/*! \brief Get a rectangle of the image, without copy
+ *
+ * Rectangle is clipped to the image. Rows of a view keep
+ * the image stride, they are aligned if rect.x() is
+ */
+template <typename T> PlanarImage<T> PlanarImage<T>::view(QRect rect) const
+{
+    PlanarImage<T> v;
+    QRect r = rect.intersected(QRect(0, 0, w, h));
+
+    if (isNull() || r.isEmpty())
+        return v;
+    v = *this;
+    v.origin = origin + size_t(rowStride) * r.y() + r.x();
+    v.w = r.width();
+    v.h = r.height();
+
+    return v;
+}
+
+/*! \brief Get one channel of the image, without copy
+ */
+template <typename T> PlanarImage<T> PlanarImage<T>::channel(int c) const
+{
+    PlanarImage<T> v;
+
+    if (isNull() || c < 0 || c >= nc)
+        return v;
+    v = *this;
+    v.origin = origin + size_t(planeStride) * c;
+    v.nc = 1;
+
+    return v;
+}
+
+/*! \brief Copy pixels to a new image
+ */
+template <typename T> PlanarImage<T> PlanarImage<T>::clone() const
+{
+    PlanarImage<T> copy(w, h, nc);
+
+    for (int c = 0; c < nc; c++)
+        for (int y = 0; y < h; y++)
+            memcpy(copy.row(c, y), row(c, y), w * sizeof(T));
+
+    return copy;
+}
+
+/*! \brief Set every pixel of every channel to value
+ */
+template <typename T> void PlanarImage<T>::fill(T value)
+{
+    for (int c = 0; c < nc; c++)
+        for (int y = 0; y < h; y++) {
+            T *p = row(c, y);
+            for (int x = 0; x < w; x++)
+                p[x] = value;
+        }
+}
+
+PlanarImage<uchar> planarFromImage(const QImage &image);
+PlanarImage<quint16> planarFromImage16(const QImage &image);
+QImage planarToImage(const PlanarImage<uchar> &planes);
+QImage planarToImage(const PlanarImage<quint16> &planes);
+PlanarImage<qfloat16> planarToHalf(const PlanarImage<float> &planes);
+
+#endif // PLANARIMAGE_H
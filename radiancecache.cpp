@@ -0,0 +1,202 @@
+#include "radiancecache.h"
+#include "log.h"
+#include "trace.h"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <string.h>
+
+/* Cache file header, planes follow in native byte order */
+#define RADIANCE_CACHE_MAGIC "AHDRRAD1"
+
+typedef struct {
+    char magic[8];
+    qint32 width;
+    qint32 height;
+} cacheHeader;
+
+/*! \brief Get cache file path of a composition folder
+ */
+static QString cachePath(QString key)
+{
+    return key + "/" + RADIANCE_CACHE_FILE;
+}
+
+/*! \brief RadianceCache constructor
+ *
+ * Keeps at most entries maps in memory, cache is enabled
+ */
+RadianceCache::RadianceCache(int entries)
+{
+    maxEntries = entries;
+    enabled = true;
+    memoryBudget().addReclaimer(this);
+}
+
+RadianceCache::~RadianceCache()
+{
+    memoryBudget().removeReclaimer(this);
+}
+
+/*! \brief Enable or disable cache
+ *
+ * Disabled, nothing is kept : in memory nor in files
+ */
+void RadianceCache::setEnabled(bool enable)
+{
+    {
+        QMutexLocker locker(&mutex);
+        enabled = enable;
+    }
+    if (!enable)
+        clear();
+}
+
+/*! \brief Keep radiance map of a composition folder
+ *
+ * Saved to folder cache file, then kept in memory : map data
+ * is implicitly shared, not copied
+ * Returns false if cache file could not be written, map is
+ * not cached then
+ */
+bool RadianceCache::store(QString folder, const RadianceMap &hdr)
+{
+    QString key = QDir::cleanPath(QDir(folder).absolutePath());
+
+    {
+        QMutexLocker locker(&mutex);
+        if (!enabled)
+            return true;
+    }
+
+    TRACE_SCOPE("cache_store", "composition");
+
+    QSaveFile file(cachePath(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[RadianceCache] Could not open %s\n",
+                  cachePath(key).toStdString().c_str());
+        return false;
+    }
+
+    cacheHeader header;
+    memcpy(header.magic, RADIANCE_CACHE_MAGIC, sizeof(header.magic));
+    header.width = hdr.width();
+    header.height = hdr.height();
+    /* Planes are stored packed, row padding is dropped */
+    qint64 bytes = qint64(hdr.width()) * sizeof(float);
+    bool ok = file.write((const char *)&header, sizeof(header)) ==
+              sizeof(header);
+    for (int c = 0; c < 3 && ok; c++)
+        for (int y = 0; y < hdr.height() && ok; y++)
+            ok = file.write((const char *)hdr.row(c, y), bytes) == bytes;
+    if (!ok) {
+        file.cancelWriting();
+        LOG_ERROR("[RadianceCache] Could not write %s\n",
+                  cachePath(key).toStdString().c_str());
+        return false;
+    }
+    if (!file.commit())
+        return false;
+
+    insert(key, hdr);
+
+    return true;
+}
+
+/*! \brief Get radiance map of a composition folder
+ *
+ * Looks in memory, then in folder cache file
+ * Returns false if folder was never merged (or cache was disabled)
+ */
+bool RadianceCache::lookup(QString folder, RadianceMap &hdr)
+{
+    QString key = QDir::cleanPath(QDir(folder).absolutePath());
+
+    {
+        QMutexLocker locker(&mutex);
+        if (!enabled)
+            return false;
+        if (maps.contains(key)) {
+            keys.removeOne(key);
+            keys.prepend(key);
+            hdr = maps.value(key);
+            return true;
+        }
+    }
+
+    TRACE_SCOPE("cache_load", "composition");
+
+    QFile file(cachePath(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    cacheHeader header;
+    if (file.read((char *)&header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, RADIANCE_CACHE_MAGIC, sizeof(header.magic)) ||
+        header.width <= 0 || header.height <= 0)
+        return false;
+    qint64 bytes = qint64(header.width) * header.height * sizeof(float);
+    if (file.size() != qint64(sizeof(header)) + 3 * bytes)
+        return false;
+
+    RadianceMap map(header.width, header.height, 3);
+    bool ok = true;
+    qint64 rowBytes = qint64(header.width) * sizeof(float);
+    for (int c = 0; c < 3 && ok; c++)
+        for (int y = 0; y < header.height && ok; y++)
+            ok = file.read((char *)map.row(c, y), rowBytes) == rowBytes;
+    if (!ok) {
+        LOG_ERROR("[RadianceCache] Could not read %s\n",
+                  cachePath(key).toStdString().c_str());
+        return false;
+    }
+
+    insert(key, map);
+    hdr = map;
+
+    return true;
+}
+
+/*! \brief Release all maps held in memory
+ *
+ * Cache files are kept
+ */
+void RadianceCache::clear()
+{
+    QHash<QString, RadianceMap> dropped;
+    QMutexLocker locker(&mutex);
+
+    dropped.swap(maps);
+    keys.clear();
+    /* Buffers go back to the pool without the lock */
+    locker.unlock();
+}
+
+/*! \brief Drop maps held in memory, memory budget needs room
+ *
+ * They are read again from cache files
+ */
+void RadianceCache::reclaim()
+{
+    clear();
+}
+
+/*! \brief Add a map to memory cache, evicting least recently used
+ */
+void RadianceCache::insert(QString key, const RadianceMap &hdr)
+{
+    QList<RadianceMap> dropped;
+    QMutexLocker locker(&mutex);
+
+    keys.removeOne(key);
+    dropped << maps.take(key);
+    if (maxEntries <= 0 || !enabled)
+        return;
+
+    while (keys.size() >= maxEntries)
+        dropped << maps.take(keys.takeLast());
+    keys.prepend(key);
+    maps.insert(key, hdr);
+    /* Buffers go back to the pool without the lock */
+    locker.unlock();
+}
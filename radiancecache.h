@@ -0,0 +1,46 @@
+#ifndef RADIANCECACHE_H
+#define RADIANCECACHE_H
+
+#include "hdrmerge.h"
+#include "memorybudget.h"
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+
+/* Radiance maps kept in memory, most recent first */
+#define RADIANCE_CACHE_ENTRIES 1
+/* Cache file, in composition folder */
+#define RADIANCE_CACHE_FILE "hdr_radiance.cache"
+
+/* Merged radiance maps, keyed by composition folder
+ *
+ * Every map is saved next to its shots as raw floats, so a
+ * sequence is merged once whatever the number of tone mapped
+ * variants. Recent saved maps are also kept in memory, they are
+ * dropped when memory budget needs room.
+ * Thread safe
+ */
+class RadianceCache : public MemoryReclaimer
+{
+  public:
+    RadianceCache(int entries = RADIANCE_CACHE_ENTRIES);
+    ~RadianceCache();
+
+    void setEnabled(bool enable);
+    bool store(QString folder, const RadianceMap &hdr);
+    bool lookup(QString folder, RadianceMap &hdr);
+    void clear();
+    void reclaim() override;
+
+  private:
+    QMutex mutex;
+    int maxEntries;
+    bool enabled;
+    /* Least recently used last */
+    QStringList keys;
+    QHash<QString, RadianceMap> maps;
+
+    void insert(QString key, const RadianceMap &hdr);
+};
+
+#endif // RADIANCECACHE_H
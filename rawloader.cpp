@@ -0,0 +1,148 @@
+#include "rawloader.h"
+#include "bufferpool.h"
+#include "log.h"
+#include "trace.h"
+#include <QFileInfo>
+#include <QImageReader>
+#include <QRgba64>
+#include <QStringList>
+#ifdef HAVE_LIBRAW
+#include <libraw/libraw.h>
+#endif
+
+/*! \brief Check if a file is a camera RAW, from its extension
+ */
+bool isRawFile(QString path)
+{
+    static const QStringList raw = {"arw", "cr2", "cr3", "crw", "dng",
+                                    "erf", "kdc", "mrw", "nef", "nrw",
+                                    "orf", "pef", "raf", "rw2", "sr2",
+                                    "srf", "srw", "x3f"};
+
+    return raw.contains(QFileInfo(path).suffix().toLower());
+}
+
+/*! \brief Get decode mode from its config name
+ *
+ * Returns false if name is unknown
+ */
+bool rawDecodeMode(QString name, RawDecodeMode &mode)
+{
+    if (name == "full")
+        mode = RAW_FULL;
+    else if (name == "half")
+        mode = RAW_HALF;
+    else
+        return false;
+
+    return true;
+}
+
+/*! \brief Decode a camera RAW file
+ *
+ * Output is linear 16 bit RGB (QImage::Format_RGBX64), sRGB
+ * primaries, camera white balance, no auto brightness.
+ * In RAW_HALF mode, each 2x2 Bayer block gives one pixel :
+ * half width and height, no demosaic.
+ * One LibRaw instance per call : files can be decoded from
+ * several threads at once.
+ */
+bool loadRaw(QString path, RawDecodeMode mode, QImage &image)
+{
+#ifdef HAVE_LIBRAW
+    LibRaw raw;
+    int err;
+
+    TRACE_SCOPE("raw_decode", "composition");
+
+    raw.imgdata.params.half_size = mode == RAW_HALF;
+    raw.imgdata.params.use_camera_wb = 1;
+    raw.imgdata.params.output_color = 1;
+    raw.imgdata.params.output_bps = 16;
+    raw.imgdata.params.gamm[0] = 1.0;
+    raw.imgdata.params.gamm[1] = 1.0;
+    raw.imgdata.params.no_auto_bright = 1;
+
+    if ((err = raw.open_file(path.toLocal8Bit().constData())) !=
+            LIBRAW_SUCCESS ||
+        (err = raw.unpack()) != LIBRAW_SUCCESS ||
+        (err = raw.dcraw_process()) != LIBRAW_SUCCESS) {
+        LOG_ERROR("[RawLoader] %s : %s\n", path.toStdString().c_str(),
+                  LibRaw::strerror(err));
+        return false;
+    }
+
+    libraw_processed_image_t *out = raw.dcraw_make_mem_image(&err);
+    if (!out || out->type != LIBRAW_IMAGE_BITMAP || out->colors != 3 ||
+        out->bits != 16) {
+        LOG_ERROR("[RawLoader] %s : unexpected output\n",
+                  path.toStdString().c_str());
+        if (out)
+            LibRaw::dcraw_clear_mem(out);
+        return false;
+    }
+
+    image = pooledImage(out->width, out->height, QImage::Format_RGBX64);
+    if (image.isNull()) {
+        LOG_ERROR("[RawLoader] %s : out of memory\n",
+                  path.toStdString().c_str());
+        LibRaw::dcraw_clear_mem(out);
+        return false;
+    }
+    const quint16 *src = reinterpret_cast<const quint16 *>(out->data);
+    for (int y = 0; y < out->height; y++) {
+        QRgba64 *line = reinterpret_cast<QRgba64 *>(image.scanLine(y));
+        const quint16 *s = src + 3 * y * out->width;
+        for (int x = 0; x < out->width; x++)
+            line[x] = QRgba64::fromRgba64(s[3 * x], s[3 * x + 1],
+                                          s[3 * x + 2], 0xFFFF);
+    }
+    LibRaw::dcraw_clear_mem(out);
+
+    return true;
+#else
+    Q_UNUSED(mode);
+    Q_UNUSED(image);
+    LOG_ERROR("[RawLoader] %s : built without LibRaw\n",
+              path.toStdString().c_str());
+    return false;
+#endif
+}
+
+/*! \brief Decode a shot, RAW or not
+ *
+ * mode only applies to RAW files
+ */
+bool loadShot(QString path, RawDecodeMode mode, QImage &image)
+{
+    if (isRawFile(path))
+        return loadRaw(path, mode, image);
+
+    return image.load(path);
+}
+
+/*! \brief Get decoded size of a shot, in bytes
+ *
+ * Headers only are read. 0 if size is unknown
+ */
+qint64 shotBytes(QString path, RawDecodeMode mode)
+{
+    if (!isRawFile(path)) {
+        QSize size = QImageReader(path).size();
+        return size.isValid() ? qint64(size.width()) * size.height() * 4 : 0;
+    }
+
+#ifdef HAVE_LIBRAW
+    LibRaw raw;
+    if (raw.open_file(path.toLocal8Bit().constData()) != LIBRAW_SUCCESS)
+        return 0;
+    qint64 pixels = qint64(raw.imgdata.sizes.width) * raw.imgdata.sizes.height;
+    if (mode == RAW_HALF)
+        pixels /= 4;
+
+    return pixels * sizeof(QRgba64);
+#else
+    Q_UNUSED(mode);
+    return 0;
+#endif
+}
@@ -0,0 +1,18 @@
+#ifndef RAWLOADER_H
+#define RAWLOADER_H
+
+#include <QImage>
+#include <QString>
+
+enum RawDecodeMode {
+    RAW_FULL, /* Full resolution demosaic */
+    RAW_HALF  /* 2x2 superpixels, no interpolation */
+};
+
+bool isRawFile(QString path);
+bool rawDecodeMode(QString name, RawDecodeMode &mode);
+bool loadRaw(QString path, RawDecodeMode mode, QImage &image);
+bool loadShot(QString path, RawDecodeMode mode, QImage &image);
+qint64 shotBytes(QString path, RawDecodeMode mode);
+
+#endif // RAWLOADER_H
@@ -0,0 +1,332 @@
+#include "response.h"
+#include "log.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QDomDocument>
+#include <QFile>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextStream>
+#include <math.h>
+
+/* Fewer filled values are not a usable response */
+#define RESPONSE_MIN_VALUES 32
+
+/* Responses file is shared by merge threads */
+static QMutex responseMutex;
+
+static const char *channelNames[3] = {"red", "green", "blue"};
+
+/*! \brief ResponseSampler constructor
+ */
+ResponseSampler::ResponseSampler()
+{
+    reset();
+}
+
+/*! \brief Forget sampled shots
+ */
+void ResponseSampler::reset()
+{
+    width = height = 0;
+    values.clear();
+    times.clear();
+}
+
+/*! \brief Get number of sampled shots
+ */
+int ResponseSampler::count()
+{
+    return values.size();
+}
+
+/*! \brief Sample one exposure
+ *
+ * Grid is set in merged coordinates, away from borders that
+ * alignment fills, image is translated by offset
+ * Returns false if image is linear 16 bit or does not match
+ * previous ones
+ */
+bool ResponseSampler::add(const QImage &image, double time, QPoint offset)
+{
+    if (image.isNull() || time <= 0)
+        return false;
+    if (image.format() == QImage::Format_RGBX64 ||
+        image.format() == QImage::Format_RGBA64)
+        return false;
+    if (values.isEmpty()) {
+        width = image.width();
+        height = image.height();
+    } else if (image.width() != width || image.height() != height)
+        return false;
+
+    QImage rgb = image;
+    if (rgb.format() != QImage::Format_RGB32 &&
+        rgb.format() != QImage::Format_ARGB32)
+        rgb = rgb.convertToFormat(QImage::Format_RGB32);
+
+    int mx = width / 16;
+    int my = height / 16;
+    QVector<uchar> v(RESPONSE_SAMPLES_X * RESPONSE_SAMPLES_Y * 3);
+    uchar *pv = v.data();
+    for (int j = 0; j < RESPONSE_SAMPLES_Y; j++) {
+        int y = my + (2 * j + 1) * (height - 2 * my) / (2 * RESPONSE_SAMPLES_Y);
+        const QRgb *line = reinterpret_cast<const QRgb *>(
+            rgb.constScanLine(qBound(0, y - offset.y(), height - 1)));
+        for (int i = 0; i < RESPONSE_SAMPLES_X; i++) {
+            int x =
+                mx + (2 * i + 1) * (width - 2 * mx) / (2 * RESPONSE_SAMPLES_X);
+            QRgb px = line[qBound(0, x - offset.x(), width - 1)];
+            *pv++ = qRed(px);
+            *pv++ = qGreen(px);
+            *pv++ = qBlue(px);
+        }
+    }
+    values.append(v);
+    times.append(time);
+
+    return true;
+}
+
+/*! \brief Recover inverse camera response from samples
+ *
+ * Robertson's method, per channel : exposures and response are
+ * estimated in turn,
+ * E(i) = sum(w(Z) * g(Z) * dt) / sum(w(Z) * dt^2)
+ * g(m) = mean of E(i) * dt over samples where Z = m
+ * Values never sampled are interpolated, response is made
+ * monotonic. Mid gray is scaled as the sRGB curve decodes it,
+ * so radiance stays in the same range and gray stays gray
+ * Returns false if bracket is too small or too narrow
+ */
+bool ResponseSampler::calibrate(cameraResponse &response)
+{
+    int n = values.size();
+
+    TRACE_SCOPE("calibrate_response", "composition");
+
+    if (n < 2)
+        return false;
+    double tmin = times.first(), tmax = times.first();
+    for (int j = 1; j < n; j++) {
+        tmin = qMin(tmin, times.at(j));
+        tmax = qMax(tmax, times.at(j));
+    }
+    /* At least one EV between extreme shots */
+    if (tmax < 2 * tmin)
+        return false;
+
+    /* Clipped values carry no information */
+    float wt[256];
+    for (int m = 0; m < 256; m++) {
+        float d = (m - 127.5f) / 127.5f;
+        wt[m] = m == 0 || m == 255 ? 0 : expf(-4 * d * d);
+    }
+    double mid = pow((128 / 255.0 + 0.055) / 1.055, 2.4);
+    int samples = RESPONSE_SAMPLES_X * RESPONSE_SAMPLES_Y;
+    bool valid[3] = {false, false, false};
+
+    parallelFor(0, 3, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            QVector<double> g(256), sum(256), exposure(samples);
+            QVector<int> hits(256);
+
+            for (int m = 0; m < 256; m++)
+                g[m] = (m + 1) / 129.0;
+            for (int it = 0; it < RESPONSE_ITERATIONS; it++) {
+                for (int i = 0; i < samples; i++) {
+                    double num = 0, den = 0;
+                    for (int j = 0; j < n; j++) {
+                        int z = values.at(j).at(3 * i + c);
+                        double t = times.at(j);
+                        num += wt[z] * g[z] * t;
+                        den += wt[z] * t * t;
+                    }
+                    exposure[i] = den > 0 ? num / den : 0;
+                }
+                sum.fill(0);
+                hits.fill(0);
+                for (int j = 0; j < n; j++) {
+                    const uchar *z = values.at(j).constData() + c;
+                    for (int i = 0; i < samples; i++) {
+                        if (exposure[i] <= 0)
+                            continue;
+                        sum[z[3 * i]] += exposure[i] * times.at(j);
+                        hits[z[3 * i]]++;
+                    }
+                }
+
+                /* Fill values never sampled */
+                int prev = -1, filled = 0;
+                for (int m = 0; m < 256; m++) {
+                    if (!hits[m] || sum[m] <= 0)
+                        continue;
+                    g[m] = sum[m] / hits[m];
+                    if (prev < 0) {
+                        for (int k = 0; k < m; k++)
+                            g[k] = g[m] * (k + 1) / (m + 1);
+                    } else {
+                        for (int k = prev + 1; k < m; k++)
+                            g[k] = g[prev] +
+                                   (g[m] - g[prev]) * (k - prev) / (m - prev);
+                    }
+                    prev = m;
+                    filled++;
+                }
+                if (filled < RESPONSE_MIN_VALUES)
+                    break;
+                for (int k = prev + 1; k < 256; k++)
+                    g[k] = g[prev] * (k + 1) / (prev + 1);
+
+                /* Scale is free, mid gray is fixed */
+                double scale = g[128];
+                for (int m = 0; m < 256; m++)
+                    g[m] /= scale;
+                valid[c] = it == RESPONSE_ITERATIONS - 1;
+            }
+            if (!valid[c])
+                continue;
+
+            /* Brighter value, more light */
+            for (int m = 1; m < 256; m++)
+                g[m] = qMax(g[m], g[m - 1] * 1.0001);
+            for (int m = 0; m < 256; m++)
+                response.g[c][m] = log(qMax(g[m] * mid, 1e-6));
+        }
+    });
+
+    return valid[0] && valid[1] && valid[2];
+}
+
+/*! \brief Recover inverse camera response from a bracket
+ *
+ * All shots at once, see ResponseSampler
+ * offsets, if given, translate each shot
+ */
+bool calibrateResponse(const QList<QImage> &images, const QList<double> &times,
+                       const QList<QPoint> &offsets, cameraResponse &response)
+{
+    ResponseSampler sampler;
+
+    if (images.size() != times.size())
+        return false;
+    for (int i = 0; i < images.size(); i++) {
+        if (!sampler.add(images.at(i), times.at(i),
+                         i < offsets.size() ? offsets.at(i) : QPoint(0, 0)))
+            return false;
+    }
+
+    return sampler.calibrate(response);
+}
+
+/*! \brief Read responses file
+ *
+ * Returns false if file does not exist or cannot be read
+ */
+static bool readResponses(QString file, QDomDocument &doc)
+{
+    QFile f(file);
+
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    if (!doc.setContent(&f) ||
+        doc.documentElement().tagName() != "autohdr_responses") {
+        LOG_ERROR("[Response] Could not read %s\n", file.toStdString().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*! \brief Find response of a camera body at an ISO
+ */
+static QDomElement findResponse(QDomDocument &doc, QString camera, QString ISO)
+{
+    QDomNode node = doc.documentElement().firstChild();
+    while (!node.isNull()) {
+        QDomElement e = node.toElement();
+        if (!e.isNull() && e.tagName() == "response" &&
+            e.attribute("camera") == camera && e.attribute("ISO") == ISO)
+            return e;
+        node = node.nextSibling();
+    }
+
+    return QDomElement();
+}
+
+/*! \brief Load calibrated response of a camera body at an ISO
+ *
+ * camera identifies the body (model and serial number)
+ * Returns false if no response was calibrated for them
+ */
+bool loadResponse(QString file, QString camera, QString ISO,
+                  cameraResponse &response)
+{
+    QMutexLocker locker(&responseMutex);
+    QDomDocument doc;
+
+    if (camera.isEmpty() || !readResponses(file, doc))
+        return false;
+    QDomElement e = findResponse(doc, camera, ISO);
+    if (e.isNull())
+        return false;
+
+    for (int c = 0; c < 3; c++) {
+        QStringList v = e.firstChildElement(channelNames[c]).text().split(' ');
+        v.removeAll("");
+        if (v.size() != 256)
+            return false;
+        for (int m = 0; m < 256; m++)
+            response.g[c][m] = v.at(m).toFloat();
+    }
+
+    return true;
+}
+
+/*! \brief Save calibrated response of a camera body at an ISO
+ *
+ * Replaces previous response of same body and ISO,
+ * file is replaced atomically
+ */
+bool saveResponse(QString file, QString camera, QString ISO,
+                  const cameraResponse &response)
+{
+    QMutexLocker locker(&responseMutex);
+    QDomDocument doc("XML");
+
+    TRACE_SCOPE("save_response", "composition");
+
+    if (!readResponses(file, doc)) {
+        doc = QDomDocument("XML");
+        doc.appendChild(doc.createElement("autohdr_responses"));
+    }
+    QDomElement old = findResponse(doc, camera, ISO);
+    if (!old.isNull())
+        doc.documentElement().removeChild(old);
+
+    QDomElement e = doc.createElement("response");
+    e.setAttribute("camera", camera);
+    e.setAttribute("ISO", ISO);
+    for (int c = 0; c < 3; c++) {
+        QStringList v;
+        for (int m = 0; m < 256; m++)
+            v << QString::number(response.g[c][m], 'g', 7);
+        QDomElement curve = doc.createElement(channelNames[c]);
+        curve.appendChild(doc.createTextNode(v.join(' ')));
+        e.appendChild(curve);
+    }
+    doc.documentElement().appendChild(e);
+
+    QSaveFile f(file);
+    if (!f.open(QIODevice::WriteOnly)) {
+        LOG_ERROR("[Response] Could not write %s\n",
+                  file.toStdString().c_str());
+        return false;
+    }
+    QTextStream stream(&f);
+    stream << doc.toString();
+    stream.flush();
+
+    return f.commit();
+}
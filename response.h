@@ -0,0 +1,52 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include "hdrmerge.h"
+#include <QImage>
+#include <QList>
+#include <QPoint>
+#include <QString>
+#include <QVector>
+
+/* Calibrated responses file, next to config file */
+#define RESPONSE_FILE "autohdr_responses.xml"
+/* Sampling grid of a bracket */
+#define RESPONSE_SAMPLES_X 64
+#define RESPONSE_SAMPLES_Y 48
+/* Robertson iterations */
+#define RESPONSE_ITERATIONS 20
+
+/* Camera response calibration
+ *
+ * Pixel values of a bracket are sampled on a fixed grid as
+ * shots come, the inverse response is then recovered from
+ * the samples only (Robertson). 8 bit shots only, decoded
+ * RAW shots are linear already
+ */
+class ResponseSampler
+{
+  public:
+    ResponseSampler();
+
+    void reset();
+    bool add(const QImage &image, double time, QPoint offset = QPoint(0, 0));
+    int count();
+    bool calibrate(cameraResponse &response);
+
+  private:
+    int width;
+    int height;
+    /* Per shot, RGB of every sample */
+    QList<QVector<uchar>> values;
+    QList<double> times;
+};
+
+bool calibrateResponse(const QList<QImage> &images, const QList<double> &times,
+                       const QList<QPoint> &offsets,
+                       cameraResponse &response);
+bool loadResponse(QString file, QString camera, QString ISO,
+                  cameraResponse &response);
+bool saveResponse(QString file, QString camera, QString ISO,
+                  const cameraResponse &response);
+
+#endif // RESPONSE_H
@@ -1,52 +1,32 @@
 #include "sequence.h"
+#include "analysis.h"
 #include "captureworker.h"
 #include "composition.h"
-#include <QMessageBox>
+#include "log.h"
+#include "trace.h"
 
 /*! \brief Sequence constructor
  *
  * Uses references to instances of RemoteCamera and Config
- * created by AutoHDR_MainWindow
+ * created by AutoHDR_MainWindow (or the daemon)
  *
  * Creates an instance of Composition
  *
- * Manages a variety of signals :
- * - Compute sequence abort from AutoHDR_ComputeSequence UI
- * - Sequence accept or reject from AutoHDR_PreviewSequence UI
- * - Capture sequence progress and error from CaptureWorker
- * - Capture sequence abort from AutoHDR_CaptureSequence UI
- * - Composition start from AutoHDR_ComputeEnd UI
- * - Sequence state machine sequencer
+ * Manages capture sequence progress and error from CaptureWorker
+ * and notifies them, as well as state machine progress, through
+ * signals : Sequence has no user interface of its own
  * Manages CaptureWorker thread
  */
-Sequence::Sequence(RemoteCamera *cam, Config *conf, QWidget *parent)
-    : QWidget(parent)
+Sequence::Sequence(CameraControl *cam, Config *conf, QObject *parent)
+    : QObject(parent)
 {
     c = cam;
     config = conf;
     state = CS_IDLE;
+    previous.valid = false;
+    warmStart = false;
     comp = new Composition(this, conf);
 
-    /* Link with compute window */
-    connect(&computeSequenceDialog,
-            &AutoHDR_ComputeSequence::abortComputeSequence, this,
-            &Sequence::computeSequenceAborted);
-
-    /* Link with sequence preview window */
-    connect(&previewSequenceDialog, &AutoHDR_PreviewSequence::acceptSequence,
-            this, &Sequence::sequenceAccepted);
-    connect(&previewSequenceDialog, &AutoHDR_PreviewSequence::rejectSequence,
-            this, &Sequence::sequenceRejected);
-
-    /* Link with capture window */
-    connect(&captureSequenceDialog,
-            &AutoHDR_CaptureSequence::abortCaptureSequence, this,
-            &Sequence::captureSequenceAborted);
-
-    /* Link with end capture dialog */
-    connect(&captureEndDialog, &AutoHDR_CaptureEnd::acceptCapture, comp,
-            &Composition::startComposition);
-
     /* Capture thread */
     captureWorker = new CaptureWorker(config, c, this);
     captureWorker->moveToThread(&sequenceAcquisition);
@@ -91,6 +71,10 @@ void Sequence::startComputing()
     if (state == CS_IDLE) {
         state = CS_START;
         clearSequence();
+        /* Previous composition waits for this sequence, an idle
+         * engine is not : it merges this sequence during capture */
+        if (comp->isRunning())
+            comp->suspendComposition();
     }
 }
 
@@ -101,68 +85,6 @@ void Sequence::abortComputing()
     state = CS_IDLE;
 }
 
-/*! \brief Check overexposition of a pixel
- *
- * A pixel is overexposed if at least one of its
- * color components is above given threshold
- */
-static bool isOverExposed(QRgb px, unsigned char overexp_threshold)
-{
-    return ((((px & 0x00FF0000) >> 16) >= overexp_threshold) ||
-            (((px & 0x0000FF00) >> 8) >= overexp_threshold) ||
-            ((px & 0x000000FF) >= overexp_threshold));
-}
-
-/*! \brief Check underexposition of a pixel
- *
- * A pixel is underexposed if all of its
- * color components are under given threshold
- */
-static bool isUnderExposed(QRgb px, unsigned char underexp_threshold)
-{
-    return ((((px & 0x00FF0000) >> 16) <= underexp_threshold) &&
-            (((px & 0x0000FF00) >> 8) <= underexp_threshold) &&
-            ((px & 0x000000FF) <= underexp_threshold));
-}
-
-enum ExpositionType { UNDER_EXPOSITION, OVER_EXPOSITION };
-
-/*! \brief Rate image (under- or over-) exposition
- *
- * Analyses every pixel of an image and returns a percentage
- * of under- or over-exposition
- */
-static int rateImageExposition(Config *conf, QImage &image, ExpositionType exp)
-{
-    int n = 0;
-    int w = image.width();
-    int h = image.height();
-    bool (*pf)(QRgb, unsigned char);
-    unsigned char threshold;
-
-    /* If the image is invalid
-     * make the function harmless */
-    if (!w || !h)
-        return -1;
-
-    if (exp == UNDER_EXPOSITION) {
-        pf = &isUnderExposed;
-        threshold = conf->getBlackThreshold();
-    } else {
-        pf = &isOverExposed;
-        threshold = conf->getWhiteThreshold();
-    }
-
-    /* Analyse every pixel of the image */
-    for (int i = 0; i < w; i++)
-        for (int j = 0; j < h; j++)
-            if (pf(image.pixel(i, j), threshold))
-                n++;
-
-    /* Return an exposition percentage */
-    return n * 100 / (w * h);
-}
-
 /*! \brief Save a sequence boundary
  *
  * Saves an image and its associated parameters
@@ -178,6 +100,48 @@ void Sequence::setSequenceBoundary()
     shots.append(sp);
 }
 
+/*! \brief Check if search can start from previous boundaries
+ *
+ * Previous sequence must have been computed with the same start
+ * parameters and criterias, and liveview luminance histogram
+ * must not have changed more than configured
+ */
+bool Sequence::checkWarmStart(QImage &image)
+{
+    computeLumaHistogram(image, startHistogram);
+
+    if (!config->getWarmStart() || !previous.valid)
+        return false;
+    if (previous.ISO != startParam.ISO ||
+        previous.aperture != startParam.aperture ||
+        previous.exposure != startParam.exposure ||
+        previous.overExpCrit != overExpCrit ||
+        previous.underExpCrit != underExpCrit)
+        return false;
+
+    int change = compareHistograms(previous.histogram, startHistogram);
+    LOG_INFO("[Sequence] Scene change since previous sequence : %d%%\n",
+             change);
+
+    return change >= 0 && change < config->getSceneChangeThreshold();
+}
+
+/*! \brief Save computed boundaries for next warm start
+ */
+void Sequence::saveBoundaries(int stops)
+{
+    previous.valid = true;
+    previous.ISO = startParam.ISO;
+    previous.aperture = startParam.aperture;
+    previous.exposure = startParam.exposure;
+    previous.overExpCrit = overExpCrit;
+    previous.underExpCrit = underExpCrit;
+    previous.lower = shots.first().exposure;
+    previous.upper = shots.last().exposure;
+    previous.stops = stops;
+    previous.histogram = startHistogram;
+}
+
 /*! \brief Sets the number of shots needed between 2 boundaries
  *
  * 1 shot needed if no parameter was changed during analysis
@@ -233,10 +197,11 @@ void Sequence::distributeShots(int stops)
     }
 
 out:
-    fprintf(stdout, "[Sequence] Sequence needs %d shots : ", shots.size());
+    QString exposures;
     for (int i = 0; i < shots.size(); i++)
-        fprintf(stdout, " %s", shots.at(i).exposure.toStdString().c_str());
-    fprintf(stdout, "\n");
+        exposures += " " + shots.at(i).exposure;
+    LOG_INFO("[Sequence] Sequence needs %d shots : %s\n", shots.size(),
+             exposures.toStdString().c_str());
 }
 
 /*! \brief Sequence analysis state machine
@@ -255,11 +220,21 @@ void Sequence::runStateMachine(QImage *image)
     static int stopsNb;
     static QString exposure;
 
-    if (state != CS_IDLE) {
-        /* Check is exposure was correctly updated */
-        if (c->getCurrentExposure() == exposure) {
-            /* Update reference image */
-            currentView = QImage(*image);
+    if (state == CS_IDLE)
+        return;
+
+    TRACE_SCOPE("state_machine", "sequence");
+
+    /* Check is exposure was correctly updated */
+    if (c->getCurrentExposure() == exposure) {
+        /* Update reference image */
+        currentView = QImage(*image);
+        /* Search frames span the bracket : fuse each exposure once */
+        if ((state == CS_LOWER_CRITERIA_SEEKING ||
+             state == CS_UPPER_CRITERIA_SEEKING) &&
+            !previewExposures.contains(exposure)) {
+            previewExposures << exposure;
+            fusionPreview.add(currentView);
         }
     }
 
@@ -270,12 +245,23 @@ void Sequence::runStateMachine(QImage *image)
         break;
 
     case CS_START:
-        /* Update UI and start seeking for 1st criteria */
-        manageSequenceUI();
+        /* Notify and start seeking for 1st criteria */
+        notifySequenceState();
         state = CS_LOWER_CRITERIA_SEEKING;
-        stopsNb = 0;
-        exposure = c->getCurrentExposure();
-        fprintf(stdout, "[Sequence] Starting lower criteria seeking\n");
+        warmStart = checkWarmStart(*image);
+        if (warmStart) {
+            /* Same scene : check previous boundary with one frame,
+             * seeking goes on from there if it is not met anymore */
+            stopsNb = previous.stops;
+            exposure = previous.lower;
+            c->setCurrentExposure(exposure);
+            LOG_INFO("[Sequence] Checking previous lower criteria %s\n",
+                     exposure.toStdString().c_str());
+        } else {
+            stopsNb = 0;
+            exposure = c->getCurrentExposure();
+            LOG_INFO("[Sequence] Starting lower criteria seeking\n");
+        }
         break;
 
     case CS_LOWER_CRITERIA_SEEKING: {
@@ -301,10 +287,17 @@ void Sequence::runStateMachine(QImage *image)
     }
 
     case CS_LOWER_CRITERIA_FOUND:
-        manageSequenceUI();
+        notifySequenceState();
         state = CS_UPPER_CRITERIA_SEEKING;
-        exposure = c->getCurrentExposure();
-        fprintf(stdout, "[Sequence] Starting upper criteria seeking\n");
+        if (warmStart) {
+            exposure = previous.upper;
+            c->setCurrentExposure(exposure);
+            LOG_INFO("[Sequence] Checking previous upper criteria %s\n",
+                     exposure.toStdString().c_str());
+        } else {
+            exposure = c->getCurrentExposure();
+            LOG_INFO("[Sequence] Starting upper criteria seeking\n");
+        }
         break;
 
     case CS_UPPER_CRITERIA_SEEKING: {
@@ -330,12 +323,14 @@ void Sequence::runStateMachine(QImage *image)
     }
 
     case CS_UPPER_CRITERIA_FOUND:
+        saveBoundaries(stopsNb);
         distributeShots(stopsNb);
         if (!shots.size()) {
             state = CS_IDLE;
             manageSequenceError("Maximum shots in sequence exceeded");
         } else {
-            manageSequenceUI();
+            fusedPreview = fusionPreview.result();
+            notifySequenceState();
             state = CS_IDLE;
         }
         break;
@@ -359,6 +354,21 @@ shotParameters Sequence::getShotParameters(int n)
     return shots.at(n);
 }
 
+/*! \brief Get HDR preview of computed sequence
+ *
+ * Low resolution fusion of the liveview frames seen during
+ * computing, null if sequence was not computed
+ */
+QImage Sequence::getFusedPreview()
+{
+    return fusedPreview;
+}
+
+Composition *Sequence::getComposition()
+{
+    return comp;
+}
+
 void Sequence::setShot(shotParameters sp)
 {
     shots.push_back(sp);
@@ -400,6 +410,9 @@ void Sequence::setCriterias(int lower, int upper, int nb)
 void Sequence::clearSequence()
 {
     shots.clear();
+    fusionPreview.reset();
+    previewExposures.clear();
+    fusedPreview = QImage();
 }
 
 /*! \brief Reset camara parameters
@@ -424,20 +437,18 @@ void Sequence::computeSequenceAborted()
     abortComputing();
     /* Reset camera parameters to those selected */
     resetParams();
-
-    computeSequenceDialog.close();
+    comp->resumeComposition();
 }
 
 /*! \brief Accept analysis, start capture
  */
 void Sequence::sequenceAccepted()
 {
-    previewSequenceDialog.close();
-    previewSequenceDialog.stopCountdown();
-
     resetParams();
+    /* Merge shots as they come */
+    comp->beginIncremental();
 
-    captureSequenceDialog.show();
+    emit captureStarted();
     emit startSequenceCapture();
 }
 
@@ -445,51 +456,34 @@ void Sequence::sequenceAccepted()
  */
 void Sequence::sequenceRejected()
 {
-    previewSequenceDialog.close();
-    previewSequenceDialog.stopCountdown();
-
     resetParams();
+    comp->resumeComposition();
 }
 
-/*! \brief Manage sequence dialogs
+/*! \brief Notify sequence state
  *
- * Show, update or close sequence dialogs
+ * Applies camera parameters and emits progress signals
  * according to state machine
  */
-void Sequence::manageSequenceUI()
+void Sequence::notifySequenceState()
 {
-    static QString startExposure;
-
     switch (state) {
     case CS_START:
         /* set current ISO and aperture
          * in case operator changed them on camera */
         resetParams();
-        /* Get initial exposure */
-        startExposure = c->getCurrentExposure();
-        /* Display computing dialog */
-        computeSequenceDialog.show();
-        computeSequenceDialog.updateStatus("Computing sequence...");
-        computeSequenceDialog.setProgress(10);
+        emit computingStarted();
         break;
 
     case CS_LOWER_CRITERIA_FOUND:
-        computeSequenceDialog.updateStatus("Found lower criteria.");
-        computeSequenceDialog.setProgress(50);
         /* Back to initial parameters */
         resetParams();
+        emit lowerCriteriaFound();
         break;
 
     case CS_UPPER_CRITERIA_FOUND:
-        /* Display results dialog */
-        computeSequenceDialog.close();
-        previewSequenceDialog.show();
-        previewSequenceDialog.setLabelResults(
-            QString("Measurements completed ! Capture will take ") +
-            QString::number(getShotsNb()) + QString(" shot(s)."));
-        previewSequenceDialog.setLowerPreview(shots.first().preview);
-        previewSequenceDialog.setUpperPreview(shots.last().preview);
-        previewSequenceDialog.startCountdown();
+        /* Results are available through getShotParameters() */
+        emit sequenceComputed();
         break;
 
     default:
@@ -499,35 +493,34 @@ void Sequence::manageSequenceUI()
 
 /*! \brief Manage sequence error
  *
- * Show a MessageBox with error diagnostic
+ * Resets camera and notifies error diagnostic
  */
 void Sequence::manageSequenceError(QString msg)
 {
-    computeSequenceDialog.close();
+    LOG_ERROR("[Sequence] %s\n", msg.toStdString().c_str());
     resetParams();
+    /* Do not warm start from a failed search */
+    previous.valid = false;
+    comp->resumeComposition();
 
-    QMessageBox::critical(this, "Error", msg);
+    emit sequenceError(msg);
 }
 
 /*! \brief Manage capture progress
  *
- * Show, update or close sequence dialogs
- * according to capture progress
+ * Notifies capture progress, or end of capture
  */
 void Sequence::handleCaptureProgress(int nbImg, int total)
 {
+    comp->addShot(shots.at(nbImg - 1));
+
     if (nbImg == total) {
         /* Finished */
-        captureSequenceDialog.close();
-        /* Display end dialog */
-        captureEndDialog.show();
-        captureEndDialog.setStatus(QString::number(total) +
-                                   " images successfully captured.");
         resetParams();
+        comp->resumeComposition();
+        emit captureFinished(total);
     } else {
-        captureSequenceDialog.setProgress(100 * nbImg / total);
-        captureSequenceDialog.setStatus("Took shot " + QString::number(nbImg) +
-                                        " of " + QString::number(total));
+        emit captureProgress(nbImg, total);
     }
 }
 
@@ -539,19 +532,20 @@ void Sequence::captureSequenceAborted()
 {
     /* Abort capture thread */
     captureWorker->setCaptureRunState(false);
+    comp->cancelIncremental();
+    comp->resumeComposition();
 
     resetParams();
-
-    captureSequenceDialog.close();
 }
 
 /*! \brief Manage capture error
  */
 void Sequence::captureSequenceError()
 {
+    LOG_ERROR("[Sequence] Sequence capture failed\n");
+    comp->cancelIncremental();
+    comp->resumeComposition();
     resetParams();
 
-    captureSequenceDialog.close();
-
-    QMessageBox::critical(this, "Error", "Sequence capture failed");
+    emit captureFailed();
 }
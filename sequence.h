@@ -1,17 +1,16 @@
 #ifndef SEQUENCE__H
 #define SEQUENCE__H
 
-#include "autohdr_captureend.h"
-#include "autohdr_capturesequence.h"
-#include "autohdr_computesequence.h"
-#include "autohdr_previewsequence.h"
 #include "camera.h"
 #include "config.h"
+#include "fusion.h"
+#include "memorybudget.h"
 #include <QImage>
 #include <QList>
+#include <QObject>
 #include <QString>
 #include <QThread>
-#include <QWidget>
+#include <QVector>
 
 class CaptureWorker;
 class Composition;
@@ -20,7 +19,8 @@ typedef struct {
     QString ISO;
     QString aperture;
     QString exposure;
-    QImage preview;
+    /* Spilled to disk when memory budget needs room */
+    SpillImage preview;
     QString path;
 } shotParameters;
 
@@ -33,19 +33,21 @@ enum SequenceState {
     CS_UPPER_CRITERIA_FOUND
 };
 
-class Sequence : public QWidget
+class Sequence : public QObject
 {
     Q_OBJECT
 
   public:
-    explicit Sequence(RemoteCamera *cam = nullptr, Config *conf = nullptr,
-                      QWidget *parent = nullptr);
+    explicit Sequence(CameraControl *cam = nullptr, Config *conf = nullptr,
+                      QObject *parent = nullptr);
     ~Sequence();
 
     /* Getters */
     void getCriterias(int *lower, int *upper, int *nb);
     int getShotsNb();
     shotParameters getShotParameters(int n);
+    QImage getFusedPreview();
+    Composition *getComposition();
 
     /* Setters */
     void setCriterias(int lower, int upper, int nb);
@@ -57,6 +59,15 @@ class Sequence : public QWidget
 
   signals:
     void startSequenceCapture();
+    /* Progress notifications, for UI or daemon */
+    void computingStarted();
+    void lowerCriteriaFound();
+    void sequenceComputed();
+    void sequenceError(QString msg);
+    void captureStarted();
+    void captureProgress(int nbImg, int total);
+    void captureFinished(int total);
+    void captureFailed();
 
   public slots:
     void startComputing();
@@ -71,7 +82,7 @@ class Sequence : public QWidget
     void captureSequenceError();
 
   private:
-    RemoteCamera *c;
+    CameraControl *c;
     Config *config;
     SequenceState state;
     QImage currentView;
@@ -82,6 +93,25 @@ class Sequence : public QWidget
     int nbImgMax;
     /* Results */
     QList<shotParameters> shots;
+    /* Previous computed boundaries, for warm start */
+    struct {
+        bool valid;
+        QString ISO;
+        QString aperture;
+        QString exposure;
+        int overExpCrit;
+        int underExpCrit;
+        QString lower;
+        QString upper;
+        int stops;
+        QVector<int> histogram;
+    } previous;
+    bool warmStart;
+    QVector<int> startHistogram;
+    /* Search frames fused into an HDR preview, one per exposure */
+    FusionPreview fusionPreview;
+    QStringList previewExposures;
+    QImage fusedPreview;
     /* Composition */
     Composition *comp;
 
@@ -89,17 +119,13 @@ class Sequence : public QWidget
     QThread sequenceAcquisition;
     CaptureWorker *captureWorker;
 
-    /* Dialogs */
-    AutoHDR_ComputeSequence computeSequenceDialog;
-    AutoHDR_PreviewSequence previewSequenceDialog;
-    AutoHDR_CaptureSequence captureSequenceDialog;
-    AutoHDR_CaptureEnd captureEndDialog;
-
     void resetParams();
-    void manageSequenceUI();
+    void notifySequenceState();
     void manageSequenceError(QString msg);
     void setSequenceBoundary();
     void distributeShots(int stops);
+    bool checkWarmStart(QImage &image);
+    void saveBoundaries(int stops);
 };
 
 #endif // SEQUENCE__H
@@ -0,0 +1,207 @@
+#include "sequenceui.h"
+#include <QMessageBox>
+
+/*! \brief SequenceUI constructor
+ *
+ * Manages a variety of signals :
+ * - Sequence computing progress and errors from Sequence
+ * - Compute sequence abort from AutoHDR_ComputeSequence UI
+ * - Sequence accept or reject from AutoHDR_PreviewSequence UI
+ * - Capture sequence progress and errors from Sequence
+ * - Capture sequence abort from AutoHDR_CaptureSequence UI
+ * - Composition start from AutoHDR_CaptureEnd UI
+ * - Composition progress, abort and errors
+ */
+SequenceUI::SequenceUI(Sequence *seq, QWidget *parent) : QObject(parent)
+{
+    s = seq;
+    comp = s->getComposition();
+    window = parent;
+
+    /* Sequence progress */
+    connect(s, &Sequence::computingStarted, this,
+            &SequenceUI::computingStarted);
+    connect(s, &Sequence::lowerCriteriaFound, this,
+            &SequenceUI::lowerCriteriaFound);
+    connect(s, &Sequence::sequenceComputed, this,
+            &SequenceUI::sequenceComputed);
+    connect(s, &Sequence::sequenceError, this, &SequenceUI::sequenceError);
+    connect(s, &Sequence::captureStarted, this, &SequenceUI::captureStarted);
+    connect(s, &Sequence::captureProgress, this,
+            &SequenceUI::captureProgress);
+    connect(s, &Sequence::captureFinished, this,
+            &SequenceUI::captureFinished);
+    connect(s, &Sequence::captureFailed, this, &SequenceUI::captureFailed);
+
+    /* Link with compute window */
+    connect(&computeSequenceDialog,
+            &AutoHDR_ComputeSequence::abortComputeSequence, this,
+            &SequenceUI::computeAborted);
+
+    /* Link with sequence preview window */
+    connect(&previewSequenceDialog, &AutoHDR_PreviewSequence::acceptSequence,
+            this, &SequenceUI::sequenceAccepted);
+    connect(&previewSequenceDialog, &AutoHDR_PreviewSequence::rejectSequence,
+            this, &SequenceUI::sequenceRejected);
+
+    /* Link with capture window */
+    connect(&captureSequenceDialog,
+            &AutoHDR_CaptureSequence::abortCaptureSequence, this,
+            &SequenceUI::captureAborted);
+
+    /* Link with end capture dialog */
+    connect(&captureEndDialog, &AutoHDR_CaptureEnd::acceptCapture, comp,
+            QOverload<>::of(&Composition::startComposition));
+
+    /* Composition progress */
+    connect(comp, &Composition::compositionStarted, this,
+            &SequenceUI::compositionStarted);
+    connect(comp, &Composition::compositionDraft, this,
+            &SequenceUI::compositionDraft);
+    connect(comp, &Composition::compositionFinished, this,
+            &SequenceUI::compositionFinished);
+    connect(comp, &Composition::compositionError, this,
+            &SequenceUI::compositionError);
+    connect(&composeDialog, &AutoHDR_Compose::abortCompose, this,
+            &SequenceUI::compositionAborted);
+}
+
+/*! \brief Display computing dialog
+ */
+void SequenceUI::computingStarted()
+{
+    computeSequenceDialog.show();
+    computeSequenceDialog.updateStatus("Computing sequence...");
+    computeSequenceDialog.setProgress(10);
+}
+
+void SequenceUI::lowerCriteriaFound()
+{
+    computeSequenceDialog.updateStatus("Found lower criteria.");
+    computeSequenceDialog.setProgress(50);
+}
+
+/*! \brief Display results dialog
+ */
+void SequenceUI::sequenceComputed()
+{
+    computeSequenceDialog.close();
+    previewSequenceDialog.show();
+    previewSequenceDialog.setLabelResults(
+        QString("Measurements completed ! Capture will take ") +
+        QString::number(s->getShotsNb()) + QString(" shot(s)."));
+    previewSequenceDialog.setLowerPreview(
+        s->getShotParameters(0).preview.image());
+    previewSequenceDialog.setUpperPreview(
+        s->getShotParameters(s->getShotsNb() - 1).preview.image());
+    previewSequenceDialog.setFusedPreview(s->getFusedPreview());
+    previewSequenceDialog.startCountdown();
+}
+
+/*! \brief Show a MessageBox with error diagnostic
+ */
+void SequenceUI::sequenceError(QString msg)
+{
+    computeSequenceDialog.close();
+
+    QMessageBox::critical(window, "Error", msg);
+}
+
+void SequenceUI::computeAborted()
+{
+    s->computeSequenceAborted();
+
+    computeSequenceDialog.close();
+}
+
+void SequenceUI::sequenceAccepted()
+{
+    previewSequenceDialog.close();
+    previewSequenceDialog.stopCountdown();
+
+    s->sequenceAccepted();
+}
+
+void SequenceUI::sequenceRejected()
+{
+    previewSequenceDialog.close();
+    previewSequenceDialog.stopCountdown();
+
+    s->sequenceRejected();
+}
+
+void SequenceUI::captureStarted()
+{
+    captureSequenceDialog.setProgress(0);
+    captureSequenceDialog.show();
+}
+
+void SequenceUI::captureProgress(int nbImg, int total)
+{
+    captureSequenceDialog.setProgress(100 * nbImg / total);
+    captureSequenceDialog.setStatus("Took shot " + QString::number(nbImg) +
+                                    " of " + QString::number(total));
+}
+
+/*! \brief Display end dialog
+ */
+void SequenceUI::captureFinished(int total)
+{
+    captureSequenceDialog.close();
+
+    captureEndDialog.show();
+    captureEndDialog.setStatus(QString::number(total) +
+                               " images successfully captured.");
+}
+
+void SequenceUI::captureAborted()
+{
+    s->captureSequenceAborted();
+
+    captureSequenceDialog.close();
+}
+
+void SequenceUI::captureFailed()
+{
+    captureSequenceDialog.close();
+
+    QMessageBox::critical(window, "Error", "Sequence capture failed");
+}
+
+void SequenceUI::compositionStarted()
+{
+    composeDialog.setDraft(QImage());
+    composeDialog.updateStatus("HDR composition ongoing...");
+    composeDialog.show();
+}
+
+/*! \brief Display draft while full resolution result is composed
+ */
+void SequenceUI::compositionDraft(QImage draft)
+{
+    composeDialog.setDraft(draft);
+    composeDialog.updateStatus("Draft ready, full resolution ongoing...");
+}
+
+void SequenceUI::compositionAborted()
+{
+    composeDialog.close();
+
+    comp->abortComposition();
+}
+
+void SequenceUI::compositionFinished(int code)
+{
+    composeDialog.close();
+
+    QString statusStr =
+        "HDR composition ended with code " + QString::number(code);
+    QMessageBox::information(&composeDialog, "Information", statusStr);
+}
+
+void SequenceUI::compositionError(QString msg)
+{
+    composeDialog.close();
+
+    QMessageBox::critical(&composeDialog, "Error", msg);
+}
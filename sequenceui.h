@@ -0,0 +1,62 @@
+#ifndef SEQUENCEUI_H
+#define SEQUENCEUI_H
+
+#include "autohdr_captureend.h"
+#include "autohdr_capturesequence.h"
+#include "autohdr_compose.h"
+#include "autohdr_computesequence.h"
+#include "autohdr_previewsequence.h"
+#include "composition.h"
+#include "sequence.h"
+#include <QObject>
+#include <QWidget>
+
+/* Dialogs driving a Sequence and its Composition
+ *
+ * GUI counterpart of the core Sequence : reflects its progress
+ * signals and forwards operator decisions
+ */
+class SequenceUI : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit SequenceUI(Sequence *seq = nullptr, QWidget *parent = nullptr);
+
+  public slots:
+    /* Sequence progress */
+    void computingStarted();
+    void lowerCriteriaFound();
+    void sequenceComputed();
+    void sequenceError(QString msg);
+    void captureStarted();
+    void captureProgress(int nbImg, int total);
+    void captureFinished(int total);
+    void captureFailed();
+    /* Composition progress */
+    void compositionStarted();
+    void compositionDraft(QImage draft);
+    void compositionFinished(int code);
+    void compositionError(QString msg);
+
+  private slots:
+    /* Operator decisions */
+    void computeAborted();
+    void sequenceAccepted();
+    void sequenceRejected();
+    void captureAborted();
+    void compositionAborted();
+
+  private:
+    Sequence *s;
+    Composition *comp;
+    QWidget *window;
+
+    AutoHDR_ComputeSequence computeSequenceDialog;
+    AutoHDR_PreviewSequence previewSequenceDialog;
+    AutoHDR_CaptureSequence captureSequenceDialog;
+    AutoHDR_CaptureEnd captureEndDialog;
+    AutoHDR_Compose composeDialog;
+};
+
+#endif // SEQUENCEUI_H
@@ -0,0 +1,412 @@
+#include "tonemap.h"
+#include "bufferpool.h"
+#include "imagewriter.h"
+#include "parallel.h"
+#include "trace.h"
+#include <QVector>
+#include <math.h>
+
+/* Luminance floor, avoids log(0) */
+#define TM_EPSILON 1e-6f
+/* Reinhard key value (middle gray) */
+#define TM_KEY 0.18f
+/* Drago bias */
+#define TM_BIAS 0.85f
+/* Local operator : base layer is computed at 1/TM_BASE_SCALE
+ * resolution, blurred over 1/TM_BASE_RADIUS of image size */
+#define TM_BASE_SCALE 4
+#define TM_BASE_RADIUS 50
+/* Local operator : output contrast of base layer, detail boost */
+#define TM_CONTRAST 100.0f
+#define TM_DETAIL 1.2f
+/* Output encoding LUT size */
+#define TM_LUT_SIZE 4096
+
+/* Everything mapping a pixel needs, computed once per radiance map */
+typedef struct {
+    ToneMapOperator op;
+    const RadianceMap *hdr;
+    float logAverage;
+    float maxLum;
+    /* Reinhard */
+    float keyScale;
+    float invWhite2;
+    /* Drago */
+    float dragoNorm;
+    float dragoExp;
+    float dragoInvMax;
+    /* Local : low resolution log luminance base layer */
+    int baseWidth;
+    int baseHeight;
+    QVector<float> base;
+    float baseMax;
+    float compression;
+} toneMapContext;
+
+static inline int clampIndex(int i, int n)
+{
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+/* Rows of the three planes of a radiance map */
+typedef struct {
+    const float *r;
+    const float *g;
+    const float *b;
+} radianceRow;
+
+static inline radianceRow radianceAt(const RadianceMap &hdr, int y)
+{
+    return {hdr.row(0, y), hdr.row(1, y), hdr.row(2, y)};
+}
+
+static inline float luminance(const radianceRow &row, int x)
+{
+    return 0.2126f * row.r[x] + 0.7152f * row.g[x] + 0.0722f * row.b[x];
+}
+
+/*! \brief Build linear to 8 bit sRGB encoding table
+ */
+static const uchar *encodeLUT()
+{
+    static const QVector<uchar> lut = [] {
+        QVector<uchar> l(TM_LUT_SIZE);
+        for (int i = 0; i < TM_LUT_SIZE; i++) {
+            double v = i / double(TM_LUT_SIZE - 1);
+            v = v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1 / 2.4) - 0.055;
+            l[i] = uchar(v * 255 + 0.5);
+        }
+        return l;
+    }();
+
+    return lut.constData();
+}
+
+static inline uchar encode(const uchar *lut, float v)
+{
+    if (v <= 0)
+        return 0;
+    return lut[qMin(int(v * (TM_LUT_SIZE - 1) + 0.5f), TM_LUT_SIZE - 1)];
+}
+
+/*! \brief Box blur a plane, in place
+ *
+ * Rows then columns, running sums, edges are clamped
+ */
+static void boxBlur(QVector<float> &plane, int w, int h, int radius)
+{
+    QVector<float> tmp(w * h);
+    const float *src = plane.constData();
+    float *rows = tmp.data();
+    float inv = 1.0f / (2 * radius + 1);
+
+    parallelFor(0, h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const float *in = src + y * w;
+            float *out = rows + y * w;
+            float s = 0;
+            for (int i = -radius; i <= radius; i++)
+                s += in[clampIndex(i, w)];
+            for (int x = 0; x < w; x++) {
+                out[x] = s * inv;
+                s += in[clampIndex(x + radius + 1, w)] -
+                     in[clampIndex(x - radius, w)];
+            }
+        }
+    });
+
+    float *dst = plane.data();
+    parallelFor(0, w, [&](int x0, int x1) {
+        QVector<float> sum(x1 - x0, 0.0f);
+        float *s = sum.data();
+        for (int i = -radius; i <= radius; i++) {
+            const float *in = rows + clampIndex(i, h) * w;
+            for (int x = x0; x < x1; x++)
+                s[x - x0] += in[x];
+        }
+        for (int y = 0; y < h; y++) {
+            const float *add = rows + clampIndex(y + radius + 1, h) * w;
+            const float *sub = rows + clampIndex(y - radius, h) * w;
+            float *out = dst + y * w;
+            for (int x = x0; x < x1; x++) {
+                out[x] = s[x - x0] * inv;
+                s[x - x0] += add[x] - sub[x];
+            }
+        }
+    });
+}
+
+/*! \brief Compute local operator base layer
+ *
+ * Log luminance is averaged over TM_BASE_SCALE blocks, then
+ * three box blurs approximate a gaussian. Base range gives
+ * the compression factor.
+ */
+static void buildBase(toneMapContext &ctx)
+{
+    const RadianceMap &hdr = *ctx.hdr;
+    int bw = (hdr.width() + TM_BASE_SCALE - 1) / TM_BASE_SCALE;
+    int bh = (hdr.height() + TM_BASE_SCALE - 1) / TM_BASE_SCALE;
+    int radius = qMax(1, qMax(bw, bh) / TM_BASE_RADIUS);
+
+    TRACE_SCOPE("tonemap_base", "tonemap");
+
+    ctx.baseWidth = bw;
+    ctx.baseHeight = bh;
+    ctx.base.resize(bw * bh);
+    float *base = ctx.base.data();
+    parallelFor(0, bh, [&](int by0, int by1) {
+        for (int by = by0; by < by1; by++) {
+            int y1 = qMin((by + 1) * TM_BASE_SCALE, hdr.height());
+            for (int bx = 0; bx < bw; bx++) {
+                int x1 = qMin((bx + 1) * TM_BASE_SCALE, hdr.width());
+                float s = 0;
+                int n = 0;
+                for (int y = by * TM_BASE_SCALE; y < y1; y++) {
+                    radianceRow row = radianceAt(hdr, y);
+                    for (int x = bx * TM_BASE_SCALE; x < x1; x++, n++)
+                        s += logf(TM_EPSILON + luminance(row, x));
+                }
+                base[by * bw + bx] = s / n;
+            }
+        }
+    });
+
+    for (int pass = 0; pass < 3; pass++)
+        boxBlur(ctx.base, bw, bh, radius);
+
+    float lo = ctx.base.at(0), hi = lo;
+    for (int i = 1; i < bw * bh; i++) {
+        lo = qMin(lo, ctx.base.at(i));
+        hi = qMax(hi, ctx.base.at(i));
+    }
+    ctx.baseMax = hi;
+    ctx.compression =
+        hi > lo ? qMin(1.0f, logf(TM_CONTRAST) / (hi - lo)) : 1.0f;
+}
+
+/*! \brief Bilinear lookup of base layer at full resolution (x, y)
+ */
+static inline float sampleBase(const toneMapContext &ctx, int x, int y)
+{
+    float fx = (x + 0.5f) / TM_BASE_SCALE - 0.5f;
+    float fy = (y + 0.5f) / TM_BASE_SCALE - 0.5f;
+    int x0 = int(floorf(fx));
+    int y0 = int(floorf(fy));
+    float ax = fx - x0;
+    float ay = fy - y0;
+    int w = ctx.baseWidth;
+    const float *b = ctx.base.constData();
+    const float *r0 = b + clampIndex(y0, ctx.baseHeight) * w;
+    const float *r1 = b + clampIndex(y0 + 1, ctx.baseHeight) * w;
+    int c0 = clampIndex(x0, w);
+    int c1 = clampIndex(x0 + 1, w);
+
+    return (1 - ay) * ((1 - ax) * r0[c0] + ax * r0[c1]) +
+           ay * ((1 - ax) * r1[c0] + ax * r1[c1]);
+}
+
+/*! \brief Compute radiance statistics and operator parameters
+ *
+ * Log average and maximum luminance are reduced row by row
+ */
+static bool prepare(const RadianceMap &hdr, ToneMapOperator op,
+                    toneMapContext &ctx)
+{
+    int w = hdr.width();
+    int h = hdr.height();
+
+    if (hdr.isNull() || hdr.channels() != 3)
+        return false;
+
+    TRACE_SCOPE("tonemap_stats", "tonemap");
+
+    ctx.op = op;
+    ctx.hdr = &hdr;
+
+    QVector<double> rowLog(h);
+    QVector<float> rowMax(h);
+    double *logs = rowLog.data();
+    float *maxs = rowMax.data();
+    parallelFor(0, h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            double s = 0;
+            float m = 0;
+            radianceRow row = radianceAt(hdr, y);
+            for (int x = 0; x < w; x++) {
+                float l = luminance(row, x);
+                s += log(TM_EPSILON + l);
+                m = qMax(m, l);
+            }
+            logs[y] = s;
+            maxs[y] = m;
+        }
+    });
+
+    double sum = 0;
+    ctx.maxLum = 0;
+    for (int y = 0; y < h; y++) {
+        sum += rowLog.at(y);
+        ctx.maxLum = qMax(ctx.maxLum, rowMax.at(y));
+    }
+    ctx.logAverage = exp(sum / (double(w) * h));
+
+    /* Reinhard, brightest pixel maps to white */
+    ctx.keyScale = TM_KEY / ctx.logAverage;
+    float white = qMax(ctx.maxLum * ctx.keyScale, TM_EPSILON);
+    ctx.invWhite2 = 1.0f / (white * white);
+
+    /* Drago, display maximum of 100 cd/m2 */
+    float lwMax = ctx.maxLum / ctx.logAverage;
+    ctx.dragoNorm = 1.0f / qMax(log10f(lwMax + 1), TM_EPSILON);
+    ctx.dragoExp = logf(TM_BIAS) / logf(0.5f);
+    ctx.dragoInvMax = 1.0f / qMax(lwMax, TM_EPSILON);
+
+    if (op == TM_LOCAL)
+        buildBase(ctx);
+
+    return true;
+}
+
+/*! \brief Tone map rows [y0, y1) into out, tile by tile
+ *
+ * out is RGB888, its first row is row y0
+ */
+static void mapRows(const toneMapContext &ctx, int y0, int y1, QImage &out)
+{
+    const RadianceMap &hdr = *ctx.hdr;
+    int w = hdr.width();
+    int tilesX = (w + TONEMAP_TILE - 1) / TONEMAP_TILE;
+    int tilesY = (y1 - y0 + TONEMAP_TILE - 1) / TONEMAP_TILE;
+    const uchar *lut = encodeLUT();
+    /* Tiles write apart, image is not detached in threads */
+    uchar *bits = out.bits();
+    int bpl = out.bytesPerLine();
+
+    parallelFor(0, tilesX * tilesY, [&](int first, int last) {
+        for (int t = first; t < last; t++) {
+            int tx0 = (t % tilesX) * TONEMAP_TILE;
+            int ty0 = y0 + (t / tilesX) * TONEMAP_TILE;
+            int tx1 = qMin(tx0 + TONEMAP_TILE, w);
+            int ty1 = qMin(ty0 + TONEMAP_TILE, y1);
+            for (int y = ty0; y < ty1; y++) {
+                uchar *dst = bits + (y - y0) * bpl + 3 * tx0;
+                radianceRow row = radianceAt(hdr, y);
+                for (int x = tx0; x < tx1; x++, dst += 3) {
+                    float l = luminance(row, x);
+                    float ld;
+                    switch (ctx.op) {
+                    case TM_REINHARD: {
+                        float lm = l * ctx.keyScale;
+                        ld = lm * (1 + lm * ctx.invWhite2) / (1 + lm);
+                        break;
+                    }
+                    case TM_DRAGO: {
+                        float lw = l / ctx.logAverage;
+                        ld = ctx.dragoNorm * logf(lw + 1) /
+                             logf(2 + 8 * powf(lw * ctx.dragoInvMax,
+                                               ctx.dragoExp));
+                        break;
+                    }
+                    default: {
+                        float lb = sampleBase(ctx, x, y);
+                        float ll = logf(TM_EPSILON + l);
+                        ld = expf(ctx.compression * (lb - ctx.baseMax) +
+                                  TM_DETAIL * (ll - lb));
+                        break;
+                    }
+                    }
+                    float s = l > 0 ? ld / l : 0;
+                    dst[0] = encode(lut, row.r[x] * s);
+                    dst[1] = encode(lut, row.g[x] * s);
+                    dst[2] = encode(lut, row.b[x] * s);
+                }
+            }
+        }
+    });
+}
+
+/*! \brief Get operator from its config name
+ *
+ * Returns false if name is unknown
+ */
+bool toneMapOperator(QString name, ToneMapOperator &op)
+{
+    QString n = name.trimmed().toLower();
+
+    if (n == "reinhard")
+        op = TM_REINHARD;
+    else if (n == "drago")
+        op = TM_DRAGO;
+    else if (n == "local")
+        op = TM_LOCAL;
+    else
+        return false;
+
+    return true;
+}
+
+/*! \brief Get config name of an operator
+ */
+QString toneMapName(ToneMapOperator op)
+{
+    switch (op) {
+    case TM_REINHARD:
+        return "reinhard";
+    case TM_DRAGO:
+        return "drago";
+    default:
+        return "local";
+    }
+}
+
+/*! \brief Tone map a radiance map to an 8 bit sRGB image
+ *
+ * Returns a null image if radiance map is empty
+ */
+QImage toneMapImage(const RadianceMap &hdr, ToneMapOperator op)
+{
+    toneMapContext ctx;
+
+    TRACE_SCOPE("tonemap", "tonemap");
+
+    if (!prepare(hdr, op, ctx))
+        return QImage();
+
+    QImage ldr = pooledImage(hdr.width(), hdr.height(), QImage::Format_RGB888);
+    mapRows(ctx, 0, hdr.height(), ldr);
+
+    return ldr;
+}
+
+/*! \brief Tone map a radiance map to an 8 bit sRGB TIFF
+ *
+ * Bands of TONEMAP_TILE rows are mapped tile by tile in parallel,
+ * then written : LDR image is never held in memory.
+ * If run is given and turns false, stops and returns false
+ */
+bool toneMap(const RadianceMap &hdr, ToneMapOperator op, QString output,
+             const std::atomic<bool> *run)
+{
+    toneMapContext ctx;
+    TiffWriter writer;
+
+    TRACE_SCOPE("tonemap", "tonemap");
+
+    if (!prepare(hdr, op, ctx) ||
+        !writer.open(output, hdr.width(), hdr.height()))
+        return false;
+
+    for (int y = 0; y < hdr.height(); y += TONEMAP_TILE) {
+        if (run && !*run)
+            return false;
+        int y1 = qMin(y + TONEMAP_TILE, hdr.height());
+        QImage band =
+            pooledImage(hdr.width(), y1 - y, QImage::Format_RGB888);
+        mapRows(ctx, y, y1, band);
+        if (!writer.writeRows(band))
+            return false;
+    }
+
+    return writer.close();
+}
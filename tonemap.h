@@ -0,0 +1,24 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "hdrmerge.h"
+#include <QImage>
+#include <QString>
+#include <atomic>
+
+/* Tile side, in pixels */
+#define TONEMAP_TILE 256
+
+enum ToneMapOperator {
+    TM_REINHARD, /* Global photographic operator */
+    TM_DRAGO,    /* Global adaptive logarithmic operator */
+    TM_LOCAL     /* Local contrast, base layer compression */
+};
+
+bool toneMapOperator(QString name, ToneMapOperator &op);
+QString toneMapName(ToneMapOperator op);
+QImage toneMapImage(const RadianceMap &hdr, ToneMapOperator op);
+bool toneMap(const RadianceMap &hdr, ToneMapOperator op, QString output,
+             const std::atomic<bool> *run = nullptr);
+
+#endif // TONEMAP_H
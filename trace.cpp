@@ -0,0 +1,183 @@
+#include "trace.h"
+#include "log.h"
+#include <QList>
+#include <QMutex>
+#include <chrono>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+/* Stop recording in a thread buffer past this number of events */
+#define TRACE_MAX_EVENTS_PER_THREAD (1 << 20)
+
+std::atomic<bool> Trace::enabled(false);
+
+typedef struct {
+    const char *name;
+    const char *category;
+    quint64 start;
+    /* Counter value for counter events */
+    quint64 duration;
+    bool counter;
+} traceEvent;
+
+typedef struct {
+    int tid;
+    const char *threadName;
+    /* Only contended while dumping */
+    QMutex lock;
+    std::vector<traceEvent> events;
+    unsigned long dropped;
+} traceBuffer;
+
+/* Buffers are never freed : threads come and go
+ * but events must survive until dump */
+static QMutex registryLock;
+static QList<traceBuffer *> registry;
+static thread_local traceBuffer *localBuffer = nullptr;
+
+static const std::chrono::steady_clock::time_point origin =
+    std::chrono::steady_clock::now();
+
+/*! \brief Get the calling thread buffer
+ *
+ * Allocates and registers it on first use
+ */
+static traceBuffer *getLocalBuffer()
+{
+    if (!localBuffer) {
+        localBuffer = new traceBuffer();
+        localBuffer->threadName = nullptr;
+        localBuffer->dropped = 0;
+        registryLock.lock();
+        localBuffer->tid = registry.size() + 1;
+        registry.append(localBuffer);
+        registryLock.unlock();
+    }
+    return localBuffer;
+}
+
+/*! \brief Enable or disable event recording
+ */
+void Trace::setEnabled(bool state)
+{
+    enabled.store(state, std::memory_order_relaxed);
+}
+
+/*! \brief Name the calling thread in traces
+ */
+void Trace::setThreadName(const char *name)
+{
+    getLocalBuffer()->threadName = name;
+}
+
+/*! \brief Get a timestamp in microseconds
+ *
+ * Never returns 0, which TraceScope uses as "not recording"
+ */
+quint64 Trace::now()
+{
+    auto t = std::chrono::steady_clock::now() - origin;
+    return std::chrono::duration_cast<std::chrono::microseconds>(t).count() +
+           1;
+}
+
+/*! \brief Record a complete event
+ *
+ * Can be used directly for spans not matching a C++ scope
+ * (asynchronous process for instance)
+ */
+void Trace::complete(const char *name, const char *category, quint64 start,
+                     quint64 duration)
+{
+    traceBuffer *b = getLocalBuffer();
+
+    b->lock.lock();
+    if (b->events.size() < TRACE_MAX_EVENTS_PER_THREAD)
+        b->events.push_back({name, category, start, duration, false});
+    else
+        b->dropped++;
+    b->lock.unlock();
+}
+
+/*! \brief Record a counter value, from now on
+ *
+ * Shown as a graph (queue depth for instance)
+ */
+void Trace::counter(const char *name, const char *category, qint64 value)
+{
+    traceBuffer *b = getLocalBuffer();
+
+    b->lock.lock();
+    if (b->events.size() < TRACE_MAX_EVENTS_PER_THREAD)
+        b->events.push_back({name, category, now(), quint64(value), true});
+    else
+        b->dropped++;
+    b->lock.unlock();
+}
+
+/*! \brief Dump all recorded events to a Chrome trace-event JSON file
+ *
+ * Recording goes on during and after dump
+ */
+bool Trace::dump(QString tracePath)
+{
+    FILE *f = fopen(tracePath.toStdString().c_str(), "w");
+    if (!f) {
+        LOG_ERROR("[Trace] Could not write %s\n",
+                  tracePath.toStdString().c_str());
+        return false;
+    }
+
+    int pid = getpid();
+    bool first = true;
+    unsigned long n = 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    registryLock.lock();
+    for (int i = 0; i < registry.size(); i++) {
+        traceBuffer *b = registry.at(i);
+        b->lock.lock();
+        if (b->threadName) {
+            fprintf(f,
+                    "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                    "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",", pid, b->tid, b->threadName);
+            first = false;
+        }
+        for (size_t j = 0; j < b->events.size(); j++) {
+            const traceEvent &e = b->events[j];
+            if (e.counter) {
+                fprintf(f,
+                        "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"C\","
+                        "\"ts\":%llu,\"pid\":%d,\"args\":{\"value\":%lld}}",
+                        first ? "" : ",", e.name, e.category,
+                        (unsigned long long)e.start, pid,
+                        (long long)e.duration);
+                first = false;
+                continue;
+            }
+            fprintf(f,
+                    "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                    "\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d}",
+                    first ? "" : ",", e.name, e.category,
+                    (unsigned long long)e.start,
+                    (unsigned long long)e.duration, pid, b->tid);
+            first = false;
+        }
+        n += b->events.size();
+        if (b->dropped)
+            LOG_ERROR("[Trace] Thread %d dropped %lu events\n", b->tid,
+                      b->dropped);
+        b->lock.unlock();
+    }
+    registryLock.unlock();
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    LOG_INFO("[Trace] Dumped %lu events to %s\n", n,
+             tracePath.toStdString().c_str());
+    return true;
+}
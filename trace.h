@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <atomic>
+
+/* Scoped tracing of the sequence pipeline
+ *
+ * Events are recorded into per-thread buffers and dumped
+ * as Chrome trace-event JSON (chrome://tracing, Perfetto UI).
+ * When tracing is disabled a scope costs one relaxed atomic load.
+ *
+ * Event names and categories must be string literals.
+ */
+namespace Trace
+{
+extern std::atomic<bool> enabled;
+
+void setEnabled(bool state);
+void setThreadName(const char *name);
+quint64 now();
+void complete(const char *name, const char *category, quint64 start,
+              quint64 duration);
+void counter(const char *name, const char *category, qint64 value);
+bool dump(QString tracePath);
+
+inline bool isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+} // namespace Trace
+
+class TraceScope
+{
+  public:
+    TraceScope(const char *name, const char *category)
+        : name(name), category(category),
+          start(Trace::isEnabled() ? Trace::now() : 0)
+    {
+    }
+    ~TraceScope()
+    {
+        if (start)
+            Trace::complete(name, category, start, Trace::now() - start);
+    }
+
+  private:
+    const char *name;
+    const char *category;
+    quint64 start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name, category)                                            \
+    TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name, category)
+
+#endif // TRACE_H